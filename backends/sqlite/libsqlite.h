@@ -45,6 +45,7 @@
 #include <libwzd-core/wzd_backend.h>
 #include <libwzd-core/wzd_group.h>
 #include <libwzd-core/wzd_log.h>
+#include <libwzd-core/wzd_mutex.h>
 #include <libwzd-core/wzd_user.h>
 
 #include <libwzd-core/wzd_debug.h>
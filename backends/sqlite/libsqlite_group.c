@@ -55,8 +55,7 @@ static int libsqlite_group_next_id()
   db = libsqlite_open();
   if (db == NULL) return INVALID_GROUP;
   
-  ret = sqlite3_prepare(db, "SELECT COUNT(gid), MAX(gid) FROM groups;",
-                        -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT COUNT(gid), MAX(gid) FROM groups;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -67,8 +66,9 @@ static int libsqlite_group_next_id()
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return INVALID_GROUP;
       case SQLITE_BUSY:
@@ -81,7 +81,7 @@ static int libsqlite_group_next_id()
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   /* no group in table then it's the first.. */
@@ -109,7 +109,7 @@ int libsqlite_group_get_ref_by_id(gid_t gid)
   db = libsqlite_open();
   if (db == NULL) return -1;
   
-  ret = sqlite3_prepare(db, "SELECT gref FROM groups WHERE gid = ?;", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT gref FROM groups WHERE gid = ?;", &stmt);
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
     libsqlite_close(&db);
@@ -121,8 +121,9 @@ int libsqlite_group_get_ref_by_id(gid_t gid)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);      
         return -1;
       case SQLITE_BUSY:
@@ -134,7 +135,7 @@ int libsqlite_group_get_ref_by_id(gid_t gid)
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return ref;
@@ -157,8 +158,7 @@ gid_t libsqlite_group_get_id_by_ref(int ref)
   db = libsqlite_open();
   if (db == NULL) return gid;
   
-  ret = sqlite3_prepare(db, "SELECT gid FROM groups WHERE gref = ?;", -1,
-                        &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT gid FROM groups WHERE gref = ?;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -171,8 +171,9 @@ gid_t libsqlite_group_get_id_by_ref(int ref)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return INVALID_GROUP;
       case SQLITE_BUSY:
@@ -184,7 +185,7 @@ gid_t libsqlite_group_get_id_by_ref(int ref)
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return gid;
@@ -207,8 +208,7 @@ static gid_t libsqlite_group_get_id_by_name(const char *name)
   db = libsqlite_open();
   if (db == NULL) return gid;
 
-  ret = sqlite3_prepare(db, "SELECT gid FROM groups WHERE groupname = ?;", -1,
-                        &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT gid FROM groups WHERE groupname = ?;", &stmt);
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
     libsqlite_close(&db);
@@ -220,8 +220,9 @@ static gid_t libsqlite_group_get_id_by_name(const char *name)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return INVALID_GROUP;
       case SQLITE_BUSY:
@@ -233,7 +234,7 @@ static gid_t libsqlite_group_get_id_by_name(const char *name)
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return gid;
@@ -257,8 +258,7 @@ static void libsqlite_group_get_ip(wzd_group_t *group)
   db = libsqlite_open();
   if (db == NULL) return;
   
-  ret = sqlite3_prepare(db, "SELECT ip FROM groupip WHERE gref = ?;",
-                        -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT ip FROM groupip WHERE gref = ?;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.", sqlite3_errmsg(db));
@@ -271,8 +271,9 @@ static void libsqlite_group_get_ip(wzd_group_t *group)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return;
       case SQLITE_BUSY:
@@ -288,7 +289,7 @@ static void libsqlite_group_get_ip(wzd_group_t *group)
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return;
@@ -311,15 +312,13 @@ wzd_group_t *libsqlite_group_get_by_id(gid_t gid)
   db = libsqlite_open();
   if (db == NULL) return NULL;
   
-  ret = sqlite3_prepare(db,
+  ret = libsqlite_prepare(db,
     "SELECT                                                                 \
          groupname, defaultpath, flags, tagline, groupperms, max_idle_time, \
          num_logins, max_ul_speed, max_dl_speed, ratio                      \
      FROM                                                                   \
          groups                                                             \
-     WHERE gid = ?;",
-    -1, &stmt, NULL
-   );
+     WHERE gid = ?;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.", sqlite3_errmsg(db));
@@ -333,8 +332,9 @@ wzd_group_t *libsqlite_group_get_by_id(gid_t gid)
   {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return NULL;
       case SQLITE_BUSY:
@@ -360,7 +360,7 @@ wzd_group_t *libsqlite_group_get_by_id(gid_t gid)
     }
   }
 
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   if (! group) {
@@ -393,7 +393,7 @@ gid_t *libsqlite_group_get_list()
   db = libsqlite_open();
   if (db == NULL) return NULL;
 
-  ret = sqlite3_prepare(db, "SELECT gid FROM groups;", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT gid FROM groups;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s\n", sqlite3_errmsg(db));
@@ -404,8 +404,11 @@ gid_t *libsqlite_group_get_list()
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
+        libsqlite_close(&db);
+        free(group_list);
         return NULL;
       case SQLITE_BUSY:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step busy.\n");
@@ -418,7 +421,7 @@ gid_t *libsqlite_group_get_list()
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return group_list; 
@@ -544,10 +547,9 @@ void libsqlite_group_update(gid_t gid, wzd_group_t *group,
     if (errmsg) {
       out_log(SQLITE_LOG_CHANNEL, "Backend sqlite query exec error: %s\n", errmsg);
     }
-
-    libsqlite_close(&db);
   }
 
+  libsqlite_close(&db);
   sqlite3_free(query);
  
   return;
@@ -41,35 +41,223 @@ BACKEND_VERSION(SQLITE_BACKEND_VERSION);
 #define CACHE
 #define BACKEND_ID 1 
 
+/** \brief number of database connections kept open */
+#define LIBSQLITE_POOL_SIZE        4
+/** \brief number of prepared statements kept for each connection */
+#define LIBSQLITE_STMT_CACHE_SIZE  16
+/** \brief time to wait for a lock on the database, in milliseconds */
+#define LIBSQLITE_BUSY_TIMEOUT     2000
+
 /** \brief used to store filepath */
 const char *_sqlite_file; 
 
-/** 
- * \brief retrieve a sqlite3 handle with _sqlite_file
+/** \brief a pooled connection, with its prepared statements */
+struct libsqlite_conn_t {
+  sqlite3 *db;
+  int in_use;
+  sqlite3_stmt *stmt[LIBSQLITE_STMT_CACHE_SIZE];
+};
+
+static struct libsqlite_conn_t _sqlite_pool[LIBSQLITE_POOL_SIZE];
+static wzd_mutex_t *_sqlite_pool_mutex = NULL;
+
+/**
+ * \brief open a new connection to _sqlite_file
  * \return sqlite3 handle or NULL
  */
-sqlite3 *libsqlite_open()
+static sqlite3 *libsqlite_connect(void)
 {
   sqlite3 *db=NULL;
+  char *errmsg=NULL;
+
   if (sqlite3_open(_sqlite_file, &db) != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "libsqlite cannot open database file\n");
     out_log(SQLITE_LOG_CHANNEL, "sqlite message: %s\n", sqlite3_errmsg(db));
-    libsqlite_close(&db);
+    if (db != NULL) sqlite3_close(db);
     return NULL;
   }
+
+  /* with WAL, readers do not block the writer and commits do not need a full sync */
+  sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, &errmsg);
+  if (errmsg) {
+    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite could not enable WAL: %s\n", errmsg);
+    sqlite3_free(errmsg);
+  }
+  sqlite3_busy_timeout(db, LIBSQLITE_BUSY_TIMEOUT);
+
   return db;
 }
 
 /**
- * \brief close a sqlite handle and set it to NULL.
+ * \brief find the pool entry of an open connection.
+ * \note _sqlite_pool_mutex must be held.
+ * \return the entry, or NULL if the connection is not pooled.
+ */
+static struct libsqlite_conn_t *libsqlite_pool_find(sqlite3 *db)
+{
+  unsigned int i;
+
+  for (i = 0; i < LIBSQLITE_POOL_SIZE; i++) {
+    if (_sqlite_pool[i].db == db) return &_sqlite_pool[i];
+  }
+  return NULL;
+}
+
+/** 
+ * \brief retrieve a sqlite3 handle with _sqlite_file
+ *
+ * An idle connection from the pool is used if possible. The handle belongs
+ * to the caller until libsqlite_close() is called, so nested calls get
+ * different connections.
+ * \return sqlite3 handle or NULL
+ */
+sqlite3 *libsqlite_open()
+{
+  unsigned int i;
+  sqlite3 *db=NULL;
+  struct libsqlite_conn_t *conn=NULL;
+
+  if (_sqlite_pool_mutex == NULL) return libsqlite_connect();
+
+  wzd_mutex_lock(_sqlite_pool_mutex);
+  for (i = 0; i < LIBSQLITE_POOL_SIZE; i++) {
+    if (_sqlite_pool[i].db != NULL && !_sqlite_pool[i].in_use) {
+      _sqlite_pool[i].in_use = 1;
+      wzd_mutex_unlock(_sqlite_pool_mutex);
+      return _sqlite_pool[i].db;
+    }
+    /* in_use without db: another thread is connecting this slot */
+    if (_sqlite_pool[i].db == NULL && !_sqlite_pool[i].in_use && conn == NULL)
+      conn = &_sqlite_pool[i];
+  }
+  /* reserve the free slot while connecting */
+  if (conn != NULL) conn->in_use = 1;
+  wzd_mutex_unlock(_sqlite_pool_mutex);
+
+  db = libsqlite_connect();
+
+  if (conn != NULL) {
+    wzd_mutex_lock(_sqlite_pool_mutex);
+    conn->db = db;
+    conn->in_use = (db != NULL);
+    wzd_mutex_unlock(_sqlite_pool_mutex);
+  }
+
+  return db;
+}
+
+/**
+ * \brief release a sqlite handle and set it to NULL.
+ *
+ * Pooled connections are kept open for the next libsqlite_open().
  * \param db a pointer to a sqlite3 handle
  */
 void libsqlite_close(sqlite3 **db)
 {
-  if (*db != NULL) sqlite3_close(*db);
+  struct libsqlite_conn_t *conn=NULL;
+
+  if (*db == NULL) return;
+
+  if (_sqlite_pool_mutex != NULL) {
+    wzd_mutex_lock(_sqlite_pool_mutex);
+    conn = libsqlite_pool_find(*db);
+    if (conn != NULL) conn->in_use = 0;
+    wzd_mutex_unlock(_sqlite_pool_mutex);
+  }
+
+  if (conn == NULL) sqlite3_close(*db);
   *db = NULL;
 }
 
+/**
+ * \brief prepare a query, or get it from the statement cache of the connection.
+ *
+ * The statement must be released with libsqlite_finalize().
+ * \param db a handle returned by libsqlite_open().
+ * \param query the sql query.
+ * \param stmt where the statement is stored.
+ * \return SQLITE_OK or a sqlite error code.
+ */
+int libsqlite_prepare(sqlite3 *db, const char *query, sqlite3_stmt **stmt)
+{
+  int ret;
+  unsigned int i = LIBSQLITE_STMT_CACHE_SIZE;
+  struct libsqlite_conn_t *conn=NULL;
+
+  if (_sqlite_pool_mutex != NULL) {
+    wzd_mutex_lock(_sqlite_pool_mutex);
+    conn = libsqlite_pool_find(db);
+    wzd_mutex_unlock(_sqlite_pool_mutex);
+  }
+
+  /* the connection is owned by the caller, its cache can be used without lock */
+  if (conn != NULL) {
+    for (i = 0; i < LIBSQLITE_STMT_CACHE_SIZE && conn->stmt[i] != NULL; i++) {
+      if (strcmp(sqlite3_sql(conn->stmt[i]), query) == 0) {
+        *stmt = conn->stmt[i];
+        return SQLITE_OK;
+      }
+    }
+  }
+
+  ret = sqlite3_prepare_v2(db, query, -1, stmt, NULL);
+
+  if (ret == SQLITE_OK && conn != NULL && i < LIBSQLITE_STMT_CACHE_SIZE)
+    conn->stmt[i] = *stmt;
+
+  return ret;
+}
+
+/**
+ * \brief release a statement returned by libsqlite_prepare().
+ *
+ * Cached statements are only reset.
+ */
+void libsqlite_finalize(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  unsigned int i;
+  struct libsqlite_conn_t *conn=NULL;
+
+  if (stmt == NULL) return;
+
+  if (_sqlite_pool_mutex != NULL) {
+    wzd_mutex_lock(_sqlite_pool_mutex);
+    conn = libsqlite_pool_find(db);
+    wzd_mutex_unlock(_sqlite_pool_mutex);
+  }
+
+  if (conn != NULL) {
+    for (i = 0; i < LIBSQLITE_STMT_CACHE_SIZE && conn->stmt[i] != NULL; i++) {
+      if (conn->stmt[i] == stmt) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return;
+      }
+    }
+  }
+
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * \brief close all pooled connections.
+ */
+static void libsqlite_pool_free(void)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < LIBSQLITE_POOL_SIZE; i++) {
+    if (_sqlite_pool[i].db == NULL) continue;
+    if (_sqlite_pool[i].in_use)
+      out_log(SQLITE_LOG_CHANNEL, "Backend sqlite: closing a connection still in use\n");
+    for (j = 0; j < LIBSQLITE_STMT_CACHE_SIZE && _sqlite_pool[i].stmt[j] != NULL; j++) {
+      sqlite3_finalize(_sqlite_pool[i].stmt[j]);
+    }
+    sqlite3_close(_sqlite_pool[i].db);
+  }
+  memset(_sqlite_pool, 0, sizeof(_sqlite_pool));
+}
+
 /**
  * \brief function used to generate update query (printf like).
  * \param query pointer where query is stored. The query must be free with sqlite3_free and can be null for the first use.
@@ -166,6 +354,9 @@ static int FCN_INIT(const char *arg)
 
   _sqlite_file = arg;
 
+  memset(_sqlite_pool, 0, sizeof(_sqlite_pool));
+  _sqlite_pool_mutex = wzd_mutex_create(0);
+
   out_log(SQLITE_LOG_CHANNEL, "Backend sqlite initialized\n");
 
   return 0;
@@ -175,6 +366,12 @@ static int FCN_FINI(void)
 {
   out_log(SQLITE_LOG_CHANNEL, "Backend sqlite unloading\n");
 
+  if (_sqlite_pool_mutex != NULL) {
+    libsqlite_pool_free();
+    wzd_mutex_destroy(_sqlite_pool_mutex);
+    _sqlite_pool_mutex = NULL;
+  }
+
   return 0;
 }
 
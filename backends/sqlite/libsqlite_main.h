@@ -10,6 +10,8 @@
 
 sqlite3 *libsqlite_open();
 void     libsqlite_close(sqlite3 **db);
+int      libsqlite_prepare(sqlite3 *db, const char *query, sqlite3_stmt **stmt);
+void     libsqlite_finalize(sqlite3 *db, sqlite3_stmt *stmt);
 void     libsqlite_add_to_query(char **query, char *format, ...);
 
 void     libsqlite_update_ip(struct wzd_ip_list_t *db,
@@ -41,6 +41,7 @@ static void  libsqlite_user_get_stats(wzd_user_t *user);
 static void  libsqlite_user_update_ip(uid_t uid, wzd_user_t *user);
 static void  libsqlite_user_update_group(uid_t uid, wzd_user_t *user);
 static void  libsqlite_user_update_stats(uid_t uid, wzd_user_t *user);
+static void  libsqlite_user_update_credits(uid_t uid, wzd_user_t *user);
 
 /**
  * \brief Retrieve the next usable uid. used in INSERT query. (libsqlite_user_add)
@@ -59,8 +60,7 @@ static uid_t libsqlite_user_next_id()
   db = libsqlite_open();
   if (db == NULL) return INVALID_USER;
   
-  ret = sqlite3_prepare(db, "SELECT COUNT(uid), MAX(uid) FROM users;",
-                        -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT COUNT(uid), MAX(uid) FROM users;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -71,8 +71,9 @@ static uid_t libsqlite_user_next_id()
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return INVALID_USER;
       case SQLITE_BUSY:
@@ -85,7 +86,7 @@ static uid_t libsqlite_user_next_id()
     }
   }
  
- sqlite3_finalize(stmt);
+ libsqlite_finalize(db, stmt);
  libsqlite_close(&db);
 
  /* no user in table then it's the first.. */
@@ -113,7 +114,7 @@ uid_t libsqlite_user_get_id_by_name(const char *username)
   db = libsqlite_open();
   if (db == NULL) return INVALID_USER;
 
-  ret = sqlite3_prepare(db, "SELECT uid FROM users WHERE username = ?", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT uid FROM users WHERE username = ?", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -126,8 +127,9 @@ uid_t libsqlite_user_get_id_by_name(const char *username)
   while ( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s.\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return INVALID_USER;
       case SQLITE_BUSY:
@@ -139,7 +141,7 @@ uid_t libsqlite_user_get_id_by_name(const char *username)
     }
   }
 
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
 
   if (uid == INVALID_USER) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite user not found.\n");
@@ -164,7 +166,7 @@ static int libsqlite_user_get_ref_by_uid(uid_t uid)
   db = libsqlite_open();
   if (db == NULL) return ref;
 
-  ret = sqlite3_prepare(db, "SELECT uref FROM users WHERE uid = ?", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT uref FROM users WHERE uid = ?", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -177,8 +179,9 @@ static int libsqlite_user_get_ref_by_uid(uid_t uid)
   while ( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return -1;
       case SQLITE_BUSY:
@@ -190,7 +193,7 @@ static int libsqlite_user_get_ref_by_uid(uid_t uid)
     }
   }
 
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return ref;
@@ -213,8 +216,7 @@ static void libsqlite_user_get_ip(wzd_user_t *user)
   db = libsqlite_open();
   if (db == NULL) return;
 
-  ret = sqlite3_prepare(db, "SELECT ip FROM userip WHERE uref = ?", -1, &stmt,
-                        NULL);
+  ret = libsqlite_prepare(db, "SELECT ip FROM userip WHERE uref = ?", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -227,8 +229,9 @@ static void libsqlite_user_get_ip(wzd_user_t *user)
   while( (ret=sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return;
       case SQLITE_BUSY:
@@ -243,7 +246,7 @@ static void libsqlite_user_get_ip(wzd_user_t *user)
     }
   }
 
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
   return;
 }
@@ -262,13 +265,12 @@ wzd_user_t *libsqlite_user_get_by_id(uid_t uid)
   db = libsqlite_open();
   if (db == NULL) return NULL;
 
-  ret = sqlite3_prepare(db, 
+  ret = libsqlite_prepare(db, 
     "SELECT username, userpass, rootpath, tagline, flags, creator, max_idle_time, \
             max_ul_speed, max_dl_speed, num_logins, logins_per_ip, credits, ratio,\
             user_slots, leech_slots, perms, last_login                   \
        FROM users                                                        \
-       WHERE uid = ?",
-       -1, &stmt, NULL);
+       WHERE uid = ?", &stmt);
  
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -281,8 +283,9 @@ wzd_user_t *libsqlite_user_get_by_id(uid_t uid)
   while( (ret=sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return NULL;
       case SQLITE_BUSY:
@@ -318,7 +321,7 @@ wzd_user_t *libsqlite_user_get_by_id(uid_t uid)
   }
 
 
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
 
   libsqlite_close(&db);
 
@@ -356,7 +359,7 @@ static void libsqlite_user_get_groups(wzd_user_t *user)
   db = libsqlite_open();
   if (db == NULL) return;
   
-  ret = sqlite3_prepare(db, "SELECT gref FROM ugr WHERE uref = ?;", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT gref FROM ugr WHERE uref = ?;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -369,8 +372,9 @@ static void libsqlite_user_get_groups(wzd_user_t *user)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return;
       case SQLITE_BUSY:
@@ -383,7 +387,7 @@ static void libsqlite_user_get_groups(wzd_user_t *user)
     }
   }
  
- sqlite3_finalize(stmt);
+ libsqlite_finalize(db, stmt);
  libsqlite_close(&db);
 }
 
@@ -404,11 +408,9 @@ static void libsqlite_user_get_stats(wzd_user_t *user)
   db = libsqlite_open();
   if (db == NULL) return;
   
-  ret = sqlite3_prepare(db, 
+  ret = libsqlite_prepare(db, 
     "SELECT bytes_ul_total, bytes_dl_total, files_ul_total, files_dl_total \
-       FROM stats  WHERE uref = ?;",
-    -1, &stmt, NULL
-  );
+       FROM stats  WHERE uref = ?;", &stmt);
 
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -421,8 +423,9 @@ static void libsqlite_user_get_stats(wzd_user_t *user)
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return;
       case SQLITE_BUSY:
@@ -437,7 +440,7 @@ static void libsqlite_user_get_stats(wzd_user_t *user)
     }
   }
  
- sqlite3_finalize(stmt);
+ libsqlite_finalize(db, stmt);
  libsqlite_close(&db);
 }
 
@@ -458,7 +461,7 @@ uid_t *libsqlite_user_get_list()
   db = libsqlite_open();
   if (db == NULL) return NULL;
   
-  ret = sqlite3_prepare(db, "SELECT uid FROM users;", -1, &stmt, NULL);
+  ret = libsqlite_prepare(db, "SELECT uid FROM users;", &stmt);
   
   if (ret != SQLITE_OK) {
     out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
@@ -469,8 +472,9 @@ uid_t *libsqlite_user_get_list()
   while( (ret = sqlite3_step(stmt)) != SQLITE_DONE ) {
     switch(ret) {
       case SQLITE_ERROR:
+      default:
         out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        libsqlite_finalize(db, stmt);
         libsqlite_close(&db);
         return NULL;
       case SQLITE_BUSY:
@@ -484,7 +488,7 @@ uid_t *libsqlite_user_get_list()
     }
   }
  
-  sqlite3_finalize(stmt);
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 
   return user_list; 
@@ -702,12 +706,7 @@ int libsqlite_user_update(uid_t uid, wzd_user_t *user, unsigned long mod_type)
     separator = ',';
   }
   if (mod_type & _USER_CREDITS) {
-#ifndef WIN32
-    libsqlite_add_to_query(&query, "%c credits=%"PRId64"", separator, user->credits);
-#else
-    libsqlite_add_to_query(&query, "%c credits='%I64u'", separator, user->credits);
-#endif /* WIN32 */
-    separator = ',';
+    libsqlite_user_update_credits(uid, user);
   }
   if (mod_type & _USER_USERSLOTS) {
     libsqlite_add_to_query(&query, "%c user_slots=%d ", separator, user->user_slots);
@@ -753,10 +752,9 @@ int libsqlite_user_update(uid_t uid, wzd_user_t *user, unsigned long mod_type)
  */
 static void libsqlite_user_update_stats(uid_t uid, wzd_user_t *user)
 {
-  int uref;
-  char *query=NULL;
-  char *errmsg=NULL;
+  int ret, uref;
   sqlite3 *db=NULL;
+  sqlite3_stmt *stmt=NULL;
 
   uref = libsqlite_user_get_ref_by_uid(uid);
   if (uref == -1) return; 
@@ -764,30 +762,64 @@ static void libsqlite_user_update_stats(uid_t uid, wzd_user_t *user)
   db = libsqlite_open();
   if (db == NULL) return;
 
-  libsqlite_add_to_query(&query, "UPDATE stats SET ");
-#ifndef WIN32
-  libsqlite_add_to_query(
-    &query, "bytes_ul_total = %"PRId64", bytes_dl_total = %"PRId64"",
-    user->stats.bytes_ul_total, user->stats.bytes_dl_total
-  );
-#else
-  libsqlite_add_to_query(
-    &query, "bytes_ul_total = %I64u, bytes_dl_total = %I64u",
-    user->stats.bytes_ul_total, user->stats.bytes_dl_total
-  );
-#endif /* WIN32 */
-  libsqlite_add_to_query(
-    &query, ", files_ul_total = %d, files_dl_total = %d",
-    user->stats.files_ul_total, user->stats.files_dl_total
-  );
-  libsqlite_add_to_query(&query, " WHERE uref = %d;", uref);
+  /* this is run after transfers, keep it prepared */
+  ret = libsqlite_prepare(db,
+    "UPDATE stats SET bytes_ul_total = ?, bytes_dl_total = ?, \
+                      files_ul_total = ?, files_dl_total = ?  \
+       WHERE uref = ?;",
+    &stmt);
 
-  sqlite3_exec(db, query, NULL, NULL, &errmsg);
-  if (errmsg) {
-    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite query exec error: %s\n", errmsg);
+  if (ret != SQLITE_OK) {
+    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
+    libsqlite_close(&db);
+    return;
+  }
+
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)user->stats.bytes_ul_total);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)user->stats.bytes_dl_total);
+  sqlite3_bind_int64(stmt, 3, (sqlite3_int64)user->stats.files_ul_total);
+  sqlite3_bind_int64(stmt, 4, (sqlite3_int64)user->stats.files_dl_total);
+  sqlite3_bind_int(stmt, 5, uref);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
+  }
+
+  libsqlite_finalize(db, stmt);
+  libsqlite_close(&db);
+}
+
+/**
+ * \brief used in libsqlite_user_update to update user credits.
+ * \param uid current database user id.
+ * \param user struct who contains data modified.
+ */
+static void libsqlite_user_update_credits(uid_t uid, wzd_user_t *user)
+{
+  int ret;
+  sqlite3 *db=NULL;
+  sqlite3_stmt *stmt=NULL;
+
+  db = libsqlite_open();
+  if (db == NULL) return;
+
+  /* this is run after transfers, keep it prepared */
+  ret = libsqlite_prepare(db, "UPDATE users SET credits = ? WHERE uid = ?;", &stmt);
+
+  if (ret != SQLITE_OK) {
+    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite prepare error: %s.\n", sqlite3_errmsg(db));
+    libsqlite_close(&db);
+    return;
+  }
+
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)user->credits);
+  sqlite3_bind_int(stmt, 2, uid);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    out_log(SQLITE_LOG_CHANNEL, "Backend sqlite step error: %s\n", sqlite3_errmsg(db));
   }
-  sqlite3_free(query);
 
+  libsqlite_finalize(db, stmt);
   libsqlite_close(&db);
 }
 
@@ -6,6 +6,7 @@ INCLUDE(CheckIncludeFiles)
 INCLUDE(CheckFunctionExists)
 INCLUDE(CheckLibraryExists)
 INCLUDE(CheckTypeSize)
+INCLUDE(CheckCSourceCompiles)
 
 CHECK_INCLUDE_FILES ("execinfo.h" HAVE_EXECINFO_H)
 CHECK_INCLUDE_FILES ("stdint.h" HAVE_STDINT_H)
@@ -20,6 +21,8 @@ CHECK_INCLUDE_FILES ("malloc.h" HAVE_MALLOC_H)
 CHECK_INCLUDE_FILES ("sys/param.h" HAVE_SYS_PARAM_H)
 CHECK_INCLUDE_FILES ("sys/param.h;sys/mount.h" HAVE_SYS_MOUNT_H)
 CHECK_INCLUDE_FILES ("sys/statvfs.h" HAVE_SYS_STATVFS_H)
+CHECK_INCLUDE_FILES ("sys/epoll.h" HAVE_SYS_EPOLL_H)
+CHECK_INCLUDE_FILES ("sys/sendfile.h" HAVE_SYS_SENDFILE_H)
 
 CHECK_INCLUDE_FILES ("pthread.h" HAVE_PTHREAD)
 
@@ -43,6 +46,27 @@ CHECK_FUNCTION_EXISTS("strlcat" HAVE_STRLCAT)
 CHECK_FUNCTION_EXISTS("strptime" HAVE_STRPTIME)
 CHECK_FUNCTION_EXISTS("statvfs" HAVE_STATVFS)
 CHECK_FUNCTION_EXISTS("stat64" HAVE_STAT64)
+CHECK_FUNCTION_EXISTS("splice" HAVE_SPLICE)
+CHECK_FUNCTION_EXISTS("fstatat" HAVE_FSTATAT)
+CHECK_FUNCTION_EXISTS("dirfd" HAVE_DIRFD)
+
+# CRC32 acceleration (selected at runtime)
+CHECK_C_SOURCE_COMPILES("
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+__attribute__((target(\"pclmul,sse4.1\")))
+static int f(void) { __m128i a = _mm_setzero_si128(); a = _mm_clmulepi64_si128(a, a, 0x00); return _mm_extract_epi32(a, 1); }
+int main(void) { unsigned int a,b,c,d; __get_cpuid(1,&a,&b,&c,&d); return f(); }
+" HAVE_CRC32_PCLMUL)
+CHECK_C_SOURCE_COMPILES("
+#include <arm_acle.h>
+#include <sys/auxv.h>
+__attribute__((target(\"+crc\")))
+static unsigned int f(unsigned int c) { return __crc32d(c, 0ULL); }
+int main(void) { return (int)getauxval(AT_HWCAP) + (int)f(0); }
+" HAVE_CRC32_ARMV8)
 
 # PAM
 IF (WITH_PAM)
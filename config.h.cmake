@@ -12,8 +12,10 @@
 #cmakedefine HAVE_SECURITY_PAM_APPL_H 1
 #cmakedefine HAVE_SECURITY_PAM_MISC_H 1
 #cmakedefine HAVE_STDINT_H 1
+#cmakedefine HAVE_SYS_EPOLL_H 1
 #cmakedefine HAVE_SYS_MOUNT_H 1
 #cmakedefine HAVE_SYS_PARAM_H 1
+#cmakedefine HAVE_SYS_SENDFILE_H 1
 #cmakedefine HAVE_SYS_STATVFS_H 1
 #cmakedefine HAVE_SYS_TYPES_H 1
 #cmakedefine HAVE_UNISTD_H 1
@@ -29,3 +31,9 @@
 #cmakedefine HAVE_STRPTIME 1
 #cmakedefine HAVE_STATVFS 1
 #cmakedefine HAVE_STAT64 1
+#cmakedefine HAVE_SPLICE 1
+#cmakedefine HAVE_FSTATAT 1
+#cmakedefine HAVE_DIRFD 1
+
+#cmakedefine HAVE_CRC32_PCLMUL 1
+#cmakedefine HAVE_CRC32_ARMV8 1
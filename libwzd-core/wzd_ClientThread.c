@@ -46,8 +46,6 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#include <netdb.h> /* gethostbyaddr */
-
 #endif /* WIN32 */
 
 /** \todo XXX FIXME remove this line and use correct types !!!!
@@ -86,7 +84,9 @@
 #include "wzd_data.h"
 #include "wzd_messages.h"
 #include "wzd_vfs.h"
+#include "wzd_atomic.h"
 #include "wzd_configfile.h"
+#include "wzd_configloader.h"
 #include "wzd_crc32.h"
 #include "wzd_events.h"
 #include "wzd_file.h"
@@ -97,6 +97,7 @@
 #include "wzd_perm.h"
 #include "wzd_protocol.h"
 #include "wzd_ratio.h"
+#include "wzd_reactor.h"
 #include "wzd_section.h"
 #include "wzd_site.h"
 #include "wzd_string.h"
@@ -266,11 +267,7 @@ void client_die(wzd_context_t * context)
 
   out_log(LEVEL_INFO,"Client dying (socket %d)\n",context->control_socket);
   /* close existing pasv connections */
-  if (context->pasv_socket != (socket_t)-1) {
-    socket_close(context->pasv_socket);
-    FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    context->pasv_socket = -1;
-  }
+  pasv_close(context);
   if (context->data_socket != (socket_t)-1) {
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
     /* if TLS, shutdown TLS before closing data connection */
@@ -334,6 +331,7 @@ int check_timeout(wzd_context_t * context)
       file_close(context->current_action.current_file,context);
       FD_UNREGISTER(context->current_action.current_file,"Client file (RETR or STOR)");
       context->current_action.current_file = -1;
+      context->last_file.crc_valid = 0;
 
       /* send events here allow sfv checker to mark file as bad if
        * partially uploaded
@@ -502,9 +500,7 @@ socket_t waitaccept(wzd_context_t * context)
 
     if (socket_select(sock + 1, &fds, NULL, NULL, &tv) <= 0) {
       out_err(LEVEL_FLOOD,"accept timeout to client %s:%d.\n",__FILE__,__LINE__);
-      FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-      socket_close(context->pasv_socket);
-      context->pasv_socket = -1;
+      pasv_close(context);
       send_message_with_args(501,context,"PASV timeout");
       return -1;
     }
@@ -514,18 +510,25 @@ socket_t waitaccept(wzd_context_t * context)
   if (sock == (socket_t)-1) {
     out_err(LEVEL_FLOOD,"accept failed to client %s:%d.\n",__FILE__,__LINE__);
     out_err(LEVEL_FLOOD,"errno is %d:%s.\n",errno,strerror(errno));
-    FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
+    pasv_close(context);
     send_message_with_args(501,context,"PASV timeout");
     return -1;
   }
 
+  /* a pooled socket may have been announced to another client before */
+  if (context->pasv_pooled && test_fxp((const char*)remote_host,context->datafamily,context) != 0) {
+    out_log(LEVEL_NORMAL,"Data connection on pooled PASV socket from another address rejected\n");
+    memset(context->dataip,0,16);
+    pasv_close(context);
+    socket_close(sock);
+    sock = -1;
+    send_message_with_args(501,context,"Data connection from wrong address");
+    return -1;
+  }
+
   if (fxp_is_denied(user) && test_fxp((const char*)remote_host,context->datafamily,context) != 0) {
     memset(context->dataip,0,16);
-    FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
+    pasv_close(context);
     socket_close(sock);
     sock = -1;
     send_message_with_args(501,context,"FXP not allowed");
@@ -541,9 +544,7 @@ socket_t waitaccept(wzd_context_t * context)
     ret = tls_init_datamode(sock, context);
     if (ret) {
       out_err(LEVEL_INFO,"WARNING TLS data negotiation failed with client %s:%d.\n",__FILE__,__LINE__);
-      FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-      socket_close(context->pasv_socket);
-      context->pasv_socket = -1;
+      pasv_close(context);
       socket_close(sock);
       sock = -1;
       send_message_with_args(426,context,"Data connection closed (SSL/TLS negotiation failed).");
@@ -552,8 +553,8 @@ socket_t waitaccept(wzd_context_t * context)
   }
 #endif
 
-  socket_close (context->pasv_socket);
-  FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
+  /* listening socket can be reused by the next PASV command */
+  pasv_close(context);
   context->pasv_socket = sock;
 
   context->data_socket = sock;
@@ -1538,10 +1539,7 @@ int do_port(UNUSED wzd_string_t *name, wzd_string_t *args, wzd_context_t * conte
   wzd_user_t * user;
   unsigned int port;
 
-  if (context->pasv_socket != (socket_t)-1) {
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-  }
+  pasv_close(context);
   if (!args) {
     ret = send_message_with_args(501,context,"Invalid parameters");
     return E_PARAM_NULL;
@@ -1586,29 +1584,15 @@ int do_port(UNUSED wzd_string_t *name, wzd_string_t *args, wzd_context_t * conte
 int do_pasv(UNUSED wzd_string_t *name, UNUSED wzd_string_t *args, wzd_context_t * context)
 {
   int ret;
-  unsigned long addr;
-  unsigned int size,port;
-  struct sockaddr_in sai;
+  int port;
   unsigned char *myip;
   unsigned char pasv_bind_ip[16];
   unsigned char buffer[16];
   int offset=0;
-  int count=0;
-  int all_ports_used=1;
-
-  size = sizeof(struct sockaddr_in);
-  port = mainConfig->pasv_low_range; /* use pasv range min */
 
   /* close existing pasv connections */
   pasv_close(context);
 
-  /* create socket */
-  if ((context->pasv_socket=socket(AF_INET,SOCK_STREAM,0)) == (socket_t)-1) {
-    context->pasv_socket = -1;
-    ret = send_message(425,context);
-    return E_NO_DATA_CTX;
-  }
-
   myip = getmyip(context->control_socket, context->family, buffer); /* FIXME use a variable to get pasv ip ? */
 
   if (mainConfig->pasv_ip[0] == 0) {
@@ -1647,77 +1631,13 @@ int do_pasv(UNUSED wzd_string_t *name, UNUSED wzd_string_t *args, wzd_context_t
 /*  out_err(LEVEL_CRITICAL,"PASV_IP: %d.%d.%d.%d\n",
       pasv_bind_ip[0], pasv_bind_ip[1], pasv_bind_ip[2], pasv_bind_ip[3]);*/
 
-  port = mainConfig->pasv_low_range; /* use pasv range min */
-  count = mainConfig->pasv_high_range - mainConfig->pasv_low_range + 1;
-#ifndef WIN32
-  port = port + (random()) % count; /* we try to change starting port for random */
-#else
-  port = port + (rand()) % count; /* we try to change starting port for random */
-#endif
-  while (count-- > 0) {
-    memset(&sai,0,size);
-
-    sai.sin_family = AF_INET;
-    sai.sin_port = htons((unsigned short)port);
-    /* XXX TODO FIXME bind to specific address works, but not for NAT */
-    /* XXX TODO FIXME always bind to 'myip' ?! */
-    addr = INADDR_ANY;
-/*    memcpy( (void*)&addr, pasv_bind_ip, sizeof(unsigned long));*/
-
-    memcpy(&sai.sin_addr.s_addr,&addr,sizeof(unsigned long));
-
-    if (bind(context->pasv_socket,(struct sockaddr *)&sai,size)==0) {
-      /* found a free port, stop searching */
-      all_ports_used = 0;
-      break;
-    }
-    port++; /* retry with next port */
-
-    if (port > mainConfig->pasv_high_range) {
-      /* reached the top of the range, continue searching from the bottom */
-      port = mainConfig->pasv_low_range;
-    }
-  }
-
-  if (all_ports_used) {
-    /* all ports are in use, return an error */
-    out_log(LEVEL_HIGH, "PASV: all possible PASV ports are in use\n");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-    ret = send_message(425, context);
-    return E_NO_DATA_CTX;
-  }
-
-  /* sanity check */
-  if (port < mainConfig->pasv_low_range || port > mainConfig->pasv_high_range)
-  {
-    out_log(LEVEL_CRITICAL, "PASV: attempted to bind to port out of range (%d not in [%d , %d])\n",
-        port, mainConfig->pasv_low_range, mainConfig->pasv_high_range);
-        socket_close(context->pasv_socket);
-        context->pasv_socket = -1;
-        ret = send_message(425, context);
-        return E_NO_DATA_CTX;
-  }
-
-  /* sanity check */
-  if (port >= 65536) {
-    out_log(LEVEL_CRITICAL, "PASV: attempted to bind to invalid port 65536\n");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-    ret = send_message(425, context);
-    return E_NO_DATA_CTX;
-  }
-
-  if (listen(context->pasv_socket,1)<0) {
-    out_log(LEVEL_CRITICAL,"Major error during listen: errno %d error %s\n",errno,strerror(errno));
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
+  /* get a port in the PASV range (from allocator or pool) */
+  port = get_pasv_port(WZD_INET4, context);
+  if (port < 0) {
     ret = send_message(425, context);
     return E_NO_DATA_CTX;
   }
 
-  FD_REGISTER(context->pasv_socket,"Client PASV socket");
-
   context->datafamily = WZD_INET4;
   myip = getmyip(context->control_socket, context->family, buffer); /* FIXME use a variable to get pasv ip ? */
 
@@ -1760,10 +1680,7 @@ int do_eprt(UNUSED wzd_string_t *name, wzd_string_t *arg, wzd_context_t * contex
   char * param, * orig_param;
   wzd_user_t * user;
 
-  if (context->pasv_socket != (socket_t)-1) {
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-  }
+  pasv_close(context);
   /* context->resume = 0; */
   if (!arg || strlen(str_tochar(arg)) <= 7) {
     ret = send_message(502,context);
@@ -1870,42 +1787,13 @@ int do_eprt(UNUSED wzd_string_t *name, wzd_string_t *arg, wzd_context_t * contex
 int do_epsv(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t * context)
 {
   int ret;
-  unsigned int size,port;
-#if defined(IPV6_SUPPORT)
-  struct sockaddr_in6 sai6;
-#else
-  struct sockaddr_in sai;
-  unsigned long addr;
-#endif
+  int port;
   unsigned char *myip;
   unsigned char pasv_bind_ip[16];
   unsigned char buffer[16];
 
-#if !defined(IPV6_SUPPORT)
-  size = sizeof(struct sockaddr_in);
-#else
-  size = sizeof(struct sockaddr_in6);
-#endif
-  port = mainConfig->pasv_low_range; /* use pasv range min */
-
   /* close existing pasv connections */
-  if (context->pasv_socket != (socket_t)-1) {
-    socket_close(context->pasv_socket);
-/*    port = context->pasvsock+1; *//* FIXME force change of socket */
-    context->pasv_socket = -1;
-  }
-
-  /* create socket */
-#if !defined(IPV6_SUPPORT)
-  if ((context->pasv_socket = socket(PF_INET,SOCK_STREAM,0)) == (socket_t)-1)
-#else
-  if ((context->pasv_socket = socket(PF_INET6,SOCK_STREAM,0)) == (socket_t)-1)
-#endif
-  {
-    context->pasv_socket = -1;
-    ret = send_message(425,context);
-    return E_NO_DATA_CTX;
-  }
+  pasv_close(context);
 
   myip = getmyip(context->control_socket, context->family, buffer); /* FIXME use a variable to get pasv ip ? */
 
@@ -1925,57 +1813,18 @@ int do_epsv(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t *
 /*  out_err(LEVEL_CRITICAL,"PASV_IP: %d.%d.%d.%d\n",
       pasv_bind_ip[0], pasv_bind_ip[1], pasv_bind_ip[2], pasv_bind_ip[3]);*/
 
-  while (port <= mainConfig->pasv_high_range) { /* use pasv range max */
+  /* get a port in the PASV range (from allocator or pool) */
 #if !defined(IPV6_SUPPORT)
-    memset(&sai,0,size);
-
-    sai.sin_family = AF_INET;
-    sai.sin_port = htons((unsigned short)port);
-    /* XXX TODO FIXME bind to specific address works, but not for NAT */
-    /* XXX TODO FIXME always bind to 'myip' ?! */
-    addr = INADDR_ANY;
-/*    memcpy( (void*)&addr, pasv_bind_ip, sizeof(unsigned long));*/
-
-    memcpy(&sai.sin_addr.s_addr,&addr,sizeof(unsigned long));
-
-    if (bind(context->pasv_socket,(struct sockaddr *)&sai,size)==0) break;
-#else /* IPV6_SUPPORT */
-    memset(&sai6,0,size);
-
-    sai6.sin6_family = AF_INET6;
-    sai6.sin6_port = htons(port);
-    sai6.sin6_flowinfo = 0;
-/*     sai6.sin6_addr = in6addr_any;*/ /* FIXME VISUAL */
-    memset(&sai6.sin6_addr,0,16);
-    /* XXX TODO FIXME bind to specific address works, but not for NAT */
-    /* XXX TODO FIXME always bind to 'myip' ?! */
-/*    addr = INADDR_ANY;*/
-
-/*    memcpy(&sai.sin_addr.s_addr,&addr,sizeof(unsigned long));*/
-
-    if (bind(context->pasv_socket,(struct sockaddr *)&sai6,size)==0) break;
-
-#endif /* IPV6_SUPPORT */
-    port++; /* retry with next port */
-  }
-  if (port > mainConfig->pasv_high_range || port >= 65536) {
-    out_log(LEVEL_CRITICAL,"EPSV: could not find any available port for binding");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-    ret = send_message(425,context);
-    return E_NO_DATA_CTX;
-  }
-
-  if (listen(context->pasv_socket,1)<0) {
-    out_log(LEVEL_CRITICAL,"EPSV: could not listen on port %d: errno %d error %s\n",port,errno,strerror(errno));
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
+  port = get_pasv_port(WZD_INET4, context);
+#else
+  port = get_pasv_port(WZD_INET6, context);
+#endif
+  if (port < 0) {
+    out_log(LEVEL_CRITICAL,"EPSV: could not find any available port for binding\n");
     ret = send_message(425,context);
     return E_NO_DATA_CTX;
   }
 
-  FD_REGISTER(context->pasv_socket,"Client PASV socket");
-
   myip = getmyip(context->control_socket, context->family, buffer); /* FIXME use a variable to get pasv ip ? */
 
 #if !defined(IPV6_SUPPORT)
@@ -2177,28 +2026,20 @@ int do_retr(UNUSED wzd_string_t *name, wzd_string_t *arg, wzd_context_t * contex
   else
     context->current_limiter = NULL;*/
 
-/*  if (user->max_dl_speed)
-  {*/
-    context->current_dl_limiter.maxspeed = user->max_dl_speed;
-    context->current_dl_limiter.bytes_transfered = 0;
-#ifndef _MSC_VER
-    gettimeofday(&context->current_dl_limiter.current_time,NULL);
-#else
-    _ftime(&context->current_dl_limiter.current_time);
-#endif
-/*  }
-  else
-    context->current_dl_limiter.maxspeed = 0;*/
+  /* connection -> group -> global */
+  limiter_init(&context->current_dl_limiter, user->max_dl_speed,
+      limiter_get_parent(user, 0 /* is_upload */));
 
   /* we increment the counter of downloaded files at the beggining
    * of the download
    */
-  user->stats.files_dl_total++;
+  user_stats_add_file(user, 0 /* is_upload */);
 
   context->resume=0;
   context->idle_time_start = time(NULL);
 
-  if (CFG_GET_OPTION(mainConfig,CFG_OPT_EXPERIMENTAL)) {
+  /* with the event loop, transfers must not block the worker */
+  if (CFG_GET_OPTION(mainConfig,CFG_OPT_EXPERIMENTAL) || reactor_is_running()) {
     if (context->transfer_thread != NULL) {
       out_log(LEVEL_HIGH,"ERROR a transfer thread is already started\n");
       data_end_transfer(0 /* is_upload */, 0 /* end_ok */, context);
@@ -2379,18 +2220,27 @@ int do_stor(wzd_string_t *name, wzd_string_t *arg, wzd_context_t * context)
   context->idle_time_data_start = context->current_action.tm_start = time(NULL);
   gettimeofday(&context->current_action.tv_start,NULL);
 
-  context->current_ul_limiter.maxspeed = user->max_ul_speed;
-  context->current_ul_limiter.bytes_transfered = 0;
-#ifndef WIN32 /* FIXME VISUAL */
-  gettimeofday(&context->current_ul_limiter.current_time,NULL);
-#else
-  _ftime(&context->current_ul_limiter.current_time);
-#endif
+  /* crc is computed while receiving data, data_end_transfer() decides
+   * if it can be trusted for the whole file
+   */
+  context->last_file.crc = 0;
+  context->last_file.crc_valid = 0;
+  {
+    const wzd_config_snapshot_t * snapshot = config_snapshot_acquire();
+    if (snapshot->auto_crc)
+      context->last_file.crc_valid = 1;
+    config_snapshot_release(snapshot);
+  }
+
+  /* connection -> group -> global */
+  limiter_init(&context->current_ul_limiter, user->max_ul_speed,
+      limiter_get_parent(user, 1 /* is_upload */));
 
   context->resume=0;
   context->idle_time_start = time(NULL);
 
-  if (CFG_GET_OPTION(mainConfig,CFG_OPT_EXPERIMENTAL)) {
+  /* with the event loop, transfers must not block the worker */
+  if (CFG_GET_OPTION(mainConfig,CFG_OPT_EXPERIMENTAL) || reactor_is_running()) {
     if (context->transfer_thread != NULL) {
       out_log(LEVEL_HIGH,"ERROR a transfer thread is already started\n");
       data_end_transfer(0 /* is_upload */, 0 /* end_ok */, context);
@@ -2605,9 +2455,7 @@ int do_abor(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t *
   user = GetUserByID(context->userid);
 
   if (context->pasv_socket != (socket_t)-1 && context->data_socket != context->pasv_socket) {
-    socket_close(context->pasv_socket);
-    FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    context->pasv_socket=-1;
+    pasv_close(context);
   }
   if (context->current_action.current_file != (fd_t)-1) {
     /* transfer aborted, we should send a 426 */
@@ -2916,7 +2764,7 @@ int do_quit(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t *
   {
     wzd_user_t * user = NULL;
     wzd_group_t * group = NULL;
-    struct hostent * h = NULL;
+    char hostname[256];
     char inet_str[256];
     int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
 
@@ -2927,9 +2775,10 @@ int do_quit(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t *
     }
     inet_str[0] = '\0';
     inet_ntop(af, context->hostip, inet_str, sizeof(inet_str));
-    h = gethostbyaddr((char*)&context->hostip, sizeof(context->hostip), af);
+    if (ip_get_hostname_cached(context->hostip, context->family, hostname, sizeof(hostname)))
+      hostname[0] = '\0';
     log_message("LOGOUT","%s (%s) \"%s\" \"%s\" \"%s\"",
-        h && h->h_name ? h->h_name : "No hostname",
+        *hostname ? hostname : "No hostname",
         *inet_str ? inet_str : "No IP address",
         user && *(user->username) ? user->username : "No username",
         group && *(group->groupname) ? group->groupname : "No groupname",
@@ -3272,18 +3121,233 @@ int do_help(UNUSED wzd_string_t *name, UNUSED wzd_string_t *arg, wzd_context_t *
 /*****************************************************/
 /*************** client main proc ********************/
 /*****************************************************/
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+/** @brief Switch control connection to TLS, for implicit TLS servers
+ *
+ * The handshake is done here and not in the server thread, so a slow
+ * client can not delay accepts for other clients. It is bounded by
+ * HARD_TLS_HANDSHAKE_TIMEOUT, and its duration is added to server stats.
+ *
+ * \return 0 if ok
+ */
+static int client_tls_implicit(wzd_context_t * context)
+{
+  struct timeval tv_start, tv_end;
+  unsigned long elapsed;
+  char inet_buf[INET6_ADDRSTRLEN];
+  int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
+  int ret;
+
+  gettimeofday(&tv_start,NULL);
+  ret = tls_auth("SSL",context);
+  gettimeofday(&tv_end,NULL);
+
+  elapsed = (tv_end.tv_sec - tv_start.tv_sec) * 1000L + (tv_end.tv_usec - tv_start.tv_usec) / 1000L;
+  WZD_ATOMIC_ADD(&mainConfig->stats.tls_handshake_time, elapsed);
+
+  if (ret) {
+    WZD_ATOMIC_INC(&mainConfig->stats.tls_handshake_failures);
+    inet_buf[0] = '\0';
+    inet_ntop(af,context->hostip,inet_buf,sizeof(inet_buf));
+    out_log(LEVEL_HIGH,"TLS switch failed (implicit) from client %s after %lu ms\n", inet_buf, elapsed);
+    return -1;
+  }
+  WZD_ATOMIC_INC(&mainConfig->stats.tls_handshakes);
+  out_log(LEVEL_FLOOD,"TLS handshake (implicit) done in %lu ms\n", elapsed);
+
+  context->connection_flags |= CONNECTION_TLS;
+
+  return 0;
+}
+#endif /* HAVE_OPENSSL || HAVE_GNUTLS */
+
+/** @brief Switch control connection to TLS, if the server uses implicit TLS
+ *
+ * This must be called before client_login(). The event loop runs it in a
+ * separate pool of workers, so TLS handshakes do not delay logins.
+ *
+ * \return 0 if ok, or if TLS is not implicit
+ */
+int client_login_tls(wzd_context_t * context)
+{
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+  if (mainConfig->tls_type == TLS_IMPLICIT)
+    return client_tls_implicit(context);
+#endif
+  return 0;
+}
+
+/** @brief Run the login sequence and prepare context for commands
+ *
+ * Allocates transfer buffers, calls do_login(context) and, if the user
+ * is accepted, sends the welcome message and the EVENT_LOGIN event.
+ *
+ * This is shared between the client threads and the event loop workers,
+ * and must be called in the thread which will handle the client, after
+ * client_login_tls().
+ *
+ * \return 0 if login is ok
+ */
+int client_login(wzd_context_t * context)
+{
+  int ret;
+  wzd_user_t * user;
+
+  context->last_file.name[0] = '\0';
+  context->last_file.token = TOK_UNKNOWN;
+  context->data_buffer = wzd_malloc(mainConfig->data_buffer_length);
+
+  ret = do_login(context);
+  if (ret) return ret;
+
+  context->state = STATE_COMMAND;
+
+  user = GetUserByID(context->userid);
+
+  /* user+pass ok */
+  send_message_raw("230- Command okay\r\n",context);
+  {
+    wzd_string_t * event_args = str_allocate();
+    str_sprintf(event_args, "\"%s\"", user->username);
+    event_send(mainConfig->event_mgr, EVENT_LOGIN, 230, event_args, context);
+    str_deallocate(event_args);
+  }
+  ret = send_message(230,context);
+
+  /* update last login time */
+  time(&user->last_login);
+
+  context->control_buffer = malloc(WZD_BUFFER_LEN);
+
+  context->exitclient=0;
+  context->idle_time_start = time(NULL);
+
+  return 0;
+}
+
+/** @brief Join the transfer thread of a client, if the transfer is finished
+ */
+void client_join_transfer(wzd_context_t * context)
+{
+  if (context->transfer_thread != NULL &&
+      context->is_transferring == 0) {
+    void * return_value;
+
+    out_log(LEVEL_FLOOD,"DEBUG waiting for transfer thread\n");
+
+    wzd_thread_join(context->transfer_thread,&return_value);
+
+    free(context->transfer_thread);
+    context->transfer_thread = NULL;
+  }
+}
+
+/** @brief Read one command from the control connection and execute it
+ *
+ * The command is translated to current charset if needed, then the
+ * first token is parsed and sent to commands_find() to identify the command.
+ *
+ * \note The control connection must be ready for reading, this function
+ * does not wait.
+ *
+ * \return 0 if ok, -1 if the remote host has closed the connection
+ */
+int client_read_command(wzd_context_t * context)
+{
+  char * buffer = context->control_buffer;
+  int ret;
+  wzd_user_t * user;
+  wzd_command_t * command;
+  wzd_string_t * command_buffer;
+  struct ftp_command_t * ftp_command;
+
+  ret = (context->read_fct)(context->control_socket,buffer,WZD_BUFFER_LEN-1,0,0,context); /* timeout = 0, we know there's something to read */
+
+  /* remote host has closed session */
+  if (ret==0 || ret==-1) {
+    out_log(LEVEL_FLOOD,"Host disconnected improperly!\n");
+    context->exitclient=1;
+    return -1;
+  }
+
+  /* this replace the memset (bzero ?) some lines before */
+  buffer[ret] = '\0';
+
+  cleanup_ftp_command(buffer,ret);
+
+  if (buffer[0]=='\0') return 0;
+
+  user = GetUserByID(context->userid);
+
+  command_buffer = STR(buffer);
+
+  str_trim_right(command_buffer);
+
+  set_action(context,str_tochar(command_buffer));
+
+/*    context->idle_time_start = time(NULL);*/
+#ifdef DEBUG
+out_err(LEVEL_FLOOD,"<thread %ld> <- '%s'\n",(unsigned long)context->pid_child,str_tochar(command_buffer));
+#endif
+
+  /* reset current reply */
+  reply_clear(context);
+
+  /* parse and identify command */
+  ftp_command = parse_ftp_command(command_buffer);
+
+  if (ftp_command != NULL) {
+    command = ftp_command->command;
+
+    /** For FTP commands, the default permission (if not specified)
+     * is to ALLOW users to use command, unless restricted !
+     */
+    if (command->perms && commands_check_permission(command,context)) {
+      ret = send_message_with_args(501,context,"Permission Denied");
+      free_ftp_command(ftp_command);
+      return 0;
+    }
+
+    if (command->command)
+      ret = (*(command->command))(ftp_command->command_name,ftp_command->args,context);
+    else { /* external command */
+      char buffer_command[4096];
+      wzd_group_t * group = NULL;
+
+      if (user->group_num > 0) group = GetGroupByID(user->groups[0]);
+      cookie_parse_buffer(str_tochar(command->external_command), user, group, context, buffer_command, sizeof(buffer_command));
+      chop(buffer_command);
+
+      /* add arguments given on CLI to event */
+      if (str_length(ftp_command->args)>0) {
+        strlcat(buffer_command, " ", sizeof(buffer_command));
+        strlcat(buffer_command, str_tochar(ftp_command->args), sizeof(buffer_command));
+      }
+
+      ret = event_exec(buffer_command,context);
+    }
+
+    /** \todo When all functions use reply_push, test reply and send error if -1 */
+    ret = reply_send(context);
+  } else { /* no command found */
+    ret = send_message(502,context);
+    str_deallocate(command_buffer);
+  }
+  free_ftp_command(ftp_command);
+
+  return 0;
+}
+
 /** @brief Client main loop
  *
- * Calls do_login(context) to handle the login, and then enters the main
- * loop.
+ * Calls client_login_tls(context) and client_login(context) to handle the
+ * login, and then enters the main loop.
  *
  * Each loop consist of checking if the control connection is ready for
  * reading, and if data connection is ready for reading/writing. If both
  * are ready, the control connection is always handled first.
- * Data are handled in the separate function data_execute().
- *
- * Control data are first translated to current charset if needed, then the
- * first token is parsed and sent to commands_find() to identify the command.
+ * Data are handled in the separate function data_execute(), commands
+ * in client_read_command().
  *
  * The exit is done using client_die().
  */
@@ -3292,24 +3356,18 @@ void * clientThreadProc(void *arg)
   struct timeval tv;
   fd_set fds_r,fds_w,efds;
   unsigned long max_wait_time;
+  unsigned long data_delay;
   wzd_context_t * context;
-  char *buffer = NULL;
   int save_errno;
   socket_t sockfd;
   int ret;
   wzd_user_t * user;
-  wzd_command_t * command;
-  wzd_string_t * command_buffer;
-  struct ftp_command_t * ftp_command;
 #ifndef _MSC_VER
   int oldtype;
 #endif
 
   context = arg;
   sockfd = context->control_socket;
-  context->last_file.name[0] = '\0';
-  context->last_file.token = TOK_UNKNOWN;
-  context->data_buffer = wzd_malloc(mainConfig->data_buffer_length);
 
 #ifdef WIN32
   context->thread_id = GetCurrentThreadId();
@@ -3326,7 +3384,9 @@ void * clientThreadProc(void *arg)
 #endif /* WZD_MULTITHREAD */
 #endif
 
-  ret = do_login(context);
+  ret = client_login_tls(context);
+  if (ret == 0)
+    ret = client_login(context);
 
   if (ret) {
 #if defined (WIN32)
@@ -3340,35 +3400,14 @@ void * clientThreadProc(void *arg)
     return NULL;
   }
 
-  context->state = STATE_COMMAND;
-
-  user = GetUserByID(context->userid);
-
-  /* user+pass ok */
-  send_message_raw("230- Command okay\r\n",context);
+  /* get value for client tick */
   {
-    wzd_string_t * event_args = str_allocate();
-    str_sprintf(event_args, "\"%s\"", user->username);
-    event_send(mainConfig->event_mgr, EVENT_LOGIN, 230, event_args, context);
-    str_deallocate(event_args);
-  }
-  ret = send_message(230,context);
-
-  /* update last login time */
-  time(&user->last_login);
-
-  context->control_buffer = buffer = malloc(WZD_BUFFER_LEN);
-
-  /* get value for server tick */
-  max_wait_time = config_get_integer(mainConfig->cfg_file, "GLOBAL", "client tick", &ret);
-  if (ret != CF_OK) {
-    max_wait_time = DEFAULT_CLIENT_TICK;
+    const wzd_config_snapshot_t * snapshot = config_snapshot_acquire();
+    max_wait_time = snapshot->client_tick;
+    config_snapshot_release(snapshot);
   }
 
   /* main loop */
-  context->exitclient=0;
-  context->idle_time_start = time(NULL);
-
   user = GetUserByID(context->userid);
   while (!context->exitclient) {
 #ifdef DEBUG
@@ -3384,18 +3423,7 @@ void * clientThreadProc(void *arg)
      * (default: DEFAULT_CLIENT_TICK = 10), so at this point the transfer
      * can be finished while the thread is waiting to be joined
      */
-    if (context->transfer_thread != NULL &&
-        context->is_transferring == 0) {
-      void * return_value;
-
-      out_log(LEVEL_FLOOD,"DEBUG waiting for transfer thread\n");
-
-      wzd_thread_join(context->transfer_thread,&return_value);
-      context->transfer_thread = NULL;
-
-      free(context->transfer_thread);
-      context->transfer_thread = NULL;
-    }
+    client_join_transfer(context);
 
     save_errno = 666;
     /* 1. read */
@@ -3405,13 +3433,21 @@ void * clientThreadProc(void *arg)
     /* set control fd */
     FD_SET(sockfd,&fds_r);
     FD_SET(sockfd,&efds);
-    /* set data fd */
+    tv.tv_sec=max_wait_time; tv.tv_usec=0L;
+    /* set data fd, unless bandwidth limit is reached: in this case, only
+     * wait for control connection until transfer can continue
+     */
+    ret = -1;
     if (context->transfer_thread == NULL) {
-      ret = data_set_fd(context,&fds_r,&fds_w,&efds);
+      data_delay = data_get_delay(context);
+      if (data_delay == 0) {
+        ret = data_set_fd(context,&fds_r,&fds_w,&efds);
+      } else {
+        tv.tv_sec = data_delay / 1000000;
+        tv.tv_usec = data_delay % 1000000;
+      }
     }
     if ((signed)sockfd > ret) ret = sockfd;
-
-    tv.tv_sec=max_wait_time; tv.tv_usec=0L;
     /* bug in windows implementation of select(): when aborting a data connection,
      * next calls to select() always return immediatly, causing wzdftpd
      * to use 100% cpu (infinite loop).
@@ -3464,77 +3500,8 @@ out_err(LEVEL_CRITICAL,"read %d %d write %d %d error %d %d\n",FD_ISSET(sockfd,&f
       if (check_timeout(context)) break;
       continue;
     }
-    ret = (context->read_fct)(sockfd,buffer,WZD_BUFFER_LEN-1,0,0,context); /* timeout = 0, we know there's something to read */
-
-    /* remote host has closed session */
-    if (ret==0 || ret==-1) {
-      out_log(LEVEL_FLOOD,"Host disconnected improperly!\n");
-      context->exitclient=1;
-      break;
-    }
-
-    /* this replace the memset (bzero ?) some lines before */
-    buffer[ret] = '\0';
-
-    cleanup_ftp_command(buffer,ret);
-
-    if (buffer[0]=='\0') continue;
-
-    command_buffer = STR(buffer);
 
-    str_trim_right(command_buffer);
-
-    set_action(context,str_tochar(command_buffer));
-
-/*    context->idle_time_start = time(NULL);*/
-#ifdef DEBUG
-out_err(LEVEL_FLOOD,"<thread %ld> <- '%s'\n",(unsigned long)context->pid_child,str_tochar(command_buffer));
-#endif
-
-    /* reset current reply */
-    reply_clear(context);
-
-    /* parse and identify command */
-    ftp_command = parse_ftp_command(command_buffer);
-
-    if (ftp_command != NULL) {
-      command = ftp_command->command;
-
-      /** For FTP commands, the default permission (if not specified)
-       * is to ALLOW users to use command, unless restricted !
-       */
-      if (command->perms && commands_check_permission(command,context)) {
-        ret = send_message_with_args(501,context,"Permission Denied");
-        free_ftp_command(ftp_command);
-        continue;
-      }
-
-      if (command->command)
-        ret = (*(command->command))(ftp_command->command_name,ftp_command->args,context);
-      else { /* external command */
-        char buffer_command[4096];
-        wzd_group_t * group = NULL;
-
-        if (user->group_num > 0) group = GetGroupByID(user->groups[0]);
-        cookie_parse_buffer(str_tochar(command->external_command), user, group, context, buffer_command, sizeof(buffer_command));
-        chop(buffer_command);
-
-        /* add arguments given on CLI to event */
-        if (str_length(ftp_command->args)>0) {
-          strlcat(buffer_command, " ", sizeof(buffer_command));
-          strlcat(buffer_command, str_tochar(ftp_command->args), sizeof(buffer_command));
-        }
-
-        ret = event_exec(buffer_command,context);
-      }
-
-      /** \todo When all functions use reply_push, test reply and send error if -1 */
-      ret = reply_send(context);
-    } else { /* no command found */
-      ret = send_message(502,context);
-      str_deallocate(command_buffer);
-    }
-    free_ftp_command(ftp_command);
+    if (client_read_command(context)) break;
 
   } /* while (!exitclient) */
 
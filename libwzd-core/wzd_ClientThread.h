@@ -32,8 +32,28 @@ int clear_write(socket_t sock, const char *msg, size_t length, int flags, unsign
 
 void * clientThreadProc(void *arg);
 
+/** \brief Switch control connection to TLS, if the server uses implicit TLS
+ * \return 0 if ok
+ */
+int client_login_tls(wzd_context_t * context);
+
+/** \brief Run the login sequence and prepare context for commands
+ * \return 0 if login is ok
+ */
+int client_login(wzd_context_t * context);
+
+/** \brief Join the transfer thread of a client, if the transfer is finished */
+void client_join_transfer(wzd_context_t * context);
+
+/** \brief Read one command from the control connection and execute it
+ * \return 0 if ok, -1 if the remote host has closed the connection
+ */
+int client_read_command(wzd_context_t * context);
+
 void client_die(wzd_context_t * context);
 
+int check_timeout(wzd_context_t * context);
+
 #define FEAT_COMMON " NON-FREE FTPD SUCKS\n" \
   " MDTM\n" \
   " SIZE\n" \
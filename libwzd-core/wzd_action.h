@@ -173,6 +173,7 @@ struct last_file_t {
     struct timeval tv;
     u64_t	size;
     u32_t crc;
+    int crc_valid; /**< crc was computed during upload and covers the whole file */
     unsigned int token;
 };
 
@@ -76,11 +76,14 @@
 
 #include "wzd_structs.h"
 
+#include "wzd_atomic.h"
 #include "wzd_backend.h"
 #include "wzd_cache.h"
 #include "wzd_ClientThread.h"
 #include "wzd_configfile.h"
 #include "wzd_configloader.h"
+#include "wzd_cookie.h"
+#include "wzd_crc32.h"
 #include "wzd_crontab.h"
 #include "wzd_dir.h"
 #include "wzd_events.h"
@@ -93,6 +96,7 @@
 #include "wzd_misc.h"
 #include "wzd_mod.h"
 #include "wzd_perm.h"
+#include "wzd_reactor.h"
 #include "wzd_section.h"
 #include "wzd_site.h"
 #include "wzd_site_group.h"
@@ -0,0 +1,73 @@
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+#ifndef __WZD_ATOMIC__
+#define __WZD_ATOMIC__
+
+/** \file wzd_atomic.h
+ * \brief Atomic operations on integers and pointers
+ *
+ * All operations are full memory barriers. WZD_ATOMIC_INC, WZD_ATOMIC_DEC
+ * and WZD_ATOMIC_ADD return the new value, WZD_ATOMIC_OR and
+ * WZD_ATOMIC_XCHG return the previous value.
+ *
+ * Unless the name ends with 64, the argument must point to a 32 bits
+ * integer.
+ */
+
+#if defined(__GNUC__)
+
+# define WZD_ATOMIC_INC(p)		__sync_add_and_fetch((p),1)
+# define WZD_ATOMIC_DEC(p)		__sync_sub_and_fetch((p),1)
+# define WZD_ATOMIC_ADD(p,v)		__sync_add_and_fetch((p),(v))
+# define WZD_ATOMIC_OR(p,v)		__sync_fetch_and_or((p),(v))
+# define WZD_ATOMIC_CAS(p,o,n)		__sync_bool_compare_and_swap((p),(o),(n))
+# define WZD_ATOMIC_XCHG(p,v)		__sync_lock_test_and_set((p),(v))
+# define WZD_ATOMIC_XCHGPTR(p,v)	__sync_lock_test_and_set((p),(v))
+
+# define WZD_ATOMIC_ADD64(p,v)		__sync_add_and_fetch((p),(v))
+# define WZD_ATOMIC_CAS64(p,o,n)	__sync_bool_compare_and_swap((p),(o),(n))
+
+# define WZD_ATOMIC_BARRIER()		__sync_synchronize()
+
+#elif defined(WIN32)
+
+# define WZD_ATOMIC_INC(p)		InterlockedIncrement((volatile LONG*)(p))
+# define WZD_ATOMIC_DEC(p)		InterlockedDecrement((volatile LONG*)(p))
+# define WZD_ATOMIC_ADD(p,v)		(InterlockedExchangeAdd((volatile LONG*)(p),(v)) + (v))
+# define WZD_ATOMIC_OR(p,v)		InterlockedOr((volatile LONG*)(p),(v))
+# define WZD_ATOMIC_CAS(p,o,n)		(InterlockedCompareExchange((volatile LONG*)(p),(n),(o)) == (LONG)(o))
+# define WZD_ATOMIC_XCHG(p,v)		InterlockedExchange((volatile LONG*)(p),(v))
+# define WZD_ATOMIC_XCHGPTR(p,v)	InterlockedExchangePointer((PVOID volatile*)(p),(v))
+
+# define WZD_ATOMIC_ADD64(p,v)		(InterlockedExchangeAdd64((volatile LONGLONG*)(p),(v)) + (v))
+# define WZD_ATOMIC_CAS64(p,o,n)	(InterlockedCompareExchange64((volatile LONGLONG*)(p),(n),(o)) == (LONGLONG)(o))
+
+# define WZD_ATOMIC_BARRIER()		MemoryBarrier()
+
+#else
+# error "no atomic operations available on this platform"
+#endif
+
+#endif /* __WZD_ATOMIC__ */
@@ -34,6 +34,7 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -42,6 +43,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 
 #include <dlfcn.h>
 #endif
@@ -55,6 +57,7 @@
 
 #include "wzd_structs.h"
 
+#include "wzd_atomic.h"
 #include "wzd_backend.h"
 #include "wzd_cache.h"
 #include "wzd_configfile.h"
@@ -63,7 +66,9 @@
 #include "wzd_misc.h"
 #include "wzd_libmain.h"
 #include "wzd_log.h"
+#include "wzd_threads.h"
 #include "wzd_user.h"
+#include "wzd_vfs.h"
 
 #include "wzd_debug.h"
 
@@ -75,9 +80,61 @@
 
 #endif /* WZD_USE_PCH */
 
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 
 static int _trigger_user_max_dl(wzd_user_t * user);
 static int _trigger_user_max_ul(wzd_user_t * user);
+static int _backend_mod_user_stats(uid_t uid, wzd_user_t * user, unsigned long mod_type);
+
+/** \brief User modifications waiting to be sent to the backend
+ *
+ * Slots are assigned to a uid on first use and never released, only the
+ * modification mask is reset when it is sent. Several modifications of the
+ * same user are merged into one call to the backend.
+ *
+ * Pending modifications are shared between all threads, and updated
+ * using atomic operations only.
+ */
+struct _user_pending_t {
+  volatile unsigned long key; /**< uid + 1, or 0 if the slot is free */
+  volatile unsigned long mod_type;
+};
+
+static struct _user_pending_t _user_pending[HARD_USER_PENDING_SLOTS];
+static volatile unsigned long _user_pending_count = 0;
+static volatile unsigned long _user_pending_flushing = 0;
+
+#if defined(HAVE_PTHREAD)
+/* flusher thread, woken up when HARD_USER_PENDING_FLUSH modifications are
+ * waiting
+ */
+static pthread_mutex_t _user_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _user_pending_cond = PTHREAD_COND_INITIALIZER;
+static wzd_thread_t _user_pending_thread;
+static int _user_pending_running = 0;
+static int _user_pending_wakeup = 0;
+
+/* journal of statistics not yet sent to the backend (option stats_journal).
+ * One line is appended for each deferred modification, with the values of
+ * the user at that time. The journal is rotated when a flush starts, and the
+ * old file is removed when the flush is done, so after a crash the files
+ * contain at least all statistics which were not sent.
+ */
+static pthread_mutex_t _user_journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int _user_journal_fd = -1;
+static char * _user_journal_path = NULL;
+static char * _user_journal_old = NULL;
+/* set when the last flush failed: the old journal must not be removed */
+static int _user_journal_keep = 0;
+
+static void _user_journal_open(void);
+static void _user_journal_close(void);
+static void _user_pending_start(void);
+static void _user_pending_stop(void);
+#endif /* HAVE_PTHREAD */
 
 
 /** \brief Get backend version
@@ -199,6 +256,11 @@ int backend_init(wzd_backend_def_t * backend)
     }
   }
 
+#if defined(HAVE_PTHREAD)
+  _user_journal_open();
+  _user_pending_start();
+#endif
+
   return 0;
 }
 
@@ -282,6 +344,14 @@ int backend_close(const char *backend)
   /* step 1: check that backend == mainConfig->backend.name */
   if (strcmp(backend,mainConfig->backends->filename)!=0) return 1;
 
+#if defined(HAVE_PTHREAD)
+  _user_pending_stop();
+#endif
+  backend_flush_deferred();
+#if defined(HAVE_PTHREAD)
+  _user_journal_close();
+#endif
+
   /* step 2: call end function */
   if (mainConfig->backends->b) {
     fini_fcn = mainConfig->backends->b->backend_exit;
@@ -700,12 +770,355 @@ int backend_validate_pass(const char *name, const char *pass, wzd_user_t *user,
   return -1;
 }
 
+static struct _user_pending_t * _user_pending_find(uid_t uid, int create)
+{
+  unsigned long key = (unsigned long)uid + 1;
+  unsigned int i, index;
+
+  for (i=0; i<HARD_USER_PENDING_SLOTS; i++) {
+    index = (uid + i) % HARD_USER_PENDING_SLOTS;
+    if (_user_pending[index].key == key)
+      return &_user_pending[index];
+    if (_user_pending[index].key == 0) {
+      if (!create)
+        return NULL;
+      if (WZD_ATOMIC_CAS(&_user_pending[index].key, 0, key) || _user_pending[index].key == key)
+        return &_user_pending[index];
+    }
+  }
+
+  return NULL;
+}
+
+#if defined(HAVE_PTHREAD)
+static void _user_journal_append(wzd_user_t * user)
+{
+  char buffer[256];
+  int length;
+
+  if (_user_journal_fd == -1) return;
+
+  length = snprintf(buffer, sizeof(buffer), "%lu %" PRIu64 " %" PRIu64 " %lu %lu %" PRIu64 "\n",
+      (unsigned long)user->uid, user->stats.bytes_ul_total, user->stats.bytes_dl_total,
+      user->stats.files_ul_total, user->stats.files_dl_total, user->credits);
+
+  pthread_mutex_lock(&_user_journal_mutex);
+  if (_user_journal_fd != -1 && write(_user_journal_fd, buffer, length) != length)
+    out_log(LEVEL_HIGH,"ERROR could not write statistics journal %s (%s)\n",_user_journal_path,strerror(errno));
+  pthread_mutex_unlock(&_user_journal_mutex);
+}
+
+/* append journal \a from at the end of \a to, so entries are read in the
+ * same order
+ */
+static int _user_journal_concat(const char * from, const char * to)
+{
+  FILE * fp_in, * fp_out;
+  char buffer[4096];
+  size_t length;
+  int ret = 0;
+
+  fp_in = fopen(from, "r");
+  if (fp_in == NULL) return (errno == ENOENT) ? 0 : -1;
+  fp_out = fopen(to, "a");
+  if (fp_out == NULL) {
+    fclose(fp_in);
+    return -1;
+  }
+
+  while ( (length = fread(buffer, 1, sizeof(buffer), fp_in)) > 0 ) {
+    if (fwrite(buffer, 1, length, fp_out) != length) {
+      ret = -1;
+      break;
+    }
+  }
+
+  fclose(fp_in);
+  if (fclose(fp_out)) ret = -1;
+
+  return ret;
+}
+
+/* move current journal to the old file, which is removed by
+ * _user_journal_done() once pending statistics are sent.
+ * If the old file was kept because a flush failed, the current journal is
+ * appended to it instead.
+ */
+static void _user_journal_rotate(void)
+{
+  pthread_mutex_lock(&_user_journal_mutex);
+  if (_user_journal_fd != -1) {
+    close(_user_journal_fd);
+    if (_user_journal_keep) {
+      if (_user_journal_concat(_user_journal_path, _user_journal_old))
+        out_log(LEVEL_HIGH,"ERROR could not append statistics journal %s to %s (%s)\n",_user_journal_path,_user_journal_old,strerror(errno));
+    } else if (rename(_user_journal_path, _user_journal_old))
+      out_log(LEVEL_HIGH,"ERROR could not rename statistics journal %s (%s)\n",_user_journal_path,strerror(errno));
+    _user_journal_fd = open(_user_journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (_user_journal_fd == -1)
+      out_log(LEVEL_HIGH,"ERROR could not open statistics journal %s (%s)\n",_user_journal_path,strerror(errno));
+  }
+  pthread_mutex_unlock(&_user_journal_mutex);
+}
+
+/* called after a flush, with the number of users which could not be sent */
+static void _user_journal_done(int failed)
+{
+  if (failed) {
+    _user_journal_keep = 1;
+    return;
+  }
+  _user_journal_keep = 0;
+  if (_user_journal_old != NULL)
+    unlink(_user_journal_old);
+}
+
+/* read statistics left by a previous run, returns the number of entries */
+static int _user_journal_read(const char * filename)
+{
+  FILE * fp;
+  char line[256];
+  unsigned long uid, files_ul, files_dl;
+  u64_t bytes_ul, bytes_dl, credits;
+  wzd_user_t * user;
+  int count = 0;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) return 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%lu %" SCNu64 " %" SCNu64 " %lu %lu %" SCNu64,
+          &uid, &bytes_ul, &bytes_dl, &files_ul, &files_dl, &credits) != 6)
+      continue; /* last line may be truncated */
+    user = GetUserByID((uid_t)uid);
+    if (!user) continue;
+
+    user->stats.bytes_ul_total = bytes_ul;
+    user->stats.bytes_dl_total = bytes_dl;
+    user->stats.files_ul_total = files_ul;
+    user->stats.files_dl_total = files_dl;
+    user->credits = credits;
+    backend_mod_user_deferred(user->uid, _USER_BYTESUL | _USER_BYTESDL | _USER_CREDITS);
+    count++;
+  }
+  fclose(fp);
+
+  return count;
+}
+
+/* statistics found in the journal are sent to the backend before the
+ * journal is reset
+ */
+static void _user_journal_open(void)
+{
+  wzd_string_t * str;
+  int count;
+
+  if (_user_journal_path != NULL) return;
+
+  str = config_get_string(mainConfig->cfg_file, "GLOBAL", "stats_journal", NULL);
+  if (str == NULL) return;
+
+  _user_journal_path = wzd_strdup(str_tochar(str));
+  _user_journal_old = wzd_malloc(strlen(_user_journal_path) + 5);
+  snprintf(_user_journal_old, strlen(_user_journal_path) + 5, "%s.old", _user_journal_path);
+  str_deallocate(str);
+
+  count = _user_journal_read(_user_journal_old);
+  count += _user_journal_read(_user_journal_path);
+  if (count > 0) {
+    out_log(LEVEL_NORMAL,"Restored %d statistics entries from journal %s\n",count,_user_journal_path);
+    backend_flush_deferred();
+  }
+
+  /* journal is truncated below, keep its entries if they were not sent */
+  if (_user_journal_keep && _user_journal_concat(_user_journal_path, _user_journal_old))
+    out_log(LEVEL_HIGH,"ERROR could not append statistics journal %s to %s (%s)\n",_user_journal_path,_user_journal_old,strerror(errno));
+
+  _user_journal_fd = open(_user_journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (_user_journal_fd == -1)
+    out_log(LEVEL_HIGH,"ERROR could not open statistics journal %s (%s)\n",_user_journal_path,strerror(errno));
+}
+
+/* must be called after the last flush */
+static void _user_journal_close(void)
+{
+  pthread_mutex_lock(&_user_journal_mutex);
+  if (_user_journal_fd != -1) {
+    close(_user_journal_fd);
+    _user_journal_fd = -1;
+    /* everything has been sent */
+    if (!_user_journal_keep)
+      unlink(_user_journal_path);
+  }
+  pthread_mutex_unlock(&_user_journal_mutex);
+
+  wzd_free(_user_journal_path);
+  wzd_free(_user_journal_old);
+  _user_journal_path = _user_journal_old = NULL;
+}
+
+static void * _user_pending_thread_fund(UNUSED void * arg)
+{
+  pthread_mutex_lock(&_user_pending_mutex);
+  while (_user_pending_running) {
+    while (_user_pending_running && !_user_pending_wakeup)
+      pthread_cond_wait(&_user_pending_cond, &_user_pending_mutex);
+    _user_pending_wakeup = 0;
+    pthread_mutex_unlock(&_user_pending_mutex);
+
+    backend_flush_deferred();
+
+    pthread_mutex_lock(&_user_pending_mutex);
+  }
+  pthread_mutex_unlock(&_user_pending_mutex);
+
+  return NULL;
+}
+
+static void _user_pending_start(void)
+{
+  if (_user_pending_running) return;
+
+  _user_pending_running = 1;
+  if (wzd_thread_create(&_user_pending_thread, NULL, _user_pending_thread_fund, NULL)) {
+    out_log(LEVEL_HIGH,"ERROR could not start statistics flusher, statistics will be sent by transfer threads\n");
+    _user_pending_running = 0;
+  }
+}
+
+static void _user_pending_stop(void)
+{
+  void * return_value;
+
+  if (!_user_pending_running) return;
+
+  pthread_mutex_lock(&_user_pending_mutex);
+  _user_pending_running = 0;
+  pthread_cond_signal(&_user_pending_cond);
+  pthread_mutex_unlock(&_user_pending_mutex);
+
+  wzd_thread_join(&_user_pending_thread, &return_value);
+}
+#endif /* HAVE_PTHREAD */
+
+/** \brief Send user modifications to backend later
+ *
+ * Changes of user \a uid are recorded, and merged with any other pending
+ * modification of the same user. They are sent by backend_flush_deferred(),
+ * which is called from backend_commit_changes(), or by the flusher thread
+ * when too many changes are waiting.
+ *
+ * If option stats_journal is set, the statistics of the user are also
+ * appended to the journal, so they can be restored after a crash.
+ *
+ * This is used for statistics updated after each transfer, so transfers do
+ * not have to wait for the backend.
+ */
+int backend_mod_user_deferred(uid_t uid, unsigned long mod_type)
+{
+  struct _user_pending_t * pending;
+  wzd_user_t * user;
+
+  pending = _user_pending_find(uid, 1);
+  if (pending == NULL) { /* table is full */
+    user = GetUserByID(uid);
+    if (!user) return -1;
+    return _backend_mod_user_stats(uid, user, mod_type);
+  }
+
+  WZD_ATOMIC_OR(&pending->mod_type, mod_type);
+
+#if defined(HAVE_PTHREAD)
+  if (_user_journal_fd != -1 && (user = GetUserByID(uid)) != NULL)
+    _user_journal_append(user);
+
+  if (WZD_ATOMIC_INC(&_user_pending_count) >= HARD_USER_PENDING_FLUSH) {
+    if (_user_pending_running) {
+      pthread_mutex_lock(&_user_pending_mutex);
+      _user_pending_wakeup = 1;
+      pthread_cond_signal(&_user_pending_cond);
+      pthread_mutex_unlock(&_user_pending_mutex);
+    } else
+      backend_flush_deferred();
+  }
+#else
+  if (WZD_ATOMIC_INC(&_user_pending_count) >= HARD_USER_PENDING_FLUSH)
+    backend_flush_deferred();
+#endif
+
+  return 0;
+}
+
+/** \brief Send all pending user modifications to backend
+ *
+ * Masks are reset before the user is sent, so modifications recorded while
+ * flushing are kept for the next call. If the backend refuses a user, its
+ * modifications are restored and the old journal is kept.
+ *
+ * \return The number of users sent to the backend
+ */
+int backend_flush_deferred(void)
+{
+  unsigned int i;
+  unsigned long key, mod_type;
+  wzd_user_t * user;
+  int count = 0;
+  int failed = 0;
+
+  if (!mainConfig || !mainConfig->backends) return 0;
+
+  /* another thread is already flushing */
+  if (!WZD_ATOMIC_CAS(&_user_pending_flushing, 0, 1))
+    return 0;
+
+  WZD_ATOMIC_XCHG(&_user_pending_count, 0);
+
+#if defined(HAVE_PTHREAD)
+  /* modifications recorded from now on go to the new journal */
+  _user_journal_rotate();
+#endif
+
+  for (i=0; i<HARD_USER_PENDING_SLOTS; i++) {
+    key = _user_pending[i].key;
+    if (key == 0 || _user_pending[i].mod_type == 0) continue;
+
+    mod_type = WZD_ATOMIC_XCHG(&_user_pending[i].mod_type, 0);
+    if (mod_type == 0) continue;
+
+    user = GetUserByID((uid_t)(key - 1));
+    if (!user) continue; /* user was deleted */
+
+    if (_backend_mod_user_stats(user->uid, user, mod_type)) {
+      out_log(LEVEL_HIGH,"ERROR could not send statistics of user %s to backend\n",user->username);
+      /* retry on next flush */
+      WZD_ATOMIC_OR(&_user_pending[i].mod_type, mod_type);
+      WZD_ATOMIC_INC(&_user_pending_count);
+      failed++;
+      continue;
+    }
+    count++;
+  }
+
+#if defined(HAVE_PTHREAD)
+  _user_journal_done(failed);
+#endif
+
+  _user_pending_flushing = 0;
+
+  return count;
+}
+
 /** \brief Commit changes to backend
+ *
+ * Pending user modifications are sent first.
  */
 int backend_commit_changes(const char *backend)
 {
   wzd_backend_t * b;
 
+  backend_flush_deferred();
+
   if ( (b = mainConfig->backends->b) && b->backend_commit_changes)
     return b->backend_commit_changes();
 
@@ -765,6 +1178,13 @@ int backend_mod_user(const char *backend, uid_t uid, wzd_user_t * user, unsigned
   wzd_backend_t * b;
   wzd_user_t * new_user;
 
+  /* user is deleted, forget pending modifications */
+  if (user == NULL) {
+    struct _user_pending_t * pending = _user_pending_find(uid, 0);
+    if (pending != NULL)
+      WZD_ATOMIC_XCHG(&pending->mod_type, 0);
+  }
+
   WZD_MUTEX_LOCK(SET_MUTEX_BACKEND);
 
   if ( (b = mainConfig->backends->b) && b->backend_mod_user)
@@ -793,6 +1213,7 @@ int backend_mod_user(const char *backend, uid_t uid, wzd_user_t * user, unsigned
         out_log(LEVEL_CRITICAL,"Attempt to call a backend function on %s:%d while there is no available backend !\n", __FILE__, __LINE__);
       else
         out_log(LEVEL_CRITICAL,"FATAL: backend %s does not define get_user method\n",b->name);
+      checkpath_cache_invalidate();
       WZD_MUTEX_UNLOCK(SET_MUTEX_BACKEND);
       return -1;
     }
@@ -807,6 +1228,41 @@ int backend_mod_user(const char *backend, uid_t uid, wzd_user_t * user, unsigned
     }
   }
 
+  /* name may have been changed in place */
+  if (!ret && (mod_type & _USER_USERNAME))
+    user_reindex(uid);
+
+  /* home directory, flags or groups may have changed. This must be done after
+   * the modification, or a path resolved in between would stay cached */
+  checkpath_cache_invalidate();
+
+  WZD_MUTEX_UNLOCK(SET_MUTEX_BACKEND);
+  return ret;
+}
+
+/* send statistics of a user to the backend.
+ * Unlike backend_mod_user(), the user is not reloaded: counters are updated
+ * atomically by transfers while the backend is called, and copying the
+ * backend version would lose these updates. Statistics do not change
+ * permissions, so the checkpath cache is kept.
+ */
+static int _backend_mod_user_stats(uid_t uid, wzd_user_t * user, unsigned long mod_type)
+{
+  int ret;
+  wzd_backend_t * b;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_BACKEND);
+
+  if ( (b = mainConfig->backends->b) && b->backend_mod_user)
+    ret = b->backend_mod_user(uid,user,mod_type);
+  else {
+    if (b == NULL)
+      out_log(LEVEL_CRITICAL,"Attempt to call a backend function on %s:%d while there is no available backend !\n", __FILE__, __LINE__);
+    else
+      out_log(LEVEL_CRITICAL,"FATAL: backend %s does not define mod_user method\n",b->name);
+    ret = -1;
+  }
+
   WZD_MUTEX_UNLOCK(SET_MUTEX_BACKEND);
   return ret;
 }
@@ -849,6 +1305,7 @@ int backend_mod_group(const char *backend, gid_t gid, wzd_group_t * group, unsig
         out_log(LEVEL_CRITICAL,"Attempt to call a backend function on %s:%d while there is no available backend !\n", __FILE__, __LINE__);
       else
         out_log(LEVEL_CRITICAL,"FATAL: backend %s does not define get_user method\n",b->name);
+      checkpath_cache_invalidate();
       WZD_MUTEX_UNLOCK(SET_MUTEX_BACKEND);
       return -1;
     }
@@ -863,6 +1320,13 @@ int backend_mod_group(const char *backend, gid_t gid, wzd_group_t * group, unsig
     }
   }
 
+  /* name may have been changed in place */
+  if (!ret && (mod_type & _GROUP_GROUPNAME))
+    group_reindex(gid);
+
+  /* users of group may have lost permissions */
+  checkpath_cache_invalidate();
+
   WZD_MUTEX_UNLOCK(SET_MUTEX_BACKEND);
   return ret;
 }
@@ -239,7 +239,21 @@ int backend_mod_user(const char *backend, uid_t uid, wzd_user_t * user, unsigned
  */
 int backend_mod_group(const char *backend, gid_t gid, wzd_group_t * group, unsigned long mod_type);
 
+/** \brief Send user modifications to backend later
+ *
+ * Modifications of the same user are merged, and sent by
+ * backend_flush_deferred().
+ */
+int backend_mod_user_deferred(uid_t uid, unsigned long mod_type);
+
+/** \brief Send all pending user modifications to backend
+ * \return The number of users sent
+ */
+int backend_flush_deferred(void);
+
 /** \brief Commit changes to backend
+ *
+ * Pending user modifications are sent first.
  */
 int backend_commit_changes(const char *backend);
 
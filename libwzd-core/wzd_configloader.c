@@ -43,6 +43,7 @@
 #include <ctype.h> /* isspace */
 
 #ifndef WIN32
+#include <unistd.h>	/* usleep() */
 #include <grp.h>	/* getgrnam() */
 #include <pwd.h>	/* getpwnam() */
 #endif
@@ -52,6 +53,7 @@
 
 #include "wzd_string.h"
 #include "wzd_utf8.h"
+#include "wzd_atomic.h"
 #include "wzd_configfile.h"
 #include "wzd_configloader.h"
 #include "wzd_crontab.h"
@@ -63,6 +65,7 @@
 #include "wzd_section.h"
 #include "wzd_socket.h"
 #include "wzd_site.h"
+#include "wzd_spawn.h"
 #include "wzd_vfs.h"
 
 #include "wzd_debug.h"
@@ -77,8 +80,30 @@ static void _cfg_parse_modules(const wzd_configfile_t * file, wzd_config_t * con
 static void _cfg_parse_permissions(const wzd_configfile_t * file, wzd_config_t * config);
 static void _cfg_parse_pre_ip(const wzd_configfile_t * file, wzd_config_t * config);
 static void _cfg_parse_sections(const wzd_configfile_t * file, wzd_config_t * config);
+static void _cfg_parse_spawn_limits(const wzd_configfile_t * file);
 static void _cfg_parse_vfs(const wzd_configfile_t * file, wzd_config_t * config);
 
+/* the snapshot is shared by all threads, and swapped using atomic
+ * operations only
+ */
+
+/* used when no config has been loaded, never freed */
+static wzd_config_snapshot_t _config_snapshot_default = {
+  1,			/* refcount */
+  0,			/* auto_crc */
+  DEFAULT_CLIENT_TICK,	/* client_tick */
+  "ALL",		/* tls_cipher_list */
+  0,			/* pasv_pool_size */
+  LOG_OVERFLOW_BLOCK,	/* log_overflow */
+};
+
+static wzd_config_snapshot_t * volatile _config_snapshot = &_config_snapshot_default;
+
+/* number of threads between the read of _config_snapshot and the
+ * increment of its refcount
+ */
+static volatile long _config_snapshot_acquiring = 0;
+
 
 
 
@@ -148,6 +173,7 @@ void cfg_free(wzd_config_t * cfg)
 
   commands_fini(cfg->commands_list);
 
+  ip_acl_free(cfg->login_pre_ip_acl);
   ip_list_free(cfg->login_pre_ip_checks);
 
   config_free(cfg->cfg_file);
@@ -233,6 +259,11 @@ wzd_config_t * cfg_store(wzd_configfile_t * file, int * error)
 
   /* IP XXX to be implemented */
 
+  /* LIST_SUBDIR_PERMS */
+  ret = config_get_boolean(file, "GLOBAL", "list_subdir_perms", &err);
+  if (err == CF_OK && !(ret))
+    CFG_SET_OPTION(cfg,CFG_OPT_NO_LIST_SUBDIR_PERMS);
+
   /* LOGFILE */
   str = config_get_string(file, "GLOBAL", "logfile", NULL);
   if (str) {
@@ -479,10 +510,135 @@ wzd_config_t * cfg_store(wzd_configfile_t * file, int * error)
   _cfg_parse_permissions(file, cfg);
 
   _cfg_parse_crontab(file, cfg);
+  _cfg_parse_spawn_limits(file);
+
+  config_snapshot_publish(config_snapshot_build(file));
 
   return cfg;
 }
 
+wzd_config_snapshot_t * config_snapshot_build(const wzd_configfile_t * file)
+{
+  wzd_config_snapshot_t * snapshot;
+  wzd_string_t * str;
+  long l;
+  int ret, err;
+
+  snapshot = wzd_malloc(sizeof(wzd_config_snapshot_t));
+  memcpy(snapshot, &_config_snapshot_default, sizeof(wzd_config_snapshot_t));
+  snapshot->refcount = 1;
+
+  /* AUTO CRC */
+  ret = config_get_boolean((wzd_configfile_t*)file, "GLOBAL", "auto crc", &err);
+  if (err == CF_OK && (ret))
+    snapshot->auto_crc = 1;
+
+  /* CLIENT TICK */
+  l = config_get_integer((wzd_configfile_t*)file, "GLOBAL", "client tick", &err);
+  if (err == CF_OK && l > 0)
+    snapshot->client_tick = (int)l;
+
+  /* PASV_POOL_SIZE */
+  l = config_get_integer((wzd_configfile_t*)file, "GLOBAL", "pasv_pool_size", &err);
+  if (err == CF_OK && l > 0)
+    snapshot->pasv_pool_size = (l > HARD_PASV_POOL_SIZE) ? HARD_PASV_POOL_SIZE : (unsigned int)l;
+
+  /* LOG_OVERFLOW */
+  str = config_get_string((wzd_configfile_t*)file, "GLOBAL", "log_overflow", NULL);
+  if (str) {
+    ret = str2logoverflow(str_tochar(str));
+    if (ret == -1)
+      out_log(LEVEL_HIGH,"ERROR log_overflow must be one of block, drop, count (found %s)\n",str_tochar(str));
+    else
+      snapshot->log_overflow = ret;
+    str_deallocate(str);
+  }
+
+  /* TLS_CIPHER_LIST */
+  str = config_get_string((wzd_configfile_t*)file, "GLOBAL", "tls_cipher_list", NULL);
+  if (str) {
+    snapshot->tls_cipher_list = wzd_strdup(str_tochar(str));
+    str_deallocate(str);
+  } else {
+    snapshot->tls_cipher_list = wzd_strdup(_config_snapshot_default.tls_cipher_list);
+  }
+
+  return snapshot;
+}
+
+const wzd_config_snapshot_t * config_snapshot_acquire(void)
+{
+  wzd_config_snapshot_t * snapshot;
+
+  WZD_ATOMIC_INC(&_config_snapshot_acquiring);
+  snapshot = _config_snapshot;
+  WZD_ATOMIC_INC(&snapshot->refcount);
+  WZD_ATOMIC_DEC(&_config_snapshot_acquiring);
+
+  return snapshot;
+}
+
+void config_snapshot_release(const wzd_config_snapshot_t * snapshot)
+{
+  wzd_config_snapshot_t * s = (wzd_config_snapshot_t*)snapshot;
+
+  if (s == NULL || s == &_config_snapshot_default) return;
+
+  if (WZD_ATOMIC_DEC(&s->refcount) == 0) {
+    wzd_free(s->tls_cipher_list);
+    wzd_free(s);
+  }
+}
+
+void config_snapshot_publish(wzd_config_snapshot_t * snapshot)
+{
+  wzd_config_snapshot_t * old;
+
+  if (snapshot == NULL) return;
+
+  old = WZD_ATOMIC_XCHGPTR(&_config_snapshot, snapshot);
+
+  /* read on each out_log(), so it is kept by the log module */
+  log_set_overflow_policy(snapshot->log_overflow);
+
+  /* a reader may have read the old pointer, but not yet incremented its
+   * refcount: wait until it has done so (this is only a few instructions)
+   */
+  WZD_ATOMIC_BARRIER();
+  while (_config_snapshot_acquiring != 0) {
+#ifndef WIN32
+    usleep(1);
+#else
+    Sleep(0);
+#endif
+  }
+
+  config_snapshot_release(old);
+}
+
+int config_snapshot_reload(const char * filename)
+{
+  wzd_configfile_t * file;
+  int ret;
+
+  if (!filename) return -1;
+
+  file = config_new();
+  ret = config_load_from_file(file, filename, 0);
+  if (ret) {
+    out_log(LEVEL_HIGH,"ERROR could not reload config file %s (%d)\n",filename,ret);
+    config_free(file);
+    return -1;
+  }
+
+  config_snapshot_publish(config_snapshot_build(file));
+  config_free(file);
+
+  out_log(LEVEL_INFO,"INFO config snapshot reloaded from %s\n",filename);
+
+  return 0;
+}
+
 /******************* STATIC ******************/
 
 static void _cfg_parse_pre_ip(const wzd_configfile_t * file, wzd_config_t * config)
@@ -517,6 +673,8 @@ static void _cfg_parse_pre_ip(const wzd_configfile_t * file, wzd_config_t * conf
   }
 
   str_deallocate_array(array);
+
+  config->login_pre_ip_acl = ip_acl_compile(config->login_pre_ip_checks);
 }
 
 static void _cfg_parse_crontab(const wzd_configfile_t * file, wzd_config_t * config)
@@ -563,6 +721,38 @@ static void _cfg_parse_crontab(const wzd_configfile_t * file, wzd_config_t * con
   str_deallocate_array(array);
 }
 
+/** \brief Read limits of external commands running at the same time,
+ * for each event type
+ */
+static void _cfg_parse_spawn_limits(const wzd_configfile_t * file)
+{
+  wzd_string_t ** array;
+  int i;
+  int err;
+  char * event_name;
+  unsigned long eventmask;
+  long l;
+
+  array = config_get_keys(file,"spawn_limits",&err);
+  if (!array) return;
+
+  for (i=0; array[i] != NULL; i++) {
+    event_name = (char*)str_tochar(array[i]);
+    if (!event_name) continue;
+
+    eventmask = str2event(event_name);
+    l = config_get_integer((wzd_configfile_t*)file, "spawn_limits", event_name, &err);
+    if (eventmask == 0 || err != CF_OK || l < 0) {
+      out_log(LEVEL_HIGH,"ERROR invalid entry [spawn_limits] : %s\n",event_name);
+      continue;
+    }
+    if (spawn_set_limit(eventmask, (unsigned int)l) != 0)
+      out_log(LEVEL_HIGH,"ERROR too many entries in [spawn_limits], ignoring %s\n",event_name);
+  }
+
+  str_deallocate_array(array);
+}
+
 static void _cfg_parse_custom_commands(const wzd_configfile_t * file, wzd_config_t * config)
 {
   wzd_string_t ** array;
@@ -41,4 +41,48 @@ void cfg_free(wzd_config_t * cfg);
  */
 wzd_config_t * cfg_store(wzd_configfile_t * file, int * error);
 
+/** \brief Settings used on hot paths
+ *
+ * Values are parsed once, when the config is loaded or reloaded, and read
+ * without locks using config_snapshot_acquire().
+ */
+typedef struct wzd_config_snapshot_t {
+  volatile long refcount;
+
+  int auto_crc;			/**< "auto crc" */
+  int client_tick;		/**< "client tick", in seconds */
+  char * tls_cipher_list;	/**< "tls_cipher_list" */
+  unsigned int pasv_pool_size;	/**< "pasv_pool_size" */
+  int log_overflow;		/**< "log_overflow", applied by config_snapshot_publish() */
+} wzd_config_snapshot_t;
+
+/** \brief Read settings used on hot paths from \a file
+ * \return a new snapshot, with a refcount of 1
+ */
+wzd_config_snapshot_t * config_snapshot_build(const wzd_configfile_t * file);
+
+/** \brief Get current snapshot
+ *
+ * This function never blocks. The snapshot must be released using
+ * config_snapshot_release().
+ */
+const wzd_config_snapshot_t * config_snapshot_acquire(void);
+
+/** \brief Release snapshot returned by config_snapshot_acquire() */
+void config_snapshot_release(const wzd_config_snapshot_t * snapshot);
+
+/** \brief Replace current snapshot by \a snapshot
+ *
+ * Threads using the previous snapshot keep it until they release it.
+ */
+void config_snapshot_publish(wzd_config_snapshot_t * snapshot);
+
+/** \brief Read \a filename again, and publish a new snapshot
+ *
+ * Only settings stored in the snapshot are changed, sessions are not
+ * interrupted.
+ * \return 0 if ok
+ */
+int config_snapshot_reload(const char * filename);
+
 #endif /* __WZD_CONFIGLOADER__ */
@@ -0,0 +1,1861 @@
+/* vi:ai:et:ts=8 sw=2
+ */
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+/** \file wzd_cookie.c
+ * \brief Cookie parser
+ *
+ * Templates are compiled once into a list of operations (static text, end of
+ * line, cookie, loop, condition, include) and kept in a cache: strings are
+ * indexed by content, files by name and checked for modifications.
+ *
+ * Rendering a template only uses local state, so several threads can render
+ * templates at the same time. The cache lock is held only to find or insert
+ * a template.
+ */
+
+#include "wzd_all.h"
+
+#ifndef WZD_USE_PCH
+
+#if defined(WIN32)
+#include <winsock2.h>
+#ifdef __CYGWIN__
+#include <w32api/ws2tcpip.h>
+#endif
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif /* WIN32 */
+
+#ifdef HAVE_LIMITS_H
+# include <limits.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+
+#include "wzd_structs.h"
+#include "wzd_log.h"
+#include "wzd_misc.h"
+
+#include "wzd_backend.h"
+#include "wzd_cache.h"
+#include "wzd_cookie.h"
+#include "wzd_crc32.h"
+#include "wzd_fs.h"
+#include "wzd_group.h"
+#include "wzd_messages.h"
+#include "wzd_section.h"
+#include "wzd_user.h"
+#include "wzd_vfs.h"
+
+#include "wzd_debug.h"
+#include "wzd_libmain.h"
+
+#endif /* WZD_USE_PCH */
+
+typedef enum {
+  COOKIE_NOCOL=1,
+  COOKIE_BLACK,
+  COOKIE_RED,
+  COOKIE_GREEN,
+  COOKIE_BROWN,
+  COOKIE_BLUE,
+  COOKIE_MAGENTA,
+  COOKIE_CYAN,
+  COOKIE_WHITE,
+
+  COOKIE_CONNECTED_MAX,
+  COOKIE_CONNECTED_USERS,
+
+  COOKIE_TOTAL_DL,
+  COOKIE_TOTAL_DL2,
+  COOKIE_TOTAL_UL,
+  COOKIE_TOTAL_UL2,
+
+  COOKIE_FILECRC,
+  COOKIE_FILEPATH,
+
+  COOKIE_GROUPHOME,
+  COOKIE_GROUPID,
+  COOKIE_GROUPIP_ALLOW,
+  COOKIE_GROUPMAXDL,
+  COOKIE_GROUPMAXIDLE,
+  COOKIE_GROUPMAXUL,
+  COOKIE_GROUPNAME,
+  COOKIE_GROUPFLAGS,
+  COOKIE_GROUPNUM_LOGINS,
+  COOKIE_GROUPRATIO,
+  COOKIE_GROUPTAG,
+  COOKIE_GROUPTOTAL_DL,
+  COOKIE_GROUPTOTAL_DL2,
+  COOKIE_GROUPTOTAL_UL,
+  COOKIE_GROUPTOTAL_UL2,
+
+  COOKIE_LASTFILECRC,
+  COOKIE_LASTFILENAME,
+  COOKIE_LASTFILESIZE,
+  COOKIE_LASTFILESPEED,
+  COOKIE_LASTFILETIME,
+
+  COOKIE_MSG,
+
+  COOKIE_SECTIONNAME,
+
+  COOKIE_SPACEFREE,
+  COOKIE_SPACETOTAL,
+
+  COOKIE_USERCREDITS,
+  COOKIE_USERCREDITS2,
+  COOKIE_USERFILES_DL,
+  COOKIE_USERFILES_UL,
+  COOKIE_USERFLAGS,
+  COOKIE_USERGROUP,
+  COOKIE_USERGROUPS,
+  COOKIE_USERHOME,
+  COOKIE_USERID,
+  COOKIE_USERCREATOR,
+  COOKIE_USERIP,
+  COOKIE_USERIP_ALLOW,
+  COOKIE_USERLASTCMD,
+  COOKIE_USERLAST_LOGIN,
+  COOKIE_USERLEECHSLOTS,
+  COOKIE_USERMAXDL,
+  COOKIE_USERMAXIDLE,
+  COOKIE_USERMAXUL,
+  COOKIE_USERNAME,
+  COOKIE_USERNUM_LOGINS,
+  COOKIE_USERLOGINS_PER_IP,
+  COOKIE_USERPATH,
+  COOKIE_USERPID,
+  COOKIE_USERPWD,
+  COOKIE_USERRATIO,
+  COOKIE_USERSLOTS,
+  COOKIE_USERSPEED,
+  COOKIE_USERTAG,
+  COOKIE_USERTIME,
+  COOKIE_USERTOTAL_DL,
+  COOKIE_USERTOTAL_DL2,
+  COOKIE_USERTOTAL_UL,
+  COOKIE_USERTOTAL_UL2,
+
+  COOKIE_VFSVIRTUAL,
+  COOKIE_VFSPHYSICAL,
+  COOKIE_VFSTARGET,
+
+  COOKIE_INCLUDE,
+} sc_cookie_t;
+
+/* keyword can be prefixed by a field width: %10.username */
+#define COOKIE_KW_PADDING	0x01
+/* keyword must be followed by a number: %userip_allow2 */
+#define COOKIE_KW_INDEX		0x02
+
+struct cookie_keyword_t {
+  const char * name;
+  unsigned short cookie;
+  unsigned short flags;
+};
+
+static const struct cookie_keyword_t cookie_keywords[] = {
+  { "!0", COOKIE_NOCOL, 0 },
+  { "!black", COOKIE_BLACK, 0 },
+  { "!red", COOKIE_RED, 0 },
+  { "!green", COOKIE_GREEN, 0 },
+  { "!brown", COOKIE_BROWN, 0 },
+  { "!blue", COOKIE_BLUE, 0 },
+  { "!magenta", COOKIE_MAGENTA, 0 },
+  { "!cyan", COOKIE_CYAN, 0 },
+  { "!white", COOKIE_WHITE, 0 },
+
+  { "bwtotal_dl2", COOKIE_TOTAL_DL2, COOKIE_KW_PADDING },
+  { "bwtotal_dl", COOKIE_TOTAL_DL, COOKIE_KW_PADDING },
+  { "bwtotal_ul2", COOKIE_TOTAL_UL2, COOKIE_KW_PADDING },
+  { "bwtotal_ul", COOKIE_TOTAL_UL, COOKIE_KW_PADDING },
+
+  { "connected_maxusers", COOKIE_CONNECTED_MAX, COOKIE_KW_PADDING },
+  { "connected_users", COOKIE_CONNECTED_USERS, COOKIE_KW_PADDING },
+
+  { "filecrc", COOKIE_FILECRC, COOKIE_KW_PADDING },
+  { "filepath", COOKIE_FILEPATH, COOKIE_KW_PADDING },
+
+  { "grouphome", COOKIE_GROUPHOME, COOKIE_KW_PADDING },
+  { "groupid", COOKIE_GROUPID, COOKIE_KW_PADDING },
+  { "groupip_allow", COOKIE_GROUPIP_ALLOW, COOKIE_KW_PADDING | COOKIE_KW_INDEX },
+  { "groupmaxdl", COOKIE_GROUPMAXDL, COOKIE_KW_PADDING },
+  { "groupmaxidle", COOKIE_GROUPMAXIDLE, COOKIE_KW_PADDING },
+  { "groupmaxul", COOKIE_GROUPMAXUL, COOKIE_KW_PADDING },
+  { "groupname", COOKIE_GROUPNAME, COOKIE_KW_PADDING },
+  { "groupflags", COOKIE_GROUPFLAGS, COOKIE_KW_PADDING },
+  { "groupnum_logins", COOKIE_GROUPNUM_LOGINS, COOKIE_KW_PADDING },
+  { "groupratio", COOKIE_GROUPRATIO, COOKIE_KW_PADDING },
+  { "grouptag", COOKIE_GROUPTAG, COOKIE_KW_PADDING },
+  { "grouptotal_dl2", COOKIE_GROUPTOTAL_DL2, COOKIE_KW_PADDING },
+  { "grouptotal_dl", COOKIE_GROUPTOTAL_DL, COOKIE_KW_PADDING },
+  { "grouptotal_ul2", COOKIE_GROUPTOTAL_UL2, COOKIE_KW_PADDING },
+  { "grouptotal_ul", COOKIE_GROUPTOTAL_UL, COOKIE_KW_PADDING },
+
+  { "lastfilecrc", COOKIE_LASTFILECRC, COOKIE_KW_PADDING },
+  { "lastfilename", COOKIE_LASTFILENAME, COOKIE_KW_PADDING },
+  { "lastfilesize", COOKIE_LASTFILESIZE, COOKIE_KW_PADDING },
+  { "lastfilespeed", COOKIE_LASTFILESPEED, COOKIE_KW_PADDING },
+  { "lastfiletime", COOKIE_LASTFILETIME, COOKIE_KW_PADDING },
+
+  { "msg", COOKIE_MSG, 0 },
+
+  { "sectionname", COOKIE_SECTIONNAME, 0 },
+  { "spacefree", COOKIE_SPACEFREE, 0 },
+  { "spacetotal", COOKIE_SPACETOTAL, 0 },
+
+  { "usercredits2", COOKIE_USERCREDITS2, COOKIE_KW_PADDING },
+  { "usercredits", COOKIE_USERCREDITS, COOKIE_KW_PADDING },
+  { "userfiles_dl", COOKIE_USERFILES_DL, COOKIE_KW_PADDING },
+  { "userfiles_ul", COOKIE_USERFILES_UL, COOKIE_KW_PADDING },
+  { "userflags", COOKIE_USERFLAGS, COOKIE_KW_PADDING },
+  { "usergroups", COOKIE_USERGROUPS, COOKIE_KW_PADDING },
+  { "usergroup", COOKIE_USERGROUP, COOKIE_KW_PADDING },
+  { "userhome", COOKIE_USERHOME, COOKIE_KW_PADDING },
+  { "userid", COOKIE_USERID, COOKIE_KW_PADDING },
+  { "usercreator", COOKIE_USERCREATOR, COOKIE_KW_PADDING },
+  { "userip_allow", COOKIE_USERIP_ALLOW, COOKIE_KW_PADDING | COOKIE_KW_INDEX },
+  { "userip", COOKIE_USERIP, COOKIE_KW_PADDING },
+  { "userlastcmd", COOKIE_USERLASTCMD, COOKIE_KW_PADDING },
+  { "userlast_login", COOKIE_USERLAST_LOGIN, COOKIE_KW_PADDING },
+  { "userleechslots", COOKIE_USERLEECHSLOTS, COOKIE_KW_PADDING },
+  { "usermaxdl", COOKIE_USERMAXDL, COOKIE_KW_PADDING },
+  { "usermaxidle", COOKIE_USERMAXIDLE, COOKIE_KW_PADDING },
+  { "usermaxul", COOKIE_USERMAXUL, COOKIE_KW_PADDING },
+  { "username", COOKIE_USERNAME, COOKIE_KW_PADDING },
+  { "usernum_logins", COOKIE_USERNUM_LOGINS, COOKIE_KW_PADDING },
+  { "userlogins_per_ip", COOKIE_USERLOGINS_PER_IP, COOKIE_KW_PADDING },
+  { "userpath", COOKIE_USERPATH, COOKIE_KW_PADDING },
+  { "userpid", COOKIE_USERPID, COOKIE_KW_PADDING },
+  { "userpwd", COOKIE_USERPWD, COOKIE_KW_PADDING },
+  { "userratio", COOKIE_USERRATIO, COOKIE_KW_PADDING },
+  { "userslots", COOKIE_USERSLOTS, COOKIE_KW_PADDING },
+  { "userspeed", COOKIE_USERSPEED, COOKIE_KW_PADDING },
+  { "usertag", COOKIE_USERTAG, COOKIE_KW_PADDING },
+  { "usertime", COOKIE_USERTIME, COOKIE_KW_PADDING },
+  { "usertotal_dl2", COOKIE_USERTOTAL_DL2, COOKIE_KW_PADDING },
+  { "usertotal_dl", COOKIE_USERTOTAL_DL, COOKIE_KW_PADDING },
+  { "usertotal_ul2", COOKIE_USERTOTAL_UL2, COOKIE_KW_PADDING },
+  { "usertotal_ul", COOKIE_USERTOTAL_UL, COOKIE_KW_PADDING },
+
+  { "vfsvirtual", COOKIE_VFSVIRTUAL, COOKIE_KW_PADDING },
+  { "vfsphysical", COOKIE_VFSPHYSICAL, COOKIE_KW_PADDING },
+  { "vfstarget", COOKIE_VFSTARGET, COOKIE_KW_PADDING },
+
+  { "include", COOKIE_INCLUDE, 0 },
+
+  { NULL, 0, 0 },
+};
+
+typedef enum {
+  COOKIE_OP_TEXT=0,
+  COOKIE_OP_EOL,
+  COOKIE_OP_COOKIE,
+  COOKIE_OP_FOR,
+  COOKIE_OP_IF,
+  COOKIE_OP_INCLUDE,
+} cookie_op_type_t;
+
+typedef enum {
+  COOKIE_FOR_UNKNOWN=0,
+  COOKIE_FOR_ALLUSERSCONNECTED,
+  COOKIE_FOR_ALLUSERS,
+  COOKIE_FOR_ALLGROUPS,
+  COOKIE_FOR_ALLGROUPMEMBERS,
+  COOKIE_FOR_ALLVFS,
+} cookie_for_t;
+
+/** \brief Compiled template operation
+ *
+ * Body of loops and conditions is stored just after the operation, and
+ * \a arg is the number of operations of the body.
+ */
+struct cookie_op_t {
+  unsigned char type;     /**< cookie_op_type_t */
+  unsigned char extra;    /**< FOR: cookie_for_t, IF: user flag (0 if condition is never true) */
+  unsigned short cookie;  /**< COOKIE: sc_cookie_t */
+  unsigned short padding; /**< COOKIE: field width, 0 if not set */
+  unsigned short index;   /**< COOKIE: index of ip_allow cookies */
+  unsigned int arg;       /**< TEXT/INCLUDE: offset in text, FOR/IF: size of body */
+  unsigned int length;    /**< TEXT/INCLUDE: length of text */
+};
+
+struct wzd_cookie_template_t {
+  struct cookie_op_t * ops;
+  unsigned int ops_count;
+  char * text;
+
+  /* cache */
+  char * key;             /**< file name, or template text */
+  int is_file;
+  unsigned long key_hash;
+  time_t mtime;
+  u64_t size;
+  unsigned int refcount;
+  int in_cache;
+  unsigned long last_use;
+  struct wzd_cookie_template_t * next_template;
+};
+
+/* this var defines a 'prefered' minimal buffer size before sending */
+#define MIN_SEND_BUFFERSIZE	500
+#define MAX_SEND_BUFFERSIZE	4096
+
+#define MAX_LOOP_DEPTH	10
+#define MAX_INCLUDE_DEPTH 10
+
+#define IBUFSIZE	4096
+
+/* maximum field width */
+#define MAX_PADDING	(IBUFSIZE-1)
+
+#define COOKIE_CACHE_BUCKETS	64
+#define COOKIE_CACHE_MAX	256
+/* longer strings are compiled at each use, they are not likely to be re-used */
+#define COOKIE_CACHE_TEXT_MAX	HARD_MSG_LENGTH_MAX
+
+static struct wzd_cookie_template_t * _cookie_cache[COOKIE_CACHE_BUCKETS];
+static unsigned int _cookie_cache_count = 0;
+static unsigned long _cookie_cache_clock = 0;
+
+/** \brief State of template rendering, one per call */
+struct cookie_render_t {
+  wzd_context_t * real_context; /**< context of the calling thread */
+  wzd_user_t * me;              /**< user of the calling thread */
+  unsigned short use_colors;
+
+  wzd_user_t * user;
+  wzd_group_t * group;
+  wzd_context_t * context;
+  wzd_vfs_t * vfs;
+
+  char * out_buffer;
+  unsigned int out_buffer_len;
+  unsigned int out_length;
+
+  char send_buffer[MAX_SEND_BUFFERSIZE];
+  unsigned int send_length;
+
+  unsigned long written;        /**< total number of bytes written */
+  char last[2];                 /**< last bytes written */
+  unsigned int depth;           /**< include depth */
+};
+
+static void _cookie_render_ops(struct cookie_render_t * st, const wzd_cookie_template_t * tpl, unsigned int start, unsigned int end);
+
+/************ COMPILER **************/
+
+struct cookie_compiler_t {
+  wzd_cookie_template_t * tpl;
+  unsigned int ops_size;
+  unsigned int text_length;
+  unsigned int stack[MAX_LOOP_DEPTH];
+  unsigned int stack_ptr;
+};
+
+static struct cookie_op_t * _cookie_add_op(struct cookie_compiler_t * cc, cookie_op_type_t type)
+{
+  struct cookie_op_t * op;
+
+  if (cc->tpl->ops_count >= cc->ops_size) {
+    cc->ops_size = (cc->ops_size) ? cc->ops_size * 2 : 16;
+    cc->tpl->ops = wzd_realloc(cc->tpl->ops, cc->ops_size * sizeof(struct cookie_op_t));
+  }
+  op = &cc->tpl->ops[cc->tpl->ops_count++];
+  memset(op,0,sizeof(struct cookie_op_t));
+  op->type = type;
+
+  return op;
+}
+
+/** \brief Append static text, merged with previous text if possible */
+static void _cookie_add_text(struct cookie_compiler_t * cc, const char * text, unsigned int length)
+{
+  struct cookie_op_t * op = NULL;
+
+  if (length == 0) return;
+
+  if (cc->tpl->ops_count > 0) {
+    op = &cc->tpl->ops[cc->tpl->ops_count-1];
+    if (op->type != COOKIE_OP_TEXT || op->arg + op->length != cc->text_length)
+      op = NULL;
+  }
+  if (!op) {
+    op = _cookie_add_op(cc, COOKIE_OP_TEXT);
+    op->arg = cc->text_length;
+  }
+
+  memcpy(cc->tpl->text + cc->text_length, text, length);
+  cc->text_length += length;
+  op->length += length;
+}
+
+/** \brief Match end of line: CR* LF */
+static unsigned int _cookie_match_nl(const char * p)
+{
+  const char * start = p;
+
+  while (*p == '\r') p++;
+  if (*p != '\n') return 0;
+
+  return (unsigned int)(p - start + 1);
+}
+
+/** \brief Match \a keyword, followed by (LETTERS) if \a name is not NULL, and end of line
+ *
+ * \return the length of the match, or 0
+ */
+static unsigned int _cookie_match_directive(const char * p, const char * keyword, const char ** name, unsigned int * name_length)
+{
+  unsigned int length, nl;
+
+  length = strlen(keyword);
+  if (strncmp(p, keyword, length) != 0) return 0;
+
+  if (name) {
+    *name = p + length;
+    if (p[length] == '+' || p[length] == '=') length++;
+    if (!isalpha((unsigned char)p[length])) return 0;
+    while (isalpha((unsigned char)p[length])) length++;
+    if (p[length] != ')') return 0;
+    *name_length = (unsigned int)(p + length - *name);
+    length++;
+  }
+
+  nl = _cookie_match_nl(p + length);
+  if (nl == 0) return 0;
+
+  return length + nl;
+}
+
+/** \brief Find longest keyword matching cookie starting at \a p (after '%')
+ *
+ * \return the length of the cookie, or 0 if no keyword matches
+ */
+static unsigned int _cookie_match_keyword(const char * p, struct cookie_op_t * op)
+{
+  const struct cookie_keyword_t * kw;
+  const char * start = p;
+  unsigned long padding = 0, index;
+  unsigned int best = 0, length;
+  int has_padding = 0;
+  char * ptr;
+
+  if (isdigit((unsigned char)*p)) {
+    padding = strtoul(p, &ptr, 10);
+    if (*ptr != '.') return 0;
+    p = ptr + 1;
+    has_padding = 1;
+  }
+
+  for (kw = cookie_keywords; kw->name; kw++) {
+    if (has_padding && !(kw->flags & COOKIE_KW_PADDING)) continue;
+
+    length = strlen(kw->name);
+    if (strncmp(p, kw->name, length) != 0) continue;
+
+    index = 0;
+    if (kw->flags & COOKIE_KW_INDEX) {
+      if (!isdigit((unsigned char)p[length])) continue;
+      index = strtoul(p + length, &ptr, 10);
+      length = (unsigned int)(ptr - p);
+    }
+
+    if (length > best) {
+      best = length;
+      op->cookie = kw->cookie;
+      op->index = (index < 0xffff) ? (unsigned short)index : 0xffff;
+    }
+  }
+
+  if (best == 0) return 0;
+
+  /* FIXME hardcoded limit */
+  op->padding = (padding <= 5000) ? (unsigned short)padding : 0;
+  if (op->padding > MAX_PADDING) op->padding = MAX_PADDING;
+
+  return (unsigned int)(p - start) + best;
+}
+
+static int _cookie_compile(struct cookie_compiler_t * cc, const char * text)
+{
+  const char * p = text;
+  const char * name;
+  unsigned int length, name_length;
+  struct cookie_op_t * op, tmp;
+
+  while (*p) {
+    if (*p == '\r') { /* ignore */
+      p++;
+      continue;
+    }
+    if (*p == '\n') {
+      _cookie_add_op(cc, COOKIE_OP_EOL);
+      p++;
+      continue;
+    }
+    if (*p != '%') {
+      length = strcspn(p, "%\r\n");
+      _cookie_add_text(cc, p, length);
+      p += length;
+      continue;
+    }
+
+    /* loops and conditions */
+    if ( (length = _cookie_match_directive(p, "%for(", &name, &name_length)) ) {
+      if (cc->stack_ptr >= MAX_LOOP_DEPTH) {
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH, "Loops nested too deeply\n" );
+#endif
+        return 1;
+      }
+      op = _cookie_add_op(cc, COOKIE_OP_FOR);
+      if (name_length == 17 && strncmp(name,"allusersconnected",17)==0)
+        op->extra = COOKIE_FOR_ALLUSERSCONNECTED;
+      else if (name_length == 8 && strncmp(name,"allusers",8)==0)
+        op->extra = COOKIE_FOR_ALLUSERS;
+      else if (name_length == 9 && strncmp(name,"allgroups",9)==0)
+        op->extra = COOKIE_FOR_ALLGROUPS;
+      else if (name_length == 15 && strncmp(name,"allgroupmembers",15)==0)
+        op->extra = COOKIE_FOR_ALLGROUPMEMBERS;
+      else if (name_length == 6 && strncmp(name,"allvfs",6)==0)
+        op->extra = COOKIE_FOR_ALLVFS;
+      else
+        op->extra = COOKIE_FOR_UNKNOWN;
+      cc->stack[cc->stack_ptr++] = cc->tpl->ops_count - 1;
+      p += length;
+      continue;
+    }
+    if ( (length = _cookie_match_directive(p, "%if(", &name, &name_length)) ) {
+      if (cc->stack_ptr >= MAX_LOOP_DEPTH) {
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH, "Loops nested too deeply\n" );
+#endif
+        return 1;
+      }
+      op = _cookie_add_op(cc, COOKIE_OP_IF);
+      /* TODO XXX FIXME only user flags are supported: %if(+F) */
+      op->extra = (name[0] == '+') ? name[1] : 0;
+      cc->stack[cc->stack_ptr++] = cc->tpl->ops_count - 1;
+      p += length;
+      continue;
+    }
+    if ( (length = _cookie_match_directive(p, "%endfor", NULL, NULL)) ||
+        (length = _cookie_match_directive(p, "%endif", NULL, NULL)) ) {
+      cookie_op_type_t type = (p[4] == 'f') ? COOKIE_OP_FOR : COOKIE_OP_IF;
+      p += length;
+      if (cc->stack_ptr == 0) { /* ignore */
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH,"end of block outside a for/if block");
+#endif
+        continue;
+      }
+      op = &cc->tpl->ops[cc->stack[--cc->stack_ptr]];
+      if (op->type != type) {
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH, "Unexpected end of block\n" );
+#endif
+        return 1;
+      }
+      op->arg = cc->tpl->ops_count - cc->stack[cc->stack_ptr] - 1;
+      continue;
+    }
+
+    /* cookies */
+    p++;
+    if (*p == '%') {
+      _cookie_add_text(cc, "%", 1);
+      p++;
+      continue;
+    }
+    memset(&tmp,0,sizeof(tmp));
+    length = _cookie_match_keyword(p, &tmp);
+    if (length == 0) {
+      /* invalid cookie (e.g This can be an explicit %s), keep it */
+      length = (*p != '\0' && *p != '\n') ? 1 : 0;
+      _cookie_add_text(cc, p-1, length+1);
+      p += length;
+      continue;
+    }
+    p += length;
+
+    if (tmp.cookie == COOKIE_INCLUDE) {
+      if (*p != '(') {
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH, "invalid 'include' directive\n");
+#endif
+        continue;
+      }
+      p++;
+      length = strcspn(p, ")\r\n");
+      if (p[length] != ')') {
+#ifdef WZD_DBG_COOKIES
+        out_err(LEVEL_HIGH, "invalid 'include' directive\n");
+#endif
+        p += length;
+        continue;
+      }
+      op = _cookie_add_op(cc, COOKIE_OP_INCLUDE);
+      op->arg = cc->text_length;
+      op->length = length;
+      memcpy(cc->tpl->text + cc->text_length, p, length);
+      cc->text_length += length;
+      cc->tpl->text[cc->text_length++] = '\0';
+      p += length + 1;
+      continue;
+    }
+
+    op = _cookie_add_op(cc, COOKIE_OP_COOKIE);
+    op->cookie = tmp.cookie;
+    op->padding = tmp.padding;
+    op->index = tmp.index;
+  }
+
+  if (cc->stack_ptr) {
+#ifdef WZD_DBG_COOKIES
+    out_err(LEVEL_HIGH, "unterminated for/if block\n" );
+#endif
+    return 1;
+  }
+
+  return 0;
+}
+
+static void _cookie_template_free(wzd_cookie_template_t * tpl)
+{
+  if (!tpl) return;
+  wzd_free(tpl->ops);
+  wzd_free(tpl->text);
+  wzd_free(tpl->key);
+  wzd_free(tpl);
+}
+
+/** \brief Compile \a text into a new template
+ * \return a template, or NULL if \a text is invalid
+ */
+static wzd_cookie_template_t * _cookie_template_new(const char * text)
+{
+  struct cookie_compiler_t cc;
+  wzd_cookie_template_t * tpl;
+
+  tpl = wzd_malloc(sizeof(wzd_cookie_template_t));
+  memset(tpl,0,sizeof(wzd_cookie_template_t));
+  /* text can only shrink */
+  tpl->text = wzd_malloc(strlen(text)+1);
+
+  memset(&cc,0,sizeof(cc));
+  cc.tpl = tpl;
+
+  if (_cookie_compile(&cc, text)) {
+    _cookie_template_free(tpl);
+    return NULL;
+  }
+
+  return tpl;
+}
+
+/************ CACHE **************/
+
+/** \brief Find entry in cache
+ * \note SET_MUTEX_COOKIE_PARSER must be locked
+ */
+static wzd_cookie_template_t * _cookie_cache_find(const char * key, int is_file, unsigned long hash)
+{
+  wzd_cookie_template_t * tpl;
+
+  for (tpl = _cookie_cache[hash % COOKIE_CACHE_BUCKETS]; tpl; tpl = tpl->next_template) {
+    if (tpl->key_hash == hash && tpl->is_file == is_file && strcmp(tpl->key,key)==0)
+      return tpl;
+  }
+
+  return NULL;
+}
+
+/** \brief Remove entry from cache, and free it if it is not used
+ * \note SET_MUTEX_COOKIE_PARSER must be locked
+ */
+static void _cookie_cache_remove(wzd_cookie_template_t * tpl)
+{
+  wzd_cookie_template_t ** it;
+
+  for (it = &_cookie_cache[tpl->key_hash % COOKIE_CACHE_BUCKETS]; *it; it = &(*it)->next_template) {
+    if (*it == tpl) {
+      *it = tpl->next_template;
+      break;
+    }
+  }
+
+  tpl->next_template = NULL;
+  tpl->in_cache = 0;
+  _cookie_cache_count--;
+
+  if (tpl->refcount == 0)
+    _cookie_template_free(tpl);
+}
+
+/** \brief Insert entry in cache, replacing the previous one with the same key
+ * \note SET_MUTEX_COOKIE_PARSER must be locked
+ */
+static void _cookie_cache_insert(wzd_cookie_template_t * tpl)
+{
+  wzd_cookie_template_t * old, * oldest;
+  unsigned int i;
+
+  old = _cookie_cache_find(tpl->key, tpl->is_file, tpl->key_hash);
+  if (old) _cookie_cache_remove(old);
+
+  if (_cookie_cache_count >= COOKIE_CACHE_MAX) {
+    /* remove least recently used entry */
+    oldest = NULL;
+    for (i=0; i<COOKIE_CACHE_BUCKETS; i++) {
+      for (old = _cookie_cache[i]; old; old = old->next_template) {
+        if (!oldest || old->last_use < oldest->last_use)
+          oldest = old;
+      }
+    }
+    if (oldest) _cookie_cache_remove(oldest);
+  }
+
+  tpl->in_cache = 1;
+  tpl->last_use = ++_cookie_cache_clock;
+  tpl->next_template = _cookie_cache[tpl->key_hash % COOKIE_CACHE_BUCKETS];
+  _cookie_cache[tpl->key_hash % COOKIE_CACHE_BUCKETS] = tpl;
+  _cookie_cache_count++;
+}
+
+wzd_cookie_template_t * cookie_template_acquire(const char * text)
+{
+  wzd_cookie_template_t * tpl;
+  unsigned long hash;
+  size_t length;
+
+  if (!text) return NULL;
+
+  length = strlen(text);
+  if (length > COOKIE_CACHE_TEXT_MAX) {
+    tpl = _cookie_template_new(text);
+    if (tpl) tpl->refcount = 1;
+    return tpl;
+  }
+
+  hash = compute_hashval(text,length);
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  tpl = _cookie_cache_find(text,0,hash);
+  if (tpl) {
+    /* HIT */
+    tpl->refcount++;
+    tpl->last_use = ++_cookie_cache_clock;
+    WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+    return tpl;
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+
+  /* MISS: compile without holding the lock */
+  tpl = _cookie_template_new(text);
+  if (!tpl) return NULL;
+
+  tpl->key = wzd_strdup(text);
+  tpl->key_hash = hash;
+  tpl->is_file = 0;
+  tpl->refcount = 1;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  _cookie_cache_insert(tpl);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+
+  return tpl;
+}
+
+wzd_cookie_template_t * cookie_template_acquire_file(const char * filename)
+{
+  wzd_cookie_template_t * tpl;
+  fs_filestat_t s;
+  unsigned long hash;
+  char * file_buffer;
+  size_t size;
+
+  if (!filename) return NULL;
+
+  hash = compute_hashval(filename,strlen(filename));
+
+  if (fs_file_stat(filename,&s)) {
+    /* file was removed */
+    WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+    tpl = _cookie_cache_find(filename,1,hash);
+    if (tpl) _cookie_cache_remove(tpl);
+    WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+    return NULL;
+  }
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  tpl = _cookie_cache_find(filename,1,hash);
+  if (tpl && tpl->mtime == s.mtime && tpl->size == s.size) {
+    /* HIT */
+    tpl->refcount++;
+    tpl->last_use = ++_cookie_cache_clock;
+    WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+    return tpl;
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+
+  /* MISS: read and compile file without holding the lock */
+  if (wzd_cache_read_file_fast(filename, &file_buffer, &size))
+    return NULL;
+
+  tpl = _cookie_template_new(file_buffer);
+  wzd_free(file_buffer);
+  if (!tpl) return NULL;
+
+  tpl->key = wzd_strdup(filename);
+  tpl->key_hash = hash;
+  tpl->is_file = 1;
+  tpl->mtime = s.mtime;
+  tpl->size = s.size;
+  tpl->refcount = 1;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  _cookie_cache_insert(tpl);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+
+  return tpl;
+}
+
+void cookie_template_release(wzd_cookie_template_t * tpl)
+{
+  int must_free;
+
+  if (!tpl) return;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  tpl->refcount--;
+  must_free = (tpl->refcount == 0 && !tpl->in_cache);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+
+  if (must_free) _cookie_template_free(tpl);
+}
+
+void cookie_cache_purge(void)
+{
+  wzd_cookie_template_t * tpl;
+  unsigned int i;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_COOKIE_PARSER);
+  for (i=0; i<COOKIE_CACHE_BUCKETS; i++) {
+    while ( (tpl = _cookie_cache[i]) )
+      _cookie_cache_remove(tpl);
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_COOKIE_PARSER);
+}
+
+/************ RENDERER **************/
+
+static void _cookie_flush(struct cookie_render_t * st)
+{
+  if (st->out_buffer || st->send_length == 0) return;
+
+  st->send_buffer[st->send_length] = '\0';
+  if (st->real_context)
+    send_message_raw(st->send_buffer,st->real_context);
+  st->send_length = 0;
+}
+
+static void _cookie_write(struct cookie_render_t * st, const char * data, unsigned int length)
+{
+  unsigned int l;
+
+  if (length == 0) return;
+
+  st->written += length;
+  if (length >= 2) {
+    st->last[0] = data[length-2];
+    st->last[1] = data[length-1];
+  } else {
+    st->last[0] = st->last[1];
+    st->last[1] = data[0];
+  }
+
+  if (st->out_buffer) {
+    if (st->out_length + 1 >= st->out_buffer_len) {
+#ifdef WZD_DBG_COOKIES
+      out_err(LEVEL_HIGH,"buffer truncated !");
+#endif
+      return;
+    }
+    l = st->out_buffer_len - st->out_length - 1;
+    if (length < l) l = length;
+    memcpy(st->out_buffer + st->out_length, data, l);
+    st->out_length += l;
+    st->out_buffer[st->out_length] = '\0';
+    return;
+  }
+
+  /* bufferize and send only complete lines, when possible */
+  while (length > 0) {
+    if (st->send_length + length >= MAX_SEND_BUFFERSIZE)
+      _cookie_flush(st);
+    l = MAX_SEND_BUFFERSIZE - st->send_length - 1;
+    if (length < l) l = length;
+    memcpy(st->send_buffer + st->send_length, data, l);
+    st->send_length += l;
+    data += l;
+    length -= l;
+  }
+}
+
+static void _cookie_eol(struct cookie_render_t * st)
+{
+  _cookie_write(st, "\r\n", 2);
+  if (st->send_length >= MIN_SEND_BUFFERSIZE)
+    _cookie_flush(st);
+}
+
+/** \brief Render operations, and terminate output by an end of line */
+static void _cookie_render_block(struct cookie_render_t * st, const wzd_cookie_template_t * tpl, unsigned int start, unsigned int end)
+{
+  unsigned long written = st->written;
+
+  _cookie_render_ops(st, tpl, start, end);
+
+  if (st->written > written && (st->last[0] != '\r' || st->last[1] != '\n'))
+    _cookie_write(st, "\r\n", 2);
+}
+
+static int _cookie_user_is_hidden(struct cookie_render_t * st, wzd_user_t * loop_user)
+{
+  if (!st->me) return 0;
+  /* do not hide to self ! */
+  if (strcmp(loop_user->username,st->me->username)==0) return 0;
+
+  /* check FLAG_HIDDEN, only siteops can see hidden users */
+  if (loop_user->flags && strchr(loop_user->flags,FLAG_HIDDEN)
+      && !(st->me->flags && strchr(st->me->flags,FLAG_SITEOP)))
+    return 1;
+  /* check if user is ultrahidden */
+  if (loop_user->flags && strchr(loop_user->flags,FLAG_ULTRAHIDDEN))
+    return 1;
+
+  return 0;
+}
+
+static void _cookie_render_for(struct cookie_render_t * st, const wzd_cookie_template_t * tpl, const struct cookie_op_t * op, unsigned int start, unsigned int end)
+{
+  wzd_user_t * user = st->user;
+  wzd_group_t * group = st->group;
+  wzd_context_t * context = st->context;
+  wzd_user_t * loop_user;
+  wzd_group_t * loop_group;
+  wzd_context_t * loop_context;
+  ListElmt * elmnt;
+  uid_t * uid_list;
+  gid_t * gid_list;
+  gid_t gid;
+  int i;
+
+  switch (op->extra) {
+  case COOKIE_FOR_ALLUSERSCONNECTED:
+    for (elmnt=list_head(context_list); elmnt!=NULL; elmnt=list_next(elmnt))
+    {
+      loop_context = list_data(elmnt);
+      if (loop_context->magic != CONTEXT_MAGIC) continue;
+      loop_user = GetUserByID(loop_context->userid);
+      if (loop_user && loop_user->username[0] != '\0' && _cookie_user_is_hidden(st,loop_user))
+        continue;
+      st->user = loop_user;
+      st->context = loop_context;
+      _cookie_render_block(st, tpl, start, end);
+    }
+    break;
+  case COOKIE_FOR_ALLUSERS:
+    uid_list = (uid_t*)backend_get_user(-2);
+    if (!uid_list) break;
+    for (i=0; uid_list[i] != (uid_t)-1; i++)
+    {
+      loop_user = GetUserByID(uid_list[i]);
+      if (!loop_user || loop_user->username[0] == '\0') continue;
+      /* check if user is ultrahidden */
+      if (loop_user->flags && strchr(loop_user->flags,FLAG_ULTRAHIDDEN)
+          && st->me && strcmp(loop_user->username,st->me->username)!=0)
+        continue;
+      st->user = loop_user;
+      _cookie_render_block(st, tpl, start, end);
+    }
+    wzd_free(uid_list);
+    break;
+  case COOKIE_FOR_ALLGROUPS:
+    gid_list = (gid_t*)backend_get_group(-2);
+    if (!gid_list) break;
+    for (i=0; gid_list[i] != (gid_t)-1; i++)
+    {
+      loop_group = GetGroupByID(gid_list[i]);
+      if (!loop_group || loop_group->groupname[0] == '\0') continue;
+      st->group = loop_group;
+      _cookie_render_block(st, tpl, start, end);
+    }
+    wzd_free(gid_list);
+    break;
+  case COOKIE_FOR_ALLGROUPMEMBERS:
+    if (!st->group) break;
+    uid_list = (uid_t*)backend_get_user(-2);
+    if (!uid_list) break;
+    gid = GetGroupIDByName(st->group->groupname);
+    for (i=0; uid_list[i] != (uid_t)-1; i++)
+    {
+      loop_user = GetUserByID(uid_list[i]);
+      if (!loop_user || loop_user->username[0] == '\0' || is_user_in_group(loop_user,gid)!=1) continue;
+      /* check if user is ultrahidden */
+      if (loop_user->flags && strchr(loop_user->flags,FLAG_ULTRAHIDDEN)
+          && st->me && strcmp(loop_user->username,st->me->username)!=0)
+        continue;
+      st->user = loop_user;
+      _cookie_render_block(st, tpl, start, end);
+    }
+    wzd_free(uid_list);
+    break;
+  case COOKIE_FOR_ALLVFS:
+    for (st->vfs = mainConfig->vfs; st->vfs; st->vfs = st->vfs->next_vfs)
+      _cookie_render_block(st, tpl, start, end);
+    break;
+  default:
+    break;
+  }
+
+  st->user = user;
+  st->group = group;
+  st->context = context;
+}
+
+static void _cookie_render_file(struct cookie_render_t * st, const char * filename, int terminate)
+{
+  wzd_cookie_template_t * tpl;
+
+  if (st->depth >= MAX_INCLUDE_DEPTH) {
+#ifdef WZD_DBG_COOKIES
+    out_err(LEVEL_HIGH, "Includes nested too deeply" );
+#endif
+    return;
+  }
+
+  tpl = cookie_template_acquire_file(filename);
+  if (!tpl) {
+#ifdef WZD_DBG_COOKIES
+    out_err(LEVEL_HIGH, "invalid 'include' directive (could not open file)\n");
+#endif
+    return;
+  }
+
+  st->depth++;
+  if (terminate)
+    _cookie_render_block(st, tpl, 0, tpl->ops_count);
+  else
+    _cookie_render_ops(st, tpl, 0, tpl->ops_count);
+  st->depth--;
+
+  cookie_template_release(tpl);
+}
+
+static void _cookie_format_bytes(char * buffer, u64_t total, int convert)
+{
+  float val;
+  char c;
+
+  if (convert) {
+#ifndef _MSC_VER
+    val = (float)total;
+#else
+    val = (float)(__int64)total;
+#endif
+    bytes_to_unit(&val,&c);
+    snprintf(buffer,IBUFSIZE,"%.2f %c",val,c);
+  } else
+    snprintf(buffer,IBUFSIZE,"%" PRIu64,total);
+}
+
+static u64_t _cookie_group_total(wzd_group_t * group, int is_upload)
+{
+  wzd_user_t * loop_user;
+  int * uid_list;
+  int gid, i;
+  u64_t total = 0;
+
+  /* iterate through users and sum */
+  gid = GetGroupIDByName(group->groupname);
+  uid_list = (int*)backend_get_user(-2);
+  if (uid_list) {
+    for (i=0; uid_list[i] >= 0; i++)
+    {
+      loop_user = GetUserByID(uid_list[i]);
+      if (!loop_user) continue;
+      if (is_user_in_group(loop_user,gid)==1)
+        total += (is_upload) ? loop_user->stats.bytes_ul_total : loop_user->stats.bytes_dl_total;
+    }
+    wzd_free(uid_list);
+  }
+
+  return total;
+}
+
+static void _cookie_format_ip_allow(char * buffer, struct wzd_ip_list_t * ip_list, unsigned int index, unsigned int max, const char * def, int valid)
+{
+  unsigned int i=0;
+
+  if (index >= max) {
+    snprintf(buffer,IBUFSIZE,"invalid index");
+    return;
+  }
+  if (!valid) {
+    snprintf(buffer,IBUFSIZE,"%s",def);
+    return;
+  }
+
+  while (i < index && ip_list != NULL) {
+    ip_list = ip_list->next_ip;
+    i++;
+  }
+  if (ip_list != NULL)
+    snprintf(buffer,IBUFSIZE,"%s",ip_list->regexp);
+  else
+    buffer[0] = '\0';
+}
+
+static void _cookie_format_space(struct cookie_render_t * st, char * buffer, int total)
+{
+  char dev_buffer[2048];
+  long l_type, l_bsize, l_blocks, l_free;
+  float f_blocks, f_free;
+  char unit_blocks, unit_free;
+
+  if (st->context == NULL || checkpath_new(".",dev_buffer,st->context) != 0) {
+    snprintf(buffer,IBUFSIZE,"Could not get current path");
+    return;
+  }
+
+  if (get_device_info(dev_buffer,&l_type, &l_bsize, &l_blocks, &l_free)) {
+    snprintf(buffer,IBUFSIZE,"unknown");
+    return;
+  }
+  f_blocks = l_blocks*(float)l_bsize;
+  f_free = l_free*(float)l_bsize;
+  bytes_to_unit(&f_blocks,&unit_blocks);
+  bytes_to_unit(&f_free,&unit_free);
+  if (total)
+    snprintf(buffer,IBUFSIZE,"%.2f %c",f_blocks,unit_blocks);
+  else
+    snprintf(buffer,IBUFSIZE,"%.2f %c",f_free,unit_free);
+}
+
+/** \brief Write value of a cookie */
+static void _cookie_render_cookie(struct cookie_render_t * st, const struct cookie_op_t * op)
+{
+  char internalbuffer[IBUFSIZE];
+  const char * color = NULL;
+  wzd_user_t * user = st->user;
+  wzd_group_t * group = st->group;
+  wzd_context_t * context = st->context;
+  wzd_section_t * section;
+  ListElmt * elmnt;
+  wzd_context_t * it;
+  unsigned int length, i;
+  float speed;
+  char c;
+
+  internalbuffer[0] = '\0';
+
+  switch (op->cookie) {
+  /* XXX This is a little dansgerous because we don't know if strings
+   * will be ok when used (although as address of constant data it should
+   * always be ok) but we like sport !
+   */
+  case COOKIE_NOCOL: color = "[0m"; break;
+  case COOKIE_BLACK: color = "[30m"; break;
+  case COOKIE_RED: color = "[31m"; break;
+  case COOKIE_GREEN: color = "[32m"; break;
+  case COOKIE_BROWN: color = "[33m"; break;
+  case COOKIE_BLUE: color = "[34m"; break;
+  case COOKIE_MAGENTA: color = "[35m"; break;
+  case COOKIE_CYAN: color = "[36m"; break;
+  case COOKIE_WHITE: color = "[37m"; break;
+/*** Bandwidth cookies ***/
+  case COOKIE_TOTAL_DL:
+  case COOKIE_TOTAL_DL2:
+  case COOKIE_TOTAL_UL:
+  case COOKIE_TOTAL_UL2:
+    /* iterate through users and sum */
+    speed = 0.f;
+    for (elmnt=list_head(context_list); elmnt!=NULL; elmnt=list_next(elmnt))
+    {
+      it = list_data(elmnt);
+      if (it->magic != CONTEXT_MAGIC) continue;
+      if (op->cookie == COOKIE_TOTAL_DL || op->cookie == COOKIE_TOTAL_DL2) {
+        if (it->current_action.token==TOK_RETR)
+          speed += it->current_dl_limiter.current_speed;
+      } else {
+        if ((it->current_action.token==TOK_STOR) ||
+            (it->current_action.token==TOK_APPE))
+          speed += it->current_ul_limiter.current_speed;
+      }
+    }
+    if (op->cookie == COOKIE_TOTAL_DL2 || op->cookie == COOKIE_TOTAL_UL2) {
+      bytes_to_unit(&speed,&c);
+      snprintf(internalbuffer,IBUFSIZE,"%.2f %c/s",speed,c);
+    } else
+      snprintf(internalbuffer,IBUFSIZE,"%.2f",speed);
+    break;
+/*** Connected users cookies ***/
+  case COOKIE_CONNECTED_MAX:
+    snprintf(internalbuffer,IBUFSIZE,"%d",mainConfig->max_threads);
+    break;
+  case COOKIE_CONNECTED_USERS:
+    i = 0;
+    for (elmnt=list_head(context_list); elmnt!=NULL; elmnt=list_next(elmnt))
+    {
+      it = list_data(elmnt);
+      if (it->magic == CONTEXT_MAGIC)
+        i++;
+    }
+    snprintf(internalbuffer,IBUFSIZE,"%u",i);
+    break;
+/*** FILE cookies ***/
+  case COOKIE_FILECRC:
+    if (context) {
+      unsigned long crc=0;
+      if ((context->current_action.token == TOK_RETR ||
+            context->current_action.token == TOK_STOR ||
+            context->current_action.token == TOK_APPE) &&
+          (!calc_crc32(context->current_action.arg,&crc,0,(unsigned long)-1)))
+        snprintf(internalbuffer,IBUFSIZE,"%lX",crc);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"0");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"filecrc");
+    break;
+  case COOKIE_FILEPATH:
+    if (context) {
+      switch (context->current_action.token) {
+      case TOK_RETR:
+      case TOK_STOR:
+      case TOK_APPE:
+      case TOK_MKD:
+      case TOK_DELE:
+        snprintf(internalbuffer,IBUFSIZE,"%s",context->current_action.arg);
+        break;
+      default:
+        snprintf(internalbuffer,IBUFSIZE,"(null)");
+      }
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"filepath");
+    break;
+/*** GROUP cookies ***/
+  case COOKIE_GROUPHOME:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%s",group->defaultpath);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"grouphome");
+    break;
+  case COOKIE_GROUPID:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%u",group->gid);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupid");
+    break;
+  case COOKIE_GROUPFLAGS:
+    if (group) {
+      if (group->flags && strlen(group->flags)>0)
+        snprintf(internalbuffer,IBUFSIZE,"%s",group->flags);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"no flags");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupflags");
+    break;
+  case COOKIE_GROUPIP_ALLOW:
+    _cookie_format_ip_allow(internalbuffer, (group) ? group->ip_list : NULL, op->index,
+        HARD_IP_PER_GROUP, "usergroup_allow", (group != NULL));
+    break;
+  case COOKIE_GROUPMAXDL:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%u",group->max_dl_speed);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupmaxdl");
+    break;
+  case COOKIE_GROUPMAXIDLE:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%u",group->max_idle_time);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupmaxidle");
+    break;
+  case COOKIE_GROUPMAXUL:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%u",group->max_ul_speed);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupmaxul");
+    break;
+  case COOKIE_GROUPNAME:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%s",group->groupname);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupname");
+    break;
+  case COOKIE_GROUPNUM_LOGINS:
+    if (group)
+      snprintf(internalbuffer,IBUFSIZE,"%d",group->num_logins);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupnum_logins");
+    break;
+  case COOKIE_GROUPRATIO:
+    if (group) {
+      if (group->ratio)
+        snprintf(internalbuffer,IBUFSIZE,"1:%u",group->ratio);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"unlimited");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"groupratio");
+    break;
+  case COOKIE_GROUPTAG:
+    if (group) {
+      if (strlen(group->tagline)>0)
+        snprintf(internalbuffer,IBUFSIZE,"%s",group->tagline);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"no tagline set");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"grouptag");
+    break;
+  case COOKIE_GROUPTOTAL_DL:
+  case COOKIE_GROUPTOTAL_DL2:
+    if (group)
+      _cookie_format_bytes(internalbuffer, _cookie_group_total(group,0), (op->cookie == COOKIE_GROUPTOTAL_DL2));
+    else
+      snprintf(internalbuffer,IBUFSIZE,"grouptotal_dl");
+    break;
+  case COOKIE_GROUPTOTAL_UL:
+  case COOKIE_GROUPTOTAL_UL2:
+    if (group)
+      _cookie_format_bytes(internalbuffer, _cookie_group_total(group,1), (op->cookie == COOKIE_GROUPTOTAL_UL2));
+    else
+      snprintf(internalbuffer,IBUFSIZE,"grouptotal_ul");
+    break;
+/*** LAST FILE cookies ***/
+  case COOKIE_LASTFILECRC:
+    if (context)
+      snprintf(internalbuffer,IBUFSIZE,"%08x",(context->last_file.name[0]!='\0')?context->last_file.crc:0);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"crc");
+    break;
+  case COOKIE_LASTFILENAME:
+    if (context) {
+      switch (context->last_file.token) {
+      case TOK_RETR:
+      case TOK_STOR:
+      case TOK_APPE:
+      case TOK_MKD:
+        snprintf(internalbuffer,IBUFSIZE,"%s",context->last_file.name);
+        break;
+      default:
+        snprintf(internalbuffer,IBUFSIZE,"(null)");
+      }
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"lastfilename");
+    break;
+  case COOKIE_LASTFILESIZE:
+    if (context)
+      /* use 64 bits here */
+      snprintf(internalbuffer,IBUFSIZE,"%" PRIu64,(context->last_file.name[0]!='\0')?context->last_file.size:0);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"lastfilesize");
+    break;
+  case COOKIE_LASTFILESPEED:
+    if (context) {
+      float f, time;
+#ifndef _MSC_VER
+      f = (float)context->last_file.size;
+#else
+      f = (float)(__int64)context->last_file.size;
+#endif
+      if (context->last_file.name[0]!='\0') {
+        time = (float)context->last_file.tv.tv_sec + ((float)context->last_file.tv.tv_usec/1000000.f);
+        /** convert to kB/s ? */
+        snprintf(internalbuffer,IBUFSIZE,"%.1f",
+            ((time > 1e-5) ? (f / time) : 0.f) / 1024.f
+            );
+      }
+      else
+        snprintf(internalbuffer,IBUFSIZE,"0");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"lastfilespeed");
+    break;
+  case COOKIE_LASTFILETIME:
+    if (context)
+      snprintf(internalbuffer,IBUFSIZE,"%.4f",(context->last_file.name[0]!='\0')?
+          (float)context->last_file.tv.tv_sec + ((float)context->last_file.tv.tv_usec/1000000.f) :0);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"lastfiletime");
+    break;
+/*** FILES cookies ***/
+  case COOKIE_MSG:
+    if (!mainConfig->dir_message) return;
+    if (context == NULL || checkpath_new(".",internalbuffer,context)) {
+      snprintf(internalbuffer,IBUFSIZE,"Could not get current path");
+      break;
+    }
+    length = strlen(internalbuffer);
+    if (length > 0 && internalbuffer[length-1] != '/') internalbuffer[length++] = '/';
+    wzd_strncpy(internalbuffer+length,mainConfig->dir_message,IBUFSIZE-length);
+    /* message file is written inline */
+    _cookie_render_file(st, internalbuffer, 0);
+    return;
+/*** SECTION cookies ***/
+  case COOKIE_SECTIONNAME:
+    section = (context) ? section_find(mainConfig->section_list,context->currentpath) : NULL;
+    snprintf(internalbuffer,IBUFSIZE,"%s",(section)?section_getname(section):"none");
+    break;
+/*** DISK/SPACE cookies ***/
+  case COOKIE_SPACEFREE:
+    _cookie_format_space(st, internalbuffer, 0);
+    break;
+  case COOKIE_SPACETOTAL:
+    _cookie_format_space(st, internalbuffer, 1);
+    break;
+/*** USER cookies ***/
+  case COOKIE_USERCREDITS:
+  case COOKIE_USERCREDITS2:
+    if (user) {
+      if (user->ratio)
+        _cookie_format_bytes(internalbuffer, user->credits, (op->cookie == COOKIE_USERCREDITS2));
+      else
+        snprintf(internalbuffer,IBUFSIZE,"unlimited");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usercredits");
+    break;
+  case COOKIE_USERFILES_DL:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%lu",user->stats.files_dl_total);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userfiles_dl");
+    break;
+  case COOKIE_USERFILES_UL:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%lu",user->stats.files_ul_total);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userfiles_ul");
+    break;
+  case COOKIE_USERFLAGS:
+    if (user) {
+      if (user->flags && strlen(user->flags)>0)
+        snprintf(internalbuffer,IBUFSIZE,"%s",user->flags);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"no flags");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userflags");
+    break;
+  case COOKIE_USERGROUP:
+    if (user && user->group_num>0) {
+      wzd_group_t * g = GetGroupByID(user->groups[0]);
+      snprintf(internalbuffer,IBUFSIZE,"%s",(g) ? g->groupname : "invalid group");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"nogroup");
+    break;
+  case COOKIE_USERGROUPS:
+    if (user && user->group_num > 0) {
+      wzd_group_t * g;
+      for (i=0; i<user->group_num; i++) {
+        g = GetGroupByID(user->groups[i]);
+        if (g) {
+          if (internalbuffer[0] != '\0') strlcat(internalbuffer," ",IBUFSIZE);
+          strlcat(internalbuffer,g->groupname,IBUFSIZE);
+        }
+      }
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"nogroup");
+    break;
+  case COOKIE_USERHOME:
+    if (user) {
+      /* check FLAG_SEE_HOME for self */
+      if ( (st->me && strcmp(user->username,st->me->username)==0 ) || /* self */
+          (st->me && st->me->flags && strchr(st->me->flags,FLAG_SEE_HOME))) /* authorized */
+        snprintf(internalbuffer,IBUFSIZE,"%s",user->rootpath);
+      else /* not allowed to see */
+        snprintf(internalbuffer,IBUFSIZE,"- some where -");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userhome");
+    break;
+  case COOKIE_USERID:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%u",user->uid);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userid");
+    break;
+  case COOKIE_USERCREATOR:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%u",user->creator);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usercreator");
+    break;
+  case COOKIE_USERIP:
+    if (context) {
+      int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
+      /* check FLAG_SEE_IP for self */
+      if (st->me && st->me->flags && strchr(st->me->flags,FLAG_SEE_IP)) {
+        inet_ntop(af,context->hostip,internalbuffer,sizeof(internalbuffer));
+      } else { /* not allowed to see */
+        snprintf(internalbuffer,IBUFSIZE,"xxx.xxx.xxx.xxx");
+      }
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userip");
+    break;
+  case COOKIE_USERIP_ALLOW:
+    _cookie_format_ip_allow(internalbuffer, (user) ? user->ip_list : NULL, op->index,
+        HARD_IP_PER_USER, "userip_allow", (user != NULL));
+    break;
+  case COOKIE_USERLASTCMD:
+    if (context) {
+      snprintf(internalbuffer,IBUFSIZE,"%s",str_tochar(context->current_action.command));
+      if (strncasecmp(internalbuffer,"site",4)==0)
+        strcpy(internalbuffer,"SITE command");
+      if (strncasecmp(internalbuffer,"pass",4)==0)
+        strcpy(internalbuffer,"PASS xxxxx");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userlastcmd");
+    break;
+  case COOKIE_USERLAST_LOGIN:
+    if (user) {
+      struct tm *ntime = NULL;
+      if (user->last_login)
+        ntime = localtime(&user->last_login);
+      if (ntime)
+        strftime(internalbuffer,IBUFSIZE,"%b %d %H:%M",ntime);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"never");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userlast_login");
+    break;
+  case COOKIE_USERLEECHSLOTS:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%hu",user->leech_slots);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userleechslots");
+    break;
+  case COOKIE_USERMAXDL:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%u",user->max_dl_speed);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usermaxdl");
+    break;
+  case COOKIE_USERMAXIDLE:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%u",user->max_idle_time);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usermaxidle");
+    break;
+  case COOKIE_USERMAXUL:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%u",user->max_ul_speed);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usermaxul");
+    break;
+  case COOKIE_USERNAME:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%s",user->username);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"username");
+    break;
+  case COOKIE_USERNUM_LOGINS:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%d",user->num_logins);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usernum_logins");
+    break;
+  case COOKIE_USERLOGINS_PER_IP:
+    if (user) {
+      if (user->logins_per_ip == 0) snprintf(internalbuffer, IBUFSIZE,"Unlimited");
+      else snprintf(internalbuffer,IBUFSIZE,"%d",user->logins_per_ip);
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userlogins_per_ip");
+    break;
+  case COOKIE_USERPATH:
+    if (context) {
+      char dev_buffer[WZD_MAX_PATH+1];
+      wzd_user_t * context_user = GetUserByID(context->userid);
+
+      /* check FLAG_SEE_HOME for self */
+      if ( st->me &&
+          ((context_user && strcmp(st->me->username,context_user->username)==0) ||
+           (st->me->flags && strchr(st->me->flags,FLAG_SEE_HOME))) ) {
+        if (checkpath_new(context->currentpath,dev_buffer,context))
+          snprintf(internalbuffer,IBUFSIZE,"Could not get current path");
+        else
+          wzd_strncpy(internalbuffer,dev_buffer,IBUFSIZE);
+      } else {
+        snprintf(internalbuffer,IBUFSIZE,"- some where -");
+      }
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userpwd");
+    break;
+  case COOKIE_USERPID:
+    if (context) {
+      /* check FLAG_SITEOP for self */
+      if (st->me && st->me->flags && strchr(st->me->flags,FLAG_SITEOP))
+        snprintf(internalbuffer,IBUFSIZE,"%lu",context->pid_child);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"some id");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userpid");
+    break;
+  case COOKIE_USERPWD:
+    if (context)
+      snprintf(internalbuffer,IBUFSIZE,"%s",context->currentpath);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userpwd");
+    break;
+  case COOKIE_USERRATIO:
+    if (user) {
+      if (user->ratio)
+        snprintf(internalbuffer,IBUFSIZE,"1:%u",user->ratio);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"unlimited");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userratio");
+    break;
+  case COOKIE_USERSLOTS:
+    if (user)
+      snprintf(internalbuffer,IBUFSIZE,"%hu",user->user_slots);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userslots");
+    break;
+  case COOKIE_USERSPEED:
+    if (context) {
+      if (context->current_action.token==TOK_RETR)
+        snprintf(internalbuffer,IBUFSIZE,"%.1f kB/s",context->current_dl_limiter.current_speed/1024.f);
+      else if ((context->current_action.token==TOK_STOR) ||
+          (context->current_action.token==TOK_APPE))
+        snprintf(internalbuffer,IBUFSIZE,"%.1f kB/s",context->current_ul_limiter.current_speed/1024.f);
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"userspeed");
+    break;
+  case COOKIE_USERTAG:
+    if (user) {
+      if (user->flags && strchr(user->flags,FLAG_DELETED))
+        snprintf(internalbuffer,IBUFSIZE,"**DELETED**");
+      else if (strlen(user->tagline)>0)
+        snprintf(internalbuffer,IBUFSIZE,"%s",user->tagline);
+      else
+        snprintf(internalbuffer,IBUFSIZE,"no tagline set");
+    }
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usertag");
+    break;
+  case COOKIE_USERTIME:
+    if (user && context)
+      snprintf(internalbuffer,IBUFSIZE,"%s",time_to_str(time(NULL) - context->login_time));
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usertime");
+    break;
+  case COOKIE_USERTOTAL_DL:
+  case COOKIE_USERTOTAL_DL2:
+    if (user)
+      _cookie_format_bytes(internalbuffer, user->stats.bytes_dl_total, (op->cookie == COOKIE_USERTOTAL_DL2));
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usertotal_dl");
+    break;
+  case COOKIE_USERTOTAL_UL:
+  case COOKIE_USERTOTAL_UL2:
+    if (user)
+      _cookie_format_bytes(internalbuffer, user->stats.bytes_ul_total, (op->cookie == COOKIE_USERTOTAL_UL2));
+    else
+      snprintf(internalbuffer,IBUFSIZE,"usertotal_ul");
+    break;
+/*** VFS cookies ***/
+  case COOKIE_VFSVIRTUAL:
+    if (st->vfs)
+      snprintf(internalbuffer,IBUFSIZE,"%s",st->vfs->virtual_dir);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"virtual_dir");
+    break;
+  case COOKIE_VFSPHYSICAL:
+    if (st->vfs)
+      snprintf(internalbuffer,IBUFSIZE,"%s",st->vfs->physical_dir);
+    else
+      snprintf(internalbuffer,IBUFSIZE,"physical_dir");
+    break;
+  case COOKIE_VFSTARGET:
+    if (st->vfs)
+      snprintf(internalbuffer,IBUFSIZE,"%s",(st->vfs->target) ? st->vfs->target : "not restricted");
+    else
+      snprintf(internalbuffer,IBUFSIZE,"target");
+    break;
+  default:
+    return;
+  }
+
+  if (color) {
+    if (st->use_colors)
+      _cookie_write(st, color, strlen(color));
+    return;
+  }
+
+  length = strlen(internalbuffer);
+  if (op->padding) {
+    /* FIXME padding char hardcoded */
+    for (; length < op->padding; length++)
+      internalbuffer[length] = ' ';
+    length = op->padding;
+    internalbuffer[length] = '\0';
+  }
+
+  _cookie_write(st, internalbuffer, length);
+}
+
+static void _cookie_render_ops(struct cookie_render_t * st, const wzd_cookie_template_t * tpl, unsigned int start, unsigned int end)
+{
+  const struct cookie_op_t * op;
+  unsigned int i;
+
+  for (i=start; i<end; i++) {
+    op = &tpl->ops[i];
+    switch (op->type) {
+    case COOKIE_OP_TEXT:
+      _cookie_write(st, tpl->text + op->arg, op->length);
+      break;
+    case COOKIE_OP_EOL:
+      _cookie_eol(st);
+      break;
+    case COOKIE_OP_COOKIE:
+      _cookie_render_cookie(st, op);
+      break;
+    case COOKIE_OP_FOR:
+      _cookie_render_for(st, tpl, op, i+1, i+1+op->arg);
+      i += op->arg;
+      break;
+    case COOKIE_OP_IF:
+      /* TODO XXX FIXME more checks needed ! */
+      if (op->extra && st->user && st->user->flags && strchr(st->user->flags,op->extra))
+        _cookie_render_block(st, tpl, i+1, i+1+op->arg);
+      i += op->arg;
+      break;
+    case COOKIE_OP_INCLUDE:
+#ifdef WZD_DBG_COOKIES
+      out_err(LEVEL_HIGH,"  including [%s]\n", tpl->text + op->arg);
+#endif
+      _cookie_render_file(st, tpl->text + op->arg, 1);
+      break;
+    }
+  }
+}
+
+int cookie_template_render(const wzd_cookie_template_t * tpl, wzd_user_t * user, wzd_group_t * group, wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len)
+{
+  struct cookie_render_t st;
+
+  if (!tpl) return -1;
+  if (out_buffer && out_buffer_len == 0) return 0;
+
+  st.real_context = GetMyContext();
+  st.me = (st.real_context) ? GetUserByID(st.real_context->userid) : NULL;
+  st.use_colors = (st.me && st.me->flags && strchr(st.me->flags,FLAG_COLOR)) ? 1 : 0;
+
+  st.user = user;
+  st.group = group;
+  st.context = context;
+  st.vfs = NULL;
+
+  st.out_buffer = out_buffer;
+  st.out_buffer_len = out_buffer_len;
+  st.out_length = 0;
+  if (out_buffer) *out_buffer = '\0';
+
+  st.send_length = 0;
+  st.written = 0;
+  st.last[0] = st.last[1] = '\0';
+  st.depth = 0;
+
+  _cookie_render_block(&st, tpl, 0, tpl->ops_count);
+  _cookie_flush(&st);
+
+  return 0;
+}
+
+int cookie_parse_buffer(const char *buffer, wzd_user_t * user, wzd_group_t * group,
+    wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len)
+{
+  wzd_cookie_template_t * tpl;
+  int ret;
+
+  if (!buffer) return -1;
+
+  /* callers use the output even on error, never leave it uninitialized */
+  if (out_buffer && out_buffer_len) *out_buffer = '\0';
+
+  tpl = cookie_template_acquire(buffer);
+  if (!tpl) return 1;
+
+  ret = cookie_template_render(tpl, user, group, context, out_buffer, out_buffer_len);
+  cookie_template_release(tpl);
+
+  return ret;
+}
+
+int cookie_parse_file(const char * filename, wzd_user_t * user, wzd_group_t * group,
+    wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len)
+{
+  wzd_cookie_template_t * tpl;
+  int ret;
+
+  if (out_buffer && out_buffer_len) *out_buffer = '\0';
+
+  tpl = cookie_template_acquire_file(filename);
+  if (!tpl) return -1;
+
+  ret = cookie_template_render(tpl, user, group, context, out_buffer, out_buffer_len);
+  cookie_template_release(tpl);
+
+  return ret;
+}
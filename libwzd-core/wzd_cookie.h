@@ -0,0 +1,79 @@
+/* vi:ai:et:ts=8 sw=2
+ */
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+#ifndef __WZD_COOKIE_H__
+#define __WZD_COOKIE_H__
+
+/** \file wzd_cookie.h
+ * \brief Cookie templates
+ */
+
+typedef struct wzd_cookie_template_t wzd_cookie_template_t;
+
+/** \brief Get compiled template for \a text
+ *
+ * The template is compiled only if it is not in cache.
+ *
+ * \return a template, which must be released using cookie_template_release(),
+ * or NULL if \a text is not a valid template
+ */
+wzd_cookie_template_t * cookie_template_acquire(const char * text);
+
+/** \brief Get compiled template for file \a filename
+ *
+ * The file is compiled only if it is not in cache, or if it has been
+ * modified.
+ *
+ * \return a template, which must be released using cookie_template_release(),
+ * or NULL if file does not exist or is not a valid template
+ */
+wzd_cookie_template_t * cookie_template_acquire_file(const char * filename);
+
+/** \brief Release template returned by cookie_template_acquire() or
+ * cookie_template_acquire_file() */
+void cookie_template_release(wzd_cookie_template_t * tpl);
+
+/** \brief Replace cookies of template
+ *
+ * If \a out_buffer is NULL, result is sent to the client of the current
+ * thread using send_message_raw(), otherwise it is written to \a out_buffer
+ * (and truncated if needed).
+ *
+ * This function can be called by several threads at the same time.
+ */
+int cookie_template_render(const wzd_cookie_template_t * tpl, wzd_user_t * user, wzd_group_t * group, wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len);
+
+/** \brief Replace cookies of file \a filename
+ *
+ * \see cookie_template_render
+ * \return 0 if ok, -1 if file could not be read or is not a valid template
+ */
+int cookie_parse_file(const char * filename, wzd_user_t * user, wzd_group_t * group, wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len);
+
+/** \brief Remove all templates from cache */
+void cookie_cache_purge(void);
+
+#endif /* __WZD_COOKIE_H__ */
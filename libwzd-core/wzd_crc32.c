@@ -29,6 +29,37 @@
 #ifndef WZD_USE_PCH
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "wzd_types.h"
+#include "wzd_crc32.h"
+#endif
+
+#ifdef HAVE_CRC32_PCLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#ifdef HAVE_CRC32_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
 #endif
 
 #ifndef MAX
@@ -75,37 +106,327 @@ static unsigned long crcs[256]={ 0x00000000,0x77073096,0xEE0E612C,0x990951BA,
 0x53B39330,0x24B4A3A6,0xBAD03605,0xCDD70693,0x54DE5729,0x23D967BF,0xB3667A2E,
 0xC4614AB8,0x5D681B02,0x2A6F2B94,0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D};
 
+/** Size of read buffer used by calc_crc32() */
+#define CRC32_FILE_BUFSIZE	(128*1024)
+
+/* slicing-by-8 tables, crc_slice[0] is crcs[] */
+static u32_t crc_slice[8][256];
+static int crc_slice_init = 0;
+
+/* All implementations work on the non-inverted crc register */
+typedef u32_t (*crc32_fct_t)(u32_t crc, const unsigned char * buf, size_t length);
+
+static u32_t _crc32_dispatch(u32_t crc, const unsigned char * buf, size_t length);
+
+static crc32_fct_t _crc32_fct = _crc32_dispatch;
+static const char * _crc32_name = "none";
+
+/** \brief Build slicing tables from crcs[]
+ *
+ * Tables are deterministic, so if two threads race here they write the same
+ * values.
+ */
+static void _crc32_init_tables(void)
+{
+  unsigned int i, k;
+
+  if (crc_slice_init) return;
+
+  for (i=0; i<256; i++)
+    crc_slice[0][i] = (u32_t)crcs[i];
+  for (k=1; k<8; k++)
+    for (i=0; i<256; i++)
+      crc_slice[k][i] = (crc_slice[k-1][i] >> 8) ^ crc_slice[0][crc_slice[k-1][i] & 0xff];
+
+  crc_slice_init = 1;
+}
+
+/** \brief Byte-at-a-time CRC, used for the tail of buffers */
+static u32_t _crc32_bytes(u32_t crc, const unsigned char * buf, size_t length)
+{
+  while (length--)
+    crc = (crc >> 8) ^ crc_slice[0][(crc ^ *buf++) & 0xff];
+  return crc;
+}
+
+/** \brief Slicing-by-8: process 8 bytes per iteration using 8 tables */
+static u32_t _crc32_slice8(u32_t crc, const unsigned char * buf, size_t length)
+{
+  u32_t one, two;
+
+  while (length >= 8) {
+    one = crc ^ ( (u32_t)buf[0] | ((u32_t)buf[1] << 8) | ((u32_t)buf[2] << 16) | ((u32_t)buf[3] << 24) );
+    two = (u32_t)buf[4] | ((u32_t)buf[5] << 8) | ((u32_t)buf[6] << 16) | ((u32_t)buf[7] << 24);
+    crc = crc_slice[7][one & 0xff] ^
+          crc_slice[6][(one >> 8) & 0xff] ^
+          crc_slice[5][(one >> 16) & 0xff] ^
+          crc_slice[4][one >> 24] ^
+          crc_slice[3][two & 0xff] ^
+          crc_slice[2][(two >> 8) & 0xff] ^
+          crc_slice[1][(two >> 16) & 0xff] ^
+          crc_slice[0][two >> 24];
+    buf += 8;
+    length -= 8;
+  }
+
+  return _crc32_bytes(crc, buf, length);
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+/** \brief Carry-less multiplication folding (x86 PCLMULQDQ)
+ *
+ * The crc32 instruction of SSE4.2 uses the Castagnoli polynomial, which is
+ * not the one used by zip/sfv, so we fold with PCLMULQDQ instead.
+ * Constants are from "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction" (Intel), for the bit-reflected 0x04C11DB7 polynomial.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static u32_t _crc32_pclmul(u32_t crc, const unsigned char * buf, size_t length)
+{
+  static const u64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+  static const u64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+  static const u64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+  static const u64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+  size_t tail;
+
+  if (length < 64)
+    return _crc32_slice8(crc, buf, length);
+
+  tail = length & 15;
+  length -= tail;
+
+  x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+  x0 = _mm_load_si128((const __m128i *)k1k2);
+
+  buf += 64;
+  length -= 64;
+
+  /* fold 4 blocks of 128 bits in parallel */
+  while (length >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+    y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+    buf += 64;
+    length -= 64;
+  }
+
+  /* fold into 128 bits */
+  x0 = _mm_load_si128((const __m128i *)k3k4);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  /* remaining blocks of 128 bits */
+  while (length >= 16) {
+    x2 = _mm_loadu_si128((const __m128i *)buf);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    buf += 16;
+    length -= 16;
+  }
+
+  /* fold 128 bits to 64 bits */
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /* Barrett reduction to 32 bits */
+  x0 = _mm_load_si128((const __m128i *)poly);
+
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  crc = (u32_t)_mm_extract_epi32(x1, 1);
+
+  return _crc32_bytes(crc, buf, tail);
+}
+
+static int _crc32_has_pclmul(void)
+{
+  unsigned int a, b, c, d;
+
+  if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+  /* ecx bit 1: PCLMULQDQ, ecx bit 19: SSE4.1 */
+  return ((c & (1 << 1)) && (c & (1 << 19)));
+}
+#endif /* HAVE_CRC32_PCLMUL */
+
+#ifdef HAVE_CRC32_ARMV8
+/** \brief ARMv8 CRC32 instructions (same polynomial as zip/sfv) */
+__attribute__((target("+crc")))
+static u32_t _crc32_armv8(u32_t crc, const unsigned char * buf, size_t length)
+{
+  u64_t v;
+
+  while (length && ((size_t)buf & 7)) {
+    crc = __crc32b(crc, *buf++);
+    length--;
+  }
+  while (length >= 8) {
+    memcpy(&v, buf, 8);
+    crc = __crc32d(crc, v);
+    buf += 8;
+    length -= 8;
+  }
+  while (length--)
+    crc = __crc32b(crc, *buf++);
+
+  return crc;
+}
+#endif /* HAVE_CRC32_ARMV8 */
+
+/** \brief Select the fastest implementation available on this cpu, on first use */
+static u32_t _crc32_dispatch(u32_t crc, const unsigned char * buf, size_t length)
+{
+  if (calc_crc32_select(NULL))
+    return _crc32_bytes(crc, buf, length);
+
+  return (*_crc32_fct)(crc, buf, length);
+}
+
+/** \brief Select CRC32 implementation
+ * \param[in] name "slice8", "pclmul", "armv8", or NULL for the fastest
+ * implementation supported by the cpu
+ * \return 0 if ok, -1 if implementation is not available
+ */
+int calc_crc32_select(const char * name)
+{
+  _crc32_init_tables();
+
+  if (name == NULL) {
+#ifdef HAVE_CRC32_PCLMUL
+    if (_crc32_has_pclmul())
+      return calc_crc32_select("pclmul");
+#endif
+#ifdef HAVE_CRC32_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+      return calc_crc32_select("armv8");
+#endif
+    return calc_crc32_select("slice8");
+  }
+
+  if (strcmp(name,"slice8")==0) {
+    _crc32_name = "slice8";
+    _crc32_fct = _crc32_slice8;
+    return 0;
+  }
+#ifdef HAVE_CRC32_PCLMUL
+  if (strcmp(name,"pclmul")==0 && _crc32_has_pclmul()) {
+    _crc32_name = "pclmul";
+    _crc32_fct = _crc32_pclmul;
+    return 0;
+  }
+#endif
+#ifdef HAVE_CRC32_ARMV8
+  if (strcmp(name,"armv8")==0 && (getauxval(AT_HWCAP) & HWCAP_CRC32)) {
+    _crc32_name = "armv8";
+    _crc32_fct = _crc32_armv8;
+    return 0;
+  }
+#endif
+
+  return -1;
+}
+
+/** \brief Return the name of the CRC32 implementation in use */
+const char * calc_crc32_implementation(void)
+{
+  if (_crc32_fct == _crc32_dispatch)
+    calc_crc32_select(NULL);
+  return _crc32_name;
+}
+
 /* Calculates the 32-bit checksum of fname, and stores the result
  * in crc. Returns 0 on success, nonzero on error.
  */
 int calc_crc32( const char *fname, unsigned long *crc, unsigned long startpos, unsigned long length )
 {
-    FILE *in;           /* input file */
+    int fd;
     unsigned char *buf; /* pointer to the input buffer */
-    size_t i, j, len;   /* buffer positions*/
-    int k;              /* generic integer */
-    unsigned long tmpcrc=0xFFFFFFFF;
+    ssize_t i;
+    size_t len;
+    u32_t tmpcrc;
 
-    tmpcrc = (~*crc & 0xFFFFFFFF); /* stay on the 4 LSB */
+    tmpcrc = (u32_t)(~*crc & 0xFFFFFFFF); /* stay on the 4 LSB */
 
     /* open file */
-    if((in = fopen(fname, "rb")) == NULL) return -1;
+    if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0) return -1;
 
-    fseek(in,startpos,SEEK_SET);
-    len = MIN(length,BUFSIZ);
-    buf = (unsigned char *)malloc(BUFSIZ);
+    if (startpos && lseek(fd, (off_t)startpos, SEEK_SET) == (off_t)-1) {
+      close(fd);
+      return -1;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    (void)posix_fadvise(fd, (off_t)startpos, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    buf = (unsigned char *)malloc(CRC32_FILE_BUFSIZE);
+    if (!buf) {
+      close(fd);
+      return -1;
+    }
 
     /* loop through the file and calculate CRC */
-    while( (i=fread(buf, 1, len, in)) != 0 ){
-      length -= i;
-      for(j=0; j<i; j++) {
-        k=(tmpcrc ^ buf[j]) & 0x000000FFL;
-        tmpcrc=((tmpcrc >> 8) & 0x00FFFFFFL) ^ crcs[k];
+    while (length > 0) {
+      len = MIN(length,CRC32_FILE_BUFSIZE);
+      i = read(fd, buf, len);
+      if (i < 0) {
+        close(fd);
+        free(buf);
+        return -1;
       }
-      len = MIN(length,BUFSIZ);
-      if (len <= 0) break;
+      if (i == 0) break;
+      tmpcrc = (*_crc32_fct)(tmpcrc, buf, (size_t)i);
+      length -= (unsigned long)i;
     }
-    fclose(in);
+    close(fd);
     free(buf);
     *crc = (~tmpcrc & 0xFFFFFFFF); /* postconditioning */
     return 0;
@@ -116,20 +437,86 @@ int calc_crc32( const char *fname, unsigned long *crc, unsigned long startpos, u
  */
 int calc_crc32_buffer( const char *buffer, unsigned long *crc, unsigned long length )
 {
-    size_t j, len;   /* buffer positions*/
-    int k;              /* generic integer */
-    unsigned long tmpcrc=0xFFFFFFFF;
+    u32_t tmpcrc;
 
-    tmpcrc = (~*crc & 0xFFFFFFFF); /* stay on the 4 LSB */
+    tmpcrc = (u32_t)(~*crc & 0xFFFFFFFF); /* stay on the 4 LSB */
 
-    len = MIN(length,BUFSIZ);
+    tmpcrc = (*_crc32_fct)(tmpcrc, (const unsigned char *)buffer, (size_t)length);
 
-    /* loop through the buffer and calculate CRC */
-    for(j=0; j<length; j++) {
-      k=(tmpcrc ^ buffer[j]) & 0x000000FFL;
-      tmpcrc=((tmpcrc >> 8) & 0x00FFFFFFL) ^ crcs[k];
-    }
     *crc = (~tmpcrc & 0xFFFFFFFF); /* postconditioning */
     return 0;
 }
 
+/* GF(2) matrix helpers for calc_crc32_combine(), see zlib */
+static u32_t _gf2_matrix_times(const u32_t *mat, u32_t vec)
+{
+  u32_t sum = 0;
+
+  while (vec) {
+    if (vec & 1)
+      sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void _gf2_matrix_square(u32_t *square, const u32_t *mat)
+{
+  int n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = _gf2_matrix_times(mat, mat[n]);
+}
+
+/** \brief Combine checksums of two consecutive blocks
+ *
+ * If \a crc1 is the checksum of block A and \a crc2 the checksum of block B
+ * (of length \a length2), returns the checksum of A followed by B. This
+ * allows computing checksums of parts of a file in parallel.
+ */
+unsigned long calc_crc32_combine( unsigned long crc1, unsigned long crc2, u64_t length2 )
+{
+  int n;
+  u32_t row;
+  u32_t even[32];    /* even-power-of-two zeros operator */
+  u32_t odd[32];     /* odd-power-of-two zeros operator */
+  u32_t c1 = (u32_t)(crc1 & 0xFFFFFFFF);
+
+  if (length2 == 0)
+    return crc1;
+
+  /* put operator for one zero bit in odd */
+  odd[0] = 0xedb88320UL;
+  row = 1;
+  for (n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  /* put operator for two zero bits in even */
+  _gf2_matrix_square(even, odd);
+
+  /* put operator for four zero bits in odd */
+  _gf2_matrix_square(odd, even);
+
+  /* apply length2 zeros to crc1 (first square will put the operator for one
+   * zero byte, eight zero bits, in even)
+   */
+  do {
+    _gf2_matrix_square(even, odd);
+    if (length2 & 1)
+      c1 = _gf2_matrix_times(even, c1);
+    length2 >>= 1;
+
+    if (length2 == 0)
+      break;
+
+    _gf2_matrix_square(odd, even);
+    if (length2 & 1)
+      c1 = _gf2_matrix_times(odd, c1);
+    length2 >>= 1;
+  } while (length2 != 0);
+
+  return (c1 ^ (u32_t)(crc2 & 0xFFFFFFFF));
+}
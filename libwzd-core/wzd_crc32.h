@@ -35,4 +35,18 @@ int calc_crc32( const char *fname, unsigned long *crc, unsigned long startpos, u
  */
 int calc_crc32_buffer( const char *buffer, unsigned long *crc, unsigned long length );
 
+/* Combines the checksums crc1 and crc2 of two consecutive blocks, where
+ * length2 is the length of the second block, and returns the checksum of
+ * the whole data.
+ */
+unsigned long calc_crc32_combine( unsigned long crc1, unsigned long crc2, u64_t length2 );
+
+/* Selects the CRC32 implementation ("slice8", "pclmul", "armv8"), or the
+ * fastest one available if name is NULL. Returns 0 on success.
+ */
+int calc_crc32_select( const char * name );
+
+/* Returns the name of the CRC32 implementation in use */
+const char * calc_crc32_implementation( void );
+
 #endif /* __WZD_CRC32__ */
@@ -24,6 +24,19 @@
  * the source code for OpenSSL in the source distribution.
  */
 
+/** \file wzd_crontab.c
+ * \brief Periodic jobs
+ *
+ * Scheduled jobs are kept in a binary min-heap ordered by next_run. The
+ * crontab thread sleeps on a condition variable until the first job is
+ * due, or until it is woken by cronjob_add(). Due jobs are put in a queue
+ * and run by HARD_CRONTAB_WORKERS executor threads, without holding
+ * SET_MUTEX_CRONTAB.
+ *
+ * Without pthreads, the crontab thread checks jobs each second and runs
+ * them itself.
+ */
+
 #include "wzd_all.h"
 
 #ifndef WZD_USE_PCH
@@ -33,6 +46,11 @@
 #include <sys/types.h>
 #include <string.h>
 
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
 #include "wzd_structs.h"
 #include "wzd_libmain.h"
 #include "wzd_log.h"
@@ -43,41 +61,271 @@
 #include "wzd_debug.h"
 #endif /* WZD_USE_PCH */
 
+#define CRONJOB_NOT_SCHEDULED	((unsigned int)-1)
+
 static int _crontab_running = 0;
 static wzd_thread_t _crontab_thread;
 
+/* list handled by the crontab thread */
+static wzd_cronjob_t ** _crontab_list = NULL;
+
+/* heap of scheduled jobs of _crontab_list, protected by SET_MUTEX_CRONTAB */
+static wzd_cronjob_t ** _crontab_heap = NULL;
+static unsigned int _crontab_heap_count = 0;
+static unsigned int _crontab_heap_size = 0;
+
+#if defined(HAVE_PTHREAD)
+/* wakes up the crontab thread when the heap is modified */
+static pthread_mutex_t _crontab_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _crontab_wait_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long _crontab_wakeups = 0;
+
+/* queue of jobs waiting for an executor */
+static pthread_mutex_t _crontab_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _crontab_queue_cond = PTHREAD_COND_INITIALIZER;
+static wzd_cronjob_t * _crontab_queue[HARD_CRONTAB_QUEUE_SIZE];
+static unsigned int _crontab_queue_head = 0;
+static unsigned int _crontab_queue_count = 0;
+
+static wzd_thread_t _crontab_workers[HARD_CRONTAB_WORKERS];
+static unsigned int _crontab_num_workers = 0;
+#endif /* HAVE_PTHREAD */
+
 static void * _crontab_thread_fund(void *);
 
-static int _crontab_insert_sorted(wzd_cronjob_t * job, wzd_cronjob_t ** crontab)
+static time_t cronjob_find_next_exec_date(time_t start,
+    const char * minutes, const char * hours, const char * day_of_month,
+    const char * month, const char * day_of_week);
+
+/* heap functions, must be called with SET_MUTEX_CRONTAB locked */
+
+static void _crontab_heap_swap(unsigned int i, unsigned int j)
+{
+  wzd_cronjob_t * tmp;
+
+  tmp = _crontab_heap[i];
+  _crontab_heap[i] = _crontab_heap[j];
+  _crontab_heap[j] = tmp;
+  _crontab_heap[i]->heap_index = i;
+  _crontab_heap[j]->heap_index = j;
+}
+
+static void _crontab_heap_up(unsigned int i)
+{
+  while (i > 0 && _crontab_heap[i]->next_run < _crontab_heap[(i-1)/2]->next_run) {
+    _crontab_heap_swap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void _crontab_heap_down(unsigned int i)
+{
+  unsigned int smallest, child;
+
+  for (;;) {
+    smallest = i;
+    child = 2*i + 1;
+    if (child < _crontab_heap_count && _crontab_heap[child]->next_run < _crontab_heap[smallest]->next_run)
+      smallest = child;
+    child++;
+    if (child < _crontab_heap_count && _crontab_heap[child]->next_run < _crontab_heap[smallest]->next_run)
+      smallest = child;
+    if (smallest == i) return;
+    _crontab_heap_swap(i, smallest);
+    i = smallest;
+  }
+}
+
+static int _crontab_heap_push(wzd_cronjob_t * job)
 {
-  wzd_cronjob_t * current;
+  wzd_cronjob_t ** heap;
+  unsigned int size;
 
   WZD_ASSERT( job != NULL );
-  WZD_ASSERT( crontab != NULL );
 
-  current = *crontab;
+  if (_crontab_heap_count == _crontab_heap_size) {
+    size = (_crontab_heap_size) ? 2 * _crontab_heap_size : 16;
+    heap = realloc(_crontab_heap, size * sizeof(wzd_cronjob_t*));
+    if (!heap) return -1;
+    _crontab_heap = heap;
+    _crontab_heap_size = size;
+  }
+
+  job->heap_index = _crontab_heap_count;
+  _crontab_heap[_crontab_heap_count++] = job;
+  _crontab_heap_up(job->heap_index);
+
+  return 0;
+}
+
+static void _crontab_heap_remove(wzd_cronjob_t * job)
+{
+  unsigned int i = job->heap_index;
+
+  if (i == CRONJOB_NOT_SCHEDULED || i >= _crontab_heap_count) return;
+
+  job->heap_index = CRONJOB_NOT_SCHEDULED;
+  _crontab_heap_count--;
+  if (i == _crontab_heap_count) return;
+
+  _crontab_heap[i] = _crontab_heap[_crontab_heap_count];
+  _crontab_heap[i]->heap_index = i;
+  _crontab_heap_up(i);
+  _crontab_heap_down(_crontab_heap[i]->heap_index);
+}
+
+/** \brief Wake up crontab thread, because the first deadline may have changed */
+static void _crontab_wakeup(void)
+{
+#if defined(HAVE_PTHREAD)
+  pthread_mutex_lock(&_crontab_wait_mutex);
+  _crontab_wakeups++;
+  pthread_cond_signal(&_crontab_wait_cond);
+  pthread_mutex_unlock(&_crontab_wait_mutex);
+#endif
+}
 
-  /* case: list empty, or head insertion */
-  if (!current || job->next_run < current->next_run) {
-    *crontab = job;
-    job->next_cronjob = current;
+/** \brief Compute next execution of \a job after \a now, and update scheduler
+ *
+ * Must be called with SET_MUTEX_CRONTAB locked.
+ */
+static void _cronjob_reschedule(wzd_cronjob_t * job, time_t now)
+{
+  job->next_run = cronjob_find_next_exec_date(now,job->minutes,job->hours,
+      job->day_of_month, job->month, job->day_of_week);
+  /* never schedule a job in the past, it would be run in a loop */
+  if (job->next_run != 0 && job->next_run <= now)
+    job->next_run = now + 1;
 #ifdef WZD_DBG_CRONTAB
-    out_err(LEVEL_HIGH,"cronjob: head insertion for %s\n",job->hook->external_command);
+  out_err(LEVEL_FLOOD,"Next run (%s): %s\n",job->hook->external_command,ctime(&job->next_run));
 #endif
-    return 0;
+
+  if (job->heap_index != CRONJOB_NOT_SCHEDULED) {
+    if (job->next_run == 0)
+      _crontab_heap_remove(job);
+    else {
+      _crontab_heap_up(job->heap_index);
+      _crontab_heap_down(job->heap_index);
+    }
   }
+}
 
-  while (current->next_cronjob && job->next_run > current->next_cronjob->next_run) {
-    current = current->next_cronjob;
+/** \brief Insert new job in \a crontab
+ *
+ * Must be called with SET_MUTEX_CRONTAB locked.
+ */
+static int _crontab_insert(wzd_cronjob_t * job, wzd_cronjob_t ** crontab)
+{
+  WZD_ASSERT( job != NULL );
+  WZD_ASSERT( crontab != NULL );
+
+  job->next_cronjob = *crontab;
+  *crontab = job;
+
+  if (crontab == _crontab_list && job->next_run != 0) {
+    if (_crontab_heap_push(job)) return -1;
+    _crontab_wakeup();
+  }
+
+  return 0;
+}
+
+/** \brief Remove \a job from \a crontab and free it
+ *
+ * Must be called with SET_MUTEX_CRONTAB locked.
+ */
+static void _cronjob_remove(wzd_cronjob_t * job, wzd_cronjob_t ** crontab)
+{
+  wzd_cronjob_t ** prev;
+
+  for (prev = crontab; *prev; prev = &(*prev)->next_cronjob) {
+    if (*prev == job) {
+      *prev = job->next_cronjob;
+      break;
+    }
   }
 
+  _crontab_heap_remove(job);
+
+  if (job->hook) {
+    free(job->hook->external_command);
+    free(job->hook);
+  }
+  free(job);
+}
+
+/** \brief Mark \a job as running, unless policy says it must be skipped
+ *
+ * Must be called with SET_MUTEX_CRONTAB locked.
+ * \return 0 if job can be run
+ */
+static int _cronjob_try_start(wzd_cronjob_t * job)
+{
+  if (job->running > 0 && !(job->flags & CRONJOB_FLAG_ALLOW_OVERLAP)) {
+    job->skipped++;
+    out_log(LEVEL_INFO,"cron job %s is still running, skipping this execution\n",
+        (job->hook->external_command) ? job->hook->external_command : "(null)");
+    return 1;
+  }
+  job->running++;
+  return 0;
+}
+
+/** \brief Run \a job and update its statistics
+ *
+ * Must be called with SET_MUTEX_CRONTAB unlocked, after _cronjob_try_start().
+ * Jobs run once are freed when they are finished.
+ */
+static void _cronjob_execute(wzd_cronjob_t * job, wzd_cronjob_t ** crontab)
+{
+  typedef int (*cronjob_hook)(unsigned long, const char *, const char*);
+  struct timeval tv_start, tv_end;
+  unsigned long duration;
+  int ret;
+
+  gettimeofday(&tv_start,NULL);
+
+  if (job->hook->hook)
+    ret = (*(cronjob_hook)job->hook->hook)(EVENT_CRONTAB,NULL,job->hook->opt);
+  else {
+    if (job->hook->external_command)
+      ret = hook_call_external(job->hook,-1);
+  }
+
+  gettimeofday(&tv_end,NULL);
+  duration = (tv_end.tv_sec - tv_start.tv_sec) * 1000 + (tv_end.tv_usec - tv_start.tv_usec) / 1000;
 #ifdef WZD_DBG_CRONTAB
-  out_err(LEVEL_HIGH,"cronjob: inserting %s after %s\n",job->hook->external_command, current->hook->external_command);
+  out_err(LEVEL_CRITICAL,"Exec'ed %s in %lu ms\n",job->hook->external_command,duration);
 #endif
-  job->next_cronjob = current->next_cronjob;
-  current->next_cronjob = job;
 
-  return 0;
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  job->running--;
+  job->runs++;
+  job->last_run = tv_start.tv_sec;
+  job->last_duration = duration;
+  job->total_duration += duration;
+  if (duration > job->max_duration) job->max_duration = duration;
+
+  if (job->next_run == 0 && job->running == 0)
+    _cronjob_remove(job, crontab);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+}
+
+static wzd_cronjob_t * _cronjob_alloc(int (*fn)(void), const char * command)
+{
+  wzd_cronjob_t *new;
+
+  new = malloc(sizeof(wzd_cronjob_t));
+  memset(new, 0, sizeof(wzd_cronjob_t));
+  new->hook = malloc(sizeof(struct _wzd_hook_t));
+  new->hook->mask = EVENT_CRONTAB;
+  new->hook->opt = NULL;
+  new->hook->hook = fn;
+  new->hook->external_command = command?strdup(command):NULL;
+  new->hook->next_hook = NULL;
+  new->heap_index = CRONJOB_NOT_SCHEDULED;
+
+  return new;
 }
 
 /** If \a minutes is the special string "ONCE", then return 0, meaning that the cron job
@@ -205,13 +453,7 @@ int cronjob_add(wzd_cronjob_t ** crontab, int (*fn)(void), const char * command,
   out_err(LEVEL_HIGH,"adding job %s\n",command);
 #endif
 
-  new = malloc(sizeof(wzd_cronjob_t));
-  new->hook = malloc(sizeof(struct _wzd_hook_t));
-  new->hook->mask = EVENT_CRONTAB;
-  new->hook->opt = NULL;
-  new->hook->hook = fn;
-  new->hook->external_command = command?strdup(command):NULL;
-  new->hook->next_hook = NULL;
+  new = _cronjob_alloc(fn, command);
   strncpy(new->minutes,minutes,32);
   strncpy(new->hours,hours,32);
   strncpy(new->day_of_month,day_of_month,32);
@@ -220,7 +462,6 @@ int cronjob_add(wzd_cronjob_t ** crontab, int (*fn)(void), const char * command,
   (void)time(&now);
   new->next_run = cronjob_find_next_exec_date(now,minutes,hours,day_of_month,
       month,day_of_week);
-  new->next_cronjob = NULL;
 
 #ifdef WZD_DBG_CRONTAB
   out_err(LEVEL_CRITICAL,"Now: %s",ctime(&now));
@@ -228,7 +469,7 @@ int cronjob_add(wzd_cronjob_t ** crontab, int (*fn)(void), const char * command,
 #endif
 
   WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
-  ret = _crontab_insert_sorted(new,crontab);
+  ret = _crontab_insert(new,crontab);
   WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
 
   return ret;
@@ -249,20 +490,9 @@ int cronjob_add_once(wzd_cronjob_t ** crontab, int (*fn)(void), const char * com
   out_err(LEVEL_HIGH,"adding job (once) %s\n",command);
 #endif
 
-  new = malloc(sizeof(wzd_cronjob_t));
-  new->hook = malloc(sizeof(struct _wzd_hook_t));
-  new->hook->mask = EVENT_CRONTAB;
-  new->hook->opt = NULL;
-  new->hook->hook = fn;
-  new->hook->external_command = command?strdup(command):NULL;
-  new->hook->next_hook = NULL;
+  new = _cronjob_alloc(fn, command);
   strncpy(new->minutes,"ONCE",32);
-  new->hours[0] = '\0';
-  new->day_of_month[0] = '\0';
-  new->month[0] = '\0';
-  new->day_of_week[0] = '\0';
   new->next_run = date;
-  new->next_cronjob = NULL;
 
 #ifdef WZD_DBG_CRONTAB
   {
@@ -274,79 +504,125 @@ int cronjob_add_once(wzd_cronjob_t ** crontab, int (*fn)(void), const char * com
 #endif
 
   WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
-  ret = _crontab_insert_sorted(new,crontab);
+  ret = _crontab_insert(new,crontab);
   WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
 
   return ret;
 }
 
+/** \brief Run all jobs of \a crontab which are due, in the current thread
+ */
 int cronjob_run(wzd_cronjob_t ** crontab)
 {
-  wzd_cronjob_t * job = *crontab;
+  wzd_cronjob_t * job;
+  wzd_cronjob_t ** due = NULL;
+  unsigned int num_due = 0, size = 0, i;
   time_t now;
-  int ret;
-  wzd_cronjob_t * jobs_to_free = NULL;
 
   (void)time(&now);
 
-  if (!job || now < job->next_run) return 0;
-
   WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
 
-  /** list is sorted, so we only need to check the first entries */
-  while (job && now >= job->next_run )
-  {
-    /* run job */
-    typedef int (*cronjob_hook)(unsigned long, const char *, const char*);
-    if (job->hook->hook)
-      ret = (*(cronjob_hook)job->hook->hook)(EVENT_CRONTAB,NULL,job->hook->opt);
-    else {
-      if (job->hook->external_command)
-        ret = hook_call_external(job->hook,-1);
-    }
-    /* mark job as done, its position must be changed in list */
-    job->next_run = 0;
-#ifdef WZD_DBG_CRONTAB
-    out_err(LEVEL_CRITICAL,"Exec'ed %s\n",job->hook->external_command);
-    out_err(LEVEL_CRITICAL,"Now: %s",ctime(&now));
-#endif
-    job = job->next_cronjob;
-  }
+  for (job = *crontab; job; job = job->next_cronjob) {
+    if (job->next_run == 0 || now < job->next_run) continue;
 
-  while ( (*crontab) && (*crontab)->next_run == 0 ) {
-    job = *crontab;
-    *crontab = job->next_cronjob;
-    job->next_run = cronjob_find_next_exec_date(now,job->minutes,job->hours,
-        job->day_of_month, job->month, job->day_of_week);
-    if (job->next_run != 0) {
-#ifdef WZD_DBG_CRONTAB
-      out_err(LEVEL_FLOOD,"Next run (%s): %s\n",job->hook->external_command,ctime(&job->next_run));
-#endif
-      _crontab_insert_sorted(job,crontab);
-    } else {
-#ifdef WZD_DBG_CRONTAB
-      out_err(LEVEL_FLOOD,"Scheduling job (%s) for removal\n",job->hook->external_command);
-#endif
-      /* we can't call cronjob_free now because it also locks SET_MUTEX_CRONTAB */
-      job->next_cronjob = jobs_to_free;
-      jobs_to_free = job;
+    if (_cronjob_try_start(job) == 0) {
+      if (num_due == size) {
+        size = (size) ? 2 * size : 8;
+        due = realloc(due, size * sizeof(wzd_cronjob_t*));
+      }
+      due[num_due++] = job;
     }
+    _cronjob_reschedule(job, now);
   }
 
   WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
 
-  /* call cronjob_free now because it also locks SET_MUTEX_CRONTAB */
-  cronjob_free(&jobs_to_free);
+  /* jobs are run without lock, so they can add or remove jobs */
+  for (i=0; i<num_due; i++)
+    _cronjob_execute(due[i], crontab);
+  free(due);
+
+  /* jobs run once, and skipped because they were running */
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  job = *crontab;
+  while (job) {
+    wzd_cronjob_t * next = job->next_cronjob;
+    if (job->next_run == 0 && job->running == 0)
+      _cronjob_remove(job, crontab);
+    job = next;
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
 
   return 0;
 }
 
+/** \brief Run job \a command of \a crontab now, in the current thread
+ *
+ * The next scheduled execution is not changed.
+ *
+ * \return 0 if ok, 1 if the job was skipped because it is already running,
+ * -1 if job was not found
+ */
+int cronjob_run_now(wzd_cronjob_t ** crontab, const char * command)
+{
+  wzd_cronjob_t * job;
+  int ret = -1;
+
+  if (!command) return -1;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  for (job = *crontab; job; job = job->next_cronjob) {
+    if (job->hook && job->hook->external_command &&
+        strcmp(job->hook->external_command,command)==0) {
+      ret = _cronjob_try_start(job);
+      break;
+    }
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+
+  if (ret == 0)
+    _cronjob_execute(job, crontab);
+
+  return ret;
+}
+
+/** \brief Set flags (CRONJOB_FLAG_*) of job \a command
+ * \return 0 if ok, -1 if job was not found
+ */
+int cronjob_set_flags(wzd_cronjob_t ** crontab, const char * command, unsigned int flags)
+{
+  wzd_cronjob_t * job;
+  int ret = -1;
+
+  if (!command) return -1;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  for (job = *crontab; job; job = job->next_cronjob) {
+    if (job->hook && job->hook->external_command &&
+        strcmp(job->hook->external_command,command)==0) {
+      job->flags = flags;
+      ret = 0;
+    }
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+
+  return ret;
+}
+
 void cronjob_free(wzd_cronjob_t ** crontab)
 {
   wzd_cronjob_t * current_job, * next_job;
 
-  current_job = *crontab;
   WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  current_job = *crontab;
+
+  if (crontab == _crontab_list) {
+    /* all jobs of the heap are in this list */
+    free(_crontab_heap);
+    _crontab_heap = NULL;
+    _crontab_heap_count = _crontab_heap_size = 0;
+  }
 
   while (current_job) {
     next_job = current_job->next_cronjob;
@@ -367,10 +643,59 @@ void cronjob_free(wzd_cronjob_t ** crontab)
   WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
 }
 
+#if defined(HAVE_PTHREAD)
+/** \brief Executor thread: run jobs from queue */
+static void * _crontab_worker_fund(UNUSED void * arg)
+{
+  wzd_cronjob_t * job;
+
+  pthread_mutex_lock(&_crontab_queue_mutex);
+  while (1) {
+    while (_crontab_queue_count == 0 && _crontab_running)
+      pthread_cond_wait(&_crontab_queue_cond, &_crontab_queue_mutex);
+    if (!_crontab_running) break;
+
+    job = _crontab_queue[_crontab_queue_head];
+    _crontab_queue_head = (_crontab_queue_head + 1) % HARD_CRONTAB_QUEUE_SIZE;
+    _crontab_queue_count--;
+    pthread_mutex_unlock(&_crontab_queue_mutex);
+
+    _cronjob_execute(job, _crontab_list);
+
+    pthread_mutex_lock(&_crontab_queue_mutex);
+  }
+  pthread_mutex_unlock(&_crontab_queue_mutex);
+
+  return NULL;
+}
+
+/** \brief Give \a job to executors
+ *
+ * Must be called with SET_MUTEX_CRONTAB locked, after _cronjob_try_start().
+ */
+static void _crontab_dispatch(wzd_cronjob_t * job)
+{
+  pthread_mutex_lock(&_crontab_queue_mutex);
+  if (_crontab_queue_count >= HARD_CRONTAB_QUEUE_SIZE) {
+    pthread_mutex_unlock(&_crontab_queue_mutex);
+    out_log(LEVEL_HIGH,"cron job %s: all executors are busy, skipping this execution\n",
+        (job->hook->external_command) ? job->hook->external_command : "(null)");
+    job->running--;
+    job->skipped++;
+    return;
+  }
+  _crontab_queue[(_crontab_queue_head + _crontab_queue_count) % HARD_CRONTAB_QUEUE_SIZE] = job;
+  _crontab_queue_count++;
+  pthread_cond_signal(&_crontab_queue_cond);
+  pthread_mutex_unlock(&_crontab_queue_mutex);
+}
+#endif /* HAVE_PTHREAD */
+
 /** \brief Start crontab thread */
 int crontab_start(wzd_cronjob_t ** crontab)
 {
   int ret;
+  wzd_cronjob_t * job;
 
   if (_crontab_running) {
     out_log(LEVEL_NORMAL,"INFO attempt to start crontab twice\n");
@@ -378,7 +703,31 @@ int crontab_start(wzd_cronjob_t ** crontab)
   }
 
   out_log(LEVEL_NORMAL,"INFO starting crontab\n");
+
+  /* schedule existing jobs */
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  _crontab_list = crontab;
+  for (job = *crontab; job; job = job->next_cronjob) {
+    if (job->next_run != 0 && job->heap_index == CRONJOB_NOT_SCHEDULED)
+      _crontab_heap_push(job);
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+
+  _crontab_running = 1;
+
+#if defined(HAVE_PTHREAD)
+  while (_crontab_num_workers < HARD_CRONTAB_WORKERS) {
+    if (wzd_thread_create(&_crontab_workers[_crontab_num_workers], NULL, _crontab_worker_fund, NULL)) {
+      out_log(LEVEL_HIGH,"ERROR could not create cron executor thread\n");
+      break;
+    }
+    _crontab_num_workers++;
+  }
+#endif
+
   ret = wzd_thread_create(&_crontab_thread, NULL, _crontab_thread_fund, crontab);
+  if (ret)
+    _crontab_running = 0;
 
   return ret;
 }
@@ -396,22 +745,87 @@ int crontab_stop(void)
 
   _crontab_running = 0;
   out_log(LEVEL_INFO,"INFO waiting for crontab thread to exit\n");
+  _crontab_wakeup();
   wzd_thread_join(&_crontab_thread, &ret);
 
+#if defined(HAVE_PTHREAD)
+  /* executors finish their current job, queued jobs are dropped */
+  pthread_mutex_lock(&_crontab_queue_mutex);
+  pthread_cond_broadcast(&_crontab_queue_cond);
+  pthread_mutex_unlock(&_crontab_queue_mutex);
+  while (_crontab_num_workers > 0) {
+    _crontab_num_workers--;
+    wzd_thread_join(&_crontab_workers[_crontab_num_workers], &ret);
+  }
+
+  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+  pthread_mutex_lock(&_crontab_queue_mutex);
+  while (_crontab_queue_count > 0) {
+    _crontab_queue[_crontab_queue_head]->running--;
+    _crontab_queue_head = (_crontab_queue_head + 1) % HARD_CRONTAB_QUEUE_SIZE;
+    _crontab_queue_count--;
+  }
+  pthread_mutex_unlock(&_crontab_queue_mutex);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+#endif
+
   return 0;
 }
 
+#if defined(HAVE_PTHREAD)
 /* The main crontab thread.
  *
- * Checks for cron jobs each second.
+ * Sleeps until the first job of the heap is due, or until the heap is
+ * modified, then gives due jobs to the executors.
  * The parameter is the address of the cron job list.
+ */
+static void * _crontab_thread_fund(UNUSED void *param) {
+  wzd_cronjob_t * job;
+  unsigned long wakeups;
+  time_t now, deadline;
+  struct timespec ts;
+
+  while (_crontab_running) {
+    pthread_mutex_lock(&_crontab_wait_mutex);
+    wakeups = _crontab_wakeups;
+    pthread_mutex_unlock(&_crontab_wait_mutex);
+
+    (void)time(&now);
+
+    WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
+    while (_crontab_heap_count > 0 && _crontab_heap[0]->next_run <= now) {
+      job = _crontab_heap[0];
+      if (_cronjob_try_start(job) == 0)
+        _crontab_dispatch(job);
+      /* ONCE jobs are removed from the heap here, and freed by the executor */
+      _cronjob_reschedule(job, now);
+      if (job->next_run == 0 && job->running == 0)
+        _cronjob_remove(job, _crontab_list);
+    }
+    deadline = (_crontab_heap_count > 0) ? _crontab_heap[0]->next_run : 0;
+    WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
+
+    pthread_mutex_lock(&_crontab_wait_mutex);
+    if (_crontab_running && wakeups == _crontab_wakeups) {
+      if (deadline) {
+        ts.tv_sec = deadline;
+        ts.tv_nsec = 0;
+        pthread_cond_timedwait(&_crontab_wait_cond, &_crontab_wait_mutex, &ts);
+      } else
+        pthread_cond_wait(&_crontab_wait_cond, &_crontab_wait_mutex);
+    }
+    pthread_mutex_unlock(&_crontab_wait_mutex);
+  };
+
+  return NULL;
+}
+#else /* HAVE_PTHREAD */
+/* The main crontab thread.
  *
- * \todo Optimize the wait time by sleeping the exact time until the next job
- * (how to deal with crontab additions ?)
+ * Checks for cron jobs each second.
+ * The parameter is the address of the cron job list.
  */
 static void * _crontab_thread_fund(void *param) {
-  _crontab_running = 1;
-
   while (_crontab_running) {
 #ifndef WIN32
     sleep(1);
@@ -424,4 +838,4 @@ static void * _crontab_thread_fund(void *param) {
 
   return NULL;
 }
-
+#endif /* HAVE_PTHREAD */
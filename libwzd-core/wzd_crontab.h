@@ -25,6 +25,20 @@
 #ifndef __WZD_CRONTAB__
 #define __WZD_CRONTAB__
 
+/** \file wzd_crontab.h
+ * \brief Periodic jobs
+ *
+ * Jobs are kept in a list (fields are protected by SET_MUTEX_CRONTAB).
+ * When the crontab thread is started, it sleeps until the next job is due,
+ * and jobs are run by a pool of executor threads, so a slow job does not
+ * delay the others.
+ */
+
+/** \brief Allow a new execution of the job to start while the previous
+ * one is still running. By default, the new execution is skipped.
+ */
+#define CRONJOB_FLAG_ALLOW_OVERLAP	0x00000001
+
 typedef struct wzd_cronjob_t wzd_cronjob_t;
 struct wzd_cronjob_t {
   struct _wzd_hook_t * hook;
@@ -35,6 +49,18 @@ struct wzd_cronjob_t {
   char day_of_week[32];
   time_t next_run;
   wzd_cronjob_t * next_cronjob;
+
+  unsigned int flags;		/**< CRONJOB_FLAG_* */
+  unsigned int running;		/**< executions in progress */
+  unsigned int heap_index;	/**< position in scheduler, internal */
+
+  /* statistics */
+  unsigned long runs;		/**< number of executions */
+  unsigned long skipped;	/**< executions skipped because job was still running */
+  time_t last_run;		/**< start of the last execution */
+  unsigned long last_duration;	/**< duration of the last execution, in ms */
+  unsigned long max_duration;	/**< in ms */
+  unsigned long total_duration;	/**< in ms */
 };
 
 
@@ -49,8 +75,24 @@ int cronjob_add_once(wzd_cronjob_t ** crontab, int (*fn)(void), const char * com
 
 void cronjob_free(wzd_cronjob_t ** crontab);
 
+/** \brief Run all jobs of \a crontab which are due, in the current thread
+ */
 int cronjob_run(wzd_cronjob_t ** crontab);
 
+/** \brief Run job \a command of \a crontab now, in the current thread
+ *
+ * The next scheduled execution is not changed.
+ *
+ * \return 0 if ok, 1 if the job was skipped because it is already running,
+ * -1 if job was not found
+ */
+int cronjob_run_now(wzd_cronjob_t ** crontab, const char * command);
+
+/** \brief Set flags (CRONJOB_FLAG_*) of job \a command
+ * \return 0 if ok, -1 if job was not found
+ */
+int cronjob_set_flags(wzd_cronjob_t ** crontab, const char * command, unsigned int flags);
+
 /** \brief Start crontab thread */
 int crontab_start(wzd_cronjob_t ** crontab);
 
@@ -24,6 +24,9 @@
  * the source code for OpenSSL in the source distribution.
  */
 
+/* needed for splice() */
+#define _GNU_SOURCE
+
 #include "wzd_all.h"
 
 #ifndef WZD_USE_PCH
@@ -53,6 +56,14 @@
 
 #include <time.h>
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#endif
+
 
 #include "wzd_hardlimits.h"
 #include "wzd_structs.h"
@@ -62,12 +73,15 @@
 #include "wzd_ClientThread.h"
 #include "wzd_messages.h"
 #include "wzd_configfile.h"
+#include "wzd_configloader.h"
 #include "wzd_crc32.h"
 #include "wzd_events.h"
 #include "wzd_file.h"
 #include "wzd_libmain.h"
+#include "wzd_list.h"
 #include "wzd_mod.h"
 #include "wzd_data.h"
+#include "wzd_pasv.h"
 #include "wzd_socket.h"
 #include "wzd_threads.h"
 #include "wzd_user.h"
@@ -77,129 +91,48 @@
 /** \brief Close pasv connection (if opened) */
 void pasv_close(wzd_context_t * context)
 {
-  int ret;
-
-  if (context->pasv_socket >= 0) {
+  if (context->pasv_socket != (socket_t)-1) {
     FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    ret = socket_close(context->pasv_socket);
+    pasv_unlisten(context->pasv_socket, context->pasv_port);
     context->pasv_socket = -1;
   }
+  context->pasv_port = 0;
+  context->pasv_pooled = 0;
 }
 
-/** \brief Create a socket and bind it to a port in the PASV range
+/** \brief Get a socket listening on a port in the PASV range
  *
  * Any previously pasv socket is closed.
  * The socket is stored in context->pasv_socket
  *
- * \note this function relies on the fact that bind() does not modify the input structure
- *
  * \return the bound port, or -1 on error
  */
 int get_pasv_port(net_family_t family, wzd_context_t * context)
 {
-  int ret = -1;
   socket_t sock;
-  unsigned int port, count;
-  socklen_t len;
-#if defined(IPV6_SUPPORT)
-  struct sockaddr_in6 addr6;
-#endif
-  struct sockaddr_in addr4;
-
-  struct sockaddr * addr;
+  unsigned int port;
+  int pooled = 0;
+  wzd_user_t * user;
 
   /* close existing pasv connections */
-  if (context->pasv_socket != (socket_t)-1) {
-    FD_UNREGISTER(context->pasv_socket,"Client PASV socket");
-    socket_close(context->pasv_socket);
-    context->pasv_socket = -1;
-  }
-
-  count = mainConfig->pasv_high_range - mainConfig->pasv_low_range + 1;
-
-#if defined(IPV6_SUPPORT)
-  if (family == WZD_INET6) {
-    sock = socket(AF_INET6,SOCK_STREAM,0);
-    if (sock < 0) return -1;
-
-    addr = (struct sockaddr *)&addr6;
-    len = sizeof(addr6);
-    addr6.sin6_family = AF_INET6;
-    addr6.sin6_flowinfo = 0;
-    memset(&addr6.sin6_addr,0,16);
-  } else
-#endif
-  if (family == WZD_INET4) {
-    sock = socket(AF_INET,SOCK_STREAM,0);
-    if (sock < 0) return -1;
-
-    addr = (struct sockaddr *)&addr4;
-    len = sizeof(addr4);
-    addr4.sin_family = AF_INET;
-    if (mainConfig->pasv_ip[0] != 0) {
-      /* checks on pasv_ip are done when loading config */
-      memcpy(&addr4.sin_addr.s_addr,mainConfig->pasv_ip,4);
-    } else {
-      addr4.sin_addr.s_addr = htonl(INADDR_ANY);
-    }
-  }
-  else {
-    return -1;
-  }
-
-
-  /* first port is taken using random */
-  port = mainConfig->pasv_low_range;
-#ifndef WIN32
-  port = port + (random()) % count;
-#else
-  port = port + (rand()) % count;
-#endif
-
-  /* naive algorithm: try all ports sequentially */
-  while (count > 0) { /* use pasv range max */
-    /* memset(&sai,0,size); */
-#if defined(IPV6_SUPPORT)
-    if (family == WZD_INET6) {
-      addr6.sin6_port = htons((unsigned short)port);
-    } else
-#endif
-    {
-      addr4.sin_port = htons((unsigned short)port);
-    }
-
-    ret = bind(sock,addr,len);
-    if (ret == 0) break;
-
-    port++; /* retry with next port */
-    if (port >= mainConfig->pasv_high_range) {
-      /* see comment in libwzd-core/wzd_ClientThread.c for a potential problem
-       * (not really convinced of it anyway)
-       */
-      port = mainConfig->pasv_low_range;
-    }
-
-    WZD_ASSERT( port >= mainConfig->pasv_low_range && port <= mainConfig->pasv_high_range && port <= 65535 );
-
-    count--;
-  }
-
-  if (ret < 0) {
-    out_log(LEVEL_HIGH,"Could not bind to any port in the PASV range\n");
-    socket_close(sock);
-    return -1;
-  }
-
-  if (listen(sock,5 /* XXX backlog */) < 0) {
-    out_log(LEVEL_HIGH,"PASV: listen() operation failed\n");
-    socket_close(sock);
-    return -1;
-  }
+  pasv_close(context);
+
+  /* data connections on pooled sockets are only accepted from the client
+   * address, so users allowed to use FXP always get a new socket
+   */
+  user = GetUserByID(context->userid);
+  if (user && strchr(user->flags,FLAG_FXP_DISABLE))
+    sock = pasv_listen(family, &port, &pooled);
+  else
+    sock = pasv_listen(family, &port, NULL);
+  if (sock == (socket_t)-1) return -1;
 
   context->pasv_socket = sock;
+  context->pasv_port = port;
+  context->pasv_pooled = pooled;
   FD_REGISTER(context->pasv_socket,"Client PASV socket");
 
-  return port;
+  return (int)port;
 }
 
 void update_last_file(wzd_context_t * context)
@@ -241,10 +174,22 @@ out_err(LEVEL_FLOOD,"closing data connection fd: %d (control fd: %d)\n",context-
  */
 void data_end_transfer(int is_upload, int end_ok, wzd_context_t * context)
 {
+  /* the crc computed while receiving data can only be used by the
+   * EVENT_POSTUPLOAD handlers if the upload did not start at an offset
+   * (REST or APPE) and was not interrupted
+   */
+  if (!is_upload || !end_ok ||
+      lseek(context->current_action.current_file,0,SEEK_CUR) != (off_t)context->current_action.bytesnow)
+    context->last_file.crc_valid = 0;
+
   file_unlock(context->current_action.current_file);
   file_close(context->current_action.current_file, context);
   FD_UNREGISTER(context->current_action.current_file,"Client file (RETR or STOR)");
 
+  /* size and date of file have changed */
+  if (is_upload)
+    list_cache_invalidate_file(context->current_action.arg);
+
   out_xferlog(context,end_ok /* complete */);
   update_last_file(context);
 
@@ -275,6 +220,135 @@ void data_end_transfer(int is_upload, int end_ok, wzd_context_t * context)
   }
 }
 
+/** \brief Send next part of file on a cleartext (or kTLS) data connection,
+ * without copying data to userspace.
+ *
+ * Data is read from the current position of \a file, which is updated, so REST
+ * offsets are honoured.
+ *
+ * \return the number of bytes sent, 0 at end of file, -1 on error, or -2 if
+ * zero-copy is not supported for this file (nothing has been sent).
+ */
+static ssize_t _data_sendfile(socket_t sock, fd_t file, size_t length)
+{
+#ifdef HAVE_SYS_SENDFILE_H
+  ssize_t ret;
+  fd_set fds;
+  struct timeval tv;
+
+  while (1) {
+    ret = sendfile(sock, file, NULL, length);
+    if (ret >= 0) return ret;
+
+    switch (errno) {
+    case EINTR:
+      continue;
+    case EAGAIN:
+      /* data socket is non-blocking, wait until we can send */
+      FD_ZERO(&fds);
+      FD_SET(sock,&fds);
+      tv.tv_sec = HARD_XFER_TIMEOUT; tv.tv_usec = 0;
+      if (socket_select(sock + 1, NULL, &fds, NULL, &tv) <= 0) {
+        out_log(LEVEL_HIGH,"Timeout during sendfile\n");
+        return -1;
+      }
+      continue;
+    case EINVAL:
+    case ENOSYS:
+      return -2;
+    default:
+      out_log(LEVEL_HIGH,"Error during sendfile: %s\n",strerror(errno));
+      return -1;
+    }
+  }
+#else
+  return -2;
+#endif
+}
+
+/** \brief Receive next part of file from a cleartext (or kTLS) data
+ * connection, without copying data to userspace.
+ *
+ * Data is moved from the socket to \a pipe_fd, and then from the pipe to the
+ * current position of \a file, which is updated.
+ *
+ * If the file can not be written with splice(), data already received is
+ * copied from the pipe to the file through \a buffer (at least \a length
+ * bytes), and \a fallback is set: read/write must be used for the rest of
+ * the transfer.
+ *
+ * \return the number of bytes written, 0 at end of transfer, -1 on error, or
+ * -2 if zero-copy is not supported (nothing has been received).
+ */
+static ssize_t _data_splice(socket_t sock, int pipe_fd[2], fd_t file, char * buffer, size_t length, int * fallback)
+{
+#ifdef HAVE_SPLICE
+  ssize_t count, ret, done, n;
+  fd_set fds;
+  struct timeval tv;
+
+  while (1) {
+    count = splice(sock, NULL, pipe_fd[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (count >= 0) break;
+
+    switch (errno) {
+    case EINTR:
+      continue;
+    case EAGAIN:
+      /* data socket is non-blocking, wait until we can receive */
+      FD_ZERO(&fds);
+      FD_SET(sock,&fds);
+      tv.tv_sec = HARD_XFER_TIMEOUT; tv.tv_usec = 0;
+      if (socket_select(sock + 1, &fds, NULL, NULL, &tv) <= 0) {
+        out_log(LEVEL_HIGH,"Timeout during splice\n");
+        return -1;
+      }
+      continue;
+    case EINVAL:
+    case ENOSYS:
+      return -2;
+    default:
+      out_log(LEVEL_HIGH,"Error during splice: %s\n",strerror(errno));
+      return -1;
+    }
+  }
+
+  /* flush pipe to file, everything must be written */
+  done = 0;
+  while (done < count) {
+    ret = splice(pipe_fd[0], NULL, file, NULL, count - done, SPLICE_F_MOVE);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) break;
+    done += ret;
+  }
+
+  /* splice() is not supported for this file (or failed), data is still in
+   * the pipe and must not be lost
+   */
+  if (done < count) {
+    out_log(LEVEL_FLOOD,"splice to file failed (%s), using read/write\n",
+        (ret < 0) ? strerror(errno) : "short write");
+    *fallback = 1;
+    while (done < count) {
+      n = read(pipe_fd[0], buffer, count - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      ret = write(file, buffer, n);
+      if (ret != n) break;
+      done += n;
+    }
+    if (done < count) {
+      out_log(LEVEL_HIGH,"ERROR short write (%d bytes instead of %d)\n",(int)done,(int)count);
+      return -1;
+    }
+  }
+
+  return count;
+#else
+  return -2;
+#endif
+}
+
 socket_t data_set_fd(wzd_context_t * context, fd_set *fdr, fd_set *fdw, fd_set *fde)
 {
   unsigned int action;
@@ -316,6 +390,23 @@ socket_t data_set_fd(wzd_context_t * context, fd_set *fdr, fd_set *fdw, fd_set *
   return -1;
 }
 
+/** \brief Get the time to wait before the data connection can be used,
+ * according to bandwidth limits
+ * \return delay in microseconds, 0 if data can be transferred now
+ */
+unsigned long data_get_delay(wzd_context_t * context)
+{
+  if (!context) return 0;
+
+  switch (context->current_action.token) {
+  case TOK_RETR:
+    return limiter_get_delay(&context->current_dl_limiter);
+  case TOK_STOR:
+    return limiter_get_delay(&context->current_ul_limiter);
+  }
+  return 0;
+}
+
 socket_t data_check_fd(wzd_context_t * context, fd_set *fdr, fd_set *fdw, fd_set *fde)
 {
   unsigned int action;
@@ -352,37 +443,46 @@ int data_execute(wzd_context_t * context, wzd_user_t * user, fd_set *fdr, fd_set
 
   switch (action) {
   case TOK_RETR:
-    n = file_read(context->current_action.current_file,context->data_buffer,mainConfig->data_buffer_length);
-    if (n>0) {
+    /* cleartext data connections can be served directly from the page cache,
+     * and so can encrypted ones if the kernel handles TLS records */
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
-      if (context->tls_data_mode == TLS_CLEAR)
-        ret = clear_write(context->data_socket,context->data_buffer,(size_t)n,0,HARD_XFER_TIMEOUT,context);
-      else
+    if (context->tls_data_mode == TLS_CLEAR || tls_data_ktls(context,1))
+#else
+    if (context->write_fct == (write_fct_t)clear_write)
 #endif
-        ret = (context->write_fct)(context->data_socket,context->data_buffer,(unsigned int)n,0,HARD_XFER_TIMEOUT,context);
-      if (ret <= 0) {
-/*        out_log(LEVEL_INFO,"INFO error or timeout sending data\n");*/
-        /* error/timeout sending data */
-        data_end_transfer(0 /* is_upload */, 0 /* end_ok */, context);
+      n = (int)_data_sendfile(context->data_socket,context->current_action.current_file,mainConfig->data_buffer_length);
+    else
+      n = -2;
 
-        ret = send_message(426,context);
-
-        context->idle_time_start = time(NULL);
-        return 1;
+    if (n == -2) {
+      n = file_read(context->current_action.current_file,context->data_buffer,mainConfig->data_buffer_length);
+      if (n>0) {
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+        if (context->tls_data_mode == TLS_CLEAR)
+          ret = clear_write(context->data_socket,context->data_buffer,(size_t)n,0,HARD_XFER_TIMEOUT,context);
+        else
+#endif
+          ret = (context->write_fct)(context->data_socket,context->data_buffer,(unsigned int)n,0,HARD_XFER_TIMEOUT,context);
+        if (ret <= 0) n = -1;
       }
+    }
+    if (n < 0) {
+/*      out_log(LEVEL_INFO,"INFO error or timeout sending data\n");*/
+      /* error/timeout sending data */
+      data_end_transfer(0 /* is_upload */, 0 /* end_ok */, context);
+
+      ret = send_message(426,context);
+
+      context->idle_time_start = time(NULL);
+      return 1;
+    }
+    if (n>0) {
       context->current_action.bytesnow += n;
 
-      limiter_add_bytes(&mainConfig->global_dl_limiter,limiter_mutex,n,0);
-      limiter_add_bytes(&context->current_dl_limiter,limiter_mutex,n,0);
+      /* do not sleep here, the client loop waits for limiter delay */
+      (void)limiter_consume(&context->current_dl_limiter,n);
 
-      user->stats.bytes_dl_total += n;
-      if (user->ratio) {
-        /* make sure credits aren't decremented below 0 (credits is an unsigned number) */
-        if (user->credits >= n)
-          user->credits -= n;
-        else
-          user->credits = 0;
-      }
+      user_stats_add_bytes(user, 0 /* is_upload */, n);
       context->idle_time_data_start = server_time;
     } else { /* end */
       data_end_transfer(0 /* is_upload */, 1 /* end_ok */, context);
@@ -392,8 +492,8 @@ int data_execute(wzd_context_t * context, wzd_user_t * user, fd_set *fdr, fd_set
 out_err(LEVEL_INFO,"Send 226 message returned %d\n",ret);
 #endif
 
-      /* user will be invalidated */
-      backend_mod_user(mainConfig->backends->filename, user->uid, user, _USER_BYTESDL | _USER_CREDITS);
+      /* statistics are sent to the backend later */
+      backend_mod_user_deferred(user->uid, _USER_BYTESDL | _USER_CREDITS);
 
       context->current_action.token = TOK_UNKNOWN;
       context->idle_time_start = server_time;
@@ -412,17 +512,16 @@ out_err(LEVEL_INFO,"Send 226 message returned %d\n",ret);
       }
       context->current_action.bytesnow += n;
 
-      limiter_add_bytes(&mainConfig->global_ul_limiter,limiter_mutex,n,0);
-      limiter_add_bytes(&context->current_ul_limiter,limiter_mutex,n,0);
-
-      user->stats.bytes_ul_total += n;
-      if (user->ratio) {
-        /* make sure credits aren't incremented above ULLONG_MAX */
-        if (ULLONG_MAX - (user->ratio * n) <= user->credits)
-          user->credits = ULLONG_MAX;
-        else
-          user->credits += (user->ratio * n);
+      if (context->last_file.crc_valid) {
+        unsigned long crc = context->last_file.crc;
+        calc_crc32_buffer(context->data_buffer, &crc, (unsigned long)n);
+        context->last_file.crc = (u32_t)crc;
       }
+
+      /* do not sleep here, the client loop waits for limiter delay */
+      (void)limiter_consume(&context->current_ul_limiter,n);
+
+      user_stats_add_bytes(user, 1 /* is_upload */, n);
       context->idle_time_data_start = server_time;
     } else { /* consider it is finished */
       off_t current_position;
@@ -443,10 +542,10 @@ out_err(LEVEL_INFO,"Send 226 message returned %d\n",ret);
       /* we increment the counter of uploaded files at the end
        * of the upload
        */
-      user->stats.files_ul_total++;
+      user_stats_add_file(user, 1 /* is_upload */);
 
-      /* user will be invalidated */
-      backend_mod_user(mainConfig->backends->filename, user->uid, user, _USER_BYTESUL | _USER_CREDITS);
+      /* statistics are sent to the backend later */
+      backend_mod_user_deferred(user->uid, _USER_BYTESUL | _USER_CREDITS);
 
       context->current_action.token = TOK_UNKNOWN;
       context->idle_time_start = server_time;
@@ -465,7 +564,7 @@ void *do_local_retr(void * _context)
 
   struct timeval tv;
   fd_set fds_w;
-  int ret, err;
+  int ret;
   ssize_t count;
   fd_t file = context->current_action.current_file;
   socket_t maxfd = context->data_socket;
@@ -474,6 +573,8 @@ void *do_local_retr(void * _context)
   write_fct_t write_fct;
   unsigned long crc = 0;
   int auto_crc = 0;
+  int zero_copy;
+  off_t offset;
 
   _tls_store_context(context);
 
@@ -484,10 +585,19 @@ void *do_local_retr(void * _context)
 #endif
     write_fct = context->write_fct;
 
+  /* cleartext data connections can be served directly from the page cache */
+  zero_copy = (write_fct == (write_fct_t)clear_write);
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+  /* the kernel encrypts data itself when kTLS is active */
+  if (tls_data_ktls(context,1))
+    zero_copy = 1;
+#endif
+
   context->last_file.crc = 0;
-  ret = config_get_boolean(mainConfig->cfg_file, "GLOBAL", "auto crc", &err);
-  if (err == CF_OK && (ret)) {
-    auto_crc = 1;
+  {
+    const wzd_config_snapshot_t * snapshot = config_snapshot_acquire();
+    auto_crc = snapshot->auto_crc;
+    config_snapshot_release(snapshot);
   }
 
   do {
@@ -500,28 +610,41 @@ void *do_local_retr(void * _context)
     ret = socket_select(maxfd + 1, NULL, &fds_w, NULL, &tv);
 
     if (ret > 0) {
-      count = read(file, context->data_buffer, mainConfig->data_buffer_length);
-      if (count > 0) {
-        ret = (write_fct)(context->data_socket,context->data_buffer,(size_t)count,0,0,context);
+      if (zero_copy) {
+        offset = lseek(file, 0, SEEK_CUR);
+        count = _data_sendfile(context->data_socket, file, mainConfig->data_buffer_length);
+        if (count == -2) { /* not supported for this file, use read/write */
+          zero_copy = 0;
+          continue;
+        }
+        if (count < 0) goto _local_retr_exit;
+
+        /* data was not copied, read it back from the page cache to compute crc */
+        if (auto_crc && count > 0) {
+          if (pread(file, context->data_buffer, count, offset) == count) {
+            calc_crc32_buffer( context->data_buffer, &crc, count);
+          } else {
+            auto_crc = 0;
+            crc = 0;
+          }
+        }
+      } else {
+        count = read(file, context->data_buffer, mainConfig->data_buffer_length);
+        if (count > 0) {
+          ret = (write_fct)(context->data_socket,context->data_buffer,(size_t)count,0,0,context);
 
-        if (ret <= 0) goto _local_retr_exit;
+          if (ret <= 0) goto _local_retr_exit;
 
+          /* compute incremental crc32 for later use */
+          if (auto_crc) calc_crc32_buffer( context->data_buffer, &crc, count);
+        }
+      }
+      if (count > 0) {
         context->current_action.bytesnow += count;
 
-        limiter_add_bytes(&mainConfig->global_dl_limiter,limiter_mutex,count,0);
-        limiter_add_bytes(&context->current_dl_limiter,limiter_mutex,count,0);
+        limiter_add_bytes(&context->current_dl_limiter,NULL,count,0);
 
-        /* compute incremental crc32 for later use */
-        if (auto_crc) calc_crc32_buffer( context->data_buffer, &crc, count);
-
-        user->stats.bytes_dl_total += count;
-        if (user->ratio) {
-          /* make sure credits aren't decremented below 0 (credits is an unsigned number) */
-          if (user->credits >= count)
-            user->credits -= count;
-          else
-            user->credits = 0;
-        }
+        user_stats_add_bytes(user, 0 /* is_upload */, count);
         context->idle_time_data_start = server_time;
       } else {
         exit_ok = 1;
@@ -546,8 +669,8 @@ _local_retr_exit:
     ret = send_message(426,context);
   }
 
-  /* user will be invalidated */
-  backend_mod_user(mainConfig->backends->filename, user->uid, user, _USER_BYTESDL | _USER_CREDITS);
+  /* statistics are sent to the backend later */
+  backend_mod_user_deferred(user->uid, _USER_BYTESDL | _USER_CREDITS);
 
   context->current_action.token = TOK_UNKNOWN;
   context->idle_time_start = server_time;
@@ -566,7 +689,7 @@ void *do_local_stor(void * _context)
 
   struct timeval tv;
   fd_set fds_r;
-  int ret, err;
+  int ret;
   ssize_t count;
   fd_t file = context->current_action.current_file;
   socket_t maxfd = context->data_socket;
@@ -575,6 +698,11 @@ void *do_local_stor(void * _context)
   read_fct_t read_fct;
   unsigned long crc = 0;
   int auto_crc = 0;
+  int zero_copy = 0;
+  int fallback = 0;
+  int pipe_fd[2] = { -1, -1 };
+  int crc_fd = -1;
+  off_t offset;
 
   _tls_store_context(context);
 
@@ -585,10 +713,32 @@ void *do_local_stor(void * _context)
 #endif
     read_fct = context->read_fct;
 
-  context->last_file.crc = 0;
-  ret = config_get_boolean(mainConfig->cfg_file, "GLOBAL", "auto crc", &err);
-  if (err == CF_OK && (ret)) {
-    auto_crc = 1;
+#ifdef HAVE_SPLICE
+  /* cleartext data connections can be written directly to the file, and so
+   * can encrypted ones if the kernel decrypts TLS records (kTLS). A record
+   * which is not application data (e.g close_notify) makes splice() fail
+   * with EINVAL, and the transfer continues using read_fct.
+   */
+  if ((read_fct == (read_fct_t)clear_read
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+        || tls_data_ktls(context,0)
+#endif
+      ) && pipe(pipe_fd) == 0)
+    zero_copy = 1;
+#endif
+
+  /* set by do_stor() */
+  auto_crc = context->last_file.crc_valid;
+
+  /* file is opened write-only, data has to be read back using another descriptor */
+  if (zero_copy && auto_crc) {
+    crc_fd = open(context->current_action.arg, O_RDONLY);
+    if (crc_fd == -1) {
+      close(pipe_fd[0]);
+      close(pipe_fd[1]);
+      pipe_fd[0] = pipe_fd[1] = -1;
+      zero_copy = 0;
+    }
   }
 
   do {
@@ -601,32 +751,47 @@ void *do_local_stor(void * _context)
     ret = socket_select(maxfd + 1, &fds_r, NULL, NULL, &tv);
 
     if (ret > 0) {
-      count = (read_fct)(context->data_socket,context->data_buffer,mainConfig->data_buffer_length,0,0,context);
-      if (count > 0) {
-        ret = write(file, context->data_buffer, count);
-
-        if (ret <= 0) goto _local_stor_exit;
-        if (ret != count) {
-          out_log(LEVEL_HIGH,"ERROR short write (%d bytes instead of %d)\n",(int)ret,(int)count);
-          goto _local_stor_exit;
+      if (zero_copy) {
+        offset = lseek(file, 0, SEEK_CUR);
+        count = _data_splice(context->data_socket, pipe_fd, file, context->data_buffer, mainConfig->data_buffer_length, &fallback);
+        if (count == -2) { /* not supported, use read/write */
+          zero_copy = 0;
+          continue;
         }
-
+        if (count < 0) goto _local_stor_exit;
+        if (fallback) /* file can not be written with splice, use read/write */
+          zero_copy = 0;
+
+        /* data was not copied, read it back from the page cache to compute crc */
+        if (auto_crc && count > 0) {
+          if (pread(crc_fd, context->data_buffer, count, offset) == count) {
+            calc_crc32_buffer( context->data_buffer, &crc, count);
+          } else {
+            auto_crc = 0;
+            crc = 0;
+          }
+        }
+      } else {
+        count = (read_fct)(context->data_socket,context->data_buffer,mainConfig->data_buffer_length,0,0,context);
+        if (count > 0) {
+          ret = write(file, context->data_buffer, count);
+
+          if (ret <= 0) goto _local_stor_exit;
+          if (ret != count) {
+            out_log(LEVEL_HIGH,"ERROR short write (%d bytes instead of %d)\n",(int)ret,(int)count);
+            goto _local_stor_exit;
+          }
+
+          /* compute incremental crc32 for later use */
+          if (auto_crc) calc_crc32_buffer( context->data_buffer, &crc, count);
+        }
+      }
+      if (count > 0) {
         context->current_action.bytesnow += count;
 
-        limiter_add_bytes(&mainConfig->global_ul_limiter,limiter_mutex,count,0);
-        limiter_add_bytes(&context->current_ul_limiter,limiter_mutex,count,0);
+        limiter_add_bytes(&context->current_ul_limiter,NULL,count,0);
 
-        /* compute incremental crc32 for later use */
-        if (auto_crc) calc_crc32_buffer( context->data_buffer, &crc, count);
-
-        user->stats.bytes_ul_total += count;
-        if (user->ratio) {
-          /* make sure credits aren't incremented above ULLONG_MAX */
-          if (ULLONG_MAX - (user->ratio * count) <= user->credits)
-            user->credits = ULLONG_MAX;
-          else
-            user->credits += (user->ratio * count);
-        }
+        user_stats_add_bytes(user, 1 /* is_upload */, count);
         context->idle_time_data_start = server_time;
       } else {
         exit_ok = 1;
@@ -639,10 +804,18 @@ void *do_local_stor(void * _context)
   } while (1);
 
 _local_stor_exit:
+  if (pipe_fd[0] != -1) {
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+  }
+  if (crc_fd != -1)
+    close(crc_fd);
+
   if (exit_ok) { /* send header */
     off_t current_position;
 
     context->last_file.crc = crc;
+    context->last_file.crc_valid = auto_crc;
 
     /** If we don't resume a previous upload, we have to truncate the current file
      * or we won't be able to overwrite a file by a smaller one
@@ -653,7 +826,7 @@ _local_stor_exit:
     /* we increment the counter of uploaded files at the end
      * of the upload
      */
-    user->stats.files_ul_total++;
+    user_stats_add_file(user, 1 /* is_upload */);
   }
 
   file_unlock(context->current_action.current_file);
@@ -665,8 +838,8 @@ _local_stor_exit:
     ret = send_message(426,context);
   }
 
-  /* user will be invalidated */
-  backend_mod_user(mainConfig->backends->filename, user->uid, user, _USER_BYTESUL | _USER_CREDITS);
+  /* statistics are sent to the backend later */
+  backend_mod_user_deferred(user->uid, _USER_BYTESUL | _USER_CREDITS);
 
   context->current_action.token = TOK_UNKNOWN;
   context->idle_time_start = server_time;
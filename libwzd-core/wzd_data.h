@@ -28,6 +28,15 @@
 /** \brief Close pasv connection (if opened) */
 void pasv_close(wzd_context_t * context);
 
+/** \brief Get a socket listening on a port in the PASV range
+ *
+ * Any previously pasv socket is closed.
+ * The socket is stored in context->pasv_socket
+ *
+ * \return the bound port, or -1 on error
+ */
+int get_pasv_port(net_family_t family, wzd_context_t * context);
+
 /** \brief Close data connection (if opened) */
 void data_close(wzd_context_t * context);
 
@@ -38,6 +47,9 @@ void data_end_transfer(int is_upload, int end_ok, wzd_context_t * context);
 /* sets the correct fds and return the highest fd that was set or -1 */
 socket_t data_set_fd(wzd_context_t * context, fd_set *fdr, fd_set *fdw, fd_set *fde);
 
+/* returns the time (usec) to wait before data can be transferred, according to bandwidth limits */
+unsigned long data_get_delay(wzd_context_t * context);
+
 /* returns 1 if a set is ok, 0 if not fd set, -1 if error */
 socket_t data_check_fd(wzd_context_t * context, fd_set *fdr, fd_set *fdw, fd_set *fde);
 
@@ -69,10 +69,46 @@
 
 #endif /* WZD_USE_PCH */
 
+/** \brief Read owner and permissions of directory \a dirname from its own
+ * permission file
+ *
+ * This is a lighter version of file_stat(), for use when the caller already
+ * knows that \a dirname is a real directory (no VFS, no stat).
+ * \return a newly allocated structure, or NULL if directory has no entry
+ */
+static struct wzd_file_t * _dir_subdir_info(const char * dirname)
+{
+  char perm_filename[WZD_MAX_PATH+1];
+  struct wzd_permfile_t * permfile;
+  struct wzd_file_t * file = NULL;
+  size_t length;
+
+  length = strlen(dirname);
+  if (length + strlen(HARD_PERMFILE) + 2 > WZD_MAX_PATH) return NULL;
+
+  memcpy(perm_filename,dirname,length);
+  if (length == 0 || perm_filename[length-1] != '/') perm_filename[length++] = '/';
+  wzd_strncpy(perm_filename+length,HARD_PERMFILE,WZD_MAX_PATH-length);
+
+  permfile = permfile_acquire(perm_filename);
+  if (permfile) {
+    file = file_deep_copy(permfile_find_file(permfile,"."));
+    permfile_release(permfile);
+  }
+
+  return file;
+}
+
 struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
+{
+  return dir_open_ex(name, DIR_OPEN_FILES | DIR_OPEN_VFS, context);
+}
+
+struct wzd_dir_t * dir_open_ex(const char *name, unsigned int flags, wzd_context_t * context)
 {
   struct wzd_dir_t * _dir=NULL;
-  struct wzd_file_t * entry, * it, *itp, ** insertion_point;
+  struct wzd_file_t * entry, * it, ** insertion_point;
+  struct wzd_permfile_t * permfile = NULL;
   struct wzd_file_t * perm_list = NULL;
   wzd_vfs_t * vfs = mainConfig->vfs;
   short vfs_pad=0; /* is 1 if name has a trailing '/' */
@@ -81,16 +117,16 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
   char * ptr;
   const char * dir_filename;
   char buffer_file[WZD_MAX_PATH+1];
-  int ret;
+  char * buffer_name;
   unsigned short sorted = 0;
   unsigned long watchdog = 0;
 
-  fs_dir_t * dir;
+  fs_dir_t * dir = NULL;
   fs_fileinfo_t * finfo;
   fs_filestat_t st;
 
 
-  if ( fs_dir_open(name,&dir) ) return NULL;
+  if ( (flags & DIR_OPEN_FILES) && fs_dir_open(name,&dir) ) return NULL;
 
   if (name[strlen(name)-1] != '/') vfs_pad = 1;
 
@@ -98,35 +134,38 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
   _dir->dirname = path_getbasename(name,NULL); /** \bug XXX FIXME if name has a trailing /, this will return "" */
   _dir->first_entry = NULL;
 
-  length = strlen(name);
-  perm_file_name = malloc(length+strlen(HARD_PERMFILE)+2);
-  memcpy(perm_file_name,name,length);
-  ptr = perm_file_name + length - 1;
-  if ( *ptr != '/' ) { *++ptr = '/'; }
-  ptr++;
-  memcpy(ptr,HARD_PERMFILE,strlen(HARD_PERMFILE));
-  *(ptr + strlen(HARD_PERMFILE)) = '\0';
-
-  /* try to read permission file */
-  if ( (ret=readPermFile(perm_file_name,&perm_list)) && ret != E_FILE_NOEXIST)
-    { free(perm_file_name); free(_dir->dirname); free(_dir); return NULL; }
-  free(perm_file_name);
+  if (flags & DIR_OPEN_FILES) {
+    length = strlen(name);
+    perm_file_name = malloc(length+strlen(HARD_PERMFILE)+2);
+    memcpy(perm_file_name,name,length);
+    ptr = perm_file_name + length - 1;
+    if ( *ptr != '/' ) { *++ptr = '/'; }
+    ptr++;
+    memcpy(ptr,HARD_PERMFILE,strlen(HARD_PERMFILE));
+    *(ptr + strlen(HARD_PERMFILE)) = '\0';
+
+    /* try to read permission file (shared, must not be modified) */
+    permfile = permfile_acquire(perm_file_name);
+    perm_list = permfile_get_files(permfile);
+    free(perm_file_name);
+  }
 
   wzd_strncpy(buffer_file, name, WZD_MAX_PATH);
   length = strlen(buffer_file);
   if (length > 1 && buffer_file[length-1] != '/')
   { buffer_file[length] = '/'; buffer_file[++length] = '\0'; }
-  ptr = buffer_file + length;
+  buffer_name = buffer_file + length;
 
   insertion_point = &_dir->first_entry;
 
   /* loop on all directory entries and create child structs */
-  while ( !fs_dir_read(dir,&finfo) ) {
+  while ( dir && !fs_dir_read(dir,&finfo) ) {
     dir_filename = fs_fileinfo_getname(finfo);
 
     if (watchdog++ > MAX_DIRECTORY_ENTRIES) {
       out_log(LEVEL_HIGH, "watchdog: detected infinite loop in dir_open\n");
       fs_dir_close(dir);
+      permfile_release(permfile);
       return NULL;
     }
 
@@ -137,47 +176,32 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
         is_hidden_file(dir_filename) )
       continue;
 
-    /* search element in list */
-    it = perm_list;
-    itp = NULL;
-    entry = NULL;
-    while (it)
+    /* search element in list (copy it, perm_list is shared) */
+    entry = file_deep_copy(permfile_find_file(permfile,dir_filename));
+#ifdef WIN32
+    /* index is case-sensitive */
+    for (it = perm_list; !entry && it; it = it->next_file)
     {
       if ( ! DIRCMP(dir_filename,it->filename) )
-      {
-        /* remove from perm_list and insert at (*insertion_point) */
-        if (!itp) { /* first element */
-          entry = perm_list;
-          perm_list = perm_list->next_file;
-          entry->next_file = NULL;
-        } else {
-          entry = it;
-          itp->next_file = it->next_file;
-          it->next_file = NULL;
-        }
-        break;
-      }
-      itp = it;
-      it = it->next_file;
+        entry = file_deep_copy(it);
     }
+#endif
 
 
     if (!entry) { /* not listed in permission file */
 
       /* if entry is a directory, we must query dir for more infos */
-      wzd_strncpy(ptr, dir_filename, WZD_MAX_PATH- (ptr-buffer_file));
-      if (fs_file_lstat(buffer_file,&st)) {
+      if (fs_fileinfo_lstat(dir,finfo,&st)) {
         /* we have a big problem here ! */
         out_err(LEVEL_HIGH,"lstat(%s) FAILED ! (errno: %d %s)\n",dir_filename,errno,strerror(errno));
-        itp = it;
-        it = (it)?it->next_file:NULL;
         continue;
       }
-      if (S_ISDIR(st.mode)) {
+      if (S_ISDIR(st.mode) && !CFG_GET_OPTION(mainConfig,CFG_OPT_NO_LIST_SUBDIR_PERMS)) {
         /* if this is a dir, we look inside the directory for infos
          * NULL here is no problem, if will be handled by the next test
          */
-        entry = file_stat(buffer_file, context);
+        wzd_strncpy(buffer_name, dir_filename, WZD_MAX_PATH- (buffer_name-buffer_file));
+        entry = _dir_subdir_info(buffer_file);
         if (entry) { /* we correct the name (currently .) */
           wzd_strncpy(entry->filename, dir_filename, sizeof(entry->filename));
         }
@@ -194,9 +218,17 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
         entry->kind = FILE_NOTSET; /* can be reg file or symlink */
         entry->data = NULL;
         entry->next_file = NULL;
+        entry->stat = NULL;
       }
+      if (S_ISDIR(st.mode)) entry->kind = FILE_DIR;
     } /* not listed in permission file */
 
+    /* keep the result of lstat, so callers do not need to stat entry again */
+    if (!entry->stat && !fs_fileinfo_lstat(dir,finfo,&st)) {
+      entry->stat = wzd_malloc(sizeof(fs_filestat_t));
+      memcpy(entry->stat,&st,sizeof(fs_filestat_t));
+    }
+
     if (entry->kind == 3) {
       /* file exist AND is a symlink ?! */
     }
@@ -210,16 +242,17 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
     }
 
   } /* for all directory entries */
-  fs_dir_close(dir);
+  if (dir) fs_dir_close(dir);
 
   /* add vfs entries */
-  {
+  if (flags & DIR_OPEN_VFS) {
     wzd_user_t * user = GetUserByID(context->userid);
     char * buffer_vfs = wzd_malloc(WZD_MAX_PATH+1);
     while (vfs)
     {
       if (watchdog++ > MAX_DIRECTORY_ENTRIES) {
         out_log(LEVEL_HIGH, "watchdog: detected infinite loop in dir_open (in vfs)\n");
+        permfile_release(permfile);
         return NULL;
       }
 
@@ -245,6 +278,7 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
             entry->group[0] = '\0';
             entry->permissions = mainConfig->umask;
             entry->acl = NULL;
+            entry->stat = NULL;
           }
           wzd_strncpy(entry->filename,ptr,sizeof(entry->filename));
           entry->kind = FILE_VFS;
@@ -269,56 +303,35 @@ struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context)
   } /* add vfs entries */
 
   /* add symlinks */
-  {
-    it = perm_list;
-    itp = NULL;
-    while (it)
+  if (flags & DIR_OPEN_FILES) {
+    for (it = perm_list; it; it = it->next_file)
     {
       if (watchdog++ > MAX_DIRECTORY_ENTRIES) {
         out_log(LEVEL_HIGH, "watchdog: detected infinite loop in dir_open (in symlinks check)\n");
+        permfile_release(permfile);
         return NULL;
       }
 
-      if (it->kind == FILE_LNK)
-      {
-        entry = it;
+      if (it->kind != FILE_LNK) continue;
 
-        if (!itp) { /* first element */
-          it = perm_list = perm_list->next_file;
-        } else {
-          itp->next_file = it->next_file;
-          it = itp;
-        }
-        entry->next_file = NULL;
-        /* sorted insertion */
-        if (sorted) {
-          file_insert_sorted(entry,&_dir->first_entry);
-        } else {
-          (*insertion_point) = entry;
-          insertion_point = &entry->next_file;
-        }
-        if (it == perm_list) {
-          itp = NULL;
-          continue;
-        }
-      }
-      else
-      {
-        /** \todo warn user, useless entries in perm file. clean up ? */
-        if (strcmp(it->filename,".") &&
-          strcmp(it->filename,"..") &&
-          ! is_hidden_file(it->filename) )
-            out_log(LEVEL_FLOOD, "permission file for %s: useless entry %s\n", name, it->filename);
+      /* already added if it is present in the directory */
+      wzd_strncpy(buffer_name, it->filename, WZD_MAX_PATH- (buffer_name-buffer_file));
+      if (!fs_file_lstat(buffer_file,&st) && !is_hidden_file(it->filename)) continue;
+
+      entry = file_deep_copy(it);
+      /* sorted insertion */
+      if (sorted) {
+        file_insert_sorted(entry,&_dir->first_entry);
+      } else {
+        (*insertion_point) = entry;
+        insertion_point = &entry->next_file;
       }
-      itp = it;
-      it = it->next_file;
     }
   } /* add symlinks */
 
   _dir->current_entry = _dir->first_entry;
 
-  /** \todo these are useless entries */
-  free_file_recursive(perm_list);
+  permfile_release(permfile);
 
   return _dir;
 }
@@ -43,6 +43,19 @@ struct wzd_dir_t {
  */
 struct wzd_dir_t * dir_open(const char *name, wzd_context_t * context);
 
+/** dir_open() reads entries of the directory (including symlinks defined in
+ * permission file) */
+#define DIR_OPEN_FILES	0x01
+/** dir_open() adds VFS visible by the user of context */
+#define DIR_OPEN_VFS	0x02
+
+/** Open directory, reading only entries selected by flags (DIR_OPEN_FILES and/or
+ * DIR_OPEN_VFS), and returns corresponding struct, or NULL.
+ * name should be an absolute path. If DIR_OPEN_FILES is not set, the
+ * directory does not need to exist.
+ */
+struct wzd_dir_t * dir_open_ex(const char *name, unsigned int flags, wzd_context_t * context);
+
 /** Close the directory stream associated with dir and free all memory used by
  * this struct. The Directory stream descriptor is not available after this call.
  */
@@ -53,10 +53,13 @@
 #include "wzd_log.h"
 
 #include "wzd_cache.h"
+#include "wzd_cookie.h"
 #include "wzd_events.h"
+#include "wzd_fs.h"
 #include "wzd_messages.h"
 #include "wzd_misc.h"
 #include "wzd_mod.h"
+#include "wzd_spawn.h"
 #include "wzd_user.h"
 
 #include "wzd_debug.h"
@@ -85,7 +88,8 @@
 static void _event_free(wzd_event_t * event);
 static event_reply_t _event_print_file(const char *filename, wzd_context_t * context);
 
-static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context);
+static event_reply_t _event_exec(const char * commandline, wzd_context_t * context, unsigned long event_id);
+static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context, unsigned long event_id);
 
 void _cleanup_shell_command(char * buffer, size_t length);
 
@@ -215,7 +219,7 @@ int event_send(wzd_event_manager_t * mgr, u32_t event_id, unsigned int reply_cod
       if (event->callback) {
         ret = (event->callback)(args);
       } else {
-        ret = event_exec(args,context);
+        ret = _event_exec(args,context,event_id);
       }
       if (ret != EVENT_OK) return ret;
     }
@@ -235,6 +239,11 @@ static void _event_free(wzd_event_t * event)
 }
 
 event_reply_t event_exec(const char * commandline, wzd_context_t * context)
+{
+  return _event_exec(commandline, context, 0);
+}
+
+static event_reply_t _event_exec(const char * commandline, wzd_context_t * context, unsigned long event_id)
 {
   int ret;
   char buffer[1024];
@@ -270,7 +279,7 @@ event_reply_t event_exec(const char * commandline, wzd_context_t * context)
       /* call external command */
       _cleanup_shell_command(buffer, sizeof(buffer));
       out_log(LEVEL_INFO,"INFO calling external command [%s]\n",buffer);
-      ret = _event_exec_shell(buffer,context);
+      ret = _event_exec_shell(buffer,context,event_id);
       if (ret != 0) {
         reply_set_code(context,501);
         reply_push(context,"Error during external command");
@@ -284,50 +293,33 @@ event_reply_t event_exec(const char * commandline, wzd_context_t * context)
 
 static event_reply_t _event_print_file(const char *filename, wzd_context_t * context)
 {
-  wzd_cache_t * fp;
-  char * file_buffer;
-  unsigned int size, filesize;
-  u64_t sz64;
+  wzd_cookie_template_t * tpl;
+  fs_filestat_t s;
   wzd_user_t * user = GetUserByID(context->userid);
   wzd_group_t * group = GetGroupByID(user->groups[0]);
 
-  fp = wzd_cache_open(filename,O_RDONLY,0644);
-  if (!fp) {
+  if (fs_file_stat(filename,&s)) {
     send_message_raw("200 Inexistant file\r\n",context);
     return EVENT_ERROR;
   }
-  sz64 = wzd_cache_getsize(fp);
-  if (sz64 > INT_MAX) {
-    out_log(LEVEL_HIGH,"%s:%d couldn't allocate %" PRIu64 "bytes for file %s\n",__FILE__,__LINE__,sz64,filename);
-    wzd_cache_close(fp);
+  tpl = cookie_template_acquire_file(filename);
+  if (!tpl) {
+    out_log(LEVEL_HIGH,"Could not read file %s or file is not a valid template (%s:%d)\n",filename,__FILE__,__LINE__);
     send_message_raw("200 Internal error\r\n",context);
     return EVENT_ERROR;
   }
-  filesize = (unsigned int)sz64;
-  file_buffer = malloc(filesize+1);
-  if ( (size=(unsigned int)wzd_cache_read(fp,file_buffer,filesize))!=filesize )
-  {
-    out_log(LEVEL_HIGH,"Could not read file %s read %u instead of %u (%s:%d)\n",filename,size,filesize,__FILE__,__LINE__);
-    free(file_buffer);
-    wzd_cache_close(fp);
-    send_message_raw("200 Internal error\r\n",context);
-    return EVENT_ERROR;
-  }
-  file_buffer[filesize]='\0';
 
   send_message_raw("200-\r\n",context);
-  cookie_parse_buffer(file_buffer,user,group,context,NULL,0);
+  cookie_template_render(tpl,user,group,context,NULL,0);
   send_message_raw("200 Command OK\r\n",context);
 
-  wzd_cache_close(fp);
-
-  free(file_buffer);
+  cookie_template_release(tpl);
 
   return EVENT_OK;
 }
 
 #ifndef WIN32
-static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context)
+static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context, unsigned long event_id)
 {
 #if 0
   wzd_string_t * str, * commandname;
@@ -350,7 +342,7 @@ static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t *
   char buffer[1024];
   int ret;
   
-  p = wzd_popen(commandline);
+  p = wzd_popen_event(commandline, event_id);
   if (!p) {
 /*    out_log(LEVEL_HIGH,"Hook '%s': unable to popen\n",hook->external_command);*/
     out_log(LEVEL_INFO,"Failed command: '%s'\n",commandline);
@@ -365,6 +357,7 @@ static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t *
       send_message_raw(buffer,context);
     }
     fclose(file);
+    p->fdr = -1; /* closed by fclose */
   }
   else
   {
@@ -380,7 +373,7 @@ static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t *
 
 #else /* WIN32 */
 
-static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context)
+static event_reply_t _event_exec_shell(const char * commandline, wzd_context_t * context, UNUSED unsigned long event_id)
 {
   FILE * file;
   char buffer[WZD_BUFFER_LEN];
@@ -440,13 +433,37 @@ void _cleanup_shell_command(char * buffer, size_t length)
 #ifndef WIN32
 
 wzd_popen_t * wzd_popen(const char * command)
+{
+  return wzd_popen_event(command, 0);
+}
+
+wzd_popen_t * wzd_popen_event(const char * command, unsigned long event_id)
 {
   int p[2]; /* pipe contains: read,write */
   int child_pid;
   wzd_popen_t * ret = 0;
+  char * empty_env[] = { NULL };
+
+  ret = wzd_malloc(sizeof(wzd_popen_t));
+
+  /* try helper first, it avoids forking the server */
+  switch (spawn_command(event_id, command, 0, empty_env, &ret->job)) {
+    case 0:
+      ret->child_pid = ret->job.pid;
+      ret->fdr = ret->job.fd_out;
+      FD_REGISTER(ret->fdr,"Child process (popen)");
+      return ret;
+    case -1: /* helper not running */
+      break;
+    default:
+      wzd_free(ret);
+      return NULL;
+  }
+  ret->job.fd_status = -1;
 
   if (pipe(p)<0) {
     fprintf(stderr,"error during pipe: %d\n",errno);
+    wzd_free(ret);
     return NULL;
   }
 
@@ -457,8 +474,6 @@ wzd_popen_t * wzd_popen(const char * command)
     /* we won't write to the pipe */
     close(p[1]);
 
-    ret = wzd_malloc(sizeof(wzd_popen_t));
-
     ret->child_pid = child_pid;
     ret->fdr = p[0];
     FD_REGISTER(ret->fdr,"Child process (popen)");
@@ -491,10 +506,23 @@ event_reply_t wzd_pclose(wzd_popen_t * p)
   int status;
   int retcode;
 
-  close(p->fdr);
-  FD_UNREGISTER(p->fdr,"Child process (popen)");
+  if (p->fdr != -1) {
+    close(p->fdr);
+    FD_UNREGISTER(p->fdr,"Child process (popen)");
+  }
 
-  pid = waitpid(p->child_pid, &status, 0);
+  if (p->job.fd_status != -1) {
+    /* started by helper, which sends the status */
+    p->job.fd_out = -1;
+    status = spawn_wait(&p->job);
+    if (status == -1) {
+      out_log(LEVEL_NORMAL,"INFO could not get status of spawned process %d\n",p->child_pid);
+      wzd_free(p);
+      return EVENT_ERROR;
+    }
+  } else {
+    pid = waitpid(p->child_pid, &status, 0);
+  }
 
   if (WIFEXITED(status)) {
     out_log(LEVEL_FLOOD,"DEBUG spawned process %d exited with status %d\n",p->child_pid,WEXITSTATUS(status));
@@ -563,7 +591,7 @@ static void _argv_add_char(char **string, const char* str, int pos)
   (*string)[len+1] = '\0';
 }
 
-static void _argv_parse(const char *command, char ***argv)
+void event_argv_parse(const char *command, char ***argv)
 {
   int i, argc;
 
@@ -620,7 +648,7 @@ int my_spawn_nowait(const char * command)
   int ret = -1;
 
   /* parse argv */
-  _argv_parse(command, &argv);
+  event_argv_parse(command, &argv);
 
   /** \todo get env ? Use env to store reply code */
   envp = NULL;
@@ -49,16 +49,31 @@ enum event_reply_t {
 
 #ifndef WIN32
 
+#include "wzd_spawn.h"
+
 typedef struct wzd_popen_t wzd_popen_t;
 
 struct wzd_popen_t {
   int child_pid;
   int fdr;
+  wzd_spawn_job_t job; /**< job.fd_status is -1 if command was not started by the spawn helper */
 };
 
 wzd_popen_t * wzd_popen(const char * command);
+
+/** \brief Start \a command, using the spawn helper if it is running
+ *
+ * \a event_id is used for concurrency limits (see spawn_set_limit())
+ */
+wzd_popen_t * wzd_popen_event(const char * command, unsigned long event_id);
 event_reply_t wzd_pclose(wzd_popen_t * p);
 
+/** \brief Split \a command into a NULL-terminated array of arguments
+ *
+ * Quotes and backslashes are interpreted. The array must be freed by caller.
+ */
+void event_argv_parse(const char *command, char ***argv);
+
 #endif /* WIN32 */
 
 typedef event_reply_t (*event_function_t)(const char * args);
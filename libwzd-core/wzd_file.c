@@ -128,6 +128,7 @@ typedef struct
 #include "wzd_fs.h"
 #include "wzd_group.h"
 #include "wzd_cache.h"
+#include "wzd_list.h"
 #include "wzd_perm.h"
 #include "wzd_user.h"
 #include "wzd_vfs.h"
@@ -146,8 +147,73 @@ typedef struct
 
 #define BUFFER_LEN	4096
 
+/** Minimum number of slots in a permission index (must be a power of 2) */
+#define PERM_INDEX_MIN_SIZE	16
+
+/** \brief Slot of ACL index: key is (file,user) */
+struct wzd_acl_slot_t {
+  const struct wzd_file_t * file;
+  wzd_acl_line_t * acl;
+};
+
+/** \brief Hash index on file names and ACL users of a permission list
+ *
+ * Entries are still stored in linked lists, which keep the insertion order
+ * used by writePermFile(); the index only references them. Tables use open
+ * addressing with linear probing, and are at most half full.
+ */
+struct wzd_perm_index_t {
+  struct wzd_file_t ** files;
+  unsigned int files_size;
+  unsigned int files_count;
+
+  struct wzd_acl_slot_t * acls;
+  unsigned int acls_size;
+  unsigned int acls_count;
+};
+
+/** Number of buckets in permission files cache */
+#define PERMFILE_CACHE_BUCKETS	256
+/** Max number of parsed permission files kept in cache */
+#define PERMFILE_CACHE_MAX	1024
+
+/** \brief Parsed permission file, shared by all readers
+ *
+ * Entries are never modified once they are in the cache: if the permission
+ * file changes, a new entry is created and the old one is freed when its last
+ * reader releases it.
+ */
+struct wzd_permfile_t {
+  char * filename;
+  unsigned long filename_hash;
+
+  /* used to detect changes */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+
+  struct wzd_file_t * files;
+  struct wzd_perm_index_t index;
+
+  unsigned int refcount;
+  unsigned short in_cache;
+  unsigned long last_use;
+
+  struct wzd_permfile_t * next_permfile;
+};
+
+static struct wzd_permfile_t * _permfile_cache[PERMFILE_CACHE_BUCKETS];
+static unsigned int _permfile_count = 0;
+static unsigned long _permfile_clock = 0;
+/* incremented each time a permission file is written */
+static unsigned long _permfile_generation = 0;
+
 /************ PRIVATE FUNCTIONS **************/
 
+static int _readPermFile(const char *permfile, struct wzd_file_t **pTabFiles, struct wzd_perm_index_t * index);
+
 /** \brief Get default permission for user
  * \param[in] wanted_right action to be evaluated
  * \param[in] user user definition
@@ -183,6 +249,7 @@ void free_file_recursive(struct wzd_file_t * file)
       } while (acl_current);
     }
     if (file->data) free(file->data);
+    if (file->stat) wzd_free(file->stat);
     wzd_free (file);
     file = next_file;
   } while (file);
@@ -346,6 +413,7 @@ static struct wzd_file_t * add_new_file(const char *name, const char *owner, con
   new_file->kind = FILE_NOTSET;
   new_file->data = NULL;
   new_file->next_file = NULL;
+  new_file->stat = NULL;
   if (*first == NULL) {
     *first = new_file;
   } else {
@@ -375,6 +443,10 @@ struct wzd_file_t * file_deep_copy(struct wzd_file_t *file_cur)
   memcpy(new_file, file_cur, sizeof(struct wzd_file_t));
   if (file_cur->data)
     new_file->data = strdup( (char*)file_cur->data ); /** \todo we do not know size */
+  if (file_cur->stat) {
+    new_file->stat = wzd_malloc(sizeof(fs_filestat_t));
+    memcpy(new_file->stat, file_cur->stat, sizeof(fs_filestat_t));
+  }
 
   if (file_cur->acl) {
     acl_new = malloc(sizeof(wzd_acl_line_t));
@@ -384,7 +456,7 @@ struct wzd_file_t * file_deep_copy(struct wzd_file_t *file_cur)
     acl_current = file_cur->acl->next_acl;
     while (acl_current) {
       acl_next = malloc(sizeof(wzd_acl_line_t));
-      memcpy(acl_next, file_cur->acl, sizeof(wzd_acl_line_t));
+      memcpy(acl_next, acl_current, sizeof(wzd_acl_line_t));
       acl_next->next_acl = NULL;
       acl_new->next_acl = acl_next;
       acl_new = acl_next;
@@ -442,6 +514,383 @@ static void addAcl(const char *filename, const char *user, const char *rights, s
   WZD_MUTEX_UNLOCK(SET_MUTEX_ACL_T);
 }
 
+/************ PERMISSION INDEX **************/
+
+/** \brief FNV-1a hash, \a h is the initial value */
+static unsigned long _perm_index_hash(const char * s, unsigned long h)
+{
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+#define PERM_INDEX_SEED	2166136261UL
+
+static unsigned long _perm_index_acl_hash(const struct wzd_file_t * file, const char * username)
+{
+  return _perm_index_hash(username, _perm_index_hash(file->filename, PERM_INDEX_SEED) ^ '/');
+}
+
+static void _perm_index_free(struct wzd_perm_index_t * index)
+{
+  wzd_free(index->files);
+  wzd_free(index->acls);
+  memset(index, 0, sizeof(struct wzd_perm_index_t));
+}
+
+static int _perm_index_grow_files(struct wzd_perm_index_t * index)
+{
+  struct wzd_file_t ** files;
+  unsigned int size, i, j;
+
+  size = (index->files_size) ? index->files_size * 2 : PERM_INDEX_MIN_SIZE;
+  files = wzd_malloc(size * sizeof(struct wzd_file_t *));
+  if (!files) return -1;
+  memset(files, 0, size * sizeof(struct wzd_file_t *));
+
+  for (i=0; i<index->files_size; i++) {
+    if (!index->files[i]) continue;
+    j = _perm_index_hash(index->files[i]->filename, PERM_INDEX_SEED) & (size-1);
+    while (files[j]) j = (j+1) & (size-1);
+    files[j] = index->files[i];
+  }
+
+  wzd_free(index->files);
+  index->files = files;
+  index->files_size = size;
+  return 0;
+}
+
+static int _perm_index_grow_acls(struct wzd_perm_index_t * index)
+{
+  struct wzd_acl_slot_t * acls;
+  unsigned int size, i, j;
+
+  size = (index->acls_size) ? index->acls_size * 2 : PERM_INDEX_MIN_SIZE;
+  acls = wzd_malloc(size * sizeof(struct wzd_acl_slot_t));
+  if (!acls) return -1;
+  memset(acls, 0, size * sizeof(struct wzd_acl_slot_t));
+
+  for (i=0; i<index->acls_size; i++) {
+    if (!index->acls[i].acl) continue;
+    j = _perm_index_acl_hash(index->acls[i].file, index->acls[i].acl->user) & (size-1);
+    while (acls[j].acl) j = (j+1) & (size-1);
+    acls[j] = index->acls[i];
+  }
+
+  wzd_free(index->acls);
+  index->acls = acls;
+  index->acls_size = size;
+  return 0;
+}
+
+/** \brief Find file \a name using index
+ * \return file, or NULL if not found
+ */
+static struct wzd_file_t * _perm_index_find_file(const struct wzd_perm_index_t * index, const char * name)
+{
+  unsigned int j;
+
+  if (!index->files_size) return NULL;
+
+  j = _perm_index_hash(name, PERM_INDEX_SEED) & (index->files_size-1);
+  while (index->files[j]) {
+    if (strcmp(name, index->files[j]->filename)==0)
+      return index->files[j];
+    j = (j+1) & (index->files_size-1);
+  }
+  return NULL;
+}
+
+/** \brief Add file to index. If a file with the same name is already
+ * present, the first one is kept (like find_file()).
+ */
+static int _perm_index_add_file(struct wzd_perm_index_t * index, struct wzd_file_t * file)
+{
+  unsigned int j;
+
+  if ( (index->files_count+1)*2 > index->files_size && _perm_index_grow_files(index) )
+    return -1;
+
+  j = _perm_index_hash(file->filename, PERM_INDEX_SEED) & (index->files_size-1);
+  while (index->files[j]) {
+    if (strcmp(file->filename, index->files[j]->filename)==0)
+      return 0;
+    j = (j+1) & (index->files_size-1);
+  }
+  index->files[j] = file;
+  index->files_count++;
+  return 0;
+}
+
+/** \brief Find ACL for \a username on \a file using index
+ * \return ACL, or NULL if not found
+ */
+static wzd_acl_line_t * _perm_index_find_acl(const struct wzd_perm_index_t * index, const struct wzd_file_t * file, const char * username)
+{
+  unsigned int j;
+
+  if (!index->acls_size) return NULL;
+
+  j = _perm_index_acl_hash(file, username) & (index->acls_size-1);
+  while (index->acls[j].acl) {
+    if (index->acls[j].file == file && strcmp(username, index->acls[j].acl->user)==0)
+      return index->acls[j].acl;
+    j = (j+1) & (index->acls_size-1);
+  }
+  return NULL;
+}
+
+static int _perm_index_add_acl(struct wzd_perm_index_t * index, const struct wzd_file_t * file, wzd_acl_line_t * acl)
+{
+  unsigned int j;
+
+  if ( (index->acls_count+1)*2 > index->acls_size && _perm_index_grow_acls(index) )
+    return -1;
+
+  j = _perm_index_acl_hash(file, acl->user) & (index->acls_size-1);
+  while (index->acls[j].acl) {
+    if (index->acls[j].file == file && strcmp(acl->user, index->acls[j].acl->user)==0)
+      return 0;
+    j = (j+1) & (index->acls_size-1);
+  }
+  index->acls[j].file = file;
+  index->acls[j].acl = acl;
+  index->acls_count++;
+  return 0;
+}
+
+/************ PERMISSION FILES CACHE **************/
+
+static void _permfile_free(struct wzd_permfile_t * permfile)
+{
+  free_file_recursive(permfile->files);
+  _perm_index_free(&permfile->index);
+  wzd_free(permfile->filename);
+  wzd_free(permfile);
+}
+
+/** \brief Find entry in cache
+ * \note SET_MUTEX_PERMFILE must be locked
+ */
+static struct wzd_permfile_t * _permfile_find(const char * filename, unsigned long hash)
+{
+  struct wzd_permfile_t * permfile;
+
+  permfile = _permfile_cache[hash % PERMFILE_CACHE_BUCKETS];
+  while (permfile) {
+    if (permfile->filename_hash == hash && strcmp(permfile->filename,filename)==0)
+      return permfile;
+    permfile = permfile->next_permfile;
+  }
+
+  return NULL;
+}
+
+/** \brief Remove entry from cache, and free it if it is not used
+ * \note SET_MUTEX_PERMFILE must be locked
+ */
+static void _permfile_remove(struct wzd_permfile_t * permfile)
+{
+  struct wzd_permfile_t ** it;
+
+  it = &_permfile_cache[permfile->filename_hash % PERMFILE_CACHE_BUCKETS];
+  while (*it) {
+    if (*it == permfile) {
+      *it = permfile->next_permfile;
+      break;
+    }
+    it = &(*it)->next_permfile;
+  }
+
+  permfile->next_permfile = NULL;
+  permfile->in_cache = 0;
+  _permfile_count--;
+
+  if (permfile->refcount == 0)
+    _permfile_free(permfile);
+}
+
+/** \brief Remove least recently used entry which is not currently used
+ * \note SET_MUTEX_PERMFILE must be locked
+ */
+static void _permfile_evict(void)
+{
+  struct wzd_permfile_t * permfile, * oldest = NULL;
+  unsigned int i;
+
+  for (i=0; i<PERMFILE_CACHE_BUCKETS; i++) {
+    for (permfile=_permfile_cache[i]; permfile; permfile=permfile->next_permfile) {
+      if (permfile->refcount == 0 && (!oldest || permfile->last_use < oldest->last_use))
+        oldest = permfile;
+    }
+  }
+
+  if (oldest) _permfile_remove(oldest);
+}
+
+/** \brief Get parsed permission file
+ *
+ * The permission file is parsed only if it is not in cache, or if it has been
+ * modified (size, mtime, ctime or inode changed).
+ *
+ * The returned structure is shared, and must not be modified. Use
+ * readPermFile() to get a private copy.
+ *
+ * \param[in] permfile full path to permission file
+ * \return a permission file, which must be released using permfile_release(),
+ * or NULL if the file does not exist
+ */
+struct wzd_permfile_t * permfile_acquire(const char * permfile)
+{
+  struct wzd_permfile_t * entry, * old;
+  struct wzd_file_t * files = NULL;
+  struct wzd_perm_index_t index;
+  struct stat s;
+  unsigned long hash, generation;
+
+  if (!permfile) return NULL;
+
+  hash = compute_hashval(permfile,strlen(permfile));
+
+  if (stat(permfile,&s)) {
+    /* file was removed */
+    WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+    entry = _permfile_find(permfile,hash);
+    if (entry) _permfile_remove(entry);
+    WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+    return NULL;
+  }
+
+  WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+  entry = _permfile_find(permfile,hash);
+  if (entry) {
+    if (entry->dev == s.st_dev && entry->ino == s.st_ino && entry->size == s.st_size
+        && entry->mtime == s.st_mtime && entry->ctime == s.st_ctime) {
+      /* HIT */
+      entry->refcount++;
+      entry->last_use = ++_permfile_clock;
+      WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+      return entry;
+    }
+    _permfile_remove(entry);
+  }
+  generation = _permfile_generation;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+
+  /* MISS: parse file without holding the lock */
+  memset(&index,0,sizeof(index));
+  if (_readPermFile(permfile,&files,&index)) {
+    free_file_recursive(files);
+    _perm_index_free(&index);
+    return NULL;
+  }
+
+  entry = wzd_malloc(sizeof(struct wzd_permfile_t));
+  entry->filename = wzd_strdup(permfile);
+  entry->filename_hash = hash;
+  entry->dev = s.st_dev;
+  entry->ino = s.st_ino;
+  entry->size = s.st_size;
+  entry->mtime = s.st_mtime;
+  entry->ctime = s.st_ctime;
+  entry->files = files;
+  entry->index = index;
+  entry->refcount = 1;
+  entry->in_cache = 0;
+  entry->next_permfile = NULL;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+  /* a permission file was written while parsing, we may have read old data:
+   * do not store entry, it will be freed on release
+   */
+  if (generation != _permfile_generation) {
+    WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+    return entry;
+  }
+  /* another thread may have parsed the same file in the meantime */
+  old = _permfile_find(permfile,hash);
+  if (old) _permfile_remove(old);
+  if (_permfile_count >= PERMFILE_CACHE_MAX)
+    _permfile_evict();
+  entry->in_cache = 1;
+  entry->last_use = ++_permfile_clock;
+  entry->next_permfile = _permfile_cache[hash % PERMFILE_CACHE_BUCKETS];
+  _permfile_cache[hash % PERMFILE_CACHE_BUCKETS] = entry;
+  _permfile_count++;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+
+  return entry;
+}
+
+/** \brief Get file list of a permission file
+ *
+ * The list must not be modified.
+ */
+struct wzd_file_t * permfile_get_files(struct wzd_permfile_t * permfile)
+{
+  return (permfile) ? permfile->files : NULL;
+}
+
+/** \brief Find entry for \a filename in a permission file
+ *
+ * Uses the hash index built when the file was parsed. The returned entry
+ * is shared and must not be modified.
+ */
+struct wzd_file_t * permfile_find_file(struct wzd_permfile_t * permfile, const char * filename)
+{
+  if (!permfile || !filename) return NULL;
+
+  return _perm_index_find_file(&permfile->index, filename);
+}
+
+/** \brief Release permission file returned by permfile_acquire() */
+void permfile_release(struct wzd_permfile_t * permfile)
+{
+  int must_free;
+
+  if (!permfile) return;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+  permfile->refcount--;
+  must_free = (permfile->refcount == 0 && !permfile->in_cache);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+
+  if (must_free) _permfile_free(permfile);
+}
+
+/** \brief Remove permission file from cache, it will be parsed again on next use */
+void permfile_invalidate(const char * permfile)
+{
+  struct wzd_permfile_t * entry;
+  unsigned long hash;
+
+  if (!permfile) return;
+
+  hash = compute_hashval(permfile,strlen(permfile));
+
+  WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+  _permfile_generation++;
+  entry = _permfile_find(permfile,hash);
+  if (entry) _permfile_remove(entry);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+}
+
+/** \brief Remove all entries from permission files cache */
+void permfile_cache_purge(void)
+{
+  unsigned int i;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_PERMFILE);
+  for (i=0; i<PERMFILE_CACHE_BUCKETS; i++) {
+    while (_permfile_cache[i])
+      _permfile_remove(_permfile_cache[i]);
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_PERMFILE);
+}
+
 /** Read permission file and decode it
  * \param[in] permfile full path to permission file
  * \param[out] pTabFiles address of linked list (which will be allocated) containing file permissions
@@ -449,15 +898,42 @@ static void addAcl(const char *filename, const char *user, const char *rights, s
  * \todo should be "atomic"
  */
 int readPermFile(const char *permfile, struct wzd_file_t **pTabFiles)
+{
+  struct wzd_perm_index_t index;
+  int ret;
+
+  memset(&index,0,sizeof(index));
+  ret = _readPermFile(permfile,pTabFiles,&index);
+  _perm_index_free(&index);
+
+  return ret;
+}
+
+/** \brief Read permission file, and fill \a index
+ *
+ * Files and ACLs are looked up using the index, so parsing is linear in the
+ * number of lines.
+ */
+static int _readPermFile(const char *permfile, struct wzd_file_t **pTabFiles, struct wzd_perm_index_t * index)
 {
   wzd_cache_t * fp;
   char line_buffer[BUFFER_LEN];
   struct wzd_file_t *current_file, *ptr_file;
+  struct wzd_file_t ** tail;
+  wzd_acl_line_t * acl_cur;
   char * token1, *token2, *token3, *token4, *token5, *token6;
   char *ptr;
 
   if ( !pTabFiles ) return E_PARAM_NULL;
 
+  /* index entries already present in list */
+  tail = pTabFiles;
+  for (current_file = *pTabFiles; current_file; current_file = current_file->next_file) {
+    _perm_index_add_file(index,current_file);
+    for (acl_cur = current_file->acl; acl_cur; acl_cur = acl_cur->next_acl)
+      _perm_index_add_acl(index,current_file,acl_cur);
+    tail = &current_file->next_file;
+  }
   current_file = *pTabFiles;
 
   WZD_MUTEX_LOCK(SET_MUTEX_DIRINFO);
@@ -481,9 +957,11 @@ int readPermFile(const char *permfile, struct wzd_file_t **pTabFiles)
     token4 = strtok_r(NULL," \t\r\n",&ptr);
     if (!token4) continue; /* malformed line */
     /* find file in  list */
-    ptr_file = find_file(token2,*pTabFiles);
+    ptr_file = _perm_index_find_file(index,token2);
     if (!ptr_file) {
-      ptr_file = add_new_file(token2,0,0,pTabFiles);
+      ptr_file = add_new_file(token2,0,0,tail);
+      tail = &ptr_file->next_file;
+      _perm_index_add_file(index,ptr_file);
     }
     if (strcmp(token1,"owner")==0) {
       token5 = strtok_r(NULL," \t\r\n",&ptr);
@@ -500,7 +978,14 @@ int readPermFile(const char *permfile, struct wzd_file_t **pTabFiles)
       }
     }
     else if (strcmp(token1,"perm")==0) {
-      addAcl(token2,token3,token4,ptr_file);
+      acl_cur = _perm_index_find_acl(index,ptr_file,token3);
+      if (acl_cur) { /* replace old perms */
+        strncpy(acl_cur->perms,token4,3);
+      } else {
+        addAcl(token2,token3,token4,ptr_file);
+        /* addAcl does head insertion */
+        _perm_index_add_acl(index,ptr_file,ptr_file->acl);
+      }
     }
     else if (strcmp(token1,"link")==0) {
       /** \todo FIXME handle links: set type to link, set destination, set owner/perms */
@@ -529,6 +1014,25 @@ int readPermFile(const char *permfile, struct wzd_file_t **pTabFiles)
   return E_OK;
 }
 
+/** \brief Remove listings showing entries of permission file from cache */
+static void _list_cache_invalidate_permfile(const char *permfile)
+{
+  char dirname[WZD_MAX_PATH+1];
+  char * ptr;
+
+  wzd_strncpy(dirname,permfile,sizeof(dirname));
+  ptr = strrchr(dirname,'/');
+  if (!ptr) return;
+  if (ptr == dirname) ptr++;
+  *ptr = '\0';
+
+  list_cache_invalidate(dirname);
+  /* owner and permissions of the directory itself are listed in its parent */
+  list_cache_invalidate_file(dirname);
+
+  checkpath_cache_invalidate();
+}
+
 /** \brief Write permission file
  * \param[in] permfile permission file full path
  * \param[in] pTabFiles address of linked list of permissions
@@ -544,9 +1048,13 @@ int writePermFile(const char *permfile, struct wzd_file_t **pTabFiles)
 
   file_cur = *pTabFiles;
 
+  permfile_invalidate(permfile);
+
   if ( !file_cur ) {
     /* delete permission file */
-    return unlink(permfile);
+    int ret = unlink(permfile);
+    _list_cache_invalidate_permfile(permfile);
+    return ret;
   }
 
   WZD_MUTEX_LOCK(SET_MUTEX_DIRINFO);
@@ -599,6 +1107,8 @@ int writePermFile(const char *permfile, struct wzd_file_t **pTabFiles)
 
   /* force cache update */
   wzd_cache_update(permfile);
+  permfile_invalidate(permfile);
+  _list_cache_invalidate_permfile(permfile);
 
   WZD_MUTEX_UNLOCK(SET_MUTEX_DIRINFO);
 
@@ -619,7 +1129,8 @@ int _checkFileForPerm(const char *dir, const char * wanted_file, unsigned long w
 {
   char perm_filename[WZD_MAX_PATH+1];
   size_t length, neededlength;
-  struct wzd_file_t * file_list=NULL, * file_cur;
+  struct wzd_permfile_t * permfile;
+  struct wzd_file_t * file_cur;
   wzd_acl_line_t * acl_cur;
   int ret;
   int is_dir;
@@ -643,16 +1154,16 @@ out_err(LEVEL_HIGH,"%s:%d\n",__FILE__,__LINE__);
 out_err(LEVEL_HIGH,"dir %s filename %s wanted file %s\n",dir,perm_filename,wanted_file);
 */
 
-  ret = readPermFile(perm_filename,&file_list);
-  if (ret) { /* no permissions file */
+  permfile = permfile_acquire(perm_filename);
+  if (!permfile) { /* no permissions file */
     return _default_perm(wanted_right,user);
   }
 
-  file_cur = find_file(wanted_file,file_list);
+  file_cur = permfile_find_file(permfile,wanted_file);
 
   if (file_cur) { /* wanted_file is in list */
     /* now find corresponding acl */
-    acl_cur = find_acl(user->username,file_cur);
+    acl_cur = _perm_index_find_acl(&permfile->index,file_cur,user->username);
 
     is_dir = ( strcmp(wanted_file,".")==0 );
 
@@ -684,8 +1195,7 @@ out_err(LEVEL_HIGH,"dir %s filename %s wanted file %s\n",dir,perm_filename,wante
               ret = 0;
           }
 /*	  out_err(LEVEL_HIGH,"user is file owner : %d !\n",ret);*/
-          free_file_recursive(file_list);
-          file_list = NULL;
+          permfile_release(permfile);
           return !ret;
         }
         for (i=0; i<user->group_num; i++) {
@@ -710,8 +1220,7 @@ out_err(LEVEL_HIGH,"dir %s filename %s wanted file %s\n",dir,perm_filename,wante
                 ret = 0;
             }
             /*	    out_err(LEVEL_HIGH,"user is in group : %d !\n",ret);*/
-            free_file_recursive(file_list);
-            file_list = NULL;
+            permfile_release(permfile);
             return !ret;
           }
         }
@@ -736,8 +1245,7 @@ out_err(LEVEL_HIGH,"dir %s filename %s wanted file %s\n",dir,perm_filename,wante
           ret = 0;
       }
 /*      out_err(LEVEL_HIGH,"user is in others : %d !\n",ret);*/
-      free_file_recursive(file_list);
-      file_list = NULL;
+      permfile_release(permfile);
       return !ret;
 
     }
@@ -765,13 +1273,11 @@ out_err(LEVEL_HIGH,"dir %s filename %s wanted file %s\n",dir,perm_filename,wante
       ret = -1; /* stupid right asked */
       break;
     }
-    free_file_recursive(file_list);
-    file_list = NULL;
+    permfile_release(permfile);
     return ret; /* stupid right asked */
   } else { /* ! in file_list */
     /* FIXME XXX search in parent dirs ???????? - group perms XXX FIXME */
-    free_file_recursive(file_list);
-    file_list = NULL;
+    permfile_release(permfile);
     return _default_perm(wanted_right,user);
   } /* ! in acl */
 
@@ -1459,6 +1965,8 @@ fd_t file_open(const char *filename, int mode, unsigned long wanted_right, wzd_c
         return -1;
       }
       file_lock(file,F_WRLCK);
+      list_cache_invalidate_file(filename);
+      checkpath_cache_invalidate();
     }
     else {
       if (is_locked) {
@@ -1504,8 +2012,12 @@ int file_mkdir(const char *dirname, unsigned int mode, wzd_context_t * context)
   ret = _checkPerm(dirname,RIGHT_MKDIR,user);
   if (ret) return E_NOPERM;
   ret = fs_mkdir(dirname,0755,&err);
+  if (ret) return E_COMMAND_FAILED;
 
-  return (ret) ? E_COMMAND_FAILED : E_OK;
+  list_cache_invalidate_file(dirname);
+  checkpath_cache_invalidate();
+
+  return E_OK;
 }
 
 /** @brief remove directory.
@@ -1565,11 +2077,20 @@ out_err(LEVEL_HIGH,"Removing directory '%s'\n",dirname);
   {
     fs_filestat_t s;
     fs_file_lstat(dirname,&s);
-    if (S_ISLNK(s.mode))
-      return unlink(dirname);
+    if (S_ISLNK(s.mode)) {
+      ret = unlink(dirname);
+      list_cache_invalidate_file(dirname);
+      checkpath_cache_invalidate();
+      return ret;
+    }
   }
 #endif
-  return rmdir(dirname);
+  ret = rmdir(dirname);
+  list_cache_invalidate(dirname);
+  list_cache_invalidate_file(dirname);
+  checkpath_cache_invalidate();
+
+  return ret;
 
 }
 
@@ -1606,6 +2127,12 @@ out_err(LEVEL_HIGH,"rename error %d (%s)\n", errno, strerror(errno));
     return 1;
   }
 
+  list_cache_invalidate(old_filename);
+  list_cache_invalidate_file(old_filename);
+  list_cache_invalidate(new_filename);
+  list_cache_invalidate_file(new_filename);
+  checkpath_cache_invalidate();
+
   return 0;
 }
 
@@ -1693,6 +2220,9 @@ out_err(LEVEL_HIGH,"remove error %d (%s)\n", errno, strerror(errno));
   }
   WZD_MUTEX_UNLOCK(SET_MUTEX_PERMISSION);
 
+  list_cache_invalidate_file(filename);
+  checkpath_cache_invalidate();
+
   return 0;
 }
 
@@ -1701,8 +2231,8 @@ wzd_user_t * file_getowner(const char *filename, wzd_context_t * context)
   char perm_filename[BUFFER_LEN];
   char stripped_filename[BUFFER_LEN];
   char * ptr;
-  int ret;
-  struct wzd_file_t * file_list=NULL, * file_cur;
+  struct wzd_permfile_t * permfile;
+  struct wzd_file_t * file_cur;
   size_t neededlength, length;
   fs_filestat_t s;
 
@@ -1740,30 +2270,18 @@ wzd_user_t * file_getowner(const char *filename, wzd_context_t * context)
   }
   strncpy(perm_filename+length,HARD_PERMFILE,neededlength);
 
-  /* remove name in perm file !! */
-  ret = readPermFile(perm_filename,&file_list);
-  if (!ret) {
+  permfile = permfile_acquire(perm_filename);
+  if (permfile) {
     /* we have a permission file */
-    file_cur = file_list;
-    while (file_cur)
+    file_cur = permfile_find_file(permfile,stripped_filename);
+    if (file_cur && file_cur->owner[0]!='\0')
     {
-      if (strcmp(stripped_filename,file_cur->filename)==0) {
-        if (file_cur->owner[0]!='\0')
-        {
-          wzd_user_t * user;
-          user = GetUserByName(file_cur->owner);
-          free_file_recursive(file_list);
-          return user;
-        }
-        else
-        {
-          free_file_recursive(file_list);
-          return GetUserByName("nobody");
-        }
-      }
-      file_cur = file_cur->next_file;
+      wzd_user_t * user;
+      user = GetUserByName(file_cur->owner);
+      permfile_release(permfile);
+      return user;
     }
-    free_file_recursive(file_list);
+    permfile_release(permfile);
   }
 
   return GetUserByName("nobody");
@@ -1849,7 +2367,8 @@ struct wzd_file_t * file_stat(const char *filename, wzd_context_t * context)
   char perm_filename[WZD_MAX_PATH+1];
   char stripped_filename[WZD_MAX_PATH+1];
   char * ptr;
-  struct wzd_file_t * file_list=NULL, * file_cur, *file;
+  struct wzd_permfile_t * permfile;
+  struct wzd_file_t * file_cur, *file;
   size_t neededlength, length;
   fs_filestat_t s;
   int nx=0;
@@ -1933,12 +2452,13 @@ struct wzd_file_t * file_stat(const char *filename, wzd_context_t * context)
   }
   wzd_strncpy(perm_filename+length,HARD_PERMFILE,neededlength);
 
-  if ( ! readPermFile(perm_filename,&file_list) ) {
+  permfile = permfile_acquire(perm_filename);
+  if (permfile) {
     /* we have a permission file */
-    file_cur = find_file(stripped_filename, file_list);
+    file_cur = permfile_find_file(permfile, stripped_filename);
     if (file_cur)
       file = file_deep_copy(file_cur);
-    free_file_recursive(file_list);
+    permfile_release(permfile);
   }
 
   if (!file && nx) return NULL;
@@ -1955,6 +2475,7 @@ struct wzd_file_t * file_stat(const char *filename, wzd_context_t * context)
     file->kind = FILE_NOTSET;
     file->data = NULL;
     file->next_file = NULL;
+    file->stat = NULL;
   }
 
   if (file) {
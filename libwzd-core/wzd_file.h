@@ -65,6 +65,7 @@ struct wzd_file_t {
   wzd_file_kind_t kind;
   void * data;
   struct wzd_file_t	*next_file;
+  struct fs_filestat_t	*stat;	/**< @brief lstat of file, if already known (or NULL) */
 };
 
 
@@ -112,6 +113,27 @@ int _setPerm(const char *filename, const char *granted_user, const char *owner,
 /** \brief Read permission file and decode it */
 int readPermFile(const char *permfile, struct wzd_file_t **pTabFiles);
 
+/** \brief Parsed permission file, shared between readers */
+struct wzd_permfile_t;
+
+/** \brief Get parsed permission file from cache */
+struct wzd_permfile_t * permfile_acquire(const char * permfile);
+
+/** \brief Get file list of a permission file */
+struct wzd_file_t * permfile_get_files(struct wzd_permfile_t * permfile);
+
+/** \brief Find entry for \a filename in a permission file, using hash index */
+struct wzd_file_t * permfile_find_file(struct wzd_permfile_t * permfile, const char * filename);
+
+/** \brief Release permission file returned by permfile_acquire() */
+void permfile_release(struct wzd_permfile_t * permfile);
+
+/** \brief Remove permission file from cache */
+void permfile_invalidate(const char * permfile);
+
+/** \brief Remove all entries from permission files cache */
+void permfile_cache_purge(void);
+
 void file_insert_sorted(struct wzd_file_t *entry, struct wzd_file_t **tab);
 
 /** \brief Copy file structure and members */
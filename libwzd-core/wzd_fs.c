@@ -63,6 +63,9 @@ struct fs_fileinfo_t {
 #ifdef WIN32
   wchar_t * wname;
 #endif
+
+  fs_filestat_t stat;
+  int stat_valid;	/**< @brief 1 if stat has been filled by fs_fileinfo_lstat() */
 };
 
 struct fs_dir_t {
@@ -130,6 +133,7 @@ int fs_dir_open(const char * pathname, fs_dir_t ** newdir)
   strncpy((*newdir)->dirname,pathname,strlen(pathname)+2);
   (*newdir)->handle = NULL;
   (*newdir)->finfo.name = NULL;
+  (*newdir)->finfo.stat_valid = 0;
 
   /* ensure pathname is / terminated */
   len = strlen(pathname);
@@ -236,6 +240,7 @@ int fs_dir_read(fs_dir_t * dir, fs_fileinfo_t **fileinfo)
   /* sanity check to make sure dir->finfo.name is actually allocated */
   if (dir->finfo.name) wzd_free(dir->finfo.name);
   dir->finfo.name = filename;
+  dir->finfo.stat_valid = 0;
 
 
   if (fileinfo)
@@ -244,6 +249,47 @@ int fs_dir_read(fs_dir_t * dir, fs_fileinfo_t **fileinfo)
   return 0;
 }
 
+/** \brief Get informations on directory entry, without following symlinks
+ *
+ * The open directory handle is used, so the path does not have to be resolved
+ * again by the kernel. The result is kept in \a finfo until the next call to
+ * fs_dir_read().
+ */
+int fs_fileinfo_lstat(fs_dir_t * dir, fs_fileinfo_t * finfo, fs_filestat_t * s)
+{
+  if (!dir || !finfo || !finfo->name) return -1;
+
+  if (!finfo->stat_valid) {
+#if !defined(WIN32) && defined(HAVE_FSTATAT) && defined(HAVE_DIRFD)
+    struct stat st;
+
+    if (!dir->handle) return -1;
+    if (fstatat(dirfd((DIR*)dir->handle),finfo->name,&st,AT_SYMLINK_NOFOLLOW)) return -1;
+    finfo->stat.size = (u64_t)st.st_size;
+    finfo->stat.mode = st.st_mode;
+    finfo->stat.mtime = st.st_mtime;
+    finfo->stat.ctime = st.st_ctime;
+    finfo->stat.nlink = st.st_nlink;
+#else
+    char * pathname;
+    size_t length;
+    int ret;
+
+    length = strlen(dir->dirname) + strlen(finfo->name) + 1;
+    pathname = wzd_malloc(length);
+    snprintf(pathname,length,"%s%s",dir->dirname,finfo->name);
+    ret = fs_file_lstat(pathname,&finfo->stat);
+    wzd_free(pathname);
+    if (ret) return -1;
+#endif
+    finfo->stat_valid = 1;
+  }
+
+  if (s) memcpy(s,&finfo->stat,sizeof(fs_filestat_t));
+
+  return 0;
+}
+
 /** \brief Get informations on file
  *
  * pathname must be an absolute path
@@ -83,6 +83,13 @@ int fs_file_lstat(const char *pathname, fs_filestat_t * s);
  */
 int fs_file_fstat(fd_t file, fs_filestat_t * s);
 
+/** \brief Get informations on directory entry \a finfo returned by fs_dir_read()
+ *
+ * Symlinks are not followed. The stat is done relative to the directory
+ * handle when possible, and is done only once per entry.
+ */
+int fs_fileinfo_lstat(fs_dir_t * dir, fs_fileinfo_t * finfo, fs_filestat_t * s);
+
 
 const char * fs_fileinfo_getname(fs_fileinfo_t * finfo);
 
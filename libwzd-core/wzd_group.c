@@ -63,6 +63,115 @@
 static gid_t _max_gid = 0;
 static wzd_group_t ** _group_array = NULL;
 
+/** \brief Entry of the group name index */
+struct _group_name_node_t {
+  unsigned long hash;
+  gid_t gid;
+  struct _group_name_node_t * next;
+  char name[HARD_GROUPNAME_LENGTH];
+};
+
+/* name index: buckets (the count is a power of 2), and node of each gid.
+ * Protected by SET_MUTEX_USER.
+ */
+static struct _group_name_node_t ** _group_name_buckets = NULL;
+static unsigned int _group_name_buckets_count = 0;
+static unsigned int _group_name_count = 0;
+static struct _group_name_node_t ** _group_name_nodes = NULL;
+
+/** \brief Double the number of buckets of the name index
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _group_index_grow(void)
+{
+  struct _group_name_node_t ** buckets;
+  struct _group_name_node_t * node, * next;
+  unsigned int count, i, index;
+
+  count = (_group_name_buckets_count) ? _group_name_buckets_count * 2 : HARD_NAME_INDEX_BUCKETS;
+  buckets = wzd_malloc(count * sizeof(struct _group_name_node_t *));
+  memset(buckets, 0, count * sizeof(struct _group_name_node_t *));
+
+  for (i=0; i<_group_name_buckets_count; i++) {
+    for (node = _group_name_buckets[i]; node; node = next) {
+      next = node->next;
+      index = node->hash & (count - 1);
+      node->next = buckets[index];
+      buckets[index] = node;
+    }
+  }
+
+  wzd_free(_group_name_buckets);
+  _group_name_buckets = buckets;
+  _group_name_buckets_count = count;
+}
+
+/** \brief Add \a gid to the name index, using its current name
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _group_index_add(gid_t gid)
+{
+  struct _group_name_node_t * node;
+  unsigned int index;
+
+  if (_group_name_count >= _group_name_buckets_count * 2)
+    _group_index_grow();
+
+  node = wzd_malloc(sizeof(struct _group_name_node_t));
+  wzd_strncpy(node->name, _group_array[gid]->groupname, sizeof(node->name));
+  node->hash = compute_hashval(node->name, strlen(node->name));
+  node->gid = gid;
+
+  index = node->hash & (_group_name_buckets_count - 1);
+  node->next = _group_name_buckets[index];
+  _group_name_buckets[index] = node;
+  _group_name_nodes[gid] = node;
+  _group_name_count++;
+}
+
+/** \brief Remove \a gid from the name index
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _group_index_remove(gid_t gid)
+{
+  struct _group_name_node_t * node, ** prev;
+
+  node = _group_name_nodes[gid];
+  if (!node) return;
+
+  prev = &_group_name_buckets[node->hash & (_group_name_buckets_count - 1)];
+  while (*prev && *prev != node)
+    prev = &(*prev)->next;
+  if (*prev) *prev = node->next;
+
+  _group_name_nodes[gid] = NULL;
+  _group_name_count--;
+  wzd_free(node);
+}
+
+/** \brief Find gid of group \a name in the name index
+ * \note SET_MUTEX_USER must be locked
+ * \return the gid, or -1
+ */
+static gid_t _group_index_find(const char * name)
+{
+  struct _group_name_node_t * node;
+  unsigned long hash;
+
+  if (_group_name_buckets_count == 0) return (gid_t)-1;
+
+  hash = compute_hashval(name, strlen(name));
+  for (node = _group_name_buckets[hash & (_group_name_buckets_count - 1)]; node; node = node->next) {
+    /* group can have been renamed in place, so we also check the registered name */
+    if (node->hash == hash && strcmp(node->name,name)==0
+        && _group_array[node->gid] != NULL
+        && strcmp(_group_array[node->gid]->groupname,name)==0)
+      return node->gid;
+  }
+
+  return (gid_t)-1;
+}
+
 /** \brief Allocate a new empty structure for a group
  */
 wzd_group_t * group_allocate(void)
@@ -194,15 +303,18 @@ gid_t group_register(wzd_group_t * group, u16_t backend_id)
 
   gid = group->gid;
 
-  if (gid >= _max_gid) {
+  if (_group_array == NULL || gid > _max_gid) {
     size_t size; /* size of extent */
+    size_t first = (_group_array) ? _max_gid + 1 : 0; /* first new slot */
 
     if (gid >= _max_gid + 255)
       size = gid - _max_gid;
     else
       size = 256;
     _group_array = wzd_realloc(_group_array, (_max_gid + size + 1)*sizeof(wzd_group_t*));
-    memset(_group_array + _max_gid, 0, (size+1) * sizeof(wzd_group_t*));
+    memset(_group_array + first, 0, (_max_gid + size + 1 - first) * sizeof(wzd_group_t*));
+    _group_name_nodes = wzd_realloc(_group_name_nodes, (_max_gid + size + 1)*sizeof(struct _group_name_node_t*));
+    memset(_group_name_nodes + first, 0, (_max_gid + size + 1 - first) * sizeof(struct _group_name_node_t*));
     _max_gid = _max_gid + size;
   }
 
@@ -214,6 +326,7 @@ gid_t group_register(wzd_group_t * group, u16_t backend_id)
 
   _group_array[gid] = group;
   group->backend_id = backend_id;
+  _group_index_add(gid);
 
   out_log(LEVEL_FLOOD,"DEBUG registered gid %d with backend %d\n",gid,backend_id);
 
@@ -239,8 +352,11 @@ int group_update(gid_t gid, wzd_group_t * new_group)
     if (_group_array[new_group->gid] != NULL) return -3;
   }
 
-  /* same group ? do nothing */
-  if (gid == new_group->gid && _group_array[gid] == new_group) return 0;
+  /* same group ? only the name may have changed */
+  if (gid == new_group->gid && _group_array[gid] == new_group) {
+    group_reindex(gid);
+    return 0;
+  }
 
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
   /* backup old group */
@@ -249,10 +365,12 @@ int group_update(gid_t gid, wzd_group_t * new_group)
   /* update group */
   *_group_array[gid] = *new_group;
   group_free(buffer);
+  _group_index_remove(gid);
   if (gid != new_group->gid) {
     _group_array[new_group->gid] = _group_array[gid];
     _group_array[gid] = NULL;
   }
+  _group_index_add(new_group->gid);
   WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 
   return 0;
@@ -274,6 +392,7 @@ wzd_group_t * group_unregister(gid_t gid)
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
 
   if (_group_array[gid] != NULL) {
+    _group_index_remove(gid);
     group = _group_array[gid];
     _group_array[gid] = NULL;
   }
@@ -293,11 +412,18 @@ void group_free_registry(void)
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
   if (_group_array != NULL) {
     for (gid=0; gid<=_max_gid; gid++) {
+      _group_index_remove(gid);
       group_free(_group_array[gid]);
     }
   }
   wzd_free(_group_array);
   _group_array = NULL;
+  wzd_free(_group_name_nodes);
+  _group_name_nodes = NULL;
+  wzd_free(_group_name_buckets);
+  _group_name_buckets = NULL;
+  _group_name_buckets_count = 0;
+  _group_name_count = 0;
   _max_gid = 0;
   WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 }
@@ -316,22 +442,36 @@ wzd_group_t * group_get_by_id(gid_t gid)
 
 /** \brief Get registered group using the \a name
  * \return The group, or NULL
- * \todo Re-implement the function using a hash table
  */
 wzd_group_t * group_get_by_name(const char * groupname)
 {
+  wzd_group_t * group = NULL;
   gid_t gid;
 
-  if (groupname == NULL || strlen(groupname)<1 || _max_gid==0) return NULL;
+  if (groupname == NULL || groupname[0] == '\0' || _max_gid==0) return NULL;
 
-  /* We don't need to lock the access since the _group_array can only grow */
-  for (gid=0; gid<=_max_gid; gid++) {
-    if (_group_array[gid] != NULL
-        && _group_array[gid]->groupname != NULL
-        && strcmp(groupname,_group_array[gid]->groupname)==0)
-      return _group_array[gid];
+  WZD_MUTEX_LOCK(SET_MUTEX_USER);
+  gid = _group_index_find(groupname);
+  if (gid != (gid_t)-1)
+    group = _group_array[gid];
+  WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
+
+  return group;
+}
+
+/** \brief Update name index after group \a gid has been modified in place
+ */
+void group_reindex(gid_t gid)
+{
+  if (gid == (gid_t)-1 || gid > _max_gid) return;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_USER);
+  if (_group_array[gid] != NULL &&
+      (_group_name_nodes[gid] == NULL || strcmp(_group_name_nodes[gid]->name,_group_array[gid]->groupname)!=0)) {
+    _group_index_remove(gid);
+    _group_index_add(gid);
   }
-  return NULL;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 }
 
 /** \brief Get list or groups register for a specific backend
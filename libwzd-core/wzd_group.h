@@ -94,6 +94,13 @@ wzd_group_t * group_get_by_id(gid_t gid);
  */
 wzd_group_t * group_get_by_name(const char * groupname);
 
+/** \brief Update name index after group \a gid has been modified in place
+ *
+ * This must be called if the name of a registered group is changed without
+ * using group_update(). backend_mod_group() does it.
+ */
+void group_reindex(gid_t gid);
+
 /** \brief Get list or groups register for a specific backend
  * The returned list is terminated by -1, and must be freed with wzd_free()
  */
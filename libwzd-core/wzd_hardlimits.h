@@ -32,11 +32,25 @@
 #define	DEFAULT_SERVER_TICK	1L
 #define	DEFAULT_CLIENT_TICK	10L
 
+/* number of workers when using the event loop */
+#define	DEFAULT_EVENT_WORKERS	16
+#define	DEFAULT_LOGIN_WORKERS	8
+#define	DEFAULT_HANDSHAKE_WORKERS	8
+/* maximum duration of the login sequence with the event loop (seconds) */
+#define	HARD_LOGIN_TIMEOUT	60
+
 #define	HARD_REACTION_TIME	1L
 
 /* FIXME should be a variable */
 #define	HARD_XFER_TIMEOUT	30L
 #define	HARD_IDENT_TIMEOUT	5
+/* maximum duration of a TLS handshake (seconds) */
+#define	HARD_TLS_HANDSHAKE_TIMEOUT	10
+/* default size of the TLS session cache (entries) and lifetime of
+ * cached sessions (seconds)
+ */
+#define	HARD_TLS_SESSION_CACHE_SIZE	1024
+#define	HARD_TLS_SESSION_TIMEOUT	300
 
 #define	TRFMSG_INTERVAL		1000000
 
@@ -66,8 +80,38 @@
 /* interval of time to commit backend */
 #define	HARD_COMMIT_BACKEND_INTVL	"*"
 
+/* number of users with statistics waiting to be sent to backend */
+#define	HARD_USER_PENDING_SLOTS	1024
+/* number of deferred user modifications before they are sent to backend */
+#define	HARD_USER_PENDING_FLUSH	256
+
+/* number of entries in the DNS cache used by ip checks */
+#define	HARD_DNS_CACHE_SIZE	1024
+/* time (in seconds) a resolved name is kept in the DNS cache */
+#define	HARD_DNS_CACHE_TTL	600
+/* time (in seconds) a failed lookup is kept in the DNS cache */
+#define	HARD_DNS_CACHE_NEGATIVE_TTL	60
+/* number of DNS lookups waiting for a resolver thread */
+#define	HARD_DNS_QUEUE_SIZE	64
+/* number of resolver threads */
+#define	HARD_DNS_RESOLVERS	2
+/* maximum time (in seconds) a login waits for the host name of the client */
+#define	HARD_DNS_LOGIN_WAIT	5
+
 #define	HARD_LS_BUFFERSIZE	4096
 
+/* number of directory listings kept in cache */
+#define	HARD_LIST_CACHE_SIZE	256
+/* time (in seconds) a directory listing is kept in cache */
+#define	HARD_LIST_CACHE_TTL	10
+/* directories with more entries are not cached */
+#define	HARD_LIST_CACHE_MAX_ENTRIES	8192
+
+/* number of resolved paths kept in cache, for each client */
+#define	HARD_CHECKPATH_CACHE_SIZE	64
+/* time (in seconds) a resolved path is kept in cache */
+#define	HARD_CHECKPATH_CACHE_TTL	5
+
 /** \brief Maximum number of entries the LIST command can return */
 #define MAX_DIRECTORY_ENTRIES   65535
 
@@ -87,4 +131,35 @@
 #define	HARD_USERNAME_LENGTH		256
 #define	HARD_GROUPNAME_LENGTH		128
 
+/* initial number of buckets of the user and group name indexes */
+#define	HARD_NAME_INDEX_BUCKETS		256
+
+/* maximum number of listening sockets kept for PASV */
+#define	HARD_PASV_POOL_SIZE		64
+/* maximum number of reserved ports tried, for one PASV command, if bind() fails */
+#define	HARD_PASV_BIND_RETRIES		16
+
+/* number of threads running cron jobs */
+#define	HARD_CRONTAB_WORKERS		2
+/* maximum number of cron jobs waiting for an executor */
+#define	HARD_CRONTAB_QUEUE_SIZE		32
+
+/* number of log rings (threads are spread over rings) */
+#define	HARD_LOG_RINGS			8
+/* number of messages in each log ring (must be a power of 2) */
+#define	HARD_LOG_RING_SIZE		128
+/* maximum length of a log message, longer messages are truncated */
+#define	HARD_LOG_LINE_SIZE		1024
+/* maximum number of messages written by a single writev() */
+#define	HARD_LOG_WRITEV			32
+
+/* number of event types with a limit of running external commands */
+#define	HARD_SPAWN_LIMITS		16
+/* maximum time (in seconds) to wait for a running command of the same type */
+#define	HARD_SPAWN_LIMIT_WAIT		10
+/* maximum size of command line and environment sent to the spawn helper */
+#define	HARD_SPAWN_REQUEST_SIZE		16384
+/* maximum time (in seconds) to wait for the reply of the spawn helper */
+#define	HARD_SPAWN_REPLY_TIMEOUT	5
+
 #endif /* __WZD_HARD_LIMITS__ */
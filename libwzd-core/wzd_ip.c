@@ -49,6 +49,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "wzd_structs.h"
 
@@ -58,14 +59,22 @@
 #include "wzd_log.h"
 #include "wzd_misc.h"
 #include "wzd_socket.h"
+#include "wzd_threads.h"
 #include "wzd_user.h"
 
 #include "wzd_debug.h"
 
 #endif /* WZD_USE_PCH */
 
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 #define MAX_NUMERIC_IP_LEN 64
 
+/* result of ip_rule_match() when a host name is not in the DNS cache yet */
+#define IP_MATCH_UNKNOWN  -2
+
 struct _wzd_ip_t {
   net_family_t family;
 
@@ -75,11 +84,110 @@ struct _wzd_ip_t {
   char raw[MAX_NUMERIC_IP_LEN];
 };
 
+/** \brief Numeric address, IPv4-mapped addresses are stored as IPv4 */
+struct ip_addr_t {
+  net_family_t family;
+  unsigned char bytes[16];
+};
+
+enum ip_rule_type_t {
+  IP_RULE_INVALID=0,
+  IP_RULE_NETWORK,   /* numeric address and prefix length */
+  IP_RULE_GLOB,      /* numeric address with wildcards */
+  IP_RULE_HOSTNAME,  /* host name, with or without wildcards */
+};
+
+struct wzd_ip_rule_t {
+  enum ip_rule_type_t type;
+  struct ip_addr_t addr;  /**< family is WZD_INET_NONE if rule matches all addresses */
+  unsigned int prefix;
+  int has_wildcards;
+  char * ident;           /**< NULL if rule has no ident part */
+  char * host;
+};
+
+struct ip_trie_node_t {
+  struct ip_trie_node_t * child[2];
+  int rule;               /**< index of the first rule for this network, or -1 */
+};
+
+struct ip_acl_entry_t {
+  int index;
+  struct wzd_ip_rule_t * rule;
+};
+
+struct wzd_ip_acl_t {
+  struct ip_trie_node_t * root4;
+  struct ip_trie_node_t * root6;
+  u8_t * allowed;         /**< is_allowed, for each rule index */
+
+  struct ip_acl_entry_t * others; /**< rules which are not in tries, sorted by index */
+  unsigned int others_count;
+};
+
+/* the DNS cache is split in sets of IP_DNS_WAYS entries */
+#define IP_DNS_WAYS       4
+#define IP_DNS_SETS       (HARD_DNS_CACHE_SIZE / IP_DNS_WAYS)
+/* maximum number of addresses kept for a host name */
+#define IP_DNS_MAX_ADDR   4
+#define IP_DNS_MAX_NAME   256
+
+enum ip_dns_kind_t {
+  IP_DNS_REVERSE=0,
+  IP_DNS_FORWARD,
+};
+
+enum ip_dns_state_t {
+  IP_DNS_EMPTY=0,
+  IP_DNS_PENDING,
+  IP_DNS_VALID,
+  IP_DNS_FAILED,
+};
+
+struct ip_dns_entry_t {
+  enum ip_dns_kind_t kind;
+  enum ip_dns_state_t state;
+  int queued;             /**< lookup is waiting for a resolver, entry must not be replaced */
+  time_t expires;
+
+  char name[IP_DNS_MAX_NAME];             /**< result of reverse lookup, or key of forward lookup */
+  unsigned int num_addr;
+  struct ip_addr_t addr[IP_DNS_MAX_ADDR]; /**< key of reverse lookup, or result of forward lookup */
+};
+
+static struct ip_dns_entry_t _dns_cache[HARD_DNS_CACHE_SIZE];
+
+#if defined(HAVE_PTHREAD)
+/* protects the DNS cache and the lookup queue */
+static pthread_mutex_t _dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _dns_cond = PTHREAD_COND_INITIALIZER;
+/* signaled when a lookup is done, for threads waiting for a name */
+static pthread_cond_t _dns_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long _dns_done_count = 0;
+
+static unsigned int _dns_queue[HARD_DNS_QUEUE_SIZE];
+static unsigned int _dns_queue_head = 0;
+static unsigned int _dns_queue_count = 0;
+static unsigned int _dns_resolvers = 0;
+
+#define IP_DNS_LOCK()   pthread_mutex_lock(&_dns_mutex)
+#define IP_DNS_UNLOCK() pthread_mutex_unlock(&_dns_mutex)
+#else
+#define IP_DNS_LOCK()
+#define IP_DNS_UNLOCK()
+#endif
+
 
 static int string_is_hostname(const char * s);
 static int string_is_ipv4(const char * s);
 static int string_is_ipv6(const char * s);
 
+static void ip_addr_normalize(struct ip_addr_t * addr);
+static int ip_list_find(struct wzd_ip_list_t *list, const char *ip, int check_ident, const char * ident, unsigned int timeout);
+static int ip_acl_find(const wzd_ip_acl_t *acl, const char *ip, int defer, unsigned int timeout);
+static int ip_dns_reverse(const struct ip_addr_t * addr, char * buffer, size_t length);
+static int ip_dns_forward_match(const char * name, const struct ip_addr_t * addr);
+
 
 /** \brief Allocate and initialize a new \a wzd_ip_t struct
  */
@@ -101,142 +209,336 @@ void ip_free(wzd_ip_t * ip)
 }
 
 
-/** \brief IP comparison
+/** \brief Convert a numeric ip to a \a ip_addr_t
  *
- * ip1 must be a numeric ip
- * ip2 can be composed of wildcards
+ * IPv4-mapped addresses are converted to IPv4.
  *
- * \note
- * The * wildcard will stop at the first match:
- *   1*0 will match 15.0 whereas 1*0 will not match 10.0
- *
- * \return 1 if identical
+ * \return the text to be used for wildcard matching, or NULL if \a ip is
+ * not a numeric address
  */
-int ip_compare(const char * ip, const char * pattern)
+static const char * ip_addr_parse(const char * ip, struct ip_addr_t * addr)
 {
-  char buffer1[256], buffer2[256];
-  const char *ptr;
-  int has_wildcards1=0, has_wildcards2=0;
-#ifndef IPV6_SUPPORT
-  struct hostent * host;
-#endif
+  memset(addr,0,sizeof(*addr));
 
-  if (!ip || !pattern) return 0;
+  if (strncmp(ip,"::ffff:",strlen("::ffff:"))==0 && strchr(ip,'.')!=NULL)
+    ip += strlen("::ffff:");
 
-  /* simple case */
-  if (strcmp(ip,pattern)==0) return 1;
+  if (inet_pton(AF_INET,ip,addr->bytes) == 1) {
+    addr->family = WZD_INET4;
+    return ip;
+  }
+  if (inet_pton(AF_INET6,ip,addr->bytes) == 1) {
+    addr->family = WZD_INET6;
+    ip_addr_normalize(addr);
+    return ip;
+  }
 
-  has_wildcards1 = ( strpbrk(ip,"*?") != NULL );
-  has_wildcards2 = ( strpbrk(pattern,"*?") != NULL );
+  return NULL;
+}
 
-#ifndef IPV6_SUPPORT
-  if (!has_wildcards1 && !has_wildcards2) { /* no wildcards */
-    if (socket_getipbyname(ip, buffer1, sizeof(buffer1))) return 0;
+/** \brief Convert IPv4-mapped IPv6 addresses to IPv4
+ */
+static void ip_addr_normalize(struct ip_addr_t * addr)
+{
+  static const unsigned char v4mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
 
-    if (socket_getipbyname(pattern, buffer2, sizeof(buffer2))) return 0;
+  if (addr->family == WZD_INET6 && memcmp(addr->bytes,v4mapped,sizeof(v4mapped))==0) {
+    memmove(addr->bytes,addr->bytes+12,4);
+    memset(addr->bytes+4,0,12);
+    addr->family = WZD_INET4;
+  }
+}
 
-    if (memcmp(buffer1,buffer2,4)==0) /** and for IPv6 ?! */
-      return 1;
+/** \return 1 if the first \a prefix bits of \a a and \a b are the same
+ */
+static int ip_prefix_match(const unsigned char * a, const unsigned char * b, unsigned int prefix)
+{
+  unsigned int n = prefix / 8;
+  unsigned int bits = prefix % 8;
 
-    /* other aliases for host ?! */
+  if (memcmp(a,b,n) != 0) return 0;
+  if (bits && ((a[n] ^ b[n]) & (0xff << (8 - bits)) & 0xff)) return 0;
 
-    return 0;
-  } /* no wildcards */
+  return 1;
+}
 
-  if (has_wildcards1 && has_wildcards2) { /* wildcards in both strings ... I don't know what to do */
-    return 0;
+static void ip_lowercase(char * s)
+{
+  for ( ; *s; s++)
+    *s = tolower((unsigned char)*s);
+}
+
+/** \brief Parse a network in CIDR notation, like 10.0.0.0/8 or [fe80::]/10
+ *
+ * \return 0 if ok
+ */
+static int ip_rule_parse_network(struct wzd_ip_rule_t * rule, const char * host)
+{
+  char buffer[MAX_NUMERIC_IP_LEN];
+  const char * slash;
+  char * end;
+  unsigned long prefix, max_prefix;
+  size_t length;
+  unsigned int i;
+
+  slash = strchr(host,'/');
+  if (*host == '[') {
+    host++;
+    if (slash == host || *(slash-1) != ']') return -1;
+    length = slash - host - 1;
+  } else
+    length = slash - host;
+  if (length == 0 || length >= sizeof(buffer)) return -1;
+  memcpy(buffer,host,length);
+  buffer[length] = '\0';
+
+  if (!isdigit((unsigned char)*(slash+1))) return -1;
+  prefix = strtoul(slash+1,&end,10);
+  if (*end != '\0') return -1;
+
+  if (inet_pton(AF_INET,buffer,rule->addr.bytes) == 1) {
+    rule->addr.family = WZD_INET4;
+    max_prefix = 32;
+  } else if (inet_pton(AF_INET6,buffer,rule->addr.bytes) == 1) {
+    rule->addr.family = WZD_INET6;
+    max_prefix = 128;
+  } else
+    return -1;
+  if (prefix > max_prefix) return -1;
+
+  if (rule->addr.family == WZD_INET6 && prefix >= 96) {
+    ip_addr_normalize(&rule->addr);
+    if (rule->addr.family == WZD_INET4) prefix -= 96;
   }
 
-  if (has_wildcards1 && !has_wildcards2) { /* swap ip to have only wildcards in ip2 */
-    ptr = ip;
-    pattern = ip;
-    ip = ptr;
+  /* clear host part */
+  for (i=0; i<16; i++) {
+    if (prefix >= 8*(i+1)) continue;
+    if (prefix <= 8*i)
+      rule->addr.bytes[i] = 0;
+    else
+      rule->addr.bytes[i] &= (0xff << (8 - (prefix - 8*i))) & 0xff;
   }
+  rule->prefix = prefix;
 
-  /* here, only ip2 contains wildcards */
-  if (socket_getipbyname(ip, buffer1, sizeof(buffer1))) return 0;
+  return 0;
+}
 
-  /* try direct match: 127.0.0.1 vs 127.0.0.* */
-  if (my_str_compare(ip,pattern)==1)
-    return 1;
+/** \brief Parse an IPv4 wildcard on a byte boundary, like 192.168.*
+ *
+ * \return 0 if ok
+ */
+static int ip_rule_parse_wildcard(struct wzd_ip_rule_t * rule, const char * host)
+{
+  unsigned long value;
+  unsigned int i;
+  char * end;
+
+  for (i=0; i<4; i++) {
+    if (strcmp(host,"*")==0) {
+      rule->addr.family = WZD_INET4;
+      rule->prefix = 8*i;
+      return 0;
+    }
+    if (!isdigit((unsigned char)*host)) return -1;
+    value = strtoul(host,&end,10);
+    if (value > 255 || *end != '.') return -1;
+    rule->addr.bytes[i] = (unsigned char)value;
+    host = end+1;
+  }
 
-  /* try reverse lookup */
-  host = gethostbyaddr(buffer1,4,AF_INET); /** \todo will not work with IPv6 */
-  if (!host) return 0;
-  if (my_str_compare(host->h_name,pattern)==1)
-    return 1;
-#else /* IPV6_SUPPORT */
-  {
-    struct addrinfo aiHint;
-    struct addrinfo * aiList = NULL, * aiListPattern = NULL;
-    int retval;
+  return -1;
+}
 
-    if (strncmp(ip,"::ffff:",strlen("::ffff:"))==0)
-      ip += strlen("::ffff:");
+/** \brief Parse an ip rule ([ident@]host) and find how it must be matched
+ *
+ * The returned rule must be freed using wzd_free()
+ */
+static struct wzd_ip_rule_t * ip_rule_compile(const char * pattern)
+{
+  struct wzd_ip_rule_t * rule;
+  size_t length;
+  char * host, * ptr;
 
-    memset(&aiHint,0,sizeof(struct addrinfo));
-    aiHint.ai_family = AF_UNSPEC;
-    aiHint.ai_socktype = SOCK_STREAM;
-    aiHint.ai_protocol = IPPROTO_TCP;
-    memset(buffer1,0,sizeof(struct in6_addr));
-    memset(buffer2,0,sizeof(struct in6_addr));
+  length = strlen(pattern);
+  rule = wzd_malloc(sizeof(*rule) + length + 1);
+  memset(rule,0,sizeof(*rule));
+  host = (char*)(rule+1);
+  memcpy(host,pattern,length+1);
 
-    if (!has_wildcards1 && !has_wildcards2) { /* no wildcards */
-      retval = getaddrinfo(ip, NULL, &aiHint, &aiList);
-      if (retval) return 0;
-      memcpy(buffer1, aiList->ai_addr, aiList->ai_addrlen);
+  if ( (ptr = strchr(host,'@'))!=NULL ) {
+    *ptr = '\0';
+    rule->ident = host;
+    host = ptr+1;
+  }
+  rule->host = host;
+  rule->has_wildcards = ( strpbrk(host,"*?") != NULL );
+  length = strlen(host);
 
-      freeaddrinfo(aiList);
+  if (strcmp(host,"*")==0) {
+    /* all addresses, of all families */
+    rule->type = IP_RULE_NETWORK;
+  }
+  else if (strchr(host,'/') != NULL) {
+    if (ip_rule_parse_network(rule,host)==0)
+      rule->type = IP_RULE_NETWORK;
+  }
+  else if (!rule->has_wildcards && ip_addr_parse(host,&rule->addr) != NULL) {
+    rule->type = IP_RULE_NETWORK;
+    rule->prefix = (rule->addr.family == WZD_INET6) ? 128 : 32;
+  }
+  else if (rule->has_wildcards && strspn(host,"0123456789.*?") == length) {
+    if (ip_rule_parse_wildcard(rule,host)==0)
+      rule->type = IP_RULE_NETWORK;
+    else {
+      memset(&rule->addr,0,sizeof(rule->addr));
+      rule->addr.family = WZD_INET4;
+      rule->type = IP_RULE_GLOB;
+    }
+  }
+  else if (rule->has_wildcards && strchr(host,':') != NULL &&
+      strspn(host,"0123456789abcdefABCDEF:.*?") == length) {
+    rule->addr.family = WZD_INET6;
+    rule->type = IP_RULE_GLOB;
+  }
+  else {
+    ip_lowercase(host);
+    rule->type = IP_RULE_HOSTNAME;
+  }
 
-      retval = getaddrinfo(pattern, NULL, &aiHint, &aiListPattern);
-      if (retval) return 0;
-      memcpy(buffer2, aiListPattern->ai_addr, aiListPattern->ai_addrlen);
+  return rule;
+}
 
-      freeaddrinfo(aiListPattern);
+static int ip_rule_match_name(const struct wzd_ip_rule_t * rule, const char * name)
+{
+  if (rule->has_wildcards)
+    return (my_str_compare(name,rule->host)==1);
+  return (strcmp(name,rule->host)==0);
+}
 
-      if (memcmp(buffer1,buffer2,sizeof(struct in6_addr))==0)
+/** \brief Check if ip matches rule, ignoring ident
+ *
+ * \a addr is the numeric form of \a text, or NULL if \a text is not a
+ * numeric ip.
+ *
+ * \return 1 if ip matches, 0 if not, or IP_MATCH_UNKNOWN if a host name
+ * needed by the rule is not known yet
+ */
+static int ip_rule_match(const struct wzd_ip_rule_t * rule, const struct ip_addr_t * addr, const char * text)
+{
+  char name[IP_DNS_MAX_NAME];
+  int ret, ret_forward;
+
+  switch (rule->type) {
+    case IP_RULE_NETWORK:
+      if (addr == NULL) return 0;
+      if (rule->addr.family == WZD_INET_NONE) return 1;
+      if (rule->addr.family != addr->family) return 0;
+      return ip_prefix_match(addr->bytes,rule->addr.bytes,rule->prefix);
+    case IP_RULE_GLOB:
+      if (addr == NULL || rule->addr.family != addr->family) return 0;
+      return (my_str_compare(text,rule->host)==1);
+    case IP_RULE_HOSTNAME:
+      if (addr == NULL) { /* not an ip, compare names */
+        wzd_strncpy(name,text,sizeof(name));
+        ip_lowercase(name);
+        return ip_rule_match_name(rule,name);
+      }
+      ret = ip_dns_reverse(addr,name,sizeof(name));
+      if (ret == 0 && ip_rule_match_name(rule,name))
         return 1;
+      ret = (ret == IP_MATCH_UNKNOWN) ? IP_MATCH_UNKNOWN : 0;
+      if (!rule->has_wildcards) {
+        ret_forward = ip_dns_forward_match(rule->host,addr);
+        if (ret_forward != 0) return ret_forward;
+      }
+      return ret;
+    default:
+      return 0;
+  }
+}
 
-      /* other aliases for host ?! */
+/** \return 1 if \a ident is accepted by rule
+ */
+static int ip_rule_match_ident(const struct wzd_ip_rule_t * rule, const char * ident)
+{
+  if (rule->ident == NULL) return 1;
 
-      return 0;
-    } /* no wildcards */
+  /* if ident is NULL, we can still accept it if ident_ref is the wildcard * */
+  if (ident == NULL) return (strcmp(rule->ident,"*")==0);
 
-    if (has_wildcards1 && has_wildcards2) { /* wildcards in both strings ... I don't know what to do */
-      return 0;
-    }
+  return (my_str_compare(ident,rule->ident)==1);
+}
 
-    if (has_wildcards1 && !has_wildcards2) { /* swap ip to have only wildcards in ip2 */
-      ptr = ip;
-      pattern = ip;
-      ip = ptr;
-    }
+/** \brief Wait until the result of ip_rule_match() is known, or until
+ * \a deadline
+ */
+static int ip_rule_match_wait(const struct wzd_ip_rule_t * rule, const struct ip_addr_t * addr, const char * text, time_t deadline)
+{
+  int ret;
+#if defined(HAVE_PTHREAD)
+  unsigned long done_count;
+  struct timespec ts;
+
+  while (1) {
+    IP_DNS_LOCK();
+    done_count = _dns_done_count;
+    IP_DNS_UNLOCK();
+
+    ret = ip_rule_match(rule, addr, text);
+    if (ret != IP_MATCH_UNKNOWN || time(NULL) >= deadline) break;
+
+    ts.tv_sec = deadline;
+    ts.tv_nsec = 0;
+    IP_DNS_LOCK();
+    while (done_count == _dns_done_count && time(NULL) < deadline)
+      pthread_cond_timedwait(&_dns_done_cond, &_dns_mutex, &ts);
+    IP_DNS_UNLOCK();
+  }
+#else
+  ret = ip_rule_match(rule, addr, text);
+#endif
 
-    /* here, only ip2 contains wildcards */
-    retval = getaddrinfo(ip, NULL, &aiHint, &aiList);
-    if (retval) return 0;
-    memcpy(buffer1, aiList->ai_addr, aiList->ai_addrlen);
+  return ret;
+}
 
-    freeaddrinfo(aiList);
+/** \brief IP comparison
+ *
+ * ip should be a numeric ip
+ * pattern can be a numeric ip, a network (CIDR notation), a host name, and
+ * can be composed of wildcards
+ *
+ * Host names are checked using the DNS cache, so this function never blocks:
+ * if the name of \a ip is not known yet, host names will not match.
+ *
+ * \note
+ * The * wildcard will stop at the first match:
+ *   1*0 will match 15.0 whereas 1*0 will not match 10.0
+ *
+ * \return 1 if identical
+ */
+int ip_compare(const char * ip, const char * pattern)
+{
+  struct wzd_ip_rule_t * rule;
+  struct ip_addr_t addr;
+  const char * text;
+  int ret;
 
-    /* try direct match: 127.0.0.1 vs 127.0.0.* */
-    if (my_str_compare(ip,pattern)==1)
-      return 1;
+  if (!ip || !pattern) return 0;
 
-    /* try reverse lookup */
-    aiHint.ai_flags = AI_CANONNAME;
-    retval = getaddrinfo(ip, NULL, &aiHint, &aiList);
-    if (retval) return 0;
-    wzd_strncpy(buffer1, aiList->ai_canonname, sizeof(buffer1));
+  /* simple case */
+  if (strcmp(ip,pattern)==0) return 1;
 
-    freeaddrinfo(aiList);
+  rule = ip_rule_compile(pattern);
+  text = ip_addr_parse(ip,&addr);
 
-    if (my_str_compare(buffer1,pattern)==1)
-      return 1;
-  }
-#endif /* IPV6_SUPPORT */
+  ret = 0;
+  if (rule->ident == NULL)
+    ret = (ip_rule_match(rule, (text) ? &addr : NULL, (text) ? text : ip) == 1);
 
-  return 0;
+  wzd_free(rule);
+
+  return ret;
 }
 
 
@@ -245,16 +547,25 @@ int ip_compare(const char * ip, const char * pattern)
 int ip_add_check(struct wzd_ip_list_t **list, const char *newip, int is_allowed)
 {
   struct wzd_ip_list_t * new_ip_t, *insert_point;
+  struct wzd_ip_rule_t * rule;
 
   WZD_ASSERT( list != NULL );
 
   if (strlen(newip) < 1) return -1;
   if (strlen(newip) >= MAX_IP_LENGTH) return -1; /* upper limit for an hostname */
 
+  rule = ip_rule_compile(newip);
+  if (rule->type == IP_RULE_INVALID) {
+    out_log(LEVEL_NORMAL,"ERROR invalid ip or network %s\n",newip);
+    wzd_free(rule);
+    return -1;
+  }
+
   new_ip_t = malloc(sizeof(*new_ip_t));
   new_ip_t->regexp = wzd_strndup(newip,MAX_IP_LENGTH);
   new_ip_t->is_allowed = (is_allowed) ? 1 : 0;
   new_ip_t->next_ip = NULL;
+  new_ip_t->rule = rule;
 
   /* tail insertion, be aware that order is important */
   insert_point = *list;
@@ -277,20 +588,7 @@ int ip_add_check(struct wzd_ip_list_t **list, const char *newip, int is_allowed)
  */
 int ip_list_check(struct wzd_ip_list_t *list, const char *ip)
 {
-  struct wzd_ip_list_t * current_ip;
-  char * ptr_test;
-
-  current_ip = list;
-  while (current_ip) {
-    ptr_test = current_ip->regexp;
-    if (*ptr_test == '\0') return -1; /* ip has length 0 ! */
-
-    if (ip_compare(ip,ptr_test)==1) return current_ip->is_allowed;
-
-    current_ip = current_ip->next_ip;
-  } /* while current_ip */
-
-  return -1;
+  return ip_list_find(list, ip, 0, NULL, 0);
 }
 
 /** \brief Check if ip is allowed by list, comparing \a ident if present
@@ -298,32 +596,57 @@ int ip_list_check(struct wzd_ip_list_t *list, const char *ip)
  * \returns 1 if allowed, 0 if denied, -1 on error or if not found
  */
 int ip_list_check_ident(struct wzd_ip_list_t *list, const char *ip, const char * ident)
+{
+  return ip_list_find(list, ip, 1, ident, 0);
+}
+
+/** \brief Check if ip is allowed by list, waiting for host names
+ *
+ * \returns 1 if allowed, 0 if denied, -1 on error or if not found
+ */
+int ip_list_check_ident_wait(struct wzd_ip_list_t *list, const char *ip, const char * ident, unsigned int timeout)
+{
+  return ip_list_find(list, ip, 1, ident, timeout);
+}
+
+/** \brief Walk list and return is_allowed for the first rule matching ip
+ *
+ * If \a check_ident is 0, rules containing an ident are ignored.
+ *
+ * Host names which are not known are waited for at most \a timeout seconds.
+ * If still unknown, deny rules match and allow rules do not.
+ */
+static int ip_list_find(struct wzd_ip_list_t *list, const char *ip, int check_ident, const char * ident, unsigned int timeout)
 {
   struct wzd_ip_list_t * current_ip;
-  char buffer[1024];
-  const char * ptr;
-  const char * ident_ref, * ip_ref;
+  struct ip_addr_t addr;
+  const char * text;
+  time_t deadline;
+  int ret;
+
+  if (!ip) return -1;
+
+  text = ip_addr_parse(ip,&addr);
+  deadline = time(NULL) + timeout;
 
   for (current_ip = list; current_ip != NULL; current_ip = current_ip->next_ip) {
-    ip_ref = current_ip->regexp;
-
-    if ( (ptr = strchr(current_ip->regexp,'@'))!=NULL ) {
-      /* split regexp into ident_ref and ip_ref */
-      ip_ref = ptr+1;
-      strncpy(buffer,current_ip->regexp,(ptr-current_ip->regexp));
-      buffer[ptr-current_ip->regexp] = '\0';
-      ident_ref = buffer;
-      /* Check ident and exit if different */
-      if (ident == NULL) {
-        /* if ident is NULL, we can still accept it if ident_ref is the wildcard * */
-        if (strcmp(ident_ref,"*")!=0) continue;
-      } else {
-        if (my_str_compare(ident,ident_ref)!=1) continue;
-      }
+    WZD_ASSERT( current_ip->rule != NULL );
+    if (current_ip->rule == NULL) continue;
+
+    if (current_ip->rule->ident != NULL) {
+      if (!check_ident) continue;
+      /* Check ident and skip rule if different */
+      if (!ip_rule_match_ident(current_ip->rule,ident)) continue;
     }
 
     /* if the ident check is ok, check the ip */
-    if (ip_compare(ip,ip_ref)==1) return current_ip->is_allowed;
+    ret = ip_rule_match(current_ip->rule, (text) ? &addr : NULL, (text) ? text : ip);
+    if (ret == IP_MATCH_UNKNOWN && timeout > 0)
+      ret = ip_rule_match_wait(current_ip->rule, (text) ? &addr : NULL, (text) ? text : ip, deadline);
+    if (ret == IP_MATCH_UNKNOWN)
+      ret = (current_ip->is_allowed) ? 0 : 1;
+    if (ret)
+      return current_ip->is_allowed;
   }
 
   return -1;
@@ -342,6 +665,7 @@ int ip_remove(struct wzd_ip_list_t ** list, const char * ip)
   /* first ? */
   if (strcmp(current_ip->regexp, ip)==0) {
     *list = (*list)->next_ip;
+    wzd_free(current_ip->rule);
     wzd_free(current_ip->regexp);
     wzd_free(current_ip);
     return 0;
@@ -351,6 +675,7 @@ int ip_remove(struct wzd_ip_list_t ** list, const char * ip)
     if (strcmp(current_ip->next_ip->regexp,ip)==0) {
       free_ip = current_ip->next_ip;
       current_ip->next_ip = free_ip->next_ip;
+      wzd_free(free_ip->rule);
       wzd_free(free_ip->regexp);
       wzd_free(free_ip);
       return 0;
@@ -391,6 +716,7 @@ void ip_list_free(struct wzd_ip_list_t *list)
   while (current) {
     next = current->next_ip;
 
+    wzd_free(current->rule);
     free(current->regexp);
     free(current);
 
@@ -398,6 +724,498 @@ void ip_list_free(struct wzd_ip_list_t *list)
   }
 }
 
+static void ip_trie_insert(struct ip_trie_node_t ** root, const unsigned char * bytes, unsigned int prefix, int index)
+{
+  struct ip_trie_node_t ** node = root;
+  unsigned int i;
+
+  for (i=0; ; i++) {
+    if (*node == NULL) {
+      *node = wzd_malloc(sizeof(struct ip_trie_node_t));
+      (*node)->child[0] = (*node)->child[1] = NULL;
+      (*node)->rule = -1;
+    }
+    if (i == prefix) break;
+    node = &(*node)->child[ (bytes[i/8] >> (7 - i%8)) & 1 ];
+  }
+
+  /* rules are inserted in order, so keep the first one */
+  if ((*node)->rule < 0)
+    (*node)->rule = index;
+}
+
+/** \return index of the first rule matching address, or -1
+ */
+static int ip_trie_lookup(const struct ip_trie_node_t * node, const unsigned char * bytes, unsigned int bits)
+{
+  unsigned int i;
+  int best = -1;
+
+  for (i=0; node != NULL; i++) {
+    if (node->rule >= 0 && (best < 0 || node->rule < best))
+      best = node->rule;
+    if (i == bits) break;
+    node = node->child[ (bytes[i/8] >> (7 - i%8)) & 1 ];
+  }
+
+  return best;
+}
+
+static void ip_trie_free(struct ip_trie_node_t * node)
+{
+  if (node == NULL) return;
+
+  ip_trie_free(node->child[0]);
+  ip_trie_free(node->child[1]);
+  wzd_free(node);
+}
+
+/** \brief Compile \a list into a lookup structure
+ *
+ * \return the compiled list, or NULL if \a list is empty
+ */
+wzd_ip_acl_t * ip_acl_compile(struct wzd_ip_list_t *list)
+{
+  wzd_ip_acl_t * acl;
+  struct wzd_ip_list_t * current_ip;
+  struct wzd_ip_rule_t * rule;
+  unsigned int count;
+  int index;
+
+  count = 0;
+  for (current_ip = list; current_ip != NULL; current_ip = current_ip->next_ip)
+    count++;
+  if (count == 0) return NULL;
+
+  acl = wzd_malloc(sizeof(*acl));
+  memset(acl,0,sizeof(*acl));
+  acl->allowed = wzd_malloc(count * sizeof(u8_t));
+  acl->others = wzd_malloc(count * sizeof(struct ip_acl_entry_t));
+
+  for (current_ip = list, index = 0; current_ip != NULL; current_ip = current_ip->next_ip, index++) {
+    acl->allowed[index] = current_ip->is_allowed;
+
+    rule = ip_rule_compile(current_ip->regexp);
+    /* rules with ident are never checked by ip_list_check */
+    if (rule->type == IP_RULE_INVALID || rule->ident != NULL) {
+      wzd_free(rule);
+      continue;
+    }
+
+    if (rule->type == IP_RULE_NETWORK) {
+      if (rule->addr.family != WZD_INET6)
+        ip_trie_insert(&acl->root4, rule->addr.bytes, rule->prefix, index);
+      if (rule->addr.family != WZD_INET4)
+        ip_trie_insert(&acl->root6, rule->addr.bytes, rule->prefix, index);
+      wzd_free(rule);
+      continue;
+    }
+
+    acl->others[acl->others_count].index = index;
+    acl->others[acl->others_count].rule = rule;
+    acl->others_count++;
+  }
+
+  return acl;
+}
+
+/** \brief Check if ip is allowed by compiled list
+ *
+ * \returns 1 if allowed, 0 if denied, -1 on error or if not found, -2 if
+ * a host name is not known yet
+ */
+int ip_acl_check(const wzd_ip_acl_t *acl, const char *ip)
+{
+  return ip_acl_find(acl, ip, 1, 0);
+}
+
+/** \brief Check if ip is allowed by compiled list, waiting for host names
+ *
+ * \returns 1 if allowed, 0 if denied, -1 on error or if not found
+ */
+int ip_acl_check_wait(const wzd_ip_acl_t *acl, const char *ip, unsigned int timeout)
+{
+  return ip_acl_find(acl, ip, 0, timeout);
+}
+
+/** \brief Return is_allowed for the first rule of \a acl matching ip
+ *
+ * If \a defer is set, the function never blocks, and returns -2 as soon as
+ * a host name rule can not be decided. Else, host names are waited for at
+ * most \a timeout seconds, then deny rules match and allow rules do not.
+ */
+static int ip_acl_find(const wzd_ip_acl_t *acl, const char *ip, int defer, unsigned int timeout)
+{
+  struct ip_addr_t addr;
+  const char * text;
+  time_t deadline;
+  unsigned int i;
+  int best = -1;
+  int ret;
+
+  if (!acl || !ip) return -1;
+
+  text = ip_addr_parse(ip,&addr);
+  deadline = time(NULL) + timeout;
+  if (text != NULL) {
+    if (addr.family == WZD_INET6)
+      best = ip_trie_lookup(acl->root6, addr.bytes, 128);
+    else
+      best = ip_trie_lookup(acl->root4, addr.bytes, 32);
+  }
+
+  /* other rules are sorted, and only needed if they come before the network found */
+  for (i=0; i<acl->others_count; i++) {
+    if (best >= 0 && acl->others[i].index > best) break;
+    ret = ip_rule_match(acl->others[i].rule, (text) ? &addr : NULL, (text) ? text : ip);
+    if (ret == IP_MATCH_UNKNOWN) {
+      /* result depends on a host name, let the caller decide when to wait */
+      if (defer) return -2;
+      if (timeout > 0)
+        ret = ip_rule_match_wait(acl->others[i].rule, (text) ? &addr : NULL, (text) ? text : ip, deadline);
+    }
+    /* an unknown host name can not be allowed, but must be denied */
+    if (ret == IP_MATCH_UNKNOWN)
+      ret = (acl->allowed[acl->others[i].index]) ? 0 : 1;
+    if (ret) {
+      best = acl->others[i].index;
+      break;
+    }
+  }
+
+  if (best < 0) return -1;
+
+  return acl->allowed[best];
+}
+
+/** \brief Frees a compiled list
+ */
+void ip_acl_free(wzd_ip_acl_t *acl)
+{
+  unsigned int i;
+
+  if (!acl) return;
+
+  ip_trie_free(acl->root4);
+  ip_trie_free(acl->root6);
+  for (i=0; i<acl->others_count; i++)
+    wzd_free(acl->others[i].rule);
+  wzd_free(acl->others);
+  wzd_free(acl->allowed);
+  wzd_free(acl);
+}
+
+static unsigned int ip_dns_hash(enum ip_dns_kind_t kind, const struct ip_addr_t * addr, const char * name)
+{
+  unsigned int hash = 2166136261U; /* FNV-1a */
+  unsigned int i;
+
+  if (kind == IP_DNS_REVERSE) {
+    hash = (hash ^ addr->family) * 16777619U;
+    for (i=0; i<sizeof(addr->bytes); i++)
+      hash = (hash ^ addr->bytes[i]) * 16777619U;
+  } else {
+    for ( ; *name; name++)
+      hash = (hash ^ (unsigned char)*name) * 16777619U;
+  }
+
+  return hash;
+}
+
+static int ip_dns_key_equal(const struct ip_dns_entry_t * entry, enum ip_dns_kind_t kind, const struct ip_addr_t * addr, const char * name)
+{
+  if (entry->kind != kind) return 0;
+
+  if (kind == IP_DNS_REVERSE)
+    return (entry->addr[0].family == addr->family &&
+        memcmp(entry->addr[0].bytes,addr->bytes,sizeof(addr->bytes))==0);
+
+  return (strcmp(entry->name,name)==0);
+}
+
+/** \brief Run the lookup for \a entry (blocking)
+ *
+ * \return 0 if ok
+ */
+static int ip_dns_resolve(struct ip_dns_entry_t * entry)
+{
+  struct ip_addr_t * addr;
+
+  if (entry->kind == IP_DNS_REVERSE) {
+    union {
+      struct sockaddr sa;
+      struct sockaddr_in sin;
+      struct sockaddr_in6 sin6;
+    } sa;
+    socklen_t length;
+
+    addr = &entry->addr[0];
+    memset(&sa,0,sizeof(sa));
+    if (addr->family == WZD_INET6) {
+      sa.sin6.sin6_family = AF_INET6;
+      memcpy(&sa.sin6.sin6_addr,addr->bytes,16);
+      length = sizeof(struct sockaddr_in6);
+    } else {
+      sa.sin.sin_family = AF_INET;
+      memcpy(&sa.sin.sin_addr,addr->bytes,4);
+      length = sizeof(struct sockaddr_in);
+    }
+
+    if (getnameinfo(&sa.sa,length,entry->name,sizeof(entry->name),NULL,0,NI_NAMEREQD) != 0)
+      return -1;
+    ip_lowercase(entry->name);
+  } else {
+    struct addrinfo hints;
+    struct addrinfo * result = NULL, * ai;
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(entry->name,NULL,&hints,&result) != 0)
+      return -1;
+
+    entry->num_addr = 0;
+    for (ai = result; ai != NULL && entry->num_addr < IP_DNS_MAX_ADDR; ai = ai->ai_next) {
+      addr = &entry->addr[entry->num_addr];
+      memset(addr,0,sizeof(*addr));
+      if (ai->ai_family == AF_INET) {
+        addr->family = WZD_INET4;
+        memcpy(addr->bytes,&((struct sockaddr_in*)ai->ai_addr)->sin_addr,4);
+      } else if (ai->ai_family == AF_INET6) {
+        addr->family = WZD_INET6;
+        memcpy(addr->bytes,&((struct sockaddr_in6*)ai->ai_addr)->sin6_addr,16);
+        ip_addr_normalize(addr);
+      } else
+        continue;
+      entry->num_addr++;
+    }
+    freeaddrinfo(result);
+
+    if (entry->num_addr == 0) return -1;
+  }
+
+  return 0;
+}
+
+/* must be called with _dns_mutex locked */
+static void ip_dns_store(struct ip_dns_entry_t * entry, const struct ip_dns_entry_t * lookup, int result)
+{
+  if (result == 0) {
+    *entry = *lookup;
+    entry->state = IP_DNS_VALID;
+    entry->expires = time(NULL) + HARD_DNS_CACHE_TTL;
+  } else {
+    entry->state = IP_DNS_FAILED;
+    entry->expires = time(NULL) + HARD_DNS_CACHE_NEGATIVE_TTL;
+  }
+  entry->queued = 0;
+}
+
+#if defined(HAVE_PTHREAD)
+static void * ip_dns_resolver_fund(UNUSED void * arg)
+{
+  struct ip_dns_entry_t lookup;
+  unsigned int index;
+  int ret;
+
+  pthread_mutex_lock(&_dns_mutex);
+  while (1) {
+    while (_dns_queue_count == 0)
+      pthread_cond_wait(&_dns_cond, &_dns_mutex);
+
+    index = _dns_queue[_dns_queue_head];
+    _dns_queue_head = (_dns_queue_head + 1) % HARD_DNS_QUEUE_SIZE;
+    _dns_queue_count--;
+
+    /* queued entries are never evicted, so the entry can be updated later */
+    lookup = _dns_cache[index];
+    pthread_mutex_unlock(&_dns_mutex);
+
+    ret = ip_dns_resolve(&lookup);
+
+    pthread_mutex_lock(&_dns_mutex);
+    ip_dns_store(&_dns_cache[index], &lookup, ret);
+    _dns_done_count++;
+    pthread_cond_broadcast(&_dns_done_cond);
+  }
+
+  return NULL;
+}
+
+/* must be called with _dns_mutex locked */
+static int ip_dns_start_resolvers(void)
+{
+  wzd_thread_attr_t thread_attr;
+  wzd_thread_t thread;
+
+  if (_dns_resolvers > 0) return 0;
+
+  wzd_thread_attr_init(&thread_attr);
+  wzd_thread_attr_set_detached(&thread_attr);
+  while (_dns_resolvers < HARD_DNS_RESOLVERS) {
+    if (wzd_thread_create(&thread, &thread_attr, ip_dns_resolver_fund, NULL)) {
+      out_log(LEVEL_HIGH,"ERROR could not create DNS resolver thread\n");
+      break;
+    }
+    _dns_resolvers++;
+  }
+  wzd_thread_attr_destroy(&thread_attr);
+
+  return (_dns_resolvers > 0) ? 0 : -1;
+}
+#endif /* HAVE_PTHREAD */
+
+/* must be called with _dns_mutex locked */
+static void ip_dns_queue(struct ip_dns_entry_t * entry)
+{
+#if defined(HAVE_PTHREAD)
+  if (_dns_queue_count >= HARD_DNS_QUEUE_SIZE || ip_dns_start_resolvers()) {
+    /* resolvers are busy, lookup will be tried again next time */
+    if (entry->state == IP_DNS_PENDING) entry->state = IP_DNS_EMPTY;
+    return;
+  }
+
+  entry->queued = 1;
+  _dns_queue[(_dns_queue_head + _dns_queue_count) % HARD_DNS_QUEUE_SIZE] = entry - _dns_cache;
+  _dns_queue_count++;
+  pthread_cond_signal(&_dns_cond);
+#else
+  struct ip_dns_entry_t lookup;
+
+  /* no threads, resolve now */
+  lookup = *entry;
+  ip_dns_store(entry, &lookup, ip_dns_resolve(&lookup));
+#endif
+}
+
+/** \brief Find a valid entry in cache, and start lookup if needed
+ *
+ * Must be called with _dns_mutex locked
+ *
+ * \return the entry, or NULL if the lookup failed or is pending. \a pending
+ * is set to 1 if the result is not known yet.
+ */
+static struct ip_dns_entry_t * ip_dns_get(enum ip_dns_kind_t kind, const struct ip_addr_t * addr, const char * name, int * pending)
+{
+  struct ip_dns_entry_t * set, * entry, * victim = NULL;
+  time_t now;
+  unsigned int i;
+
+  *pending = 0;
+  now = time(NULL);
+  set = &_dns_cache[(ip_dns_hash(kind,addr,name) % IP_DNS_SETS) * IP_DNS_WAYS];
+
+  for (i=0; i<IP_DNS_WAYS; i++) {
+    entry = &set[i];
+    if (entry->state == IP_DNS_EMPTY || !ip_dns_key_equal(entry,kind,addr,name)) continue;
+
+    if (entry->expires <= now && !entry->queued)
+      ip_dns_queue(entry);
+    /* an expired name is still used until it is refreshed */
+    if (entry->state == IP_DNS_VALID) return entry;
+    *pending = (entry->state != IP_DNS_FAILED);
+    return NULL;
+  }
+
+  /* replace an empty entry, or the one expiring first */
+  for (i=0; i<IP_DNS_WAYS; i++) {
+    entry = &set[i];
+    if (entry->queued) continue;
+    if (victim == NULL || (victim->state != IP_DNS_EMPTY &&
+          (entry->state == IP_DNS_EMPTY || entry->expires < victim->expires)))
+      victim = entry;
+  }
+  if (victim == NULL) { /* all entries are waiting for a lookup */
+    *pending = 1;
+    return NULL;
+  }
+
+  memset(victim,0,sizeof(*victim));
+  victim->kind = kind;
+  victim->state = IP_DNS_PENDING;
+  victim->expires = now;
+  if (kind == IP_DNS_REVERSE) {
+    victim->addr[0] = *addr;
+    victim->num_addr = 1;
+  } else {
+    wzd_strncpy(victim->name,name,sizeof(victim->name));
+  }
+  ip_dns_queue(victim);
+
+  if (victim->state == IP_DNS_VALID) return victim;
+  *pending = (victim->state != IP_DNS_FAILED);
+  return NULL;
+}
+
+/** \brief Get name of \a addr from cache
+ *
+ * \return 0 if ok, -1 if lookup failed, or IP_MATCH_UNKNOWN if it is pending
+ */
+static int ip_dns_reverse(const struct ip_addr_t * addr, char * buffer, size_t length)
+{
+  struct ip_dns_entry_t * entry;
+  int pending;
+  int ret = -1;
+
+  IP_DNS_LOCK();
+  entry = ip_dns_get(IP_DNS_REVERSE, addr, NULL, &pending);
+  if (entry != NULL) {
+    if (buffer) wzd_strncpy(buffer,entry->name,length);
+    ret = 0;
+  } else if (pending)
+    ret = IP_MATCH_UNKNOWN;
+  IP_DNS_UNLOCK();
+
+  return ret;
+}
+
+/** \return 1 if \a addr is one of the addresses of \a name in cache, or
+ * IP_MATCH_UNKNOWN if the lookup is pending
+ */
+static int ip_dns_forward_match(const char * name, const struct ip_addr_t * addr)
+{
+  struct ip_dns_entry_t * entry;
+  unsigned int i;
+  int pending;
+  int ret = 0;
+
+  IP_DNS_LOCK();
+  entry = ip_dns_get(IP_DNS_FORWARD, NULL, name, &pending);
+  if (pending)
+    ret = IP_MATCH_UNKNOWN;
+  if (entry != NULL) {
+    for (i=0; i<entry->num_addr; i++) {
+      if (entry->addr[i].family == addr->family &&
+          memcmp(entry->addr[i].bytes,addr->bytes,sizeof(addr->bytes))==0) {
+        ret = 1;
+        break;
+      }
+    }
+  }
+  IP_DNS_UNLOCK();
+
+  return ret;
+}
+
+/** \brief Get host name of \a ip from the DNS cache, without blocking
+ *
+ * \return 0 if name was found in cache, -1 otherwise
+ */
+int ip_get_hostname_cached(const unsigned char *ip, net_family_t family, char *buffer, size_t length)
+{
+  struct ip_addr_t addr;
+
+  if (!ip) return -1;
+
+  memset(&addr,0,sizeof(addr));
+  addr.family = (family == WZD_INET6) ? WZD_INET6 : WZD_INET4;
+  memcpy(addr.bytes, ip, (addr.family == WZD_INET6) ? 16 : 4);
+  ip_addr_normalize(&addr);
+
+  return (ip_dns_reverse(&addr, buffer, length) == 0) ? 0 : -1;
+}
+
 /** \brief Convert an ip address structure to a string
  *
  * \return 0 if ok
@@ -654,6 +1472,43 @@ int ip_is_bnc(const char * remote, wzd_config_t * config)
   return 0;
 }
 
+/** \brief Check remote peer against the global ip rules (login_pre_ip_check)
+ *
+ * \return 1 if ip is ok, 0 if ip is denied, -1 if ip is not in list or on
+ * error, -2 if \a timeout is 0 and a host name is not known yet
+ */
+int ip_check_global(const unsigned char * userip, net_family_t family, wzd_config_t * config, unsigned int timeout)
+{
+  char ipv6[INET6_ADDRSTRLEN] = {0};
+  char ipv4[INET_ADDRSTRLEN] = {0};
+  int ret = -1;
+
+  WZD_ASSERT(config != NULL);
+  if (!config) return -1;
+
+  /** \warning If no ip was specified (ok or denied), then the default is to allow */
+  if (config->login_pre_ip_acl == NULL) return 1;
+
+#if defined(IPV6_SUPPORT)
+  if (family == WZD_INET6) {
+    inet_ntop(AF_INET6,userip,ipv6,INET6_ADDRSTRLEN);
+    ret = (timeout) ? ip_acl_check_wait(config->login_pre_ip_acl,ipv6,timeout) : ip_acl_check(config->login_pre_ip_acl,ipv6);
+    if (ret == 0 && IN6_IS_ADDR_V4MAPPED((const struct in6_addr*)userip)) {
+      inet_ntop(AF_INET,userip,ipv4,INET_ADDRSTRLEN);
+      ret = (timeout) ? ip_acl_check_wait(config->login_pre_ip_acl,ipv4,timeout) : ip_acl_check(config->login_pre_ip_acl,ipv4);
+    }
+  } else
+#else
+    (void)ipv6; /* Quelches warnings about unused variable. */
+#endif
+  {
+    inet_ntop(AF_INET,userip,ipv4,INET_ADDRSTRLEN);
+    ret = (timeout) ? ip_acl_check_wait(config->login_pre_ip_acl,ipv4,timeout) : ip_acl_check(config->login_pre_ip_acl,ipv4);
+  }
+
+  return ret;
+}
+
 /** \brief Return our own ip
  *
  * \a buffer must be at least 16 bytes long
@@ -25,12 +25,18 @@
 #ifndef __WZD_IP_H__
 #define __WZD_IP_H__
 
+struct wzd_ip_rule_t;
+
 struct wzd_ip_list_t {
   char  * regexp;
   u8_t  is_allowed;
   struct wzd_ip_list_t * next_ip;
+  struct wzd_ip_rule_t * rule; /**< compiled form of regexp, built by ip_add_check */
 };
 
+/** \brief Compiled ip list, see ip_acl_compile() */
+typedef struct wzd_ip_acl_t wzd_ip_acl_t;
+
 enum host_type_t {
   HT_UNKNOWN = 0,
   HT_HOSTNAME,
@@ -73,6 +79,15 @@ int ip_list_check(struct wzd_ip_list_t *list, const char *ip);
  */
 int ip_list_check_ident(struct wzd_ip_list_t *list, const char *ip, const char * ident);
 
+/** \brief Check if ip is allowed by list, comparing \a ident if present
+ *
+ * Host names which are not in the DNS cache yet are waited for, at most
+ * \a timeout seconds for the whole list.
+ *
+ * \returns: 1 if allowed, 0 if denied, -1 on error or if not found
+ */
+int ip_list_check_ident_wait(struct wzd_ip_list_t *list, const char *ip, const char * ident, unsigned int timeout);
+
 /** \brief Remove \a ip from list
  * \return 0 if ok, -1 if not found
  */
@@ -81,6 +96,52 @@ int ip_remove(struct wzd_ip_list_t ** list, const char * ip);
 int ip_inlist(struct wzd_ip_list_t *list, const char *ip);
 void ip_list_free(struct wzd_ip_list_t *list);
 
+/** \brief Compile \a list into a lookup structure
+ *
+ * Numeric rules (addresses, networks in CIDR notation, and wildcards on
+ * byte boundaries like 10.0.*) are stored in a binary trie, other rules are
+ * checked in order. The result does not depend on \a list after this call.
+ *
+ * \return the compiled list, or NULL if \a list is empty
+ */
+wzd_ip_acl_t * ip_acl_compile(struct wzd_ip_list_t *list);
+
+/** \brief Check if ip is allowed by compiled list
+ *
+ * Rules are evaluated as if ip_list_check() was used on the original list:
+ * the first matching rule wins. Host name rules use the reverse DNS cache
+ * and never block: if the name is not known yet and the result depends on
+ * it, -2 is returned and the caller should use ip_acl_check_wait() later.
+ *
+ * \returns 1 if allowed, 0 if denied, -1 on error or if not found, -2 if
+ * a host name is not known yet
+ */
+int ip_acl_check(const wzd_ip_acl_t *acl, const char *ip);
+
+/** \brief Check if ip is allowed by compiled list, waiting for host names
+ *
+ * Host names which are not in the DNS cache yet are waited for, at most
+ * \a timeout seconds. If still unknown, deny rules match and allow rules
+ * do not.
+ *
+ * \returns 1 if allowed, 0 if denied, -1 on error or if not found
+ */
+int ip_acl_check_wait(const wzd_ip_acl_t *acl, const char *ip, unsigned int timeout);
+
+/** \brief Frees a compiled list
+ */
+void ip_acl_free(wzd_ip_acl_t *acl);
+
+/** \brief Get host name of \a ip from the DNS cache, without blocking
+ *
+ * If the name is not known, a reverse lookup is started in the background
+ * and the function returns immediatly. \a buffer can be NULL to only
+ * start the lookup.
+ *
+ * \return 0 if name was found in cache, -1 otherwise
+ */
+int ip_get_hostname_cached(const unsigned char *ip, net_family_t family, char *buffer, size_t length);
+
 /** \brief Convert an ip address structure to a string
  *
  * \return 0 if ok
@@ -109,6 +170,17 @@ int iptohostname(const char *ip, net_family_t family, char **hostname, size_t *l
  */
 int ip_is_bnc(const char * remote, wzd_config_t * config);
 
+/** \brief Check remote peer against the global ip rules (login_pre_ip_check)
+ *
+ * If \a timeout is 0, the function never blocks and returns -2 if a host
+ * name rule must be checked later. Else, host names are waited for at most
+ * \a timeout seconds.
+ *
+ * \return 1 if ip is ok, 0 if ip is denied, -1 if ip is not in list or on
+ * error, -2 if a host name is not known yet
+ */
+int ip_check_global(const unsigned char * userip, net_family_t family, wzd_config_t * config, unsigned int timeout);
+
 /** \brief Return our own ip
  *
  * \a buffer must be at least 16 bytes long
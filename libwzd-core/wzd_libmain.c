@@ -29,14 +29,19 @@
 #ifndef WZD_USE_PCH
 #include <stdio.h>
 #include <string.h>
+#include <signal.h> /* sig_atomic_t */
 
 #include "wzd_structs.h"
 
+#include "wzd_configfile.h"
+#include "wzd_configloader.h"
+
 #include "wzd_libmain.h"
 #include "wzd_log.h"
 #include "wzd_messages.h"
 #include "wzd_mutex.h"
 #include "wzd_tls.h"
+#include "wzd_vfs.h"
 #include "wzd_ClientThread.h"
 
 #include "wzd_debug.h"
@@ -55,6 +60,9 @@ wzd_mutex_t	* server_mutex = NULL;
 
 wzd_mutex_t     * mutex_set[SET_MUTEX_NUM];
 
+/** set by server_restart(), handled in server_reload_check() */
+static volatile sig_atomic_t _server_reload_requested = 0;
+
 unsigned long mutex_set_key[SET_MUTEX_NUM] = {
   0x22005400,
   0x22005401,
@@ -68,6 +76,9 @@ unsigned long mutex_set_key[SET_MUTEX_NUM] = {
   0x22005409,
   0x2200540a,
   0x2200540b,
+  0x2200540c,
+  0x2200540d,
+  0x2200540e,
 };
 
 time_t          server_time;
@@ -231,7 +242,28 @@ void server_restart(int signum)
   }
 #endif
 
-  out_log(LEVEL_CRITICAL, " ** server_restart:  Not yet implemented\n");
+  /* only set a flag here: reading the config file is not safe in a
+   * signal handler, and must not pause clients
+   */
+  _server_reload_requested = 1;
+}
+
+/** \brief Reload config snapshot if server_restart() has been called
+ *
+ * Must be called from the main loop.
+ */
+void server_reload_check(void)
+{
+  if (!_server_reload_requested) return;
+  _server_reload_requested = 0;
+
+  out_log(LEVEL_INFO,"Reload requested, re-reading %s\n",
+      (mainConfig && mainConfig->config_filename) ? mainConfig->config_filename : "(null)");
+
+  if (!mainConfig || !mainConfig->config_filename) return;
+
+  if (config_snapshot_reload(mainConfig->config_filename))
+    out_log(LEVEL_HIGH,"Reload failed, keeping previous settings\n");
 }
 
 /** \brief remove a context from the list */
@@ -315,6 +347,7 @@ void context_free(wzd_context_t * context)
   reply_free(context->reply);
   str_deallocate(context->current_action.command);
   ip_free(context->peer_ip);
+  checkpath_cache_free(context);
   wzd_free(context);
 }
 
@@ -46,6 +46,12 @@ typedef enum {
 
   SET_MUTEX_COOKIE_PARSER,
 
+  SET_MUTEX_PERMFILE,
+
+  SET_MUTEX_LIST_CACHE,
+
+  SET_MUTEX_PASV,
+
   SET_MUTEX_NUM /* must be last */
 } wzd_set_mutext_t;
 
@@ -56,6 +62,12 @@ WZDIMPORT extern wzd_mutex_t * mutex_set[SET_MUTEX_NUM];
 
 void server_restart(int signum);
 
+/** \brief Reload config snapshot if server_restart() has been called
+ *
+ * Must be called from the main loop.
+ */
+void server_reload_check(void);
+
 #define WZD_MUTEX_LOCK(x) wzd_mutex_lock(mutex_set[x])
 #define WZD_MUTEX_UNLOCK(x) wzd_mutex_unlock(mutex_set[x])
 
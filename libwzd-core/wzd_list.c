@@ -62,6 +62,8 @@
 #include "wzd_file.h"
 #include "wzd_fs.h"
 #include "wzd_dir.h"
+#include "wzd_list.h"
+#include "wzd_libmain.h"
 #include "wzd_utf8.h"
 #include "wzd_vfs.h"
 
@@ -102,22 +104,503 @@ int list_call_wrapper(socket_t sock, wzd_context_t *context, const char *line, c
 
 
 
+/************ LISTING CACHE **************/
+
+/* Directory listings are shared by all users: only entries of the directory
+ * itself are cached, formatted for a given format and charset. VFS entries
+ * depend on the user and are added for each listing, and hidden files or
+ * masks are filtered when lines are sent.
+ *
+ * An entry is valid if the directory and its permission file were not
+ * modified, and is never kept more than HARD_LIST_CACHE_TTL seconds (dates
+ * and sizes of files being uploaded change without touching the directory).
+ */
+
+#define LIST_CACHE_BUCKETS	64
+
+enum list_cache_format_t {
+  LIST_CACHE_SHORT=0,
+  LIST_CACHE_LONG,
+  LIST_CACHE_MLSD,
+};
+
+struct list_cache_line_t {
+  char * filename;              /**< used to filter hidden files and masks */
+  char * line;                  /**< LIST: complete line, MLSD: facts before Perm= */
+  char * line_end;              /**< MLSD: facts after Perm=, and file name */
+  struct wzd_file_t * file;     /**< MLSD: used to compute permissions of user */
+};
+
+struct list_cache_entry_t {
+  char * dirname;
+  unsigned long dirname_hash;
+  unsigned int format;
+  unsigned int utf8;
+
+  time_t dir_mtime;
+  time_t dir_ctime;
+  time_t permfile_mtime;
+  u64_t permfile_size;
+  time_t expires;
+
+  struct list_cache_line_t * lines;
+  unsigned int lines_count;
+  unsigned int lines_size;
+
+  unsigned int refcount;
+  int in_cache;
+  unsigned long last_use;
+  struct list_cache_entry_t * next_entry;
+};
+
+static struct list_cache_entry_t * _list_cache[LIST_CACHE_BUCKETS];
+static unsigned int _list_cache_count = 0;
+static unsigned long _list_cache_clock = 0;
+static unsigned long _list_cache_generation = 0;
+
+static void _list_cache_free(struct list_cache_entry_t * entry)
+{
+  unsigned int i;
+
+  for (i=0; i<entry->lines_count; i++) {
+    wzd_free(entry->lines[i].filename);
+    wzd_free(entry->lines[i].line);
+    wzd_free(entry->lines[i].line_end);
+    if (entry->lines[i].file) free_file_recursive(entry->lines[i].file);
+  }
+  wzd_free(entry->lines);
+  wzd_free(entry->dirname);
+  wzd_free(entry);
+}
+
+static struct list_cache_line_t * _list_cache_add_line(struct list_cache_entry_t * entry, const char * filename, const char * line)
+{
+  struct list_cache_line_t * cache_line;
+
+  if (entry->lines_count >= entry->lines_size) {
+    entry->lines_size = (entry->lines_size) ? entry->lines_size * 2 : 32;
+    entry->lines = wzd_realloc(entry->lines, entry->lines_size * sizeof(struct list_cache_line_t));
+  }
+  cache_line = &entry->lines[entry->lines_count++];
+  cache_line->filename = wzd_strdup(filename);
+  cache_line->line = wzd_strdup(line);
+  cache_line->line_end = NULL;
+  cache_line->file = NULL;
+
+  return cache_line;
+}
+
+/** \brief Find entry in cache
+ * \note SET_MUTEX_LIST_CACHE must be locked
+ */
+static struct list_cache_entry_t * _list_cache_find(const char * dirname, unsigned long hash, unsigned int format, unsigned int utf8)
+{
+  struct list_cache_entry_t * entry;
+
+  for (entry = _list_cache[hash % LIST_CACHE_BUCKETS]; entry; entry = entry->next_entry) {
+    if (entry->dirname_hash == hash && entry->format == format && entry->utf8 == utf8
+        && strcmp(entry->dirname,dirname)==0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+/** \brief Remove entry from cache, and free it if it is not used
+ * \note SET_MUTEX_LIST_CACHE must be locked
+ */
+static void _list_cache_remove(struct list_cache_entry_t * entry)
+{
+  struct list_cache_entry_t ** it;
+
+  for (it = &_list_cache[entry->dirname_hash % LIST_CACHE_BUCKETS]; *it; it = &(*it)->next_entry) {
+    if (*it == entry) {
+      *it = entry->next_entry;
+      break;
+    }
+  }
+
+  entry->next_entry = NULL;
+  entry->in_cache = 0;
+  _list_cache_count--;
+
+  if (entry->refcount == 0)
+    _list_cache_free(entry);
+}
+
+/** \brief Remove least recently used entry which is not currently used
+ * \note SET_MUTEX_LIST_CACHE must be locked
+ */
+static void _list_cache_evict(void)
+{
+  struct list_cache_entry_t * entry, * oldest = NULL;
+  unsigned int i;
+
+  for (i=0; i<LIST_CACHE_BUCKETS; i++) {
+    for (entry = _list_cache[i]; entry; entry = entry->next_entry) {
+      if (entry->refcount == 0 && (!oldest || entry->last_use < oldest->last_use))
+        oldest = entry;
+    }
+  }
+
+  if (oldest) _list_cache_remove(oldest);
+}
+
+/** \brief Get modification times of directory and of its permission file
+ * \return 0 if ok, -1 if directory does not exist
+ */
+static int _list_cache_stat(const char * dirname, struct list_cache_entry_t * entry)
+{
+  char perm_filename[WZD_MAX_PATH+1];
+  fs_filestat_t s;
+  size_t length;
+
+  if (fs_file_stat(dirname,&s) || !S_ISDIR(s.mode)) return -1;
+  entry->dir_mtime = s.mtime;
+  entry->dir_ctime = s.ctime;
+
+  wzd_strncpy(perm_filename,dirname,sizeof(perm_filename));
+  length = strlen(perm_filename);
+  if (length == 0 || perm_filename[length-1] != '/')
+    strlcat(perm_filename,"/",sizeof(perm_filename));
+  strlcat(perm_filename,HARD_PERMFILE,sizeof(perm_filename));
+
+  if (fs_file_stat(perm_filename,&s)) {
+    entry->permfile_mtime = 0;
+    entry->permfile_size = 0;
+  } else {
+    entry->permfile_mtime = s.mtime;
+    entry->permfile_size = s.size;
+  }
+
+  return 0;
+}
+
+static int _list_format_long(struct wzd_file_t * file, char * buffer, char * buffer_ptr, char * line, size_t line_length, wzd_context_t * context);
+
+static int _mlsd_stat_entry(struct wzd_file_t * file, char * buffer, char * buffer_ptr, fs_filestat_t * s);
+
+static char * _mlst_format_facts(struct wzd_file_t * file_info, fs_filestat_t *s, char * buffer);
+static char * _mlst_format_perms(struct wzd_file_t * file_info, char * buffer, wzd_context_t * context);
+static char * _mlst_format_name(struct wzd_file_t * file_info, char * buffer, wzd_context_t * context);
+
+/** \brief Read and format all entries of directory
+ * \return a new entry, or NULL if directory could not be opened
+ */
+static struct list_cache_entry_t * _list_cache_build(const char * dirname, unsigned int format, wzd_context_t * context)
+{
+  struct list_cache_entry_t * entry;
+  struct list_cache_line_t * cache_line;
+  struct wzd_dir_t * dir;
+  struct wzd_file_t * file;
+  char buffer[WZD_MAX_PATH+1], * buffer_ptr;
+  char line[HARD_LS_BUFFERSIZE];
+  fs_filestat_t s;
+  size_t length;
+
+  dir = dir_open_ex(dirname,DIR_OPEN_FILES,context);
+  if (!dir) return NULL;
+
+  entry = wzd_malloc(sizeof(struct list_cache_entry_t));
+  memset(entry,0,sizeof(struct list_cache_entry_t));
+
+  wzd_strncpy(buffer,dirname,WZD_MAX_PATH);
+  length = strlen(buffer);
+  if (buffer[length-1] != '/') {
+    buffer[length++] = '/';
+    buffer[length] = '\0';
+  }
+  buffer_ptr = buffer+length; /* just after last '/' */
+
+  while ( (file = dir_read(dir,context)) )
+  {
+    switch (format) {
+      case LIST_CACHE_SHORT:
+        wzd_strncpy(line,file->filename,WZD_MAX_PATH);
+        strncat(line,"\r\n",WZD_MAX_PATH);
+        _list_cache_add_line(entry,file->filename,line);
+        break;
+      case LIST_CACHE_LONG:
+        _list_format_long(file,buffer,buffer_ptr,line,sizeof(line),context);
+        _list_cache_add_line(entry,file->filename,line);
+        break;
+      case LIST_CACHE_MLSD:
+        if (_mlsd_stat_entry(file,buffer,buffer_ptr,&s)) continue;
+        _mlst_format_facts(file,&s,line);
+        cache_line = _list_cache_add_line(entry,file->filename,line);
+        strcpy(_mlst_format_name(file,line,context),"\r\n");
+        cache_line->line_end = wzd_strdup(line);
+        cache_line->file = file_deep_copy(file);
+        break;
+    }
+  }
+
+  dir_close(dir);
+
+  return entry;
+}
+
+/** \brief Get formatted entries of directory
+ * \return an entry, which must be released using _list_cache_release(), or
+ * NULL if directory could not be opened
+ */
+static struct list_cache_entry_t * _list_cache_acquire(const char * dirname, unsigned int format, wzd_context_t * context)
+{
+  struct list_cache_entry_t * entry, * old, st;
+  unsigned long hash, generation;
+  unsigned int utf8 = 0;
+  time_t now;
+
+#ifdef HAVE_UTF8
+  /* names are converted only in long formats */
+  if (format != LIST_CACHE_SHORT && (context->connection_flags & CONNECTION_UTF8))
+    utf8 = 1;
+#endif
+
+  if (_list_cache_stat(dirname,&st)) return NULL;
+
+  hash = compute_hashval(dirname,strlen(dirname));
+  now = time(NULL);
+
+  WZD_MUTEX_LOCK(SET_MUTEX_LIST_CACHE);
+  entry = _list_cache_find(dirname,hash,format,utf8);
+  if (entry) {
+    if (entry->expires > now && entry->dir_mtime == st.dir_mtime && entry->dir_ctime == st.dir_ctime
+        && entry->permfile_mtime == st.permfile_mtime && entry->permfile_size == st.permfile_size) {
+      /* HIT */
+      entry->refcount++;
+      entry->last_use = ++_list_cache_clock;
+      WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+      return entry;
+    }
+    _list_cache_remove(entry);
+  }
+  generation = _list_cache_generation;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+
+  /* MISS: read directory without holding the lock */
+  entry = _list_cache_build(dirname,format,context);
+  if (!entry) return NULL;
+
+  entry->dirname = wzd_strdup(dirname);
+  entry->dirname_hash = hash;
+  entry->format = format;
+  entry->utf8 = utf8;
+  entry->dir_mtime = st.dir_mtime;
+  entry->dir_ctime = st.dir_ctime;
+  entry->permfile_mtime = st.permfile_mtime;
+  entry->permfile_size = st.permfile_size;
+  entry->expires = now + HARD_LIST_CACHE_TTL;
+  entry->refcount = 1;
+
+  if (entry->lines_count > HARD_LIST_CACHE_MAX_ENTRIES) return entry;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_LIST_CACHE);
+  /* directory was modified while reading it, do not store entry */
+  if (generation != _list_cache_generation) {
+    WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+    return entry;
+  }
+  /* another thread may have read the same directory in the meantime */
+  old = _list_cache_find(dirname,hash,format,utf8);
+  if (old) _list_cache_remove(old);
+  if (_list_cache_count >= HARD_LIST_CACHE_SIZE)
+    _list_cache_evict();
+  entry->in_cache = 1;
+  entry->last_use = ++_list_cache_clock;
+  entry->next_entry = _list_cache[hash % LIST_CACHE_BUCKETS];
+  _list_cache[hash % LIST_CACHE_BUCKETS] = entry;
+  _list_cache_count++;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+
+  return entry;
+}
+
+static void _list_cache_release(struct list_cache_entry_t * entry)
+{
+  int must_free;
+
+  if (!entry) return;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_LIST_CACHE);
+  entry->refcount--;
+  must_free = (entry->refcount == 0 && !entry->in_cache);
+  WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+
+  if (must_free) _list_cache_free(entry);
+}
+
+void list_cache_invalidate(const char * dirname)
+{
+  struct list_cache_entry_t * entry, * next;
+  char buffer[WZD_MAX_PATH+1];
+  unsigned long hash;
+
+  if (!dirname) return;
+
+  wzd_strncpy(buffer,dirname,sizeof(buffer));
+  REMOVE_TRAILING_SLASH(buffer);
+  hash = compute_hashval(buffer,strlen(buffer));
+
+  WZD_MUTEX_LOCK(SET_MUTEX_LIST_CACHE);
+  _list_cache_generation++;
+  for (entry = _list_cache[hash % LIST_CACHE_BUCKETS]; entry; entry = next) {
+    next = entry->next_entry;
+    if (entry->dirname_hash == hash && strcmp(entry->dirname,buffer)==0)
+      _list_cache_remove(entry);
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+}
+
+void list_cache_invalidate_file(const char * filename)
+{
+  char buffer[WZD_MAX_PATH+1];
+  char * ptr;
+
+  if (!filename) return;
+
+  wzd_strncpy(buffer,filename,sizeof(buffer));
+  REMOVE_TRAILING_SLASH(buffer);
+  ptr = strrchr(buffer,'/');
+  if (!ptr) return;
+  if (ptr == buffer) ptr++; /* file is in / */
+  *ptr = '\0';
+
+  list_cache_invalidate(buffer);
+}
+
+void list_cache_purge(void)
+{
+  unsigned int i;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_LIST_CACHE);
+  for (i=0; i<LIST_CACHE_BUCKETS; i++) {
+    while (_list_cache[i])
+      _list_cache_remove(_list_cache[i]);
+  }
+  WZD_MUTEX_UNLOCK(SET_MUTEX_LIST_CACHE);
+}
+
+/************ LIST **************/
+
+/** \brief Format entry of a long listing
+ * \param[in] buffer directory name, / terminated
+ * \param[in] buffer_ptr end of directory name in \a buffer
+ */
+static int _list_format_long(struct wzd_file_t * file, char * buffer, char * buffer_ptr, char * line, size_t line_length, wzd_context_t * context)
+{
+  char * ptr_to_buffer;
+  char buffer_name[256];
+  char datestr[128];
+  fs_filestat_t sta;
+
+  switch (file->kind) {
+    case FILE_LNK:
+    case FILE_VFS:
+      ptr_to_buffer = (char*)file->data;
+      break;
+    default:
+      wzd_strncpy(buffer_ptr,file->filename,WZD_MAX_PATH-(buffer_ptr-buffer));
+      ptr_to_buffer = buffer;
+      break;
+  }
+
+  if (file->stat && ptr_to_buffer == buffer) {
+    /* already done by dir_open() */
+    memcpy(&sta,file->stat,sizeof(fs_filestat_t));
+  } else if (fs_file_lstat(ptr_to_buffer,&sta)) {
+    /* destination does not exist */
+    out_log(LEVEL_FLOOD, "list: broken file %s -> %s\n", file->filename, ptr_to_buffer);
+    memset(&sta, 0, sizeof(sta));
+    sta.mode = S_IFREG;
+  };
+
+  /* date */
+  _format_date(sta.mtime, datestr, sizeof(datestr));
+
+  /* permissions */
+
+  if (!S_ISDIR(sta.mode) && !S_ISLNK(sta.mode) &&
+    !S_ISREG(sta.mode)) {
+    /* destination does not exist */
+    out_log(LEVEL_FLOOD, "list: strange file %s\n", file->filename);
+    memset(&sta, 0, sizeof(sta));
+  };
+
+  if (S_ISLNK(sta.mode)) {
+    char linkbuf[256];
+    int linksize;
+    linksize = readlink(ptr_to_buffer,linkbuf,sizeof(linkbuf)-1);
+    if (linksize > 0) {
+      linkbuf[linksize]='\0';
+      snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> %s",file->filename,linkbuf);
+    }
+    else
+      snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> (INEXISTANT FILE)",file->filename);
+  } else if (file->kind == FILE_LNK) {
+    /** \bug file->data is an absolute path ... */
+    if (sta.ctime != 0) {
+      snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> %s",file->filename,(char*)file->data);
+    }
+    else {
+      snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> (INEXISTANT FILE) %s",file->filename, (char*)file->data);
+    }
+  } else {
+    wzd_strncpy(buffer_name,file->filename,sizeof(buffer_name)-1);
+    if (strlen(file->filename)<sizeof(buffer_name)) buffer_name[strlen(file->filename)]='\0';
+    else buffer_name[sizeof(buffer_name)-1] = '\0';
+  }
+
+#ifdef HAVE_UTF8
+  if (context->connection_flags & CONNECTION_UTF8)
+  {
+    /* first, check that line is not already valid UTF-8 */
+    if ( !utf8_valid(buffer_name,strlen(buffer_name)) ) {
+      /* use line as a temp buffer */
+      if (local_charset_to_utf8(buffer_name, line, line_length, local_charset()))
+      {
+        out_log(LEVEL_NORMAL,"Error during UTF-8 conversion for %s\n", buffer_name);
+      }
+      wzd_strncpy(buffer_name, line, sizeof(buffer_name));
+    }
+  }
+#endif
+
+  snprintf(line,line_length,"%c%c%c%c%c%c%c%c%c%c %3d %s %s %13" PRIu64 " %s %s\r\n",
+      (S_ISLNK(sta.mode) || (file->kind==FILE_LNK))? 'l' : S_ISDIR(sta.mode) ? 'd' : '-',
+      file->permissions & S_IRUSR ? 'r' : '-',
+      file->permissions & S_IWUSR ? 'w' : '-',
+      file->permissions & S_IXUSR ? 'x' : '-',
+      file->permissions & S_IRGRP ? 'r' : '-',
+      file->permissions & S_IWGRP ? 'w' : '-',
+      file->permissions & S_IXGRP ? 'x' : '-',
+      file->permissions & S_IROTH ? 'r' : '-',
+      file->permissions & S_IWOTH ? 'w' : '-',
+      file->permissions & S_IXOTH ? 'x' : '-',
+      (int)sta.nlink,
+      (file->owner[0] != '\0')?file->owner:"unknown",
+      (file->group[0] != '\0')?file->group:"unknown",
+      sta.size,
+      datestr,
+      buffer_name);
+
+  return 0;
+}
+
 int list(socket_t sock,wzd_context_t * context,enum list_type_t format,char *directory,char *mask,
 	 int callback(socket_t,wzd_context_t*,char *))
 {
+  struct list_cache_entry_t * entry;
   struct wzd_dir_t * dir;
   struct wzd_file_t * file;
   char * dirname;
-  char buffer[WZD_MAX_PATH+1], * ptr_to_buffer;
+  char buffer[WZD_MAX_PATH+1];
   char line[WZD_MAX_PATH+80+1]; /* 80 is the long format max */
-  char buffer_name[256];
   char send_buffer[HARD_LS_BUFFERSIZE];
   size_t send_buffer_len;
-  char datestr[128];
   char * buffer_ptr;
   size_t length;
-  unsigned long watchdog=0;
-  fs_filestat_t sta;
+  unsigned int i;
 
   if (!directory || strlen(directory)<1) return 0;
 
@@ -135,121 +618,37 @@ int list(socket_t sock,wzd_context_t * context,enum list_type_t format,char *dir
   }
   buffer_ptr = buffer+length; /* just after last '/' */
 
-  dir = dir_open(dirname,context);
-  wzd_free(dirname);
-  if (!dir) return 0;
+  /* entries of the directory, shared by all users */
+  entry = _list_cache_acquire(dirname, (format & LIST_TYPE_SHORT) ? LIST_CACHE_SHORT : LIST_CACHE_LONG, context);
+  if (!entry) {
+    wzd_free(dirname);
+    return 0;
+  }
 
-  while ( (file = dir_read(dir,context)) )
+  for (i=0; i<entry->lines_count; i++)
   {
-    if (watchdog++ > 65535) {
-      out_log(LEVEL_HIGH, "watchdog: detected infinite loop in list()\n");
-      /* flush buffer ! */
-      list_call_wrapper(sock, context, NULL, send_buffer, &send_buffer_len, callback);
-      dir_close(dir);
+    if (entry->lines[i].filename[0] == '.' && !(format & LIST_SHOW_HIDDEN)) continue;
+    if (mask && !list_match(entry->lines[i].filename,mask)) continue;
 
-      return 1;
-    }
+    if (list_call_wrapper(sock,context,entry->lines[i].line,send_buffer,&send_buffer_len,callback)) break;
+  }
 
+  /* VFS visible by the user, if sending was not interrupted */
+  dir = (i == entry->lines_count) ? dir_open_ex(dirname,DIR_OPEN_VFS,context) : NULL;
+  wzd_free(dirname);
+
+  _list_cache_release(entry);
 
+  while ( dir && (file = dir_read(dir,context)) )
+  {
     if (file->filename[0] == '.' && !(format & LIST_SHOW_HIDDEN)) continue;
     if (mask && !list_match(file->filename,mask)) continue;
 
     if (format & LIST_TYPE_SHORT) {
       wzd_strncpy(line,file->filename,WZD_MAX_PATH);
       strncat(line,"\r\n",WZD_MAX_PATH);
-      if (list_call_wrapper(sock,context,line,send_buffer,&send_buffer_len,callback)) break;
-      continue;
-    }
-
-    /* format is long */
-
-    switch (file->kind) {
-      case FILE_LNK:
-      case FILE_VFS:
-        ptr_to_buffer = (char*)file->data;
-        break;
-      default:
-        wzd_strncpy(buffer_ptr,file->filename,WZD_MAX_PATH-(buffer_ptr-buffer));
-        ptr_to_buffer = buffer;
-        break;
-    }
-
-/*    if (fs_lstat(ptr_to_buffer,&st)) {*/
-    if (fs_file_lstat(ptr_to_buffer,&sta)) {
-      /* destination does not exist */
-      out_log(LEVEL_FLOOD, "list: broken file %s -> %s\n", file->filename, ptr_to_buffer);
-      memset(&sta, 0, sizeof(sta));
-      sta.mode = S_IFREG;
-    };
-
-    /* date */
-    _format_date(sta.mtime, datestr, sizeof(datestr));
-
-    /* permissions */
-
-    if (!S_ISDIR(sta.mode) && !S_ISLNK(sta.mode) &&
-      !S_ISREG(sta.mode)) {
-      /* destination does not exist */
-      out_log(LEVEL_FLOOD, "list: strange file %s\n", file->filename);
-      memset(&sta, 0, sizeof(sta));
-    };
-
-    if (S_ISLNK(sta.mode)) {
-      char linkbuf[256];
-      int linksize;
-      linksize = readlink(ptr_to_buffer,linkbuf,sizeof(linkbuf)-1);
-      if (linksize > 0) {
-        linkbuf[linksize]='\0';
-        snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> %s",file->filename,linkbuf);
-      }
-      else
-        snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> (INEXISTANT FILE)",file->filename);
-    } else if (file->kind == FILE_LNK) {
-      /** \bug file->data is an absolute path ... */
-      if (sta.ctime != 0) {
-        snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> %s",file->filename,(char*)file->data);
-      }
-      else {
-        snprintf(buffer_name,sizeof(buffer_name)-1,"%s -> (INEXISTANT FILE) %s",file->filename, (char*)file->data);
-      }
-    } else {
-      wzd_strncpy(buffer_name,file->filename,sizeof(buffer_name)-1);
-      if (strlen(file->filename)<sizeof(buffer_name)) buffer_name[strlen(file->filename)]='\0';
-      else buffer_name[sizeof(buffer_name)-1] = '\0';
-    }
-
-#ifdef HAVE_UTF8
-    if (context->connection_flags & CONNECTION_UTF8)
-    {
-      /* first, check that line is not already valid UTF-8 */
-      if ( !utf8_valid(buffer_name,strlen(buffer_name)) ) {
-        /* use line as a temp buffer */
-        if (local_charset_to_utf8(buffer_name, line, sizeof(line), local_charset()))
-        {
-          out_log(LEVEL_NORMAL,"Error during UTF-8 conversion for %s\n", buffer_name);
-        }
-        wzd_strncpy(buffer_name, line, sizeof(buffer_name));
-      }
-    }
-#endif
-
-    snprintf(line,WZD_MAX_PATH+80,"%c%c%c%c%c%c%c%c%c%c %3d %s %s %13" PRIu64 " %s %s\r\n",
-        (S_ISLNK(sta.mode) || (file->kind==FILE_LNK))? 'l' : S_ISDIR(sta.mode) ? 'd' : '-',
-        file->permissions & S_IRUSR ? 'r' : '-',
-        file->permissions & S_IWUSR ? 'w' : '-',
-        file->permissions & S_IXUSR ? 'x' : '-',
-        file->permissions & S_IRGRP ? 'r' : '-',
-        file->permissions & S_IWGRP ? 'w' : '-',
-        file->permissions & S_IXGRP ? 'x' : '-',
-        file->permissions & S_IROTH ? 'r' : '-',
-        file->permissions & S_IWOTH ? 'w' : '-',
-        file->permissions & S_IXOTH ? 'x' : '-',
-        (int)sta.nlink,
-        (file->owner[0] != '\0')?file->owner:"unknown",
-        (file->group[0] != '\0')?file->group:"unknown",
-        sta.size,
-        datestr,
-        buffer_name);
+    } else
+      _list_format_long(file,buffer,buffer_ptr,line,WZD_MAX_PATH+80,context);
 
     if (list_call_wrapper(sock, context, line, send_buffer, &send_buffer_len, callback)) break;
   }
@@ -307,55 +706,93 @@ char * mlst_single_file(const char *filename, wzd_context_t * context)
   return str_buffer;
 }
 
+/** \brief stat() entry of MLSD listing, and set its kind if needed
+ * \param[in] buffer directory name, / terminated
+ * \param[in] buffer_ptr end of directory name in \a buffer
+ * \return 0 if ok
+ */
+static int _mlsd_stat_entry(struct wzd_file_t * file, char * buffer, char * buffer_ptr, fs_filestat_t * s)
+{
+  char * ptr_to_buffer;
+
+  /* for a VFS, we stat() the destination */
+  if (file->kind == FILE_VFS) ptr_to_buffer = file->data;
+  else {
+    wzd_strncpy(buffer_ptr,file->filename,WZD_MAX_PATH-(buffer_ptr-buffer));
+    ptr_to_buffer = buffer;
+  }
+
+  if (file->stat && ptr_to_buffer == buffer) {
+    /* already done by dir_open() */
+    memcpy(s,file->stat,sizeof(fs_filestat_t));
+  } else if (fs_file_lstat(ptr_to_buffer,s)) {
+    out_log(LEVEL_HIGH,"ERROR while stat'ing file %s, ignoring\n",buffer);
+    return -1;
+  }
+
+  if (file->kind == 0) {
+    if (S_ISDIR(s->mode)) file->kind = FILE_DIR;
+    if (S_ISLNK(s->mode)) file->kind = FILE_LNK;
+    if (S_ISREG(s->mode)) file->kind = FILE_REG;
+  }
+
+  return 0;
+}
+
 int mlsd_directory(const char * dirname, socket_t sock, int callback(socket_t,wzd_context_t*,char *),
     wzd_context_t * context)
 {
   char send_buffer[HARD_LS_BUFFERSIZE];
   char str_buffer[HARD_LS_BUFFERSIZE];
-  char * ptr_to_buffer;
   size_t send_buffer_len;
+  struct list_cache_entry_t * entry;
+  struct list_cache_line_t * cache_line;
   struct wzd_dir_t * dir;
   struct wzd_file_t * file;
   fs_filestat_t s;
   char buffer[WZD_MAX_PATH+1];
   char * ptr;
   size_t length;
-  int ret;
+  unsigned int i;
 
   if (!dirname || strlen(dirname)<1) return 1;
 
-  dir = dir_open(dirname, context);
-  if (dir == NULL) return E_PARAM_INVALID;
+  wzd_strncpy(buffer,dirname,WZD_MAX_PATH);
+  REMOVE_TRAILING_SLASH(buffer);
+
+  /* entries of the directory, shared by all users */
+  entry = _list_cache_acquire(buffer, LIST_CACHE_MLSD, context);
+  if (entry == NULL) return E_PARAM_INVALID;
 
   memset(send_buffer,0,HARD_LS_BUFFERSIZE);
   send_buffer_len = 0;
 
-  wzd_strncpy(buffer,dirname,WZD_MAX_PATH);
   length = strlen(buffer);
   if (buffer[length-1]!='/') buffer[length++] = '/';
+  buffer[length] = '\0';
 
   ptr = buffer + length; /* points to the terminating \0 */
 
-  while ( (file = dir_read(dir,context)) != NULL ) {
-    /* for a VFS, we stat() the destination */
-    if (file->kind == FILE_VFS) ptr_to_buffer = file->data;
-    else {
-      wzd_strncpy(ptr,file->filename,WZD_MAX_PATH-length);
-      ptr_to_buffer = buffer;
-    }
+  for (i=0; i<entry->lines_count; i++) {
+    cache_line = &entry->lines[i];
 
-    ret = fs_file_lstat(ptr_to_buffer,&s);
-    if (ret) {
-      out_log(LEVEL_HIGH,"ERROR while stat'ing file %s, ignoring\n",buffer);
-      continue;
-    }
+    if (strlen(cache_line->line) + strlen(cache_line->line_end) + 64 >= sizeof(str_buffer)) continue;
+
+    /* permissions depend on the user */
+    strcpy(_mlst_format_perms(cache_line->file,strpcpy(str_buffer,cache_line->line),context),cache_line->line_end);
 
-    if (file->kind == 0) {
-      if (S_ISDIR(s.mode)) file->kind = FILE_DIR;
-      if (S_ISLNK(s.mode)) file->kind = FILE_LNK;
-      if (S_ISREG(s.mode)) file->kind = FILE_REG;
+    if (list_call_wrapper(sock, context, str_buffer, send_buffer, &send_buffer_len, callback)) {
+      out_log(LEVEL_HIGH, "error during list_call_wrapper %s\n", str_buffer);
     }
+  }
+
+  _list_cache_release(entry);
 
+  /* VFS visible by the user */
+  dir = dir_open_ex(dirname, DIR_OPEN_VFS, context);
+
+  while ( dir && (file = dir_read(dir,context)) != NULL ) {
+    if (_mlsd_stat_entry(file,buffer,ptr,&s)) continue;
 
     mlst_format_line(file,&s,str_buffer,context);
 
@@ -446,16 +883,15 @@ static int _format_date(time_t t, char * buffer, size_t length)
   return 0;
 }
 
-/** \warning no check is done on buffer overflow XXX */
-static char * mlst_format_line(struct wzd_file_t * file_info, fs_filestat_t *s, char * buffer, wzd_context_t * context)
+/** \brief Format Type=, Size= and Modify= facts
+ * \return end of string written in \a buffer
+ */
+static char * _mlst_format_facts(struct wzd_file_t * file_info, fs_filestat_t *s, char * buffer)
 {
   char *ptr, *buffer_end;
   wzd_string_t *temp;
   const char *type;
 
-  if (!file_info || !s || !buffer) return NULL;
-
-  temp = str_allocate();
   buffer[0] = '\0';
   buffer_end = buffer;
 
@@ -507,8 +943,10 @@ static char * mlst_format_line(struct wzd_file_t * file_info, fs_filestat_t *s,
 
   /* Size=... */
   {
+    temp = str_allocate();
     str_sprintf(temp,"Size=%" PRIu64 ";",s->size);
     buffer_end = strpcpy(buffer_end,str_tochar(temp));
+    str_deallocate(temp);
   }
 
   /* Modify=... */
@@ -521,39 +959,57 @@ static char * mlst_format_line(struct wzd_file_t * file_info, fs_filestat_t *s,
     buffer_end = strpcpy(buffer_end,";");
   }
 
-  /* Perm=... */
-  {
-    unsigned long perms;
-    char perm_buf[64];
-    size_t length=0;
+  return buffer_end;
+}
 
-    perms = file_getperms(file_info, context);
+/** \brief Format Perm= fact, which depends on the user of \a context
+ * \return end of string written in \a buffer
+ */
+static char * _mlst_format_perms(struct wzd_file_t * file_info, char * buffer, wzd_context_t * context)
+{
+  unsigned long perms;
+  char perm_buf[64];
+  size_t length=0;
 
-    if (file_info && file_info->kind == FILE_REG) {
-      if (perms & RIGHT_STOR) perm_buf[length++] = 'a';
-      if (perms & RIGHT_RETR) perm_buf[length++] = 'r';
-      if (perms & RIGHT_STOR) perm_buf[length++] = 'w';
-    }
-    if (file_info && file_info->kind == FILE_DIR) {
-      if (perms & RIGHT_STOR) perm_buf[length++] = 'c';
-      if (perms & RIGHT_CWD)  perm_buf[length++] = 'e';
-      if (perms & RIGHT_LIST) perm_buf[length++] = 'l';
-      if (perms & RIGHT_MKDIR) perm_buf[length++] = 'm';
-      if (perms & RIGHT_STOR) perm_buf[length++] = 'p';
-    }
-    if (perms & RIGHT_DELE) perm_buf[length++] = 'd';
-    if (perms & RIGHT_RNFR) perm_buf[length++] = 'f';
+  perms = file_getperms(file_info, context);
 
-    perm_buf[length++] = ';';
-    perm_buf[length++] = '\0';
-    buffer_end = strpcpy(buffer_end,"Perm=");
-    buffer_end = strpcpy(buffer_end,perm_buf);
+  if (file_info && file_info->kind == FILE_REG) {
+    if (perms & RIGHT_STOR) perm_buf[length++] = 'a';
+    if (perms & RIGHT_RETR) perm_buf[length++] = 'r';
+    if (perms & RIGHT_STOR) perm_buf[length++] = 'w';
   }
+  if (file_info && file_info->kind == FILE_DIR) {
+    if (perms & RIGHT_STOR) perm_buf[length++] = 'c';
+    if (perms & RIGHT_CWD)  perm_buf[length++] = 'e';
+    if (perms & RIGHT_LIST) perm_buf[length++] = 'l';
+    if (perms & RIGHT_MKDIR) perm_buf[length++] = 'm';
+    if (perms & RIGHT_STOR) perm_buf[length++] = 'p';
+  }
+  if (perms & RIGHT_DELE) perm_buf[length++] = 'd';
+  if (perms & RIGHT_RNFR) perm_buf[length++] = 'f';
+
+  perm_buf[length++] = ';';
+  perm_buf[length++] = '\0';
+  buffer = strpcpy(buffer,"Perm=");
+  buffer = strpcpy(buffer,perm_buf);
+
+  return buffer;
+}
+
+/** \brief Format Unique= fact and file name
+ * \return end of string written in \a buffer
+ */
+static char * _mlst_format_name(struct wzd_file_t * file_info, char * buffer, wzd_context_t * context)
+{
+  char *ptr, *buffer_end;
+
+  buffer_end = buffer;
+  ptr = file_info->filename;
 
-  /* Unique=... 
+  /* Unique=...
    *
    * we use MD5 hash as unique value (not completely satisfying, but works !
-   * 
+   *
    * note: MD5 algorithm needs at least (2*sizeof(digest)+1) input data to work,
    * so we pad input to at least 33 bytes
    *
@@ -604,8 +1060,19 @@ static char * mlst_format_line(struct wzd_file_t * file_info, fs_filestat_t *s,
 #endif
       buffer_end = strpcpy(buffer_end,ptr);
 
-  str_deallocate(temp);
+  return buffer_end;
+}
+
+/** \warning no check is done on buffer overflow XXX */
+static char * mlst_format_line(struct wzd_file_t * file_info, fs_filestat_t *s, char * buffer, wzd_context_t * context)
+{
+  char *buffer_end;
+
+  if (!file_info || !s || !buffer) return NULL;
+
+  buffer_end = _mlst_format_facts(file_info,s,buffer);
+  buffer_end = _mlst_format_perms(file_info,buffer_end,context);
+  _mlst_format_name(file_info,buffer_end,context);
 
   return buffer;
 }
-
@@ -27,7 +27,6 @@
 
 int list(socket_t,wzd_context_t *,enum list_type_t,char *,char *,int callback(socket_t,wzd_context_t*,char *));
 int old_list(int,wzd_context_t *,enum list_type_t,char *,char *,int callback(socket_t,wzd_context_t*,char *)) DEPRECATED;
-int list_match(char *,char *);
 
 /* filename must be an ABSOLUTE path
  * return a newly allocated string
@@ -37,4 +36,16 @@ char * mlst_single_file(const char *filename, wzd_context_t * context);
 int mlsd_directory(const char * dirname, socket_t sock, int callback(socket_t,wzd_context_t*,char *),
     wzd_context_t * context);
 
+/** \brief Remove listings of directory \a dirname from cache
+ *
+ * Must be called when the content of the directory is modified.
+ */
+void list_cache_invalidate(const char * dirname);
+
+/** \brief Remove listings of the directory containing \a filename from cache */
+void list_cache_invalidate_file(const char * filename);
+
+/** \brief Remove all listings from cache */
+void list_cache_purge(void);
+
 #endif /* __WZD_LIST__ */
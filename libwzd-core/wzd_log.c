@@ -26,6 +26,16 @@
 
 /** \file wzd_log.c
  * @brief Contains routines to log files.
+ *
+ * With pthreads, out_log() does not write messages itself: the message is
+ * formatted in a stack buffer and copied to a lock-free ring, and a writer
+ * thread drains rings, using one writev() for several messages. Each
+ * thread is bound to a ring at its first message, so rings are shared only
+ * if there are more threads than HARD_LOG_RINGS. The timestamp is stored
+ * as a time_t, and converted by the writer at most once per second.
+ *
+ * Messages of different threads may be written slightly out of order.
+ * Before log_init() and after log_fini(), messages are written directly.
  */
 
 #include "wzd_all.h"
@@ -46,6 +56,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h> /* writev */
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -54,10 +66,15 @@
 #include <syslog.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <fcntl.h> /* O_WRONLY */
 
 #include "wzd_types.h"
 #include "wzd_structs.h"
+#include "wzd_atomic.h"
 #include "wzd_log.h"
 #include "wzd_misc.h"
 #include "wzd_user.h"
@@ -67,6 +84,10 @@
 
 #endif /* WZD_USE_PCH */
 
+#if defined(HAVE_PTHREAD) && !defined(WIN32)
+# define WZD_LOG_ASYNC
+#endif
+
 static struct memory_log_t _static_log;
 
 static wzd_mutex_t * _static_log_mutex = NULL;
@@ -81,6 +102,110 @@ struct wzd_log_entry_t {
 
 static struct wzd_log_entry_t _log_channels[MAX_LOG_CHANNELS];
 
+static int _log_overflow_policy = LOG_OVERFLOW_BLOCK;
+static volatile unsigned long _log_dropped = 0;
+
+#ifdef WZD_LOG_ASYNC
+
+#define LOG_RING_MASK	(HARD_LOG_RING_SIZE - 1)
+
+/* length of "%b %d %H:%M:%S " */
+#define LOG_DATE_SIZE	24
+
+struct wzd_log_message_t {
+  /* equal to position + 1 when the message is ready to be written, and to
+   * position + HARD_LOG_RING_SIZE when the slot can be reused
+   */
+  volatile unsigned long seq;
+  fd_t fd;
+  int syslog;
+  int level;
+  time_t date;
+  unsigned int length;
+  char datestr[LOG_DATE_SIZE]; /* set by writer */
+  char text[HARD_LOG_LINE_SIZE];
+};
+
+struct wzd_log_ring_t {
+  volatile unsigned long head; /* next position for producers */
+  volatile unsigned long tail; /* next position for writer */
+  struct wzd_log_message_t messages[HARD_LOG_RING_SIZE];
+};
+
+struct wzd_log_date_cache_t {
+  time_t date;
+  char datestr[LOG_DATE_SIZE];
+};
+
+static struct wzd_log_ring_t * _log_rings = NULL;
+static volatile unsigned long _log_ring_next = 0;
+static pthread_key_t _log_ring_key;
+
+static volatile int _log_async = 0;
+/* threads using the rings, log_fini() waits for them before freeing rings */
+static volatile unsigned long _log_users = 0;
+static volatile int _log_writer_running = 0;
+static volatile int _log_writer_sleeping = 0;
+static pthread_t _log_writer;
+
+/* wakes up the writer when messages are pushed, and producers waiting
+ * for the writer (log_flush(), LOG_OVERFLOW_BLOCK) when rings are drained
+ */
+static pthread_mutex_t _log_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _log_wait_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _log_drained_cond = PTHREAD_COND_INITIALIZER;
+
+static void * _log_writer_fund(void *);
+#endif /* WZD_LOG_ASYNC */
+
+static void _log_format_date(time_t date, char * buffer, size_t length)
+{
+  struct tm * ntime;
+#ifndef WIN32
+  struct tm tm_buf;
+
+  ntime = localtime_r(&date, &tm_buf);
+#else
+  ntime = localtime(&date);
+#endif
+  buffer[0] = '\0';
+  if (ntime)
+    (void)strftime(buffer,length,"%b %d %H:%M:%S ",ntime);
+}
+
+/** \brief Send message to syslog, using priority corresponding to \a level
+ */
+static void _log_syslog(int level, const char * buffer)
+{
+#ifndef _WIN32
+  int prior;
+
+  /* default priority: informational */
+  prior = LOG_INFO;
+  switch (level) {
+    case LEVEL_CRITICAL:
+      prior = LOG_ERR;
+      break;
+    case LEVEL_HIGH:
+      prior = LOG_ERR;
+      break;
+    case LEVEL_NORMAL:
+      prior = LOG_NOTICE;
+      break;
+    case LEVEL_INFO:
+      prior = LOG_INFO;
+      break;
+    case LEVEL_FLOOD:
+      prior = LOG_DEBUG;
+      break;
+    default:
+      break;
+  }
+
+  syslog(prior,"%s",buffer);
+#endif
+}
+
 int log_init(void)
 {
   int i;
@@ -100,6 +225,40 @@ int log_init(void)
     _log_channels[i].syslog = 0;
   }
 
+  _log_dropped = 0;
+
+#ifdef WZD_LOG_ASYNC
+  {
+    unsigned long j;
+
+    _log_rings = malloc(HARD_LOG_RINGS * sizeof(struct wzd_log_ring_t));
+    if (_log_rings == NULL)
+      return 0; /* messages will be written directly */
+    for (i=0; i<HARD_LOG_RINGS; i++) {
+      _log_rings[i].head = 0;
+      _log_rings[i].tail = 0;
+      for (j=0; j<HARD_LOG_RING_SIZE; j++)
+        _log_rings[i].messages[j].seq = j;
+    }
+
+    if (pthread_key_create(&_log_ring_key, NULL) != 0) {
+      free(_log_rings);
+      _log_rings = NULL;
+      return 0;
+    }
+
+    _log_writer_running = 1;
+    if (pthread_create(&_log_writer, NULL, _log_writer_fund, NULL) != 0) {
+      _log_writer_running = 0;
+      pthread_key_delete(_log_ring_key);
+      free(_log_rings);
+      _log_rings = NULL;
+      return 0;
+    }
+    _log_async = 1;
+  }
+#endif /* WZD_LOG_ASYNC */
+
   return 0;
 }
 
@@ -121,6 +280,9 @@ void log_close(fd_t fd)
 #endif
   if (fd == -1) return;
 
+  /* pending messages could be written to the next file using fd */
+  log_flush();
+
   FD_UNREGISTER(fd,"Log");
   close(fd);
 }
@@ -129,6 +291,31 @@ void log_fini(void)
 {
   int i,j,fd;
 
+#ifdef WZD_LOG_ASYNC
+  if (_log_async) {
+    /* new messages are written directly, pending messages are written
+     * by the writer before it exits
+     */
+    _log_async = 0;
+    WZD_ATOMIC_BARRIER();
+    /* threads which did not see the change yet are still using the rings,
+     * the writer is kept running so they can't be blocked
+     */
+    while (_log_users != 0)
+      usleep(1000);
+
+    pthread_mutex_lock(&_log_wait_mutex);
+    _log_writer_running = 0;
+    pthread_cond_signal(&_log_wait_cond);
+    pthread_mutex_unlock(&_log_wait_mutex);
+    pthread_join(_log_writer, NULL);
+
+    pthread_key_delete(_log_ring_key);
+    free(_log_rings);
+    _log_rings = NULL;
+  }
+#endif /* WZD_LOG_ASYNC */
+
   _static_log_enabled = 0;
   wzd_mutex_lock(_static_log_mutex);
 
@@ -223,14 +410,358 @@ int log_set_syslog(unsigned int level, int syslog_value)
   return 0;
 }
 
+/** \brief Set behaviour of out_log() when messages are sent faster
+ * than they can be written
+ */
+void log_set_overflow_policy(int policy)
+{
+  switch (policy) {
+    case LOG_OVERFLOW_BLOCK:
+    case LOG_OVERFLOW_DROP:
+    case LOG_OVERFLOW_COUNT:
+      _log_overflow_policy = policy;
+      break;
+    default:
+      break;
+  }
+}
+
+/** \brief Get number of messages dropped since log_init() */
+unsigned long log_get_dropped(void)
+{
+  return _log_dropped;
+}
+
+/** \brief Write message directly, from the calling thread
+ *
+ * Used when the writer thread is not running.
+ */
+static void _log_write_direct(int level, const char * buffer, unsigned int length)
+{
+  char datestr[128];
+
+  if (_log_channels[level].fd > 0) {
+    _log_format_date(time(NULL), datestr, sizeof(datestr));
+    write(_log_channels[level].fd, datestr, strlen(datestr));
+    write(_log_channels[level].fd, buffer, length);
+  }
+
+  if (_static_log_enabled) {
+    if (!wzd_mutex_lock(_static_log_mutex)) {
+      _buffer_push(buffer);
+      wzd_mutex_unlock(_static_log_mutex);
+    }
+  }
+
+  if (_log_channels[level].syslog)
+    _log_syslog(level, buffer);
+}
+
+#ifdef WZD_LOG_ASYNC
+static void _log_timeout(struct timespec * ts, unsigned long ms)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,NULL);
+  ts->tv_sec = tv.tv_sec + ms / 1000;
+  ts->tv_nsec = tv.tv_usec * 1000 + (ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+/** \brief Get ring of the current thread, choosing one if needed */
+static struct wzd_log_ring_t * _log_get_ring(void)
+{
+  struct wzd_log_ring_t * ring;
+
+  ring = pthread_getspecific(_log_ring_key);
+  if (ring == NULL) {
+    ring = &_log_rings[(WZD_ATOMIC_INC(&_log_ring_next) - 1) % HARD_LOG_RINGS];
+    pthread_setspecific(_log_ring_key, ring);
+  }
+  return ring;
+}
+
+/** \brief Copy message to \a ring
+ *
+ * Several threads can push messages to the same ring, slots are reserved
+ * using compare-and-swap on head.
+ * \return 0 if ok, -1 if ring is full
+ */
+static int _log_ring_push(struct wzd_log_ring_t * ring, int level, time_t date, const char * text, unsigned int length)
+{
+  struct wzd_log_message_t * msg;
+  unsigned long pos;
+  long dif;
+
+  pos = ring->head;
+  for (;;) {
+    msg = &ring->messages[pos & LOG_RING_MASK];
+    dif = (long)(msg->seq - pos);
+    if (dif == 0) {
+      if (WZD_ATOMIC_CAS(&ring->head, pos, pos + 1)) break;
+    } else if (dif < 0) {
+      return -1;
+    }
+    pos = ring->head;
+  }
+
+  msg->fd = _log_channels[level].fd;
+  msg->syslog = _log_channels[level].syslog;
+  msg->level = level;
+  msg->date = date;
+  msg->length = length;
+  memcpy(msg->text, text, length + 1);
+
+  WZD_ATOMIC_BARRIER();
+  msg->seq = pos + 1;
+
+  return 0;
+}
+
+/** \brief Check if a message is ready in one of the rings */
+static int _log_pending(void)
+{
+  unsigned long pos;
+  int i;
+
+  for (i=0; i<HARD_LOG_RINGS; i++) {
+    pos = _log_rings[i].tail;
+    if (_log_rings[i].messages[pos & LOG_RING_MASK].seq == pos + 1)
+      return 1;
+  }
+  return 0;
+}
+
+static int _log_async_push(int level, const char * buffer, unsigned int length);
+
+/** \brief Queue message for the writer thread, applying the overflow policy
+ * \return 0 if message was queued or dropped, -1 if it must be written directly
+ */
+static int _log_async_send(int level, const char * buffer, unsigned int length)
+{
+  int ret;
+
+  WZD_ATOMIC_INC(&_log_users);
+  ret = (_log_async) ? _log_async_push(level, buffer, length) : -1;
+  WZD_ATOMIC_DEC(&_log_users);
+
+  return ret;
+}
+
+/* must be called with _log_users incremented */
+static int _log_async_push(int level, const char * buffer, unsigned int length)
+{
+  struct wzd_log_ring_t * ring;
+  struct timespec ts;
+  time_t date;
+
+  ring = _log_get_ring();
+  date = time(NULL);
+
+  while (_log_ring_push(ring, level, date, buffer, length) != 0) {
+    if (_log_overflow_policy != LOG_OVERFLOW_BLOCK || !_log_writer_running) {
+      WZD_ATOMIC_INC(&_log_dropped);
+      return 0;
+    }
+    /* wait until the writer has drained some messages */
+    pthread_mutex_lock(&_log_wait_mutex);
+    pthread_cond_signal(&_log_wait_cond);
+    _log_timeout(&ts, 10);
+    pthread_cond_timedwait(&_log_drained_cond, &_log_wait_mutex, &ts);
+    pthread_mutex_unlock(&_log_wait_mutex);
+  }
+
+  /* the writer checks rings after setting _log_writer_sleeping, so the
+   * message can't be missed
+   */
+  WZD_ATOMIC_BARRIER();
+  if (_log_writer_sleeping) {
+    pthread_mutex_lock(&_log_wait_mutex);
+    pthread_cond_signal(&_log_wait_cond);
+    pthread_mutex_unlock(&_log_wait_mutex);
+  }
+
+  return 0;
+}
+
+/** \brief Write ready messages of \a ring
+ *
+ * Consecutive messages for the same file are written using one writev().
+ * \return number of messages written
+ */
+static unsigned int _log_ring_drain(struct wzd_log_ring_t * ring, struct wzd_log_date_cache_t * cache)
+{
+  struct wzd_log_message_t * batch[HARD_LOG_WRITEV];
+  struct iovec iov[2 * HARD_LOG_WRITEV];
+  struct wzd_log_message_t * msg;
+  unsigned int count, i, n_iov;
+  unsigned long pos;
+
+  pos = ring->tail;
+  for (count=0; count<HARD_LOG_WRITEV; count++) {
+    msg = &ring->messages[(pos + count) & LOG_RING_MASK];
+    if (msg->seq != pos + count + 1) break;
+    /* contents of the message must not be read before seq */
+    WZD_ATOMIC_BARRIER();
+
+    /* timestamp is converted once per second */
+    if (msg->date != cache->date) {
+      _log_format_date(msg->date, cache->datestr, sizeof(cache->datestr));
+      cache->date = msg->date;
+    }
+    memcpy(msg->datestr, cache->datestr, sizeof(msg->datestr));
+    batch[count] = msg;
+  }
+  if (count == 0) return 0;
+
+  n_iov = 0;
+  for (i=0; i<count; i++) {
+    if (batch[i]->fd <= 0) continue;
+    iov[n_iov].iov_base = batch[i]->datestr;
+    iov[n_iov].iov_len = strlen(batch[i]->datestr);
+    iov[n_iov+1].iov_base = batch[i]->text;
+    iov[n_iov+1].iov_len = batch[i]->length;
+    n_iov += 2;
+    if (i+1 == count || batch[i+1]->fd != batch[i]->fd) {
+      (void)writev(batch[i]->fd, iov, n_iov);
+      n_iov = 0;
+    }
+  }
+
+  if (_static_log_enabled) {
+    if (!wzd_mutex_lock(_static_log_mutex)) {
+      for (i=0; i<count; i++)
+        _buffer_push(batch[i]->text);
+      wzd_mutex_unlock(_static_log_mutex);
+    }
+  }
+
+  for (i=0; i<count; i++)
+    if (batch[i]->syslog)
+      _log_syslog(batch[i]->level, batch[i]->text);
+
+  /* give slots back to producers */
+  WZD_ATOMIC_BARRIER();
+  for (i=0; i<count; i++)
+    batch[i]->seq = pos + i + HARD_LOG_RING_SIZE;
+  ring->tail = pos + count;
+
+  return count;
+}
+
+/** \brief Log number of messages dropped since last call, if policy
+ * is LOG_OVERFLOW_COUNT
+ */
+static void _log_report_dropped(unsigned long * reported, struct wzd_log_date_cache_t * cache)
+{
+  char buffer[128];
+  unsigned long dropped;
+  fd_t fd;
+
+  dropped = _log_dropped;
+  if (dropped == *reported) return;
+
+  if (_log_overflow_policy == LOG_OVERFLOW_COUNT) {
+    snprintf(buffer, sizeof(buffer), "%lu log messages dropped\n", dropped - *reported);
+    fd = _log_channels[LEVEL_HIGH].fd;
+    if (fd > 0) {
+      (void)write(fd, cache->datestr, strlen(cache->datestr));
+      (void)write(fd, buffer, strlen(buffer));
+    }
+    if (_log_channels[LEVEL_HIGH].syslog)
+      _log_syslog(LEVEL_HIGH, buffer);
+  }
+  *reported = dropped;
+}
+
+/** \brief Writer thread: drain rings until log_fini() */
+static void * _log_writer_fund(UNUSED void * arg)
+{
+  struct wzd_log_date_cache_t cache;
+  unsigned long reported = 0;
+  unsigned int count;
+  struct timespec ts;
+  int i;
+
+  cache.date = (time_t)-1;
+  cache.datestr[0] = '\0';
+
+  for (;;) {
+    count = 0;
+    for (i=0; i<HARD_LOG_RINGS; i++)
+      count += _log_ring_drain(&_log_rings[i], &cache);
+    _log_report_dropped(&reported, &cache);
+
+    pthread_mutex_lock(&_log_wait_mutex);
+    pthread_cond_broadcast(&_log_drained_cond);
+    if (count == 0) {
+      if (!_log_writer_running) {
+        pthread_mutex_unlock(&_log_wait_mutex);
+        break;
+      }
+      _log_writer_sleeping = 1;
+      WZD_ATOMIC_BARRIER();
+      if (!_log_pending()) {
+        _log_timeout(&ts, 1000);
+        pthread_cond_timedwait(&_log_wait_cond, &_log_wait_mutex, &ts);
+      }
+      _log_writer_sleeping = 0;
+    }
+    pthread_mutex_unlock(&_log_wait_mutex);
+  }
+
+  return NULL;
+}
+#endif /* WZD_LOG_ASYNC */
+
+/** \brief Wait until all messages sent to out_log() have been written
+ */
+void log_flush(void)
+{
+#ifdef WZD_LOG_ASYNC
+  unsigned long heads[HARD_LOG_RINGS];
+  struct timespec ts;
+  int i, done;
+
+  if (!_log_async || pthread_equal(pthread_self(), _log_writer)) return;
+
+  WZD_ATOMIC_INC(&_log_users);
+  if (!_log_async) {
+    WZD_ATOMIC_DEC(&_log_users);
+    return;
+  }
+
+  for (i=0; i<HARD_LOG_RINGS; i++)
+    heads[i] = _log_rings[i].head;
+
+  pthread_mutex_lock(&_log_wait_mutex);
+  for (;;) {
+    done = 1;
+    for (i=0; i<HARD_LOG_RINGS; i++) {
+      if ((long)(_log_rings[i].tail - heads[i]) < 0) {
+        done = 0;
+        break;
+      }
+    }
+    if (done || !_log_writer_running) break;
+    pthread_cond_signal(&_log_wait_cond);
+    _log_timeout(&ts, 100);
+    pthread_cond_timedwait(&_log_drained_cond, &_log_wait_mutex, &ts);
+  }
+  pthread_mutex_unlock(&_log_wait_mutex);
+
+  WZD_ATOMIC_DEC(&_log_users);
+#endif /* WZD_LOG_ASYNC */
+}
+
 void out_log(int level,const char *fmt,...)
 {
-  int prior=0;
   va_list argptr;
-  char *buffer=NULL;
-  char datestr[128];
-  time_t timeval;
-  struct tm * ntime;
+  char buffer[HARD_LOG_LINE_SIZE];
+  int length;
 
   /* new logging code */
   if (level >= MAX_LOG_CHANNELS) return;
@@ -238,62 +769,33 @@ void out_log(int level,const char *fmt,...)
   /* don't log events when log level is lower than threshold */
   if (mainConfig && level < mainConfig->loglevel) return;
 
-  /* create timestamp */
-  timeval = time(NULL);
-  ntime = localtime( &timeval );
-  (void)strftime(datestr,sizeof(datestr),"%b %d %H:%M:%S ",ntime);
-
   if (_log_channels[level].fd > 0 || _log_channels[level].syslog)
   {
     va_start(argptr,fmt); /* note: ansi compatible version of va_start */
-    buffer = safe_vsnprintf(fmt,argptr);
+    length = vsnprintf(buffer,sizeof(buffer),fmt,argptr);
     va_end (argptr);
 
-    if (_log_channels[level].fd > 0) {
-      write(_log_channels[level].fd, datestr, strlen(datestr));
-      write(_log_channels[level].fd, buffer, strlen(buffer));
-    }
-    
-    if (_static_log_enabled) {
-      if (!wzd_mutex_lock(_static_log_mutex)) {
-        _buffer_push(buffer);
-        wzd_mutex_unlock(_static_log_mutex);
-      }
+    if (length < 0) {
+      buffer[0] = '\0';
+      length = 0;
+    } else if (length >= (int)sizeof(buffer)) {
+      /* message was truncated, keep end of line */
+      length = sizeof(buffer) - 1;
+      buffer[length-1] = '\n';
     }
 
-#ifndef _WIN32
-    if (_log_channels[level].syslog)
-    {
-      /* default priority: informational */
-      prior = LOG_INFO;
-      switch (level) {
-        case LEVEL_CRITICAL:
-          prior = LOG_ERR;
-          break;
-        case LEVEL_HIGH:
-          prior = LOG_ERR;
-          break;
-        case LEVEL_NORMAL:
-          prior = LOG_NOTICE;
-          break;
-        case LEVEL_INFO:
-          prior = LOG_INFO;
-          break;
-        case LEVEL_FLOOD:
-          prior = LOG_DEBUG;
-          break;
-        default:
-          break;
-      }
-
-      syslog(prior,"%s",buffer);
-    }
+#ifdef WZD_LOG_ASYNC
+    if (_log_async_send(level, buffer, (unsigned int)length) != 0)
+      _log_write_direct(level, buffer, (unsigned int)length);
+#else
+    _log_write_direct(level, buffer, (unsigned int)length);
 #endif
-    wzd_free(buffer);
   }
 
 #ifdef DEBUG
   {
+    char * debug_buffer;
+    char datestr[128];
     char new_format[1024];
     char msg_begin[120];
     char msg_end[20];
@@ -328,16 +830,17 @@ void out_log(int level,const char *fmt,...)
     }
 
     /* add timestamp */
+    _log_format_date(time(NULL), datestr, sizeof(datestr));
     strlcat(msg_begin,datestr,sizeof(msg_begin));
 
     va_start(argptr,fmt); /* note: ansi compatible version of va_start */
     snprintf(new_format,sizeof(new_format)-1,"%s%s%s",msg_begin,fmt,msg_end);
-    buffer = safe_vsnprintf(new_format,argptr);
+    debug_buffer = safe_vsnprintf(new_format,argptr);
     va_end (argptr);
 
-    write(1 /* stderr */, buffer, strlen(buffer));
+    write(1 /* stderr */, debug_buffer, strlen(debug_buffer));
 
-    wzd_free(buffer);
+    wzd_free(debug_buffer);
   }
 #endif
 }
@@ -434,16 +937,15 @@ void out_xferlog(wzd_context_t * context, int is_complete)
   time_t timeval;
   struct tm * ntime;
   const char * remote_host;
-  struct hostent *h;
+  char hostname[256];
   char * username;
 
   if (mainConfig->xferlog_fd == -1) return;
 
-  h = gethostbyaddr((char*)&context->hostip,sizeof(context->hostip),AF_INET);
-  if (h==NULL)
+  if (ip_get_hostname_cached(context->hostip, context->family, hostname, sizeof(hostname)))
     remote_host = inet_ntoa( *((struct in_addr*)context->hostip) );
   else
-    remote_host = h->h_name;
+    remote_host = hostname;
   username = GetUserByID(context->userid)->username;
   timeval = time(NULL);
   ntime = localtime( &timeval );
@@ -503,6 +1005,14 @@ const char * loglevel2str(int l)
   return "";
 }
 
+int str2logoverflow(const char *s)
+{
+  if (strcasecmp(s,"block")==0) return LOG_OVERFLOW_BLOCK;
+  else if (strcasecmp(s,"drop")==0) return LOG_OVERFLOW_DROP;
+  else if (strcasecmp(s,"count")==0) return LOG_OVERFLOW_COUNT;
+  return -1;
+}
+
 static void _buffer_push(const char *str)
 {
   int i;
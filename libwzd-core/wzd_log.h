@@ -58,12 +58,32 @@
 #define	LEVEL_HIGH	7
 #define	LEVEL_CRITICAL	9
 
+/* behaviour of out_log() when the log ring of the thread is full */
+#define	LOG_OVERFLOW_BLOCK	0	/**< wait for the log writer */
+#define	LOG_OVERFLOW_DROP	1	/**< drop message */
+#define	LOG_OVERFLOW_COUNT	2	/**< drop message, and log the number of dropped messages */
+
 /** \brief Initialize logging facilities
  *
  * Init structures used for logging
  */
 int log_init(void);
 
+/** \brief Wait until all messages sent to out_log() have been written
+ */
+void log_flush(void);
+
+/** \brief Set behaviour of out_log() when messages are sent faster
+ * than they can be written
+ *
+ * \param policy one of LOG_OVERFLOW_BLOCK, LOG_OVERFLOW_DROP or LOG_OVERFLOW_COUNT
+ */
+void log_set_overflow_policy(int policy);
+
+/** \brief Get number of messages dropped since log_init()
+ */
+unsigned long log_get_dropped(void);
+
 /** \brief Open file for logging
  */
 int log_open(const char * filename, int filemode);
@@ -173,4 +193,10 @@ int str2loglevel(const char *s);
  */
 const char * loglevel2str(int l);
 
+/** \brief Convert a string containing the log overflow policy ("block", "drop"
+ * or "count") into the corresponding constant (LOG_OVERFLOW_BLOCK)
+ * \return The constant, or -1 on error
+ */
+int str2logoverflow(const char *s);
+
 #endif /* __WZD_LOG__ */
@@ -48,6 +48,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "wzd_structs.h"
 
@@ -257,6 +258,14 @@ int do_pass(const char *username, const char * pass, wzd_context_t * context)
 }
 
 
+/* remaining time before \a deadline, in seconds */
+static unsigned int _login_dns_wait(time_t deadline)
+{
+  time_t now = time(NULL);
+
+  return (deadline > now) ? (unsigned int)(deadline - now) : 0;
+}
+
 /*************** do_user_ip **************************/
 /** \brief Check if user is connecting from an authorized ip
  *
@@ -272,6 +281,7 @@ int do_user_ip(const char *username, wzd_context_t * context)
   wzd_user_t * user;
   wzd_group_t *group;
   unsigned int i;
+  time_t deadline;
   int ret;
 
   user = GetUserByID(context->userid);
@@ -293,13 +303,18 @@ int do_user_ip(const char *username, wzd_context_t * context)
     inet_ntop(AF_INET,userip,ip,INET_ADDRSTRLEN);
   }
 
-  ret = ip_list_check_ident(user->ip_list, ip, context->ident);
+  /* the reverse lookup was started when the connection was accepted, wait
+   * for it if host names are used (at most HARD_DNS_LOGIN_WAIT for all lists)
+   */
+  deadline = time(NULL) + HARD_DNS_LOGIN_WAIT;
+
+  ret = ip_list_check_ident_wait(user->ip_list, ip, context->ident, _login_dns_wait(deadline));
   if (ret > 0) return E_OK;
 
   /* user ip not found, try groups */
   for (i=0; i<user->group_num; i++) {
     group = GetGroupByID(user->groups[i]);
-    if (group && ip_list_check_ident(group->ip_list, ip, context->ident)==1)
+    if (group && ip_list_check_ident_wait(group->ip_list, ip, context->ident, _login_dns_wait(deadline))==1)
       return E_OK;
   }
 
@@ -719,6 +734,22 @@ int do_login(wzd_context_t * context)
 {
   int ret;
 
+  /* global ip rules using a host name not known when the connection was
+   * accepted: wait for the reverse lookup here, not in the accept loop */
+  if (context->connection_flags & CONNECTION_IP_PENDING) {
+    context->connection_flags &= ~CONNECTION_IP_PENDING;
+    if (ip_check_global(context->hostip, context->family, mainConfig, HARD_DNS_LOGIN_WAIT) <= 0) {
+      char inet_str[INET6_ADDRSTRLEN];
+      int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
+
+      inet_str[0] = '\0';
+      inet_ntop(af, context->hostip, inet_str, sizeof(inet_str));
+      /* close connection without warning, as if rejected by the accept loop */
+      out_log(LEVEL_HIGH,"Failed login from %s: global ip rejected\n", inet_str);
+      return E_USER_NOIP;
+    }
+  }
+
   /* welcome msg */
   ret = send_message(220,context);
 
@@ -726,7 +757,7 @@ int do_login(wzd_context_t * context)
   ret = do_login_loop(context);
 
   {
-    struct hostent * h = NULL;
+    char hostname[256];
     char inet_str[256];
     int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
     wzd_user_t * user = NULL;
@@ -738,10 +769,11 @@ int do_login(wzd_context_t * context)
     }
     inet_str[0] = '\0';
     inet_ntop(af, context->hostip, inet_str, sizeof(inet_str));
-    h = gethostbyaddr((char*)&context->hostip, sizeof(context->hostip), af);
+    if (ip_get_hostname_cached(context->hostip, context->family, hostname, sizeof(hostname)))
+      hostname[0] = '\0';
     log_message(ret ? "LOGIN_FAILED" : "LOGIN",
         "%s (%s) \"%s\" \"%s\" \"%s\"",
-        h && h->h_name ? h->h_name : "No hostname",
+        *hostname ? hostname : "No hostname",
         *inet_str ? inet_str : "No IP address",
         user && *(user->username) ? user->username : "No username",
         group && *(group->groupname) ? group->groupname : "No groupname",
@@ -93,13 +93,16 @@
 #include "wzd_types.h"
 #include "wzd_structs.h"
 
+#include "wzd_atomic.h"
 #include "wzd_ClientThread.h"
 #include "wzd_fs.h"
+#include "wzd_group.h"
 #include "wzd_libmain.h"
 #include "wzd_log.h"
 #include "wzd_misc.h"
 #include "wzd_messages.h"
 #include "wzd_mutex.h"
+#include "wzd_reactor.h"
 #include "wzd_user.h"
 
 #endif /* WZD_USE_PCH */
@@ -706,80 +709,279 @@ unsigned long get_bandwidth(unsigned long *dl, unsigned long *ul)
 }
 
 
-wzd_bw_limiter * limiter_new(int maxspeed)
+/** Maximum burst allowed by a limiter, in microseconds of bandwidth */
+#define LIMITER_BURST_USEC	250000
+/** Maximum delay returned by limiter_consume() (usec) */
+#define LIMITER_MAX_DELAY	1000000
+
+/* Token buckets are shared between transfer threads (global and group
+ * limiters), and updated using atomic operations only.
+ */
+
+/** \brief Group limiters, created on first use */
+struct _group_limiter_t {
+  unsigned int gid;
+  wzd_bw_limiter ul_limiter;
+  wzd_bw_limiter dl_limiter;
+  struct _group_limiter_t * next_group;
+};
+
+static struct _group_limiter_t * _group_limiters = NULL;
+
+/** \brief Monotonic date, in microseconds */
+static i64_t _limiter_now(void)
 {
-  wzd_bw_limiter *l_new;
 #ifndef WIN32
-  struct timezone tz;
-#endif
+# if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
 
-  l_new = malloc(sizeof(wzd_bw_limiter));
-  l_new->maxspeed = maxspeed;
-  l_new->bytes_transfered = 0;
-#ifndef WIN32
-  gettimeofday(&(l_new->current_time),&tz);
+  if (clock_gettime(CLOCK_MONOTONIC,&ts)==0)
+    return (i64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+# endif
+  {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (i64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  }
 #else
-  _ftime(&(l_new->current_time));
+  struct _timeb tb;
+  _ftime(&tb);
+  return (i64_t)tb.time * 1000000 + tb.millitm * 1000;
 #endif
+}
 
-  return l_new;
+/** \brief Add tokens for the time elapsed since the last refill
+ *
+ * Only the thread which succeeds in moving last_refill gets the tokens for
+ * the interval, so tokens are never added twice.
+ */
+static void _limiter_refill(wzd_bw_limiter * l, u32_t maxspeed, i64_t now)
+{
+  i64_t last, elapsed, add, burst, tokens, next;
+
+  last = l->last_refill;
+  elapsed = now - last;
+  if (elapsed <= 0) return;
+
+  burst = ((i64_t)maxspeed * LIMITER_BURST_USEC) / 1000000;
+  if (burst < 1) burst = 1;
+
+  if (elapsed >= 1000000) {
+    /* idle for a long time (or first use): bucket is full */
+    add = burst;
+    next = now;
+  } else {
+    add = (elapsed * maxspeed) / 1000000;
+    if (add == 0) return; /* keep fraction for next time */
+    /* only consume the time corresponding to whole tokens */
+    next = last + (add * 1000000) / maxspeed;
+  }
+
+  if (!WZD_ATOMIC_CAS64(&l->last_refill,last,next)) return;
+
+  tokens = WZD_ATOMIC_ADD64(&l->tokens,add);
+  while (tokens > burst) {
+    if (WZD_ATOMIC_CAS64(&l->tokens,tokens,burst)) break;
+    tokens = l->tokens;
+  }
 }
 
-void limiter_add_bytes(wzd_bw_limiter *l, wzd_mutex_t * mutex, int byte_count, UNUSED int force_check)
+/** \brief Update statistics (current_speed) of limiter
+ * \note only used for connection limiters, which have a single writer
+ */
+static void _limiter_update_speed(wzd_bw_limiter *l, int byte_count)
 {
-#ifndef WIN32 /* FIXME VISUAL */
+#ifndef WIN32
   struct timeval tv;
-  struct timezone tz;
 #else
   struct _timeb tb;
 #endif
   unsigned long elapsed;
-  unsigned long pause_time;
-/*  double rate_ratio;*/
-  unsigned int bw_rate;
 
-  if (!l) return;
-/*  if (l->maxspeed == 0) return;*/
-
-wzd_mutex_lock(mutex);
   l->bytes_transfered += byte_count;
-wzd_mutex_unlock(mutex);
 
-  /* if at least 1 second of data is downloaded, assess the situation
-   * and determine how much time to wait */
-/*  if ( (l->bytes_transfered >= l->maxspeed) || force_check )
-  {*/
 #ifndef WIN32
-    gettimeofday( &tv, &tz );
-    elapsed = (unsigned long)(tv.tv_sec - l->current_time.tv_sec) * 1000000;
-    elapsed += (unsigned long)(tv.tv_usec - l->current_time.tv_usec);
+  gettimeofday( &tv, NULL );
+  elapsed = (unsigned long)(tv.tv_sec - l->current_time.tv_sec) * 1000000;
+  elapsed += (unsigned long)(tv.tv_usec - l->current_time.tv_usec);
 #else
-    _ftime(&tb);
-    elapsed = (tb.time - l->current_time.time) * 1000000;
-    elapsed += (tb.millitm - l->current_time.millitm) * 1000;
+  _ftime(&tb);
+  elapsed = (tb.time - l->current_time.time) * 1000000;
+  elapsed += (tb.millitm - l->current_time.millitm) * 1000;
 #endif
-    if (elapsed==0) elapsed=1;
-/*    bw_rate = (unsigned int)((double)l->bytes_transfered / elapsed);*/
-    l->current_speed = (float)( (l->bytes_transfered * 1000000.f) / elapsed);
-    bw_rate = (unsigned int)l->current_speed;
-/*  }*/
-  if (l->maxspeed == 0 || bw_rate <= l->maxspeed) {
-    return;
+  if (elapsed==0) elapsed=1;
+  l->current_speed = (float)( (l->bytes_transfered * 1000000.f) / elapsed);
+}
+
+/** \brief Initialize limiter
+ * \param[in] l limiter
+ * \param[in] maxspeed max speed (bytes / sec), 0 means no limit
+ * \param[in] parent next level of limit (group, global), or NULL
+ */
+void limiter_init(wzd_bw_limiter *l, u32_t maxspeed, wzd_bw_limiter *parent)
+{
+  if (!l) return;
+
+  l->maxspeed = maxspeed;
+  l->bytes_transfered = 0;
+  l->current_speed = 0.f;
+#ifndef WIN32
+  gettimeofday(&(l->current_time),NULL);
+#else
+  _ftime(&(l->current_time));
+#endif
+  l->tokens = 0;
+  l->last_refill = 0;
+  l->parent = parent;
+}
+
+wzd_bw_limiter * limiter_new(int maxspeed)
+{
+  wzd_bw_limiter *l_new;
+
+  l_new = malloc(sizeof(wzd_bw_limiter));
+  limiter_init(l_new,maxspeed,NULL);
+
+  return l_new;
+}
+
+/** \brief Get the limiter shared by all transfers of \a user
+ *
+ * This is the limiter of the main group of the user if it has a speed limit,
+ * or the global limiter. The group limiter uses the global one as parent.
+ *
+ * \param[in] user user
+ * \param[in] is_upload 1 for uploads, 0 for downloads
+ */
+wzd_bw_limiter * limiter_get_parent(wzd_user_t * user, int is_upload)
+{
+  wzd_bw_limiter * global;
+  wzd_group_t * group = NULL;
+  struct _group_limiter_t * it;
+  u32_t maxspeed;
+
+  global = (is_upload) ? &mainConfig->global_ul_limiter : &mainConfig->global_dl_limiter;
+
+  if (user && user->group_num > 0)
+    group = GetGroupByID(user->groups[0]);
+  if (!group) return global;
+
+  maxspeed = (is_upload) ? group->max_ul_speed : group->max_dl_speed;
+  if (maxspeed == 0) return global;
+
+  if (limiter_mutex) wzd_mutex_lock(limiter_mutex);
+  for (it=_group_limiters; it; it=it->next_group)
+    if (it->gid == group->gid) break;
+  if (!it) {
+    it = wzd_malloc(sizeof(struct _group_limiter_t));
+    it->gid = group->gid;
+    limiter_init(&it->ul_limiter,group->max_ul_speed,&mainConfig->global_ul_limiter);
+    limiter_init(&it->dl_limiter,group->max_dl_speed,&mainConfig->global_dl_limiter);
+    it->next_group = _group_limiters;
+    _group_limiters = it;
+  }
+  /* group limits may have been changed since last transfer */
+  it->ul_limiter.maxspeed = group->max_ul_speed;
+  it->dl_limiter.maxspeed = group->max_dl_speed;
+  if (limiter_mutex) wzd_mutex_unlock(limiter_mutex);
+
+  return (is_upload) ? &it->ul_limiter : &it->dl_limiter;
+}
+
+/** \brief Free all group limiters */
+void limiter_group_free(void)
+{
+  struct _group_limiter_t * it, * next;
+
+  if (limiter_mutex) wzd_mutex_lock(limiter_mutex);
+  for (it=_group_limiters; it; it=next) {
+    next = it->next_group;
+    wzd_free(it);
+  }
+  _group_limiters = NULL;
+  if (limiter_mutex) wzd_mutex_unlock(limiter_mutex);
+}
+
+/** \brief Account \a byte_count transferred bytes, without sleeping
+ *
+ * Bytes are removed from the bucket of \a l and all its parents (tokens can
+ * become negative).
+ *
+ * \return the time to wait (in microseconds) before sending more data, 0 if
+ * the transfer can continue immediately
+ */
+unsigned long limiter_consume(wzd_bw_limiter *l, unsigned int byte_count)
+{
+  i64_t now = 0, tokens, delay = 0, d;
+  u32_t maxspeed;
+
+  if (!l) return 0;
+
+  _limiter_update_speed(l,byte_count);
+
+  for ( ; l; l = l->parent) {
+    maxspeed = l->maxspeed;
+    if (maxspeed == 0) continue;
+    if (now == 0) now = _limiter_now();
+
+    _limiter_refill(l,maxspeed,now);
+    tokens = WZD_ATOMIC_ADD64(&l->tokens,-(i64_t)byte_count);
+    if (tokens < 0) {
+      d = (-tokens * 1000000) / maxspeed;
+      if (d > delay) delay = d;
+    }
   }
-/*out_err(LEVEL_INFO,"received: %d\n",l->bytes_transfered);*/
-/*out_err(LEVEL_INFO,"speed: %d max:%d\n",bw_rate,l->maxspeed);*/
-/*  rate_ratio = (double)bw_rate / (double)l->maxspeed;*/
-/*  pause_time = (rate_ratio - (double)1)*elapsed;*/
-  pause_time = (bw_rate-l->maxspeed) * (elapsed / l->maxspeed);
+
+  return (unsigned long)((delay > LIMITER_MAX_DELAY) ? LIMITER_MAX_DELAY : delay);
+}
+
+/** \brief Get the time to wait before data can be sent or received
+ *
+ * This does not consume bandwidth, and can be used by an event loop to
+ * schedule the next transfer instead of sleeping.
+ *
+ * \return delay in microseconds, 0 if transfer is allowed now
+ */
+unsigned long limiter_get_delay(wzd_bw_limiter *l)
+{
+  i64_t now = 0, tokens, delay = 0, d;
+  u32_t maxspeed;
+
+  for ( ; l; l = l->parent) {
+    maxspeed = l->maxspeed;
+    if (maxspeed == 0) continue;
+    if (now == 0) now = _limiter_now();
+
+    _limiter_refill(l,maxspeed,now);
+    tokens = l->tokens;
+    if (tokens < 0) {
+      d = (-tokens * 1000000) / maxspeed;
+      if (d > delay) delay = d;
+    }
+  }
+
+  return (unsigned long)((delay > LIMITER_MAX_DELAY) ? LIMITER_MAX_DELAY : delay);
+}
+
+/** \brief Account transferred bytes, and sleep if bandwidth is exceeded
+ *
+ * \note \a mutex and \a force_check are not used anymore, limiters are
+ * lock-free.
+ */
+void limiter_add_bytes(wzd_bw_limiter *l, UNUSED wzd_mutex_t * mutex, int byte_count, UNUSED int force_check)
+{
+  unsigned long pause_time;
+
+  if (!l || byte_count <= 0) return;
+
+  pause_time = limiter_consume(l,(unsigned int)byte_count);
+  if (pause_time == 0) return;
+
 #ifndef WIN32
   usleep (pause_time);
 #else
-  Sleep((unsigned long)(pause_time / (double)1000));
+  Sleep((unsigned long)(pause_time / 1000));
 #endif
-/*  gettimeofday( &tv, &tz );
-  l->current_time.tv_sec = tv.tv_sec;
-  l->current_time.tv_usec = tv.tv_usec;
-  l->bytes_transfered = 0;*/
 }
 
 void limiter_free(wzd_bw_limiter *l)
@@ -972,7 +1174,11 @@ int kill_child_signal(unsigned long pid, wzd_context_t * context)
   loop_context->exitclient = 1;
 /*  ret = TerminateThread((HANDLE)pid,0);*/
 #else
-  ret = pthread_cancel(pid);
+  /* with the event loop, pid is not a thread: client is closed on next tick */
+  if (reactor_is_running())
+    loop_context->exitclient = 1;
+  else
+    ret = pthread_cancel(pid);
 #endif
 
   return 0;
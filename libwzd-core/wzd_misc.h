@@ -99,6 +99,23 @@ wzd_string_t * format_message(wzd_context_t * context, int code, ...);
 
 unsigned long get_bandwidth(unsigned long *dl, unsigned long *ul);
 wzd_bw_limiter * limiter_new(int maxspeed);
+
+/** \brief Initialize limiter, with optional parent (group or global limiter) */
+void limiter_init(wzd_bw_limiter *l, u32_t maxspeed, wzd_bw_limiter *parent);
+
+/** \brief Get the limiter shared by all transfers of \a user (group or global) */
+wzd_bw_limiter * limiter_get_parent(wzd_user_t * user, int is_upload);
+
+/** \brief Free all group limiters */
+void limiter_group_free(void);
+
+/** \brief Account transferred bytes, return delay (usec) before next transfer */
+unsigned long limiter_consume(wzd_bw_limiter *l, unsigned int byte_count);
+
+/** \brief Return delay (usec) before next transfer is allowed, without sleeping */
+unsigned long limiter_get_delay(wzd_bw_limiter *l);
+
+/** \brief Account transferred bytes, and sleep if needed */
 void limiter_add_bytes(wzd_bw_limiter *l, wzd_mutex_t *mutex, int byte_count, int force_check);
 void limiter_free(wzd_bw_limiter *l);
 
@@ -109,7 +126,7 @@ void limiter_free(wzd_bw_limiter *l);
 char * safe_vsnprintf(const char *format, va_list ap);
 
 /* cookies */
-/* defined in wzd_cookie_lex.l */
+/* defined in wzd_cookie.c */
 int cookie_parse_buffer(const char *buffer, wzd_user_t * user, wzd_group_t * group, wzd_context_t * context, char * out_buffer, unsigned int out_buffer_len);
 
 /* used to translate text to binary word for rights */
@@ -62,6 +62,7 @@
 #include "wzd_misc.h"
 #include "wzd_messages.h"
 #include "wzd_mod.h"
+#include "wzd_spawn.h"
 #include "wzd_user.h"
 
 #include "wzd_debug.h"
@@ -96,6 +97,7 @@ struct event_entry_t event_tab[] = {
   { EVENT_SITE, "SITE" },
   { EVENT_WIPE, "WIPE" },
   { EVENT_PREWIPE, "PREWIPE" },
+  { EVENT_CRONTAB, "CRONTAB" },
   { 0, NULL },
 };
 
@@ -329,6 +331,33 @@ int hook_call_external(wzd_hook_t *hook, unsigned int code)
 /*    *(buffer+l_command++) = ' ';*/
     /* SECURITY filter buffer for shell special characters ! */
     _cleanup_shell_command(buffer,sizeof(buffer));
+#ifndef WIN32
+    {
+      wzd_spawn_job_t job;
+      int status;
+
+      /* use helper if it is running, to avoid forking the server */
+      switch (spawn_command(hook->mask, buffer, 1 /* use shell */, NULL, &job)) {
+        case 0:
+          command_output = fdopen(job.fd_out,"r");
+          if (command_output) {
+            while (fgets(buffer,1023,command_output) != NULL)
+            {
+              out_log(LEVEL_INFO,"hook: %s\n",buffer);
+            }
+            fclose(command_output);
+            job.fd_out = -1;
+          }
+          status = spawn_wait(&job);
+          return (status == -1) ? 1 : status;
+        case -1: /* helper not running */
+          break;
+        default:
+          out_log(LEVEL_HIGH,"Hook '%s': unable to spawn\n",hook->external_command);
+          return 1;
+      }
+    }
+#endif /* WIN32 */
     if ( (command_output = popen(buffer,"r")) == NULL ) {
       out_log(LEVEL_HIGH,"Hook '%s': unable to popen\n",hook->external_command);
       out_log(LEVEL_INFO,"Failed command: '%s'\n",buffer);
@@ -0,0 +1,434 @@
+/* vi:ai:et:ts=8 sw=2
+ */
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+/** \file wzd_pasv.c
+ * \brief Allocation of ports and listening sockets for PASV and EPSV
+ *
+ * The bitmap covers all ports (not only the PASV range), so the range can
+ * be changed at runtime (SITE VARS) without reallocating it. Words are
+ * modified using compare-and-swap only, and a cursor remembers where to
+ * start the next search: a port which has just been released is not given
+ * again until all other free ports of the range have been used, which
+ * avoids ports in TIME_WAIT.
+ *
+ * The pool is protected by SET_MUTEX_PASV.
+ */
+
+#include "wzd_all.h"
+
+#ifndef WZD_USE_PCH
+
+#if defined(WIN32) || (defined(__CYGWIN__) && defined(WINSOCK_SUPPORT))
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "wzd_hardlimits.h"
+#include "wzd_structs.h"
+#include "wzd_atomic.h"
+#include "wzd_configfile.h"
+#include "wzd_configloader.h"
+#include "wzd_libmain.h"
+#include "wzd_log.h"
+#include "wzd_socket.h"
+
+#include "wzd_debug.h"
+
+#endif /* WZD_USE_PCH */
+
+#include "wzd_pasv.h"
+
+#define PASV_WORD_BITS	(8 * sizeof(unsigned long))
+#define PASV_NUM_WORDS	(65536 / PASV_WORD_BITS)
+
+/* maximum number of pending connections dropped before a socket is put
+ * in the pool
+ */
+#define PASV_DRAIN_MAX	8
+
+struct pasv_pool_entry_t {
+  socket_t sock;
+  net_family_t family;
+  unsigned int port;
+};
+
+static volatile unsigned long _pasv_bitmap[PASV_NUM_WORDS];
+static volatile unsigned long _pasv_cursor = 0;
+
+static volatile unsigned long _pasv_in_use = 0;
+static volatile unsigned long _pasv_acquired = 0;
+static volatile unsigned long _pasv_exhausted = 0;
+static volatile unsigned long _pasv_bind_failures = 0;
+static volatile unsigned long _pasv_pool_hits = 0;
+
+static struct pasv_pool_entry_t _pasv_pool[HARD_PASV_POOL_SIZE];
+static unsigned int _pasv_pool_count = 0;
+
+/** \return mask of bits of word \a w corresponding to ports in [low, high] */
+static unsigned long _pasv_range_mask(unsigned long w, unsigned int low, unsigned int high)
+{
+  unsigned long lo, hi;
+
+  lo = (w == low / PASV_WORD_BITS) ? low % PASV_WORD_BITS : 0;
+  hi = (w == high / PASV_WORD_BITS) ? high % PASV_WORD_BITS : PASV_WORD_BITS - 1;
+
+  return (~0UL << lo) & (~0UL >> (PASV_WORD_BITS - 1 - hi));
+}
+
+/** \return index of lowest bit set in \a v, which must not be 0 */
+static unsigned int _pasv_lowest_bit(unsigned long v)
+{
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctzl(v);
+#else
+  unsigned int bit = 0;
+
+  while ((v & 1UL) == 0) {
+    v >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+/** \brief Reserve a port in range [\a low, \a high]
+ *
+ * \return the port, or -1 if all ports of the range are reserved
+ */
+int pasv_port_acquire(unsigned int low, unsigned int high)
+{
+  unsigned long first_word, last_word, num_words;
+  unsigned long start, i, w;
+  unsigned long mask, old, free_bits;
+  unsigned int bit;
+
+  if (low > high || high > 65535) return -1;
+
+  first_word = low / PASV_WORD_BITS;
+  last_word = high / PASV_WORD_BITS;
+  num_words = last_word - first_word + 1;
+
+  start = _pasv_cursor;
+  if (start < first_word || start > last_word)
+    start = first_word + (start % num_words);
+
+  for (i=0; i<num_words; i++) {
+    w = start + i;
+    if (w > last_word) w -= num_words;
+
+    mask = _pasv_range_mask(w, low, high);
+    for (;;) {
+      old = _pasv_bitmap[w];
+      free_bits = ~old & mask;
+      if (free_bits == 0) break; /* no free port in this word */
+
+      bit = _pasv_lowest_bit(free_bits);
+      if (WZD_ATOMIC_CAS(&_pasv_bitmap[w], old, old | (1UL << bit))) {
+        /* next search starts on next word */
+        _pasv_cursor = (w == last_word) ? first_word : w + 1;
+        WZD_ATOMIC_INC(&_pasv_in_use);
+        WZD_ATOMIC_INC(&_pasv_acquired);
+        return (int)(w * PASV_WORD_BITS + bit);
+      }
+      /* word modified by another thread, try again */
+    }
+  }
+
+  WZD_ATOMIC_INC(&_pasv_exhausted);
+  return -1;
+}
+
+/** \brief Release port reserved by pasv_port_acquire() */
+void pasv_port_release(unsigned int port)
+{
+  unsigned long w, bit, old;
+
+  if (port > 65535) return;
+
+  w = port / PASV_WORD_BITS;
+  bit = 1UL << (port % PASV_WORD_BITS);
+
+  do {
+    old = _pasv_bitmap[w];
+    if ((old & bit) == 0) return; /* not reserved */
+  } while (!WZD_ATOMIC_CAS(&_pasv_bitmap[w], old, old & ~bit));
+
+  WZD_ATOMIC_DEC(&_pasv_in_use);
+}
+
+/** \brief Drop connections pending on listening socket \a sock
+ *
+ * \param[out] family address family of the socket
+ * \return 0 if the socket can be reused
+ */
+static int _pasv_drain(socket_t sock, net_family_t * family)
+{
+#if defined(IPV6_SUPPORT)
+  struct sockaddr_in6 addr;
+#else
+  struct sockaddr_in addr;
+#endif
+  socklen_t len = sizeof(addr);
+  fd_set fds;
+  struct timeval tv;
+  socket_t pending;
+  unsigned int i;
+
+  if (getsockname(sock, (struct sockaddr *)&addr, &len) < 0) return -1;
+#if defined(IPV6_SUPPORT)
+  *family = (((struct sockaddr *)&addr)->sa_family == AF_INET6) ? WZD_INET6 : WZD_INET4;
+#else
+  *family = WZD_INET4;
+#endif
+
+  for (i=0; i<PASV_DRAIN_MAX; i++) {
+    FD_ZERO(&fds);
+    FD_SET(sock,&fds);
+    tv.tv_sec = 0; tv.tv_usec = 0;
+
+    if (socket_select(sock + 1, &fds, NULL, NULL, &tv) <= 0)
+      return 0; /* nothing pending */
+
+    pending = accept(sock, NULL, NULL);
+    if (pending == (socket_t)-1) return -1;
+    socket_close(pending);
+  }
+
+  return -1;
+}
+
+/** \brief Take a socket for \a family from the pool
+ *
+ * Connections made to the socket while it was in the pool are dropped, so
+ * they can not be accepted as the data connection of the new owner.
+ *
+ * \return the socket, or -1 if none is available
+ */
+static socket_t _pasv_pool_get(net_family_t family, unsigned int * port)
+{
+  struct pasv_pool_entry_t entry;
+  net_family_t drained_family;
+  unsigned int i;
+
+  for (;;) {
+    entry.sock = (socket_t)-1;
+
+    /* pool is disabled by default, do not take the lock for nothing */
+    if (_pasv_pool_count == 0) return (socket_t)-1;
+
+    WZD_MUTEX_LOCK(SET_MUTEX_PASV);
+    for (i=_pasv_pool_count; i>0; i--) {
+      if (_pasv_pool[i-1].family == family) {
+        entry = _pasv_pool[i-1];
+        _pasv_pool[i-1] = _pasv_pool[--_pasv_pool_count];
+        break;
+      }
+    }
+    WZD_MUTEX_UNLOCK(SET_MUTEX_PASV);
+
+    if (entry.sock == (socket_t)-1) return (socket_t)-1;
+
+    /* range may have been changed since socket was put in pool */
+    if (entry.port >= mainConfig->pasv_low_range && entry.port <= mainConfig->pasv_high_range
+        && _pasv_drain(entry.sock, &drained_family) == 0) {
+      WZD_ATOMIC_INC(&_pasv_pool_hits);
+      *port = entry.port;
+      return entry.sock;
+    }
+
+    socket_close(entry.sock);
+    pasv_port_release(entry.port);
+  }
+}
+
+/** \brief Get a socket listening on a port of the PASV range
+ *
+ * The socket is taken from the pool if possible, otherwise a new socket is
+ * bound to a reserved port.
+ *
+ * \param[in] family WZD_INET4 or WZD_INET6
+ * \param[out] port port of the returned socket
+ * \param[out] pooled set to 1 if the socket was taken from the pool. If NULL,
+ * the pool is not used.
+ * \return the socket, or -1 on error
+ */
+socket_t pasv_listen(net_family_t family, unsigned int * port, int * pooled)
+{
+  socket_t sock;
+  socklen_t len;
+  int p;
+  unsigned int retries;
+#if defined(IPV6_SUPPORT)
+  struct sockaddr_in6 addr6;
+#endif
+  struct sockaddr_in addr4;
+  struct sockaddr * addr;
+
+  if (!port) return (socket_t)-1;
+
+  if (pooled) {
+    sock = _pasv_pool_get(family, port);
+    *pooled = (sock != (socket_t)-1);
+    if (sock != (socket_t)-1) return sock;
+  }
+
+#if defined(IPV6_SUPPORT)
+  if (family == WZD_INET6) {
+    sock = socket(AF_INET6,SOCK_STREAM,0);
+    addr = (struct sockaddr *)&addr6;
+    len = sizeof(addr6);
+    memset(&addr6,0,sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+  } else
+#endif
+  if (family == WZD_INET4) {
+    sock = socket(AF_INET,SOCK_STREAM,0);
+    addr = (struct sockaddr *)&addr4;
+    len = sizeof(addr4);
+    memset(&addr4,0,sizeof(addr4));
+    addr4.sin_family = AF_INET;
+    /* XXX TODO FIXME bind to specific address works, but not for NAT */
+    addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+  }
+  else
+    return (socket_t)-1;
+
+  if (sock == (socket_t)-1) return (socket_t)-1;
+
+  for (retries=0; retries<HARD_PASV_BIND_RETRIES; retries++) {
+    p = pasv_port_acquire(mainConfig->pasv_low_range, mainConfig->pasv_high_range);
+    if (p < 0) {
+      out_log(LEVEL_HIGH, "PASV: all possible PASV ports are in use\n");
+      socket_close(sock);
+      return (socket_t)-1;
+    }
+
+#if defined(IPV6_SUPPORT)
+    if (family == WZD_INET6)
+      addr6.sin6_port = htons((unsigned short)p);
+    else
+#endif
+      addr4.sin_port = htons((unsigned short)p);
+
+    if (bind(sock,addr,len) == 0) {
+      if (listen(sock,1) < 0) {
+        out_log(LEVEL_CRITICAL,"PASV: could not listen on port %d: errno %d error %s\n",p,errno,strerror(errno));
+        socket_close(sock);
+        pasv_port_release(p);
+        return (socket_t)-1;
+      }
+      *port = (unsigned int)p;
+      return sock;
+    }
+
+    /* port is used by another process, the cursor has moved so it will
+     * not be tried again before the other ports of the range
+     */
+    WZD_ATOMIC_INC(&_pasv_bind_failures);
+    pasv_port_release(p);
+  }
+
+  out_log(LEVEL_HIGH, "PASV: could not bind to any port in the PASV range\n");
+  socket_close(sock);
+  return (socket_t)-1;
+}
+
+/** \brief Give back socket returned by pasv_listen()
+ *
+ * Pending connections are dropped, then the socket is kept in the pool if
+ * it is not full. Otherwise the socket is closed, and \a port released.
+ */
+void pasv_unlisten(socket_t sock, unsigned int port)
+{
+  const wzd_config_snapshot_t * snapshot;
+  unsigned int pool_size;
+  net_family_t family;
+
+  if (sock == (socket_t)-1) return;
+
+  snapshot = config_snapshot_acquire();
+  pool_size = snapshot->pasv_pool_size;
+  config_snapshot_release(snapshot);
+  if (pool_size > HARD_PASV_POOL_SIZE) pool_size = HARD_PASV_POOL_SIZE;
+
+  if (pool_size > 0 && port != 0 && _pasv_drain(sock, &family) == 0) {
+    WZD_MUTEX_LOCK(SET_MUTEX_PASV);
+    if (_pasv_pool_count < pool_size) {
+      _pasv_pool[_pasv_pool_count].sock = sock;
+      _pasv_pool[_pasv_pool_count].family = family;
+      _pasv_pool[_pasv_pool_count].port = port;
+      _pasv_pool_count++;
+      WZD_MUTEX_UNLOCK(SET_MUTEX_PASV);
+      return;
+    }
+    WZD_MUTEX_UNLOCK(SET_MUTEX_PASV);
+  }
+
+  socket_close(sock);
+  if (port != 0)
+    pasv_port_release(port);
+}
+
+/** \brief Close all sockets from the pool */
+void pasv_pool_purge(void)
+{
+  struct pasv_pool_entry_t entry;
+
+  for (;;) {
+    WZD_MUTEX_LOCK(SET_MUTEX_PASV);
+    if (_pasv_pool_count == 0) {
+      WZD_MUTEX_UNLOCK(SET_MUTEX_PASV);
+      return;
+    }
+    entry = _pasv_pool[--_pasv_pool_count];
+    WZD_MUTEX_UNLOCK(SET_MUTEX_PASV);
+
+    socket_close(entry.sock);
+    pasv_port_release(entry.port);
+  }
+}
+
+/** \brief Get counters of the PASV allocator */
+void pasv_get_stats(wzd_pasv_stats_t * stats)
+{
+  if (!stats) return;
+
+  stats->ports_in_use = _pasv_in_use;
+  stats->acquired = _pasv_acquired;
+  stats->exhausted = _pasv_exhausted;
+  stats->bind_failures = _pasv_bind_failures;
+  stats->pool_hits = _pasv_pool_hits;
+  stats->pool_size = _pasv_pool_count;
+}
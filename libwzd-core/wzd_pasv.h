@@ -0,0 +1,87 @@
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+#ifndef __WZD_PASV__
+#define __WZD_PASV__
+
+/** \file wzd_pasv.h
+ * \brief Allocation of ports and listening sockets for PASV and EPSV
+ *
+ * Ports of the PASV range used by the server are tracked in a bitmap shared
+ * by all clients, so a free port is found without trying to bind() every
+ * port of the range.
+ *
+ * When option \a pasv_pool_size is set, listening sockets are not closed
+ * after the data connection has been accepted: they are kept in a pool and
+ * given to the next PASV command. A pooled socket may have been announced to
+ * another client, so its data connection must come from the address of the
+ * control connection.
+ */
+
+/** \brief Counters of the PASV allocator */
+typedef struct {
+  unsigned long ports_in_use;	/**< ports currently reserved, including pool */
+  unsigned long acquired;	/**< ports reserved since start */
+  unsigned long exhausted;	/**< requests failed because range was full */
+  unsigned long bind_failures;	/**< reserved ports used by another process */
+  unsigned long pool_hits;	/**< requests served from the pool */
+  unsigned long pool_size;	/**< listening sockets in the pool */
+} wzd_pasv_stats_t;
+
+/** \brief Reserve a port in range [\a low, \a high]
+ *
+ * \return the port, or -1 if all ports of the range are reserved
+ */
+int pasv_port_acquire(unsigned int low, unsigned int high);
+
+/** \brief Release port reserved by pasv_port_acquire() */
+void pasv_port_release(unsigned int port);
+
+/** \brief Get a socket listening on a port of the PASV range
+ *
+ * The socket is taken from the pool if possible, otherwise a new socket is
+ * bound to a reserved port.
+ *
+ * \param[in] family WZD_INET4 or WZD_INET6
+ * \param[out] port port of the returned socket
+ * \param[out] pooled set to 1 if the socket was taken from the pool. If NULL,
+ * the pool is not used.
+ * \return the socket, or -1 on error
+ */
+socket_t pasv_listen(net_family_t family, unsigned int * port, int * pooled);
+
+/** \brief Give back socket returned by pasv_listen()
+ *
+ * Pending connections are dropped, then the socket is kept in the pool if
+ * it is not full. Otherwise the socket is closed, and \a port released.
+ */
+void pasv_unlisten(socket_t sock, unsigned int port);
+
+/** \brief Close all sockets from the pool */
+void pasv_pool_purge(void);
+
+/** \brief Get counters of the PASV allocator */
+void pasv_get_stats(wzd_pasv_stats_t * stats);
+
+#endif /* __WZD_PASV__ */
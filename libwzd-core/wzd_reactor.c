@@ -0,0 +1,568 @@
+/* vi:ai:et:ts=8 sw=2
+ */
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+/** \file wzd_reactor.c
+ * \brief Event-driven client model: epoll loop and worker pool
+ *
+ * Each client is in one of two states:
+ *  - idle: the control socket is armed in the epoll set (one-shot)
+ *  - busy: a job for this client is queued or being run by a worker
+ *
+ * Only the event thread moves a client from idle to busy (on event, or on
+ * tick), and only the worker running the job moves it back to idle, so a
+ * client is never handled by two workers at the same time.
+ *
+ * The login sequence blocks on the client, so it is run by a separate pool
+ * of workers: clients which do not log in can only delay other logins, not
+ * commands of connected clients. For implicit TLS, the handshake is run
+ * before by a third pool, so a handshake flood does not delay logins either.
+ * The event thread closes connections which have not completed the login
+ * after HARD_LOGIN_TIMEOUT seconds.
+ */
+
+#include "wzd_all.h"
+
+#ifndef WZD_USE_PCH
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#include "wzd_structs.h"
+#include "wzd_ClientThread.h"
+#include "wzd_libmain.h"
+#include "wzd_log.h"
+#include "wzd_misc.h"
+#include "wzd_threads.h"
+
+#include "wzd_debug.h"
+#endif /* WZD_USE_PCH */
+
+#include "wzd_reactor.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_PTHREAD)
+
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#define REACTOR_MAX_EVENTS  128
+
+enum reactor_client_state_t {
+  REACTOR_CLIENT_IDLE=0,
+  REACTOR_CLIENT_BUSY,
+};
+
+enum reactor_job_t {
+  REACTOR_JOB_HANDSHAKE=0,
+  REACTOR_JOB_LOGIN,
+  REACTOR_JOB_COMMAND,
+  REACTOR_JOB_TICK,
+  REACTOR_JOB_DIE,
+};
+
+enum reactor_pool_id_t {
+  REACTOR_POOL_COMMAND=0,
+  REACTOR_POOL_LOGIN,
+  REACTOR_POOL_HANDSHAKE,
+  REACTOR_POOL_COUNT,
+};
+
+struct reactor_client_t {
+  wzd_context_t * context;
+  enum reactor_client_state_t state;
+  enum reactor_job_t job;
+
+  time_t login_start;
+  int logged_in;
+
+  struct reactor_client_t * next_job;
+
+  struct reactor_client_t * prev_client;
+  struct reactor_client_t * next_client;
+};
+
+/* job queue and workers */
+struct reactor_pool_t {
+  struct reactor_client_t * queue_head;
+  struct reactor_client_t * queue_tail;
+  pthread_cond_t cond;
+};
+
+static int _reactor_running = 0;
+static int _reactor_epfd = -1;
+static int _reactor_wakeup[2] = { -1, -1 };
+static unsigned long _reactor_client_tick = DEFAULT_CLIENT_TICK;
+static unsigned long _reactor_next_id = 1;
+
+static wzd_thread_t _reactor_thread;
+static int _reactor_thread_started = 0;
+
+/* protects the client list, the job queues and client states */
+static pthread_mutex_t _reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct reactor_client_t * _reactor_clients = NULL;
+static struct reactor_pool_t _reactor_pools[REACTOR_POOL_COUNT] = {
+  { NULL, NULL, PTHREAD_COND_INITIALIZER },
+  { NULL, NULL, PTHREAD_COND_INITIALIZER },
+  { NULL, NULL, PTHREAD_COND_INITIALIZER },
+};
+
+static void * _reactor_thread_fund(void *);
+static void * _reactor_worker_fund(void *);
+
+/* must be called with _reactor_mutex locked */
+static void _reactor_queue_job(struct reactor_client_t * client, enum reactor_job_t job)
+{
+  struct reactor_pool_t * pool;
+
+  switch (job) {
+  case REACTOR_JOB_HANDSHAKE:
+    pool = &_reactor_pools[REACTOR_POOL_HANDSHAKE];
+    break;
+  case REACTOR_JOB_LOGIN:
+    pool = &_reactor_pools[REACTOR_POOL_LOGIN];
+    break;
+  default:
+    pool = &_reactor_pools[REACTOR_POOL_COMMAND];
+    break;
+  }
+
+  client->state = REACTOR_CLIENT_BUSY;
+  client->job = job;
+  client->next_job = NULL;
+
+  if (pool->queue_tail)
+    pool->queue_tail->next_job = client;
+  else
+    pool->queue_head = client;
+  pool->queue_tail = client;
+
+  pthread_cond_signal(&pool->cond);
+}
+
+/* must be called with _reactor_mutex locked */
+static void _reactor_wakeup_workers(void)
+{
+  unsigned int i;
+
+  for (i=0; i<REACTOR_POOL_COUNT; i++)
+    pthread_cond_broadcast(&_reactor_pools[i].cond);
+}
+
+/* must be called with _reactor_mutex locked */
+static int _reactor_client_arm(struct reactor_client_t * client, int enable)
+{
+  struct epoll_event ev;
+
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLONESHOT | (enable ? EPOLLIN : 0);
+  ev.data.ptr = client;
+
+  return epoll_ctl(_reactor_epfd, EPOLL_CTL_MOD, client->context->control_socket, &ev);
+}
+
+/** \brief Remove client from event loop and close connection
+ */
+static void _reactor_client_die(struct reactor_client_t * client)
+{
+  wzd_context_t * context = client->context;
+
+  pthread_mutex_lock(&_reactor_mutex);
+  if (client->prev_client)
+    client->prev_client->next_client = client->next_client;
+  else
+    _reactor_clients = client->next_client;
+  if (client->next_client)
+    client->next_client->prev_client = client->prev_client;
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  epoll_ctl(_reactor_epfd, EPOLL_CTL_DEL, context->control_socket, NULL);
+
+  /* abort the transfer and wait for the thread, it must not use the context
+   * after it has been freed
+   */
+  if (context->transfer_thread != NULL) {
+    void * return_value;
+
+    if (context->data_socket != (socket_t)-1)
+      shutdown(context->data_socket, SHUT_RDWR);
+    wzd_thread_join(context->transfer_thread,&return_value);
+    free(context->transfer_thread);
+    context->transfer_thread = NULL;
+  }
+
+  client_die(context);
+
+  wzd_free(client);
+}
+
+/** \brief Run job for client in worker thread
+ */
+static void _reactor_run_job(struct reactor_client_t * client)
+{
+  wzd_context_t * context = client->context;
+
+  context->thread_id = (unsigned long)pthread_self();
+  _tls_store_context(context);
+
+  switch (client->job) {
+  case REACTOR_JOB_HANDSHAKE:
+    if (client_login_tls(context)) {
+      _reactor_client_die(client);
+      return;
+    }
+    context->thread_id = (unsigned long)-1;
+    /* client must not be used after this, it belongs to a login worker */
+    pthread_mutex_lock(&_reactor_mutex);
+    _reactor_queue_job(client, REACTOR_JOB_LOGIN);
+    pthread_mutex_unlock(&_reactor_mutex);
+    return;
+  case REACTOR_JOB_LOGIN:
+    out_log(LEVEL_INFO,"Client speaking to socket %d\n",context->control_socket);
+    if (client_login(context)) {
+      _reactor_client_die(client);
+      return;
+    }
+    pthread_mutex_lock(&_reactor_mutex);
+    client->logged_in = 1;
+    pthread_mutex_unlock(&_reactor_mutex);
+    break;
+  case REACTOR_JOB_COMMAND:
+    client_join_transfer(context);
+    if (client_read_command(context)) {
+      _reactor_client_die(client);
+      return;
+    }
+    break;
+  case REACTOR_JOB_TICK:
+    client_join_transfer(context);
+    check_timeout(context);
+    break;
+  case REACTOR_JOB_DIE:
+    _reactor_client_die(client);
+    return;
+  }
+
+  if (context->exitclient) {
+    _reactor_client_die(client);
+    return;
+  }
+
+  context->thread_id = (unsigned long)-1;
+
+  pthread_mutex_lock(&_reactor_mutex);
+  if (!_reactor_running) {
+    pthread_mutex_unlock(&_reactor_mutex);
+    _reactor_client_die(client);
+    return;
+  }
+  client->state = REACTOR_CLIENT_IDLE;
+  if (_reactor_client_arm(client, 1)) {
+    out_log(LEVEL_HIGH,"ERROR could not watch control socket %d (%s)\n",
+        context->control_socket, strerror(errno));
+    pthread_mutex_unlock(&_reactor_mutex);
+    _reactor_client_die(client);
+    return;
+  }
+  pthread_mutex_unlock(&_reactor_mutex);
+}
+
+static void * _reactor_worker_fund(void * arg)
+{
+  struct reactor_pool_t * pool = arg;
+  struct reactor_client_t * client;
+
+  pthread_mutex_lock(&_reactor_mutex);
+  while (1) {
+    while (_reactor_running && pool->queue_head == NULL)
+      pthread_cond_wait(&pool->cond, &_reactor_mutex);
+
+    client = pool->queue_head;
+    if (client == NULL) break; /* stopped, and nothing left to do */
+
+    pool->queue_head = client->next_job;
+    if (pool->queue_head == NULL) pool->queue_tail = NULL;
+    pthread_mutex_unlock(&_reactor_mutex);
+
+    _reactor_run_job(client);
+
+    pthread_mutex_lock(&_reactor_mutex);
+  }
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  _tls_remove_context();
+
+  return NULL;
+}
+
+static void * _reactor_thread_fund(UNUSED void * arg)
+{
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  struct reactor_client_t * client;
+  time_t last_tick, now;
+  int i, n;
+  char c;
+
+  last_tick = time(NULL);
+
+  while (_reactor_running) {
+    n = epoll_wait(_reactor_epfd, events, REACTOR_MAX_EVENTS, _reactor_client_tick * 1000);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      out_log(LEVEL_CRITICAL,"epoll_wait failed (%s) :%s:%d\n",
+          strerror(errno), __FILE__, __LINE__);
+      break;
+    }
+
+    pthread_mutex_lock(&_reactor_mutex);
+
+    for (i=0; i<n; i++) {
+      client = events[i].data.ptr;
+      if (client == NULL) { /* wakeup pipe */
+        while (read(_reactor_wakeup[0], &c, 1) == 1) ;
+        continue;
+      }
+      if (client->state == REACTOR_CLIENT_IDLE)
+        _reactor_queue_job(client, REACTOR_JOB_COMMAND);
+    }
+
+    /* idle clients must be checked for timeouts, kills, and finished transfers */
+    now = time(NULL);
+    if (now < last_tick || (unsigned long)(now - last_tick) >= _reactor_client_tick) {
+      for (client = _reactor_clients; client; client = client->next_client) {
+        if (!client->logged_in) {
+          /* the login worker is blocked on the client, wake it up */
+          if (client->login_start && now - client->login_start >= HARD_LOGIN_TIMEOUT) {
+            out_log(LEVEL_INFO,"Login timeout on socket %d\n",client->context->control_socket);
+            shutdown(client->context->control_socket, SHUT_RDWR);
+            client->login_start = 0;
+          }
+          continue;
+        }
+        if (client->state != REACTOR_CLIENT_IDLE) continue;
+        _reactor_client_arm(client, 0);
+        _reactor_queue_job(client, REACTOR_JOB_TICK);
+      }
+      last_tick = now;
+    }
+
+    pthread_mutex_unlock(&_reactor_mutex);
+  }
+
+  /* idle clients are released here and not in reactor_stop(), since
+   * events for them may still be processed above until the loop exits
+   */
+  pthread_mutex_lock(&_reactor_mutex);
+  for (client = _reactor_clients; client; client = client->next_client) {
+    if (client->state != REACTOR_CLIENT_IDLE) continue;
+    _reactor_client_arm(client, 0);
+    _reactor_queue_job(client, REACTOR_JOB_DIE);
+  }
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  return NULL;
+}
+
+/* returns the number of workers started */
+static unsigned int _reactor_start_workers(struct reactor_pool_t * pool, unsigned int num_workers)
+{
+  wzd_thread_attr_t thread_attr;
+  wzd_thread_t thread;
+  unsigned int i;
+
+  wzd_thread_attr_init(&thread_attr);
+  wzd_thread_attr_set_detached(&thread_attr);
+  for (i=0; i<num_workers; i++) {
+    if (wzd_thread_create(&thread, &thread_attr, _reactor_worker_fund, pool)) {
+      out_log(LEVEL_CRITICAL,"Unable to create worker thread\n");
+      break;
+    }
+  }
+  wzd_thread_attr_destroy(&thread_attr);
+
+  return i;
+}
+
+int reactor_start(unsigned int num_workers, unsigned int num_login_workers, unsigned int num_handshake_workers, unsigned long client_tick)
+{
+  struct epoll_event ev;
+  unsigned int i, j, k;
+
+  if (_reactor_running) return 0;
+  if (num_workers == 0 || num_login_workers == 0 || num_handshake_workers == 0) return -1;
+
+  _reactor_epfd = epoll_create(REACTOR_MAX_EVENTS);
+  if (_reactor_epfd < 0) {
+    out_log(LEVEL_CRITICAL,"Could not create epoll descriptor (%s)\n",strerror(errno));
+    return -1;
+  }
+
+  if (pipe(_reactor_wakeup) < 0) {
+    out_log(LEVEL_CRITICAL,"Could not create event loop pipe (%s)\n",strerror(errno));
+    close(_reactor_epfd);
+    _reactor_epfd = -1;
+    return -1;
+  }
+  fcntl(_reactor_wakeup[0],F_SETFL,(fcntl(_reactor_wakeup[0],F_GETFL)|O_NONBLOCK));
+
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(_reactor_epfd, EPOLL_CTL_ADD, _reactor_wakeup[0], &ev);
+
+  if (client_tick > 0)
+    _reactor_client_tick = client_tick;
+
+  _reactor_running = 1;
+
+  i = _reactor_start_workers(&_reactor_pools[REACTOR_POOL_COMMAND], num_workers);
+  j = (i > 0) ? _reactor_start_workers(&_reactor_pools[REACTOR_POOL_LOGIN], num_login_workers) : 0;
+  k = (j > 0) ? _reactor_start_workers(&_reactor_pools[REACTOR_POOL_HANDSHAKE], num_handshake_workers) : 0;
+
+  if (i == 0 || j == 0 || k == 0 || wzd_thread_create(&_reactor_thread, NULL, _reactor_thread_fund, NULL)) {
+    out_log(LEVEL_CRITICAL,"Unable to start event loop\n");
+    reactor_stop();
+    return -1;
+  }
+  _reactor_thread_started = 1;
+
+  out_log(LEVEL_INFO,"Event loop started with %u workers, %u login workers and %u TLS handshake workers\n",i,j,k);
+
+  return 0;
+}
+
+void reactor_stop(void)
+{
+  struct reactor_client_t * client;
+  void * return_value;
+
+  pthread_mutex_lock(&_reactor_mutex);
+  _reactor_running = 0;
+
+  /* busy clients will exit when their job is finished, idle clients are
+   * released by the event thread when it exits
+   */
+  for (client = _reactor_clients; client; client = client->next_client)
+    client->context->exitclient = 1;
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  if (_reactor_wakeup[1] != -1) {
+    if (write(_reactor_wakeup[1], "", 1) < 0) { /* ignore, loop will exit on next tick */ }
+  }
+
+  if (_reactor_thread_started) {
+    wzd_thread_join(&_reactor_thread, &return_value);
+    _reactor_thread_started = 0;
+  }
+
+  /* workers exit once their queue is empty */
+  pthread_mutex_lock(&_reactor_mutex);
+  _reactor_wakeup_workers();
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  /* the epoll descriptor is not closed, workers may still be using it
+   * to unregister clients
+   */
+}
+
+int reactor_is_running(void)
+{
+  return _reactor_running;
+}
+
+int reactor_add_client(wzd_context_t * context)
+{
+  struct reactor_client_t * client;
+  struct epoll_event ev;
+
+  if (!_reactor_running) return -1;
+
+  client = wzd_malloc(sizeof(struct reactor_client_t));
+  memset(client,0,sizeof(struct reactor_client_t));
+  client->context = context;
+
+  /* registered but not armed, until login is done */
+  memset(&ev,0,sizeof(ev));
+  ev.events = EPOLLONESHOT;
+  ev.data.ptr = client;
+  if (epoll_ctl(_reactor_epfd, EPOLL_CTL_ADD, context->control_socket, &ev)) {
+    out_log(LEVEL_HIGH,"ERROR could not add control socket %d to event loop (%s)\n",
+        context->control_socket, strerror(errno));
+    wzd_free(client);
+    return -1;
+  }
+
+  pthread_mutex_lock(&_reactor_mutex);
+  /* there is no thread per client, but pid_child is used to identify clients */
+  context->pid_child = _reactor_next_id++;
+  client->login_start = time(NULL);
+
+  client->next_client = _reactor_clients;
+  if (_reactor_clients) _reactor_clients->prev_client = client;
+  _reactor_clients = client;
+
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+  if (mainConfig->tls_type == TLS_IMPLICIT)
+    _reactor_queue_job(client, REACTOR_JOB_HANDSHAKE);
+  else
+#endif
+    _reactor_queue_job(client, REACTOR_JOB_LOGIN);
+  pthread_mutex_unlock(&_reactor_mutex);
+
+  return 0;
+}
+
+#else /* HAVE_SYS_EPOLL_H */
+
+int reactor_start(UNUSED unsigned int num_workers, UNUSED unsigned int num_login_workers, UNUSED unsigned int num_handshake_workers, UNUSED unsigned long client_tick)
+{
+  out_log(LEVEL_HIGH,"Event loop is not supported on this platform\n");
+  return -1;
+}
+
+void reactor_stop(void)
+{
+}
+
+int reactor_is_running(void)
+{
+  return 0;
+}
+
+int reactor_add_client(UNUSED wzd_context_t * context)
+{
+  return -1;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -0,0 +1,73 @@
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+
+#ifndef __WZD_REACTOR__
+#define __WZD_REACTOR__
+
+/** \file wzd_reactor.h
+ * \brief Event-driven client model
+ *
+ * When enabled (option \a event_loop in config), control connections are
+ * not handled by one thread per client: a single thread waits for events
+ * on all control sockets (using epoll), and a fixed pool of workers runs
+ * the commands. The login sequence is run by a separate pool of workers,
+ * and so is the TLS handshake for implicit TLS.
+ *
+ * Data transfers are always run in a separate transfer thread in this mode.
+ */
+
+/** \brief Start event loop and workers
+ *
+ * \param[in] num_workers number of worker threads running commands
+ * \param[in] num_login_workers number of worker threads running logins
+ * \param[in] num_handshake_workers number of worker threads running TLS handshakes
+ * \param[in] client_tick interval (in seconds) of idle checks for clients
+ *
+ * \return 0 if ok, -1 if the event loop is not supported or could not be started
+ */
+int reactor_start(unsigned int num_workers, unsigned int num_login_workers, unsigned int num_handshake_workers, unsigned long client_tick);
+
+/** \brief Stop event loop
+ *
+ * All clients are disconnected. Workers exit when their current job is finished.
+ */
+void reactor_stop(void);
+
+/** \brief Test if the event loop is running
+ *
+ * \return 1 if clients are handled by the event loop
+ */
+int reactor_is_running(void);
+
+/** \brief Hand over a new client to the event loop
+ *
+ * The login sequence will be run by a login worker, then the control
+ * connection is watched by the event loop.
+ *
+ * \return 0 if ok
+ */
+int reactor_add_client(wzd_context_t * context);
+
+#endif /* __WZD_REACTOR__ */
@@ -73,6 +73,7 @@
 #include "wzd_vfs.h"
 #include "wzd_cache.h"
 #include "wzd_configfile.h"
+#include "wzd_cookie.h"
 #include "wzd_events.h"
 #include "wzd_file.h"
 #include "wzd_fs.h"
@@ -130,6 +131,14 @@ int do_site_test(wzd_string_t *command, wzd_string_t *param, wzd_context_t * con
   /* prints some stats */
   out_err(LEVEL_INFO,"# Connections: %ld\n",mainConfig->stats.num_connections);
   out_err(LEVEL_INFO,"# Childs     : %ld\n",mainConfig->stats.num_childs);
+  out_err(LEVEL_INFO,"# TLS handshakes: %lu ok, %lu failed, %lu ms\n",mainConfig->stats.tls_handshakes,
+      mainConfig->stats.tls_handshake_failures,mainConfig->stats.tls_handshake_time);
+  {
+    unsigned long resumed = mainConfig->stats.tls_sessions_resumed;
+    unsigned long total = resumed + mainConfig->stats.tls_sessions_full;
+    out_err(LEVEL_INFO,"# TLS sessions: %lu resumed / %lu (%lu%%)\n",resumed,total,
+        (total) ? (resumed * 100) / total : 0);
+  }
   ret = 0;
 
   fd_dump();
@@ -1224,44 +1233,28 @@ int do_site_perm(UNUSED wzd_string_t *ignored, wzd_string_t *command_line, wzd_c
  */
 void do_site_print_file(const char *filename, wzd_user_t *user, wzd_group_t *group, wzd_context_t *context)
 {
-  wzd_cache_t * fp;
-  char * file_buffer;
-  unsigned int size, filesize;
-  u64_t sz64;
-  fp = wzd_cache_open(filename,O_RDONLY,0644);
-  if (!fp) {
+  wzd_cookie_template_t * tpl;
+  fs_filestat_t s;
+
+  if (fs_file_stat(filename,&s)) {
     send_message_with_args(501,context,"Inexistant file");
     return;
   }
-  sz64 = wzd_cache_getsize(fp);
-  if (sz64 > INT_MAX) {
-    out_log(LEVEL_HIGH,"%s:%d couldn't allocate %" PRIu64 "bytes for file %s\n",__FILE__,__LINE__,sz64,filename);
-    wzd_cache_close(fp);
+  tpl = cookie_template_acquire_file(filename);
+  if (!tpl) {
+    out_log(LEVEL_HIGH,"Could not read file %s or file is not a valid template (%s:%d)\n",filename,__FILE__,__LINE__);
     send_message_with_args(501,context,"Internal error (see log)");
     return;
   }
-  filesize = (unsigned int)sz64;
-  file_buffer = malloc(filesize+1);
-  if ( (size=wzd_cache_read(fp,file_buffer,filesize))!=filesize )
-  {
-    out_err(LEVEL_HIGH,"Could not read file %s read %u instead of %u (%s:%d)\n",filename,size,filesize,__FILE__,__LINE__);
-    free(file_buffer);
-    wzd_cache_close(fp);
-    send_message_with_args(501,context,"Internal error (see log)");
-    return;
-  }
-  file_buffer[filesize]='\0';
 
   /* send header */
   send_message_raw("200-\r\n",context);
 
-  cookie_parse_buffer(file_buffer,user,group,context,NULL,0);
-
-  wzd_cache_close(fp);
+  cookie_template_render(tpl,user,group,context,NULL,0);
 
   send_message_raw("200 \r\n",context);
 
-  free(file_buffer);
+  cookie_template_release(tpl);
 }
 
 /********************* do_site_print_file_raw **************/
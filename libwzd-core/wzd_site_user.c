@@ -44,7 +44,6 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#include <netdb.h> /* gethostbyaddr */
 
 #include <pthread.h>
 #endif
@@ -1813,17 +1812,16 @@ int do_site_su(wzd_string_t *cname, wzd_string_t *command_line, wzd_context_t *
   {
     const char * groupname = NULL;
     const char * remote_host;
-    struct hostent *h;
+    char hostname[256];
     char inet_str[256];
     int af = (context->family == WZD_INET6) ? AF_INET6 : AF_INET;
     if (me->group_num > 0) groupname = GetGroupByID(me->groups[0])->groupname;
     inet_str[0] = '\0';
     inet_ntop(af,context->hostip,inet_str,sizeof(inet_str));
-    h = gethostbyaddr((char*)&context->hostip,sizeof(context->hostip),af);
-    if (h==NULL)
+    if (ip_get_hostname_cached(context->hostip, context->family, hostname, sizeof(hostname)))
       remote_host = inet_str;
     else
-      remote_host = h->h_name;
+      remote_host = hostname;
     log_message("DOPPEL","%s (%s) \"%s\" \"%s\" \"%s\"",
         (remote_host)?remote_host:"no host!",
         inet_str,
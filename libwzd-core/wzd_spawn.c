@@ -0,0 +1,816 @@
+/* vi:ai:et:ts=8 sw=2
+ */
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+/** \file wzd_spawn.c
+ * \brief Helper process running external commands
+ *
+ * Protocol on the socketpair: the server sends a struct spawn_request_t,
+ * followed by the command line and the environment (strings separated by
+ * '\\0'). The helper answers with a struct spawn_reply_t and, if the command
+ * was started, two descriptors (SCM_RIGHTS): the read end of the pipe
+ * connected to the standard output of the command, and the read end of a
+ * pipe where the helper writes the status returned by waitpid().
+ *
+ * Requests are sent under a mutex, and handled by the helper one at a time.
+ * The helper must not use out_log(): it is a copy of the server, without
+ * the log writer thread.
+ */
+
+#include "wzd_all.h"
+
+#ifndef WZD_USE_PCH
+
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "wzd_hardlimits.h"
+#include "wzd_structs.h"
+#include "wzd_events.h"
+#include "wzd_log.h"
+
+#include "wzd_debug.h"
+
+#endif /* WZD_USE_PCH */
+
+#include "wzd_spawn.h"
+
+#ifndef WIN32
+
+#ifdef MSG_NOSIGNAL
+# define SPAWN_SEND_FLAGS	MSG_NOSIGNAL
+#else
+# define SPAWN_SEND_FLAGS	0
+#endif
+
+#define SPAWN_FLAG_SHELL	0x01
+
+struct spawn_request_t {
+  unsigned int flags;
+  unsigned int command_length;	/**< including trailing '\\0' */
+  int env_count;		/**< -1 to use environment of helper */
+  unsigned int env_length;
+};
+
+struct spawn_reply_t {
+  int error;	/**< errno, or 0 if command was started */
+  int pid;
+};
+
+struct spawn_limit_t {
+  unsigned long event_id;
+  unsigned int max;
+  unsigned int running;
+};
+
+extern char ** environ;
+
+static fd_t _spawn_sock = -1;
+static pid_t _spawn_helper_pid = -1;
+
+static struct spawn_limit_t _spawn_limits[HARD_SPAWN_LIMITS];
+static unsigned int _spawn_limit_count = 0;
+
+#ifdef HAVE_PTHREAD
+/* serializes requests on _spawn_sock */
+static pthread_mutex_t _spawn_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t _spawn_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _spawn_limit_cond = PTHREAD_COND_INITIALIZER;
+#endif /* HAVE_PTHREAD */
+
+/* used by the helper only */
+static int _spawn_sigchld_fd = -1;
+
+static void _spawn_helper_main(int sock);
+
+/** \brief Read exactly \a length bytes
+ * \return 0 if ok, -1 on error or end of file
+ */
+static int _spawn_read_all(int fd, void * buffer, size_t length)
+{
+  char * ptr = buffer;
+  ssize_t ret;
+
+  while (length > 0) {
+    ret = read(fd, ptr, length);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return -1;
+    ptr += ret;
+    length -= ret;
+  }
+  return 0;
+}
+
+/** \brief Send exactly \a length bytes
+ * \return 0 if ok, -1 on error
+ */
+static int _spawn_send_all(int fd, const void * buffer, size_t length)
+{
+  const char * ptr = buffer;
+  ssize_t ret;
+
+  while (length > 0) {
+    ret = send(fd, ptr, length, SPAWN_SEND_FLAGS);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return -1;
+    ptr += ret;
+    length -= ret;
+  }
+  return 0;
+}
+
+static void _spawn_set_cloexec(int fd)
+{
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+int spawn_helper_start(void)
+{
+  int sv[2];
+  pid_t pid;
+
+  if (_spawn_sock != -1) return 0;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+    out_log(LEVEL_HIGH,"spawn: could not create socketpair (errno %d)\n",errno);
+    return -1;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    out_log(LEVEL_HIGH,"spawn: could not fork helper (errno %d)\n",errno);
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+
+  if (pid == 0) { /* helper */
+    close(sv[0]);
+    _spawn_helper_main(sv[1]);
+    _exit(0);
+  }
+
+  close(sv[1]);
+  _spawn_set_cloexec(sv[0]);
+  _spawn_sock = sv[0];
+  _spawn_helper_pid = pid;
+  FD_REGISTER(_spawn_sock,"Spawn helper");
+
+  out_log(LEVEL_INFO,"spawn: helper started (pid %d)\n",(int)pid);
+
+  return 0;
+}
+
+void spawn_helper_stop(void)
+{
+  int status;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_spawn_mutex);
+#endif
+  if (_spawn_sock != -1) {
+    /* helper exits when the socket is closed */
+    FD_UNREGISTER(_spawn_sock,"Spawn helper");
+    close(_spawn_sock);
+    _spawn_sock = -1;
+    while (waitpid(_spawn_helper_pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    _spawn_helper_pid = -1;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&_spawn_mutex);
+#endif
+}
+
+int spawn_helper_running(void)
+{
+  return (_spawn_sock != -1);
+}
+
+int spawn_set_limit(unsigned long event_id, unsigned int max)
+{
+  unsigned int i;
+  int ret = 0;
+
+  if (event_id == 0) return -1;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_spawn_limit_mutex);
+#endif
+  for (i=0; i<_spawn_limit_count; i++)
+    if (_spawn_limits[i].event_id == event_id) break;
+
+  if (i < _spawn_limit_count) {
+    _spawn_limits[i].max = max;
+  } else if (_spawn_limit_count < HARD_SPAWN_LIMITS) {
+    _spawn_limits[i].event_id = event_id;
+    _spawn_limits[i].max = max;
+    _spawn_limits[i].running = 0;
+    _spawn_limit_count++;
+  } else {
+    ret = -1;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_cond_broadcast(&_spawn_limit_cond);
+  pthread_mutex_unlock(&_spawn_limit_mutex);
+#endif
+
+  return ret;
+}
+
+/** \brief Wait until a command of type \a event_id can be started
+ *
+ * The wait is limited to HARD_SPAWN_LIMIT_WAIT seconds.
+ * \return slot of limit, -1 if there is no limit, or -2 on timeout
+ */
+static int _spawn_limit_acquire(unsigned long event_id)
+{
+  unsigned int i;
+#ifdef HAVE_PTHREAD
+  struct timespec ts;
+#endif
+
+  if (event_id == 0) return -1;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_spawn_limit_mutex);
+#endif
+  for (i=0; i<_spawn_limit_count; i++)
+    if ((_spawn_limits[i].event_id & event_id) && _spawn_limits[i].max > 0) break;
+
+  if (i == _spawn_limit_count) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&_spawn_limit_mutex);
+#endif
+    return -1;
+  }
+
+#ifdef HAVE_PTHREAD
+  ts.tv_sec = time(NULL) + HARD_SPAWN_LIMIT_WAIT;
+  ts.tv_nsec = 0;
+  while (_spawn_limits[i].max > 0 && _spawn_limits[i].running >= _spawn_limits[i].max) {
+    if (pthread_cond_timedwait(&_spawn_limit_cond, &_spawn_limit_mutex, &ts) == ETIMEDOUT
+        && _spawn_limits[i].running >= _spawn_limits[i].max) {
+      pthread_mutex_unlock(&_spawn_limit_mutex);
+      return -2;
+    }
+  }
+#endif
+  _spawn_limits[i].running++;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&_spawn_limit_mutex);
+#endif
+
+  return (int)i;
+}
+
+static void _spawn_limit_release(int slot)
+{
+  if (slot < 0) return;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_spawn_limit_mutex);
+#endif
+  if (_spawn_limits[slot].running > 0)
+    _spawn_limits[slot].running--;
+#ifdef HAVE_PTHREAD
+  pthread_cond_broadcast(&_spawn_limit_cond);
+  pthread_mutex_unlock(&_spawn_limit_mutex);
+#endif
+}
+
+/** \brief Receive reply and descriptors from helper
+ *
+ * Waits at most HARD_SPAWN_REPLY_TIMEOUT seconds, since this is called
+ * with _spawn_mutex locked.
+ * \return 0 if ok, -1 on error or timeout
+ */
+static int _spawn_recv_reply(struct spawn_reply_t * reply, int * fd_out, int * fd_status)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr * cmsg;
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  struct pollfd pfd;
+  int fds[2];
+  ssize_t ret;
+
+  pfd.fd = _spawn_sock;
+  pfd.events = POLLIN;
+  do {
+    ret = poll(&pfd, 1, HARD_SPAWN_REPLY_TIMEOUT * 1000);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0) return -1;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = reply;
+  iov.iov_len = sizeof(*reply);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  do {
+    ret = recvmsg(_spawn_sock, &msg, MSG_DONTWAIT);
+  } while (ret < 0 && errno == EINTR);
+  if (ret != sizeof(*reply)) return -1;
+
+  *fd_out = *fd_status = -1;
+  if (reply->error != 0) return 0;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    return -1;
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  _spawn_set_cloexec(fds[0]);
+  _spawn_set_cloexec(fds[1]);
+  *fd_out = fds[0];
+  *fd_status = fds[1];
+
+  return 0;
+}
+
+int spawn_command(unsigned long event_id, const char * command, int use_shell, char * const envp[], wzd_spawn_job_t * job)
+{
+  char request[HARD_SPAWN_REQUEST_SIZE];
+  struct spawn_request_t * header;
+  struct spawn_reply_t reply;
+  size_t length, l;
+  int fd_out, fd_status;
+  int slot, i;
+
+  if (!command || !job) return -1;
+  if (_spawn_sock == -1) return -1;
+
+  /* build request */
+  header = (struct spawn_request_t*)request;
+  header->flags = (use_shell) ? SPAWN_FLAG_SHELL : 0;
+  header->command_length = strlen(command) + 1;
+  header->env_count = -1;
+  header->env_length = 0;
+  length = sizeof(*header);
+  if (length + header->command_length > sizeof(request)) {
+    out_log(LEVEL_HIGH,"spawn: command too long\n");
+    return 1;
+  }
+  memcpy(request + length, command, header->command_length);
+  length += header->command_length;
+  if (envp) {
+    header->env_count = 0;
+    for (i=0; envp[i]; i++) {
+      l = strlen(envp[i]) + 1;
+      if (length + l > sizeof(request)) {
+        out_log(LEVEL_HIGH,"spawn: environment too large for command %s\n",command);
+        return 1;
+      }
+      memcpy(request + length, envp[i], l);
+      length += l;
+      header->env_length += l;
+      header->env_count++;
+    }
+  }
+
+  slot = _spawn_limit_acquire(event_id);
+  if (slot == -2) {
+    out_log(LEVEL_HIGH,"spawn: too many commands running for event %lu, command %s not run\n",event_id,command);
+    return 1;
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&_spawn_mutex);
+#endif
+  if (_spawn_sock == -1 ||
+      _spawn_send_all(_spawn_sock, request, length) != 0 ||
+      _spawn_recv_reply(&reply, &fd_out, &fd_status) != 0) {
+    if (_spawn_sock != -1) {
+      out_log(LEVEL_HIGH,"spawn: helper is not responding, commands will be run by the server\n");
+      FD_UNREGISTER(_spawn_sock,"Spawn helper");
+      close(_spawn_sock);
+      _spawn_sock = -1;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&_spawn_mutex);
+#endif
+    _spawn_limit_release(slot);
+    return -1;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&_spawn_mutex);
+#endif
+
+  if (reply.error != 0) {
+    out_log(LEVEL_INFO,"spawn: could not start %s (errno %d)\n",command,reply.error);
+    _spawn_limit_release(slot);
+    return 1;
+  }
+
+  job->pid = reply.pid;
+  job->fd_out = fd_out;
+  job->fd_status = fd_status;
+  job->limit = slot;
+
+  return 0;
+}
+
+int spawn_wait(wzd_spawn_job_t * job)
+{
+  int status;
+  int ret;
+
+  if (!job) return -1;
+
+  if (job->fd_out != -1) {
+    close(job->fd_out);
+    job->fd_out = -1;
+  }
+
+  ret = _spawn_read_all(job->fd_status, &status, sizeof(status));
+  close(job->fd_status);
+  job->fd_status = -1;
+
+  _spawn_limit_release(job->limit);
+  job->limit = -1;
+
+  return (ret == 0) ? status : -1;
+}
+
+
+/*********************** helper process *************************/
+
+struct spawn_child_t {
+  pid_t pid;
+  int fd_status;
+};
+
+static void _spawn_sigchld(UNUSED int signum)
+{
+  int save_errno = errno;
+  char c = 0;
+
+  (void)write(_spawn_sigchld_fd, &c, 1);
+  errno = save_errno;
+}
+
+static void _spawn_free_argv(char ** argv)
+{
+  int i;
+
+  if (!argv) return;
+  for (i=0; argv[i]; i++)
+    free(argv[i]);
+  free(argv);
+}
+
+/** \brief Send reply, and descriptors if \a fd_out is not -1 */
+static int _spawn_send_reply(int sock, struct spawn_reply_t * reply, int fd_out, int fd_status)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr * cmsg;
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  int fds[2];
+  ssize_t ret;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = reply;
+  iov.iov_len = sizeof(*reply);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (fd_out != -1) {
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    fds[0] = fd_out;
+    fds[1] = fd_status;
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  }
+
+  do {
+    ret = sendmsg(sock, &msg, SPAWN_SEND_FLAGS);
+  } while (ret < 0 && errno == EINTR);
+
+  return (ret == sizeof(*reply)) ? 0 : -1;
+}
+
+/** \brief Start command described by \a request
+ * \return pid, or -1 and set \a error
+ */
+static pid_t _spawn_start(const struct spawn_request_t * request, char * body, int fd_out, int * error)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t sigset;
+  char ** argv = NULL;
+  char ** envp;
+  char * shell_argv[4];
+  char * empty_env[1];
+  char * ptr;
+  pid_t pid = -1;
+  int i;
+
+  /* environment */
+  if (request->env_count < 0) {
+    envp = environ;
+  } else if (request->env_count == 0) {
+    empty_env[0] = NULL;
+    envp = empty_env;
+  } else {
+    envp = malloc((request->env_count + 1) * sizeof(char *));
+    ptr = body + request->command_length;
+    for (i=0; i<request->env_count; i++) {
+      envp[i] = ptr;
+      ptr += strlen(ptr) + 1;
+    }
+    envp[i] = NULL;
+  }
+
+  if (request->flags & SPAWN_FLAG_SHELL) {
+    shell_argv[0] = "/bin/sh";
+    shell_argv[1] = "-c";
+    shell_argv[2] = body;
+    shell_argv[3] = NULL;
+  } else {
+    event_argv_parse(body, &argv);
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fd_out, 1);
+  posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+  /* the command must not inherit signal settings of the server */
+  posix_spawnattr_init(&attr);
+  sigemptyset(&sigset);
+  posix_spawnattr_setsigmask(&attr, &sigset);
+  sigaddset(&sigset, SIGPIPE);
+  sigaddset(&sigset, SIGCHLD);
+  sigaddset(&sigset, SIGINT);
+  sigaddset(&sigset, SIGTERM);
+  sigaddset(&sigset, SIGHUP);
+  posix_spawnattr_setsigdefault(&attr, &sigset);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  if (request->flags & SPAWN_FLAG_SHELL) {
+    *error = posix_spawn(&pid, shell_argv[0], &actions, &attr, shell_argv, envp);
+  } else if (argv && argv[0]) {
+    *error = posix_spawn(&pid, argv[0], &actions, &attr, argv, envp);
+  } else {
+    *error = EINVAL;
+  }
+  if (*error != 0) pid = -1;
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  _spawn_free_argv(argv);
+  if (envp != environ && envp != empty_env)
+    free(envp);
+
+  return pid;
+}
+
+/** \brief Read request from \a sock, and start command
+ * \return 0 if ok, -1 if the server has closed the socket
+ */
+static int _spawn_handle_request(int sock, struct spawn_child_t ** children, unsigned int * child_count)
+{
+  static char body[HARD_SPAWN_REQUEST_SIZE];
+  struct spawn_request_t request;
+  struct spawn_reply_t reply;
+  struct spawn_child_t * new_children;
+  int out_pipe[2], status_pipe[2];
+  size_t length;
+  pid_t pid;
+
+  if (_spawn_read_all(sock, &request, sizeof(request)) != 0) return -1;
+
+  length = (size_t)request.command_length + request.env_length;
+  if (request.command_length == 0 || length > sizeof(body) - sizeof(request)) return -1;
+  if (_spawn_read_all(sock, body, length) != 0) return -1;
+  body[request.command_length - 1] = '\0';
+  if (request.env_length > 0) body[length - 1] = '\0';
+
+  memset(&reply, 0, sizeof(reply));
+
+  if (pipe(out_pipe) < 0) {
+    reply.error = errno;
+    return _spawn_send_reply(sock, &reply, -1, -1);
+  }
+  if (pipe(status_pipe) < 0) {
+    reply.error = errno;
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return _spawn_send_reply(sock, &reply, -1, -1);
+  }
+  _spawn_set_cloexec(out_pipe[0]);
+  _spawn_set_cloexec(out_pipe[1]);
+  _spawn_set_cloexec(status_pipe[0]);
+  _spawn_set_cloexec(status_pipe[1]);
+
+  pid = _spawn_start(&request, body, out_pipe[1], &reply.error);
+  close(out_pipe[1]);
+
+  if (pid < 0) {
+    close(out_pipe[0]);
+    close(status_pipe[0]);
+    close(status_pipe[1]);
+    return _spawn_send_reply(sock, &reply, -1, -1);
+  }
+
+  new_children = realloc(*children, (*child_count + 1) * sizeof(struct spawn_child_t));
+  if (new_children) {
+    *children = new_children;
+    (*children)[*child_count].pid = pid;
+    (*children)[*child_count].fd_status = status_pipe[1];
+    (*child_count)++;
+  } else {
+    /* the server will read end of file instead of the status */
+    close(status_pipe[1]);
+  }
+
+  reply.pid = (int)pid;
+  if (_spawn_send_reply(sock, &reply, out_pipe[0], status_pipe[0]) != 0) {
+    close(out_pipe[0]);
+    close(status_pipe[0]);
+    return -1;
+  }
+  close(out_pipe[0]);
+  close(status_pipe[0]);
+
+  return 0;
+}
+
+/** \brief Send status of terminated commands */
+static void _spawn_reap(struct spawn_child_t * children, unsigned int * child_count)
+{
+  unsigned int i;
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    for (i=0; i<*child_count; i++) {
+      if (children[i].pid == pid) {
+        (void)write(children[i].fd_status, &status, sizeof(status));
+        close(children[i].fd_status);
+        children[i] = children[--(*child_count)];
+        break;
+      }
+    }
+  }
+}
+
+/** \brief Main loop of helper process */
+static void _spawn_helper_main(int sock)
+{
+  struct spawn_child_t * children = NULL;
+  unsigned int child_count = 0;
+  struct pollfd pfd[2];
+  struct sigaction sa;
+  sigset_t sigset;
+  int sigchld_pipe[2];
+  long fd, max_fd;
+  char buffer[64];
+
+  /* close descriptors inherited from server */
+  max_fd = sysconf(_SC_OPEN_MAX);
+  if (max_fd < 0 || max_fd > 65536) max_fd = 65536;
+  for (fd=3; fd<max_fd; fd++)
+    if (fd != sock) close((int)fd);
+
+  /* the server handles signals, the helper exits when the socket is closed */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sa.sa_handler = SIG_DFL;
+  sigaction(SIGSEGV, &sa, NULL);
+
+  if (pipe(sigchld_pipe) < 0) _exit(1);
+  fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+  _spawn_set_cloexec(sigchld_pipe[0]);
+  _spawn_set_cloexec(sigchld_pipe[1]);
+  _spawn_set_cloexec(sock);
+  _spawn_sigchld_fd = sigchld_pipe[1];
+
+  sa.sa_handler = _spawn_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  sigemptyset(&sigset);
+  sigprocmask(SIG_SETMASK, &sigset, NULL);
+
+  for (;;) {
+    pfd[0].fd = sock;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sigchld_pipe[0];
+    pfd[1].events = POLLIN;
+
+    if (poll(pfd, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (pfd[1].revents & POLLIN) {
+      while (read(sigchld_pipe[0], buffer, sizeof(buffer)) > 0)
+        ;
+      _spawn_reap(children, &child_count);
+    }
+
+    if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      if (_spawn_handle_request(sock, &children, &child_count) != 0)
+        break;
+    }
+  }
+
+  /* commands still running are not killed */
+  free(children);
+  close(sock);
+}
+
+#else /* WIN32 */
+
+int spawn_helper_start(void)
+{
+  return -1;
+}
+
+void spawn_helper_stop(void)
+{
+}
+
+int spawn_helper_running(void)
+{
+  return 0;
+}
+
+int spawn_set_limit(UNUSED unsigned long event_id, UNUSED unsigned int max)
+{
+  return 0;
+}
+
+int spawn_command(UNUSED unsigned long event_id, UNUSED const char * command, UNUSED int use_shell, UNUSED char * const envp[], UNUSED wzd_spawn_job_t * job)
+{
+  return -1;
+}
+
+int spawn_wait(UNUSED wzd_spawn_job_t * job)
+{
+  return -1;
+}
+
+#endif /* WIN32 */
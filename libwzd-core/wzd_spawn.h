@@ -0,0 +1,102 @@
+/*
+ * wzdftpd - a modular and cool ftp server
+ * Copyright (C) 2002-2008  Pierre Chifflier
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ * As a special exemption, Pierre Chifflier
+ * and other respective copyright holders give permission to link this program
+ * with OpenSSL, and distribute the resulting executable, without including
+ * the source code for OpenSSL in the source distribution.
+ */
+
+#ifndef __WZD_SPAWN__
+#define __WZD_SPAWN__
+
+/** \file wzd_spawn.h
+ * \brief Helper process running external commands
+ *
+ * Forking the server to run an external command copies the page tables of
+ * a large process with many threads, and blocks the calling thread. The
+ * helper is forked once, when the server is still small, and receives
+ * commands over a socketpair. It starts them with posix_spawn(), and sends
+ * back a descriptor on the standard output of the command and a descriptor
+ * where the exit status is written when the command terminates.
+ *
+ * The number of commands running at the same time can be limited for
+ * each event type (see spawn_set_limit()).
+ */
+
+/** \brief Command started by the helper */
+typedef struct {
+  int pid;
+  fd_t fd_out;		/**< standard output of the command */
+  fd_t fd_status;	/**< exit status is written here by the helper */
+  int limit;		/**< slot of concurrency limit, or -1 */
+} wzd_spawn_job_t;
+
+/** \brief Fork helper process
+ *
+ * Must be called before the server has grown, after privileges have
+ * been dropped: commands are run with the uid of the helper.
+ * \return 0 if ok
+ */
+int spawn_helper_start(void);
+
+/** \brief Stop helper process
+ *
+ * Commands already started are not killed.
+ */
+void spawn_helper_stop(void);
+
+/** \brief Return 1 if helper is running */
+int spawn_helper_running(void);
+
+/** \brief Limit the number of commands of event type \a event_id running
+ * at the same time
+ *
+ * \param max maximum number of commands, or 0 to remove limit
+ * \return 0 if ok, -1 if there are too many limits
+ */
+int spawn_set_limit(unsigned long event_id, unsigned int max);
+
+/** \brief Start \a command using the helper
+ *
+ * If the limit for \a event_id has been reached, wait until a command of
+ * the same type has terminated, at most HARD_SPAWN_LIMIT_WAIT seconds.
+ *
+ * \param event_id event type, used for concurrency limits (0 if none)
+ * \param command command line. If \a use_shell is 0, it is split into
+ * arguments (argv[0] must be an absolute path), otherwise it is run
+ * using /bin/sh -c
+ * \param envp environment of the command, or NULL to use the environment
+ * of the helper
+ * \param job filled if command was started. Output must be read from
+ * job->fd_out, and spawn_wait() must be called
+ * \return 0 if ok, -1 if the helper is not running (the caller can run
+ * the command itself), 1 if the command could not be started or the wait
+ * for the limit timed out
+ */
+int spawn_command(unsigned long event_id, const char * command, int use_shell, char * const envp[], wzd_spawn_job_t * job);
+
+/** \brief Wait for command started by spawn_command()
+ *
+ * job->fd_out is closed if it is still open (set it to -1 if it has
+ * been closed by caller).
+ * \return status as returned by waitpid(), or -1 on error
+ */
+int spawn_wait(wzd_spawn_job_t * job);
+
+#endif /* __WZD_SPAWN__ */
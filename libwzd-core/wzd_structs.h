@@ -130,14 +130,19 @@ typedef unsigned long wzd_perm_t;
  */
 typedef struct limiter
 {
-  u32_t maxspeed;
+  u32_t maxspeed;		/**< @brief bytes / sec, 0 means no limit */
 #ifndef WIN32
-  struct timeval current_time;
+  struct timeval current_time;	/**< @brief start of transfer */
 #else
   struct _timeb current_time;
 #endif
   int bytes_transfered;
   float current_speed;
+
+  /* token bucket, updated with atomic operations */
+  volatile i64_t tokens;	/**< @brief available bytes, negative if in debt */
+  volatile i64_t last_refill;	/**< @brief date of last refill (usec) */
+  struct limiter * parent;	/**< @brief upper level: connection -> group -> global */
 } wzd_bw_limiter;
 
 /************************ VFS *****************************/
@@ -294,6 +299,11 @@ struct wzd_section_t {
 typedef struct {
   unsigned long num_connections; /**< @brief total # of connections since server start */
   unsigned long num_childs; /**< @brief total # of childs process created since server start */
+  unsigned long tls_handshakes; /**< @brief # of successful implicit TLS handshakes */
+  unsigned long tls_handshake_failures; /**< @brief # of failed implicit TLS handshakes */
+  unsigned long tls_handshake_time; /**< @brief total time spent in implicit TLS handshakes, in ms */
+  unsigned long tls_sessions_resumed; /**< @brief # of TLS handshakes (control and data) which resumed a session */
+  unsigned long tls_sessions_full; /**< @brief # of TLS handshakes (control and data) with a full key exchange */
 } wzd_server_stat_t;
 
 /*************************** IP **************************/
@@ -311,6 +321,8 @@ typedef enum { TLS_NONE, TLS_READ, TLS_WRITE } ssl_fd_mode_t;
 typedef struct {
   void * session;
   void * data_session;
+  void * data_resume; /**< saved session of the last data connection in client mode (SSCN) */
+  size_t data_resume_length;
 } wzd_tls_t;
 
 typedef enum {
@@ -329,6 +341,8 @@ typedef enum {
 #define	CONNECTION_TLS	0x00000040
 #define	CONNECTION_SSCN 0x00000080
 #define	CONNECTION_UTF8	0x00000100
+/** global ip rules need a host name, checked by the login worker */
+#define	CONNECTION_IP_PENDING	0x00000200
 
 typedef int (*read_fct_t)(socket_t,char*,size_t,int,unsigned int,void *);
 typedef int (*write_fct_t)(socket_t,const char*,size_t,int,unsigned int,void *);
@@ -372,6 +386,8 @@ struct wzd_context_t {
   u8_t          is_transferring;
 
   socket_t          pasv_socket;
+  unsigned int  pasv_port; /**< \brief port reserved for pasv_socket, 0 if none */
+  int           pasv_pooled; /**< \brief pasv_socket was taken from the PASV pool */
   read_fct_t    read_fct;
   write_fct_t   write_fct;
   int           dataport;
@@ -395,6 +411,7 @@ struct wzd_context_t {
   struct wzd_reply_t * reply;
   wzd_tls_t   	tls;
   struct _auth_gssapi_data_t * gssapi_data;
+  struct wzd_checkpath_cache_t * path_cache;
 };
 
 /********************** COMMANDS **************************/
@@ -408,6 +425,7 @@ struct wzd_context_t {
 /* macros used with options */
 #define CFG_OPT_DENY_ACCESS_FILES_UPLOADED  0x00000001
 #define CFG_OPT_HIDE_DOTTED_FILES           0x00000002
+#define CFG_OPT_NO_LIST_SUBDIR_PERMS        0x00000004
 #define CFG_OPT_USE_SYSLOG                  0x00000010
 #define CFG_OPT_DISABLE_TLS                 0x00000100
 #define CFG_OPT_DISABLE_IDENT               0x00000200
@@ -452,6 +470,7 @@ struct wzd_config_t {
   u32_t         pasv_high_range;
   unsigned char	pasv_ip[16];
   struct wzd_ip_list_t	*login_pre_ip_checks;
+  struct wzd_ip_acl_t	*login_pre_ip_acl; /**< compiled form of login_pre_ip_checks */
   wzd_vfs_t	*vfs;
   wzd_hook_t	*hook;
   wzd_module_t	*module;
@@ -30,6 +30,14 @@
 # include "config.h"
 #endif
 
+#if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
+#include "wzd_atomic.h"
+
+/** \brief Count a successful handshake in server stats */
+#define TLS_COUNT_HANDSHAKE(resumed) \
+  WZD_ATOMIC_INC( (resumed) ? &mainConfig->stats.tls_sessions_resumed : &mainConfig->stats.tls_sessions_full )
+#endif
+
 #ifdef HAVE_OPENSSL
 
 #if defined(WIN32) || (defined(__CYGWIN__) && defined(WINSOCK_SUPPORT))
@@ -45,6 +53,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "wzd_structs.h"
 #include "wzd_log.h"
@@ -54,6 +63,7 @@
 #include "wzd_tls.h"
 
 #include "wzd_configfile.h"
+#include "wzd_configloader.h"
 #include "wzd_messages.h"
 
 #include "wzd_debug.h"
@@ -69,8 +79,17 @@ struct wzd_ssl_t {
   SSL *         obj;
   SSL *         data_ssl;
   ssl_fd_mode_t ssl_fd_mode;
+  SSL_SESSION * data_session; /**< last session of a data connection in client mode (SSCN), offered again on the next one */
 };
 
+/* OpenSSL >= 3.0 can hand the record layer over to the kernel (kTLS) */
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && !defined(OPENSSL_NO_KTLS)
+# define WZD_HAVE_KTLS 1
+#endif
+
+/** set if data connections should try to use kernel TLS (tls_ktls) */
+static int tls_use_ktls = 0;
+
 /* pointers to OpenSSL lock arrays */
 static wzd_mutex_t **openssl_static_lock = NULL;
 static ssize_t openssl_static_lock_num = 0;
@@ -302,9 +321,41 @@ int tls_init(void)
     SSL_CTX_set_client_CA_list(tls_ctx, (STACK *)ca_list);
   }
 
-  SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT);
+  /* server cache: data connections can resume the session of the control
+   * connection, instead of doing a full handshake for each transfer
+   */
+  {
+    unsigned long cache_size, timeout;
+    int err;
+
+    cache_size = config_get_integer(mainConfig->cfg_file, "GLOBAL", "tls_session_cache_size", &err);
+    if (err) cache_size = HARD_TLS_SESSION_CACHE_SIZE;
+    timeout = config_get_integer(mainConfig->cfg_file, "GLOBAL", "tls_session_timeout", &err);
+    if (err) timeout = HARD_TLS_SESSION_TIMEOUT;
+
+    if (cache_size > 0) {
+      SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_CLIENT);
+      SSL_CTX_sess_set_cache_size(tls_ctx, cache_size);
+      SSL_CTX_set_timeout(tls_ctx, timeout);
+    } else
+      SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT);
+  }
   SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char *) "1", 1);
 
+  {
+    int err;
+
+    ret = config_get_boolean(mainConfig->cfg_file, "GLOBAL", "tls_ktls", &err);
+    if (err == CF_OK && ret) {
+#ifdef WZD_HAVE_KTLS
+      tls_use_ktls = 1;
+      out_log(LEVEL_INFO,"TLS: kernel TLS will be used for data connections when possible\n");
+#else
+      out_log(LEVEL_HIGH,"TLS: kernel TLS is not supported by this OpenSSL (%s), option tls_ktls ignored\n",OPENSSL_VERSION_TEXT);
+#endif
+    }
+  }
+
   ret = _tls_init_threads();
   if (ret) {
     out_log(LEVEL_CRITICAL, "_tls_init_threads failed (out of memory?)");
@@ -535,8 +586,7 @@ int tls_write(socket_t sock, const char *msg, size_t length, int flags, unsigned
 int tls_auth (const char *type, wzd_context_t * context)
 {
   int ret;
-  char * tls_cipher_list;
-  wzd_string_t * str;
+  const wzd_config_snapshot_t * snapshot;
 
   WZD_ASSERT(mainConfig->tls_ctx != NULL);
   if (mainConfig->tls_ctx == NULL) {
@@ -557,23 +607,14 @@ int tls_auth (const char *type, wzd_context_t * context)
   }
 #endif
 
-  {
-    str = config_get_string(mainConfig->cfg_file, "GLOBAL", "tls_cipher_list", NULL);
-    if (str) {
-      /** \bug FIXME memory leak here !! */
-      tls_cipher_list = strdup(str_tochar(str));
-      str_deallocate(str);
-    } else {
-      tls_cipher_list = "ALL";
-    }
-  }
-
   context->ssl->obj = SSL_new(mainConfig->tls_ctx);
   if (context->ssl->obj == NULL) {
     out_log(LEVEL_CRITICAL,"SSL_new failed (%s)\n",ERR_error_string(ERR_get_error(),NULL));
     return 1;
   }
-  SSL_set_cipher_list(context->ssl->obj,tls_cipher_list);
+  snapshot = config_snapshot_acquire();
+  SSL_set_cipher_list(context->ssl->obj,snapshot->tls_cipher_list);
+  config_snapshot_release(snapshot);
   ret = SSL_set_fd(context->ssl->obj,(int)context->control_socket);
   if (ret != 1) {
     out_log(LEVEL_CRITICAL,"SSL_set_fd failed (%s)\n",ERR_error_string(ERR_get_error(),NULL));
@@ -598,11 +639,16 @@ int tls_auth_cont(wzd_context_t * context)
   int ret, status, sslerr;
   fd_set fd_r, fd_w;
   struct timeval tv;
+  time_t deadline, now;
 
 #ifdef WZD_DBG_TLS
   out_err(LEVEL_HIGH,"TLS: Non-blocking accept\n");
 #endif
 
+  /* the whole handshake must be done before deadline, a client sending
+   * data slowly can not keep the thread busy */
+  deadline = time(NULL) + HARD_TLS_HANDSHAKE_TIMEOUT;
+
   SSL_set_accept_state(ssl);
   sock = (socket_t)SSL_get_fd(ssl);
   /* ensure socket is non-blocking */
@@ -619,14 +665,20 @@ int tls_auth_cont(wzd_context_t * context)
     sslerr = SSL_get_error(ssl,status);
     if (status == 1) {
       out_log(LEVEL_INFO,"control connection succesfully switched to ssl (cipher: %s)\n",SSL_get_cipher(ssl));
+      TLS_COUNT_HANDSHAKE(SSL_session_reused(ssl));
       ret = 1;
       break;
     } else {
       context->ssl->ssl_fd_mode = TLS_NONE;
+      now = time(NULL);
+      if (now >= deadline) {
+        out_log(LEVEL_HIGH,"TLS handshake timeout\n");
+        return -1;
+      }
       FD_ZERO(&fd_r);
       FD_ZERO(&fd_w);
       tv.tv_usec = 0;
-      tv.tv_sec = 5;
+      tv.tv_sec = deadline - now;
       switch (sslerr) {
       case SSL_ERROR_WANT_READ:
         FD_SET(sock,&fd_r);
@@ -704,8 +756,7 @@ int tls_auth_cont(wzd_context_t * context)
 
 int tls_init_datamode(socket_t sock, wzd_context_t * context)
 {
-  char * tls_cipher_list;
-  wzd_string_t * str;
+  const wzd_config_snapshot_t * snapshot;
 
   if (!context->ssl->data_ssl) {
     context->ssl->data_ssl = SSL_new(mainConfig->tls_ctx);
@@ -720,18 +771,18 @@ int tls_init_datamode(socket_t sock, wzd_context_t * context)
     return 1;
   }
 
-  {
-    str = config_get_string(mainConfig->cfg_file, "GLOBAL", "tls_cipher_list", NULL);
-    if (str) {
-      /** \bug FIXME memory leak here !! */
-      tls_cipher_list = strdup(str_tochar(str));
-      str_deallocate(str);
-    } else {
-      tls_cipher_list = "ALL";
-    }
-  }
+  snapshot = config_snapshot_acquire();
+  SSL_set_cipher_list(context->ssl->data_ssl, snapshot->tls_cipher_list);
+  config_snapshot_release(snapshot);
 
-  SSL_set_cipher_list(context->ssl->data_ssl, tls_cipher_list);
+#ifdef WZD_HAVE_KTLS
+  /* if the kernel supports the negotiated cipher, records will be
+   * encrypted/decrypted by the kernel after the handshake. Otherwise
+   * OpenSSL silently keeps doing it in userspace.
+   */
+  if (tls_use_ktls)
+    SSL_set_options(context->ssl->data_ssl, SSL_OP_ENABLE_KTLS);
+#endif
 
 #if defined(WIN32) || (defined(__CYGWIN__) && defined(WINSOCK_SUPPORT))
   {
@@ -763,8 +814,12 @@ int tls_auth_data_cont(wzd_context_t * context)
     ( context->current_action.token == TOK_RETR || context->current_action.token == TOK_STOR ) 
   ) ? 1 : 0;
 
-  if (client_mode)
+  if (client_mode) {
     SSL_set_connect_state(ssl);
+    /* try to resume the session used for the previous transfer */
+    if (context->ssl->data_session)
+      SSL_set_session(ssl, context->ssl->data_session);
+  }
   else
     SSL_set_accept_state(ssl);
 
@@ -779,7 +834,20 @@ int tls_auth_data_cont(wzd_context_t * context)
     sslerr = SSL_get_error(ssl,status);
 
     if (status==1) {
-      out_log(LEVEL_INFO,"Data connection succesfully switched to ssl (cipher: %s)\n",SSL_get_cipher(ssl));
+      out_log(LEVEL_INFO,"Data connection succesfully switched to ssl (cipher: %s%s)\n",SSL_get_cipher(ssl),
+          SSL_session_reused(ssl) ? ", resumed" : "");
+      TLS_COUNT_HANDSHAKE(SSL_session_reused(ssl));
+      if (client_mode && !SSL_session_reused(ssl)) {
+        if (context->ssl->data_session)
+          SSL_SESSION_free(context->ssl->data_session);
+        context->ssl->data_session = SSL_get1_session(ssl);
+      }
+#ifdef WZD_HAVE_KTLS
+      if (tls_use_ktls)
+        out_log(LEVEL_FLOOD,"Data connection kTLS: send %s, receive %s\n",
+            BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "yes" : "no",
+            BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? "yes" : "no");
+#endif
       context->tls_data_mode = TLS_PRIV;
       return 0;
     } else {
@@ -815,6 +883,29 @@ out_err(LEVEL_FLOOD,"SSL_ERROR_WANT_WRITE\n");
   return 0;
 }
 
+/*************** tls_data_ktls ***********************/
+
+/** \brief Test if the kernel handles TLS records of the data connection
+ *
+ * If so, the data socket can be used directly with sendfile() (if \a is_write
+ * is set) or splice(), and the kernel encrypts or decrypts the data.
+ */
+int tls_data_ktls(wzd_context_t * context, int is_write)
+{
+#ifdef WZD_HAVE_KTLS
+  SSL * ssl = context->ssl->data_ssl;
+
+  if (!ssl || context->tls_data_mode != TLS_PRIV) return 0;
+
+  if (is_write)
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) ? 1 : 0;
+  else
+    return BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? 1 : 0;
+#else
+  return 0;
+#endif
+}
+
 /*************** tls_close_data **********************/
 
 int tls_close_data(wzd_context_t * context)
@@ -840,6 +931,9 @@ int tls_free(wzd_context_t * context)
     SSL_free(context->ssl->obj);
   }
   context->ssl->obj = NULL;
+  if (context->ssl->data_session)
+    SSL_SESSION_free(context->ssl->data_session);
+  context->ssl->data_session = NULL;
 
   ERR_remove_state(0);
   ERR_clear_error();
@@ -859,11 +953,13 @@ void * ssl_get_obj(wzd_context_t * context)
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <gnutls/gnutls.h>
 #include <gcrypt.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
 #include <fcntl.h>
@@ -893,6 +989,110 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 static gnutls_certificate_credentials x509_cred;
 static gnutls_dh_params dh_params;
 
+#define TLS_SESSION_ID_MAX 32
+
+/** \brief Entry of the server-side session cache */
+struct tls_session_entry_t {
+  unsigned char id[TLS_SESSION_ID_MAX];
+  size_t id_length;
+  unsigned char * data;
+  size_t data_length;
+  time_t expires;
+};
+
+/* The session cache is shared by all threads, and allows data connections
+ * to resume the session of the control connection.
+ * It is a direct-mapped table: a new session replaces the one stored in
+ * the same slot, so the memory used is bounded by tls_session_cache_size.
+ */
+static struct tls_session_entry_t * tls_session_cache = NULL;
+static unsigned int tls_session_cache_size = 0;
+static unsigned int tls_session_timeout = HARD_TLS_SESSION_TIMEOUT;
+static pthread_mutex_t tls_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct tls_session_entry_t * _tls_session_slot(const gnutls_datum * key)
+{
+  unsigned int h = 2166136261U;
+  unsigned int i;
+
+  for (i=0; i<key->size; i++)
+    h = (h ^ key->data[i]) * 16777619U;
+
+  return &tls_session_cache[h % tls_session_cache_size];
+}
+
+static int _tls_session_match(const struct tls_session_entry_t * entry, const gnutls_datum * key)
+{
+  return (entry->data != NULL && entry->id_length == key->size
+      && memcmp(entry->id, key->data, key->size) == 0);
+}
+
+static int _tls_session_store(void * ptr, gnutls_datum key, gnutls_datum data)
+{
+  struct tls_session_entry_t * entry;
+  unsigned char * copy;
+
+  if (tls_session_cache == NULL || key.size > TLS_SESSION_ID_MAX) return -1;
+
+  copy = malloc(data.size);
+  if (copy == NULL) return -1;
+  memcpy(copy, data.data, data.size);
+
+  pthread_mutex_lock(&tls_session_mutex);
+  entry = _tls_session_slot(&key);
+  free(entry->data);
+  memcpy(entry->id, key.data, key.size);
+  entry->id_length = key.size;
+  entry->data = copy;
+  entry->data_length = data.size;
+  entry->expires = time(NULL) + tls_session_timeout;
+  pthread_mutex_unlock(&tls_session_mutex);
+
+  return 0;
+}
+
+static gnutls_datum _tls_session_fetch(void * ptr, gnutls_datum key)
+{
+  struct tls_session_entry_t * entry;
+  gnutls_datum res = { NULL, 0 };
+
+  if (tls_session_cache == NULL) return res;
+
+  pthread_mutex_lock(&tls_session_mutex);
+  entry = _tls_session_slot(&key);
+  if (_tls_session_match(entry, &key) && entry->expires > time(NULL)) {
+    /* data is freed by GnuTLS */
+    res.data = gnutls_malloc(entry->data_length);
+    if (res.data) {
+      memcpy(res.data, entry->data, entry->data_length);
+      res.size = entry->data_length;
+    }
+  }
+  pthread_mutex_unlock(&tls_session_mutex);
+
+  return res;
+}
+
+static int _tls_session_remove(void * ptr, gnutls_datum key)
+{
+  struct tls_session_entry_t * entry;
+  int ret = -1;
+
+  if (tls_session_cache == NULL) return -1;
+
+  pthread_mutex_lock(&tls_session_mutex);
+  entry = _tls_session_slot(&key);
+  if (_tls_session_match(entry, &key)) {
+    free(entry->data);
+    entry->data = NULL;
+    entry->id_length = 0;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&tls_session_mutex);
+
+  return ret;
+}
+
 static int generate_dh_params(void)
 {
 
@@ -997,6 +1197,22 @@ int tls_init(void)
 
   gnutls_certificate_set_dh_params(x509_cred, dh_params);
 
+  {
+    unsigned long cache_size, timeout;
+    int err;
+
+    cache_size = config_get_integer(mainConfig->cfg_file, "GLOBAL", "tls_session_cache_size", &err);
+    if (err) cache_size = HARD_TLS_SESSION_CACHE_SIZE;
+    timeout = config_get_integer(mainConfig->cfg_file, "GLOBAL", "tls_session_timeout", &err);
+    if (!err) tls_session_timeout = timeout;
+
+    if (cache_size > 0) {
+      tls_session_cache = calloc(cache_size, sizeof(struct tls_session_entry_t));
+      if (tls_session_cache)
+        tls_session_cache_size = cache_size;
+    }
+  }
+
   out_log(LEVEL_INFO,"TLS initialization successful (GnuTLS %s).\n",LIBGNUTLS_VERSION);
 
   str_deallocate(tls_certificate);
@@ -1015,6 +1231,16 @@ int tls_exit(void)
   gnutls_certificate_free_credentials(x509_cred);
   gnutls_global_deinit();
 
+  if (tls_session_cache) {
+    unsigned int i;
+
+    for (i=0; i<tls_session_cache_size; i++)
+      free(tls_session_cache[i].data);
+    free(tls_session_cache);
+    tls_session_cache = NULL;
+    tls_session_cache_size = 0;
+  }
+
   return 0;
 }
 
@@ -1041,6 +1267,14 @@ static gnutls_session initialize_tls_session(gnutls_connection_end con_end)
     /* request client certificate if any.
     */
     gnutls_certificate_server_set_request(session, GNUTLS_CERT_REQUEST);
+
+    if (tls_session_cache) {
+      gnutls_db_set_retrieve_function(session, _tls_session_fetch);
+      gnutls_db_set_store_function(session, _tls_session_store);
+      gnutls_db_set_remove_function(session, _tls_session_remove);
+      gnutls_db_set_ptr(session, NULL);
+      gnutls_db_set_cache_expiration(session, tls_session_timeout);
+    }
   }
 
   gnutls_dh_set_prime_bits(session, CLIENT_DH_BITS); /* OpenSSL will not be able to support more */
@@ -1076,26 +1310,14 @@ int tls_auth (const char *type, wzd_context_t * context)
   int was_writing=0;
   fd_set fd_r, fd_w;
   struct timeval tv;
-  wzd_string_t * str;
-  char * tls_cipher_list;
+  time_t deadline, now;
 
 
   session = initialize_tls_session(GNUTLS_SERVER);
 
   gnutls_transport_set_ptr(session, (gnutls_transport_ptr) sock);
 
-  {
-    str = config_get_string(mainConfig->cfg_file, "GLOBAL", "tls_cipher_list", NULL);
-    if (str) {
-      /** \bug FIXME memory leak here !! */
-      tls_cipher_list = strdup(str_tochar(str));
-      str_deallocate(str);
-    } else {
-      tls_cipher_list = "ALL";
-    }
-  }
-
-  /** \todo XXX parse TLS cipher names */
+  /** \todo XXX parse TLS cipher names (from config_snapshot_acquire()) */
   {
     /** Note that the priority is set on the client. The server does not use
      * the algorithm's priority except for disabling algorithms that were not
@@ -1129,11 +1351,15 @@ int tls_auth (const char *type, wzd_context_t * context)
 #endif
 
   /* Perform the TLS handshake
+   * The whole handshake must be done before deadline, a client sending
+   * data slowly can not keep the thread busy
    */
+  deadline = time(NULL) + HARD_TLS_HANDSHAKE_TIMEOUT;
   do {
     ret = gnutls_handshake(session);
     if (ret == 0) {
       out_log(LEVEL_FLOOD,"control connection succesfully switched to ssl (cipher: %s)\n",gnutls_cipher_get_name(gnutls_cipher_get(session)));
+      TLS_COUNT_HANDSHAKE(gnutls_session_is_resumed(session));
       break;
     }
     if (gnutls_error_is_fatal(ret)) {
@@ -1153,10 +1379,16 @@ int tls_auth (const char *type, wzd_context_t * context)
     }
 
     /* we need to wait before continuing the handshake */
+    now = time(NULL);
+    if (now >= deadline) {
+      out_log(LEVEL_HIGH,"GnuTLS: handshake timeout\n");
+      gnutls_deinit(session);
+      return 1;
+    }
     FD_ZERO(&fd_r);
     FD_ZERO(&fd_w);
     tv.tv_usec = 0;
-    tv.tv_sec = 5;
+    tv.tv_sec = deadline - now;
     if (was_writing) { FD_SET(sock,&fd_w); }
     else { FD_SET(sock,&fd_r); }
 
@@ -1208,6 +1440,10 @@ int tls_init_datamode(socket_t sock, wzd_context_t * context)
 
   session = initialize_tls_session( client_mode ? GNUTLS_CLIENT : GNUTLS_SERVER );
 
+  /* try to resume the session used for the previous transfer */
+  if (client_mode && context->tls.data_resume)
+    gnutls_session_set_data(session, context->tls.data_resume, context->tls.data_resume_length);
+
   /** \todo XXX parse TLS cipher names */
   {
     /** Note that the priority is set on the client. The server does not use
@@ -1257,7 +1493,25 @@ int tls_init_datamode(socket_t sock, wzd_context_t * context)
   do {
     ret = gnutls_handshake(session);
     if (ret == 0) {
-      out_log(LEVEL_FLOOD,"Data connection succesfully switched to ssl (cipher: %s)\n",gnutls_cipher_get_name(gnutls_cipher_get(session)));
+      out_log(LEVEL_FLOOD,"Data connection succesfully switched to ssl (cipher: %s%s)\n",gnutls_cipher_get_name(gnutls_cipher_get(session)),
+          gnutls_session_is_resumed(session) ? ", resumed" : "");
+      TLS_COUNT_HANDSHAKE(gnutls_session_is_resumed(session));
+      if (client_mode && !gnutls_session_is_resumed(session)) {
+        size_t length = 0;
+
+        free(context->tls.data_resume);
+        context->tls.data_resume = NULL;
+        context->tls.data_resume_length = 0;
+        if (gnutls_session_get_data(session, NULL, &length) == 0 && length > 0) {
+          context->tls.data_resume = malloc(length);
+          if (context->tls.data_resume && gnutls_session_get_data(session, context->tls.data_resume, &length) == 0)
+            context->tls.data_resume_length = length;
+          else {
+            free(context->tls.data_resume);
+            context->tls.data_resume = NULL;
+          }
+        }
+      }
       break;
     }
     if (gnutls_error_is_fatal(ret)) {
@@ -1301,6 +1555,12 @@ int tls_init_datamode(socket_t sock, wzd_context_t * context)
   return 0;
 }
 
+int tls_data_ktls(UNUSED wzd_context_t * context, UNUSED int is_write)
+{
+  /* record layer always stays in userspace with GnuTLS */
+  return 0;
+}
+
 int tls_close_data(wzd_context_t * context)
 {
   if (CFG_GET_OPTION(mainConfig,CFG_OPT_DISABLE_TLS)) {
@@ -1364,6 +1624,9 @@ int tls_free(wzd_context_t * context)
   }
 
   tls_close_data(context);
+  free(context->tls.data_resume);
+  context->tls.data_resume = NULL;
+  context->tls.data_resume_length = 0;
   if (context->tls.session) {
     int ret;
     int alert;
@@ -39,6 +39,8 @@ int tls_free(wzd_context_t * context);
 
 int tls_auth_data_cont(wzd_context_t * context);
 
+int tls_data_ktls(wzd_context_t * context, int is_write);
+
 int tls_read(socket_t sock, char *msg, size_t length, int flags, unsigned int timeout, void * vcontext);
 int tls_write(socket_t sock, const char *msg, size_t length, int flags, unsigned int timeout, void * vcontext);
 
@@ -50,6 +50,7 @@
 
 #include "wzd_structs.h"
 
+#include "wzd_atomic.h"
 #include "wzd_fs.h"
 #include "wzd_group.h"
 #include "wzd_ip.h"
@@ -65,6 +66,115 @@
 static uid_t _max_uid = 0;
 static wzd_user_t ** _user_array = NULL;
 
+/** \brief Entry of the user name index */
+struct _user_name_node_t {
+  unsigned long hash;
+  uid_t uid;
+  struct _user_name_node_t * next;
+  char name[HARD_USERNAME_LENGTH];
+};
+
+/* name index: buckets (the count is a power of 2), and node of each uid.
+ * Protected by SET_MUTEX_USER.
+ */
+static struct _user_name_node_t ** _user_name_buckets = NULL;
+static unsigned int _user_name_buckets_count = 0;
+static unsigned int _user_name_count = 0;
+static struct _user_name_node_t ** _user_name_nodes = NULL;
+
+/** \brief Double the number of buckets of the name index
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _user_index_grow(void)
+{
+  struct _user_name_node_t ** buckets;
+  struct _user_name_node_t * node, * next;
+  unsigned int count, i, index;
+
+  count = (_user_name_buckets_count) ? _user_name_buckets_count * 2 : HARD_NAME_INDEX_BUCKETS;
+  buckets = wzd_malloc(count * sizeof(struct _user_name_node_t *));
+  memset(buckets, 0, count * sizeof(struct _user_name_node_t *));
+
+  for (i=0; i<_user_name_buckets_count; i++) {
+    for (node = _user_name_buckets[i]; node; node = next) {
+      next = node->next;
+      index = node->hash & (count - 1);
+      node->next = buckets[index];
+      buckets[index] = node;
+    }
+  }
+
+  wzd_free(_user_name_buckets);
+  _user_name_buckets = buckets;
+  _user_name_buckets_count = count;
+}
+
+/** \brief Add \a uid to the name index, using its current name
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _user_index_add(uid_t uid)
+{
+  struct _user_name_node_t * node;
+  unsigned int index;
+
+  if (_user_name_count >= _user_name_buckets_count * 2)
+    _user_index_grow();
+
+  node = wzd_malloc(sizeof(struct _user_name_node_t));
+  wzd_strncpy(node->name, _user_array[uid]->username, sizeof(node->name));
+  node->hash = compute_hashval(node->name, strlen(node->name));
+  node->uid = uid;
+
+  index = node->hash & (_user_name_buckets_count - 1);
+  node->next = _user_name_buckets[index];
+  _user_name_buckets[index] = node;
+  _user_name_nodes[uid] = node;
+  _user_name_count++;
+}
+
+/** \brief Remove \a uid from the name index
+ * \note SET_MUTEX_USER must be locked
+ */
+static void _user_index_remove(uid_t uid)
+{
+  struct _user_name_node_t * node, ** prev;
+
+  node = _user_name_nodes[uid];
+  if (!node) return;
+
+  prev = &_user_name_buckets[node->hash & (_user_name_buckets_count - 1)];
+  while (*prev && *prev != node)
+    prev = &(*prev)->next;
+  if (*prev) *prev = node->next;
+
+  _user_name_nodes[uid] = NULL;
+  _user_name_count--;
+  wzd_free(node);
+}
+
+/** \brief Find uid of user \a name in the name index
+ * \note SET_MUTEX_USER must be locked
+ * \return the uid, or -1
+ */
+static uid_t _user_index_find(const char * name)
+{
+  struct _user_name_node_t * node;
+  unsigned long hash;
+
+  if (_user_name_buckets_count == 0) return (uid_t)-1;
+
+  hash = compute_hashval(name, strlen(name));
+  for (node = _user_name_buckets[hash & (_user_name_buckets_count - 1)]; node; node = node->next) {
+    /* user can have been renamed in place, so we also check the registered name */
+    if (node->hash == hash && strcmp(node->name,name)==0
+        && _user_array[node->uid] != NULL
+        && strcmp(_user_array[node->uid]->username,name)==0)
+      return node->uid;
+  }
+
+  return (uid_t)-1;
+}
+
 
 /** \brief Allocate a new empty structure for a user
  */
@@ -201,15 +311,18 @@ uid_t user_register(wzd_user_t * user, u16_t backend_id)
 
   uid = user->uid;
 
-  if (uid >= _max_uid) {
+  if (_user_array == NULL || uid > _max_uid) {
     size_t size; /* size of extent */
+    size_t first = (_user_array) ? _max_uid + 1 : 0; /* first new slot */
 
     if (uid >= _max_uid + 255)
       size = uid - _max_uid;
     else
       size = 256;
     _user_array = wzd_realloc(_user_array, (_max_uid + size + 1)*sizeof(wzd_user_t*));
-    memset(_user_array + _max_uid, 0, (size+1) * sizeof(wzd_user_t*));
+    memset(_user_array + first, 0, (_max_uid + size + 1 - first) * sizeof(wzd_user_t*));
+    _user_name_nodes = wzd_realloc(_user_name_nodes, (_max_uid + size + 1)*sizeof(struct _user_name_node_t*));
+    memset(_user_name_nodes + first, 0, (_max_uid + size + 1 - first) * sizeof(struct _user_name_node_t*));
     _max_uid = _max_uid + size;
   }
 
@@ -221,6 +334,7 @@ uid_t user_register(wzd_user_t * user, u16_t backend_id)
 
   _user_array[uid] = user;
   user->backend_id = backend_id;
+  _user_index_add(uid);
 
   out_log(LEVEL_FLOOD,"DEBUG registered uid %d with backend %d\n",uid,backend_id);
 
@@ -246,8 +360,11 @@ int user_update(uid_t uid, wzd_user_t * new_user)
     if (_user_array[new_user->uid] != NULL) return -3;
   }
 
-  /* same user ? do nothing */
-  if (uid == new_user->uid && _user_array[uid] == new_user) return 0;
+  /* same user ? only the name may have changed */
+  if (uid == new_user->uid && _user_array[uid] == new_user) {
+    user_reindex(uid);
+    return 0;
+  }
 
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
   /* backup old user */
@@ -256,10 +373,12 @@ int user_update(uid_t uid, wzd_user_t * new_user)
   /* update user */
   *_user_array[uid] = *new_user;
   user_free(buffer);
+  _user_index_remove(uid);
   if (uid != new_user->uid) {
     _user_array[new_user->uid] = _user_array[uid];
     _user_array[uid] = NULL;
   }
+  _user_index_add(new_user->uid);
   WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 
   return 0;
@@ -282,6 +401,7 @@ wzd_user_t * user_unregister(uid_t uid)
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
 
   if (_user_array[uid] != NULL) {
+    _user_index_remove(uid);
     user = _user_array[uid];
     _user_array[uid] = NULL;
   }
@@ -301,11 +421,18 @@ void user_free_registry(void)
   WZD_MUTEX_LOCK(SET_MUTEX_USER);
   if (_user_array != NULL) {
     for (uid=0; uid<=_max_uid; uid++) {
+      _user_index_remove(uid);
       user_free(_user_array[uid]);
     }
   }
   wzd_free(_user_array);
   _user_array = NULL;
+  wzd_free(_user_name_nodes);
+  _user_name_nodes = NULL;
+  wzd_free(_user_name_buckets);
+  _user_name_buckets = NULL;
+  _user_name_buckets_count = 0;
+  _user_name_count = 0;
   _max_uid = 0;
   WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 }
@@ -324,22 +451,36 @@ wzd_user_t * user_get_by_id(uid_t uid)
 
 /** \brief Get registered user using the \a name
  * \return The user, or NULL
- * \todo Re-implement the function using a hash table
  */
 wzd_user_t * user_get_by_name(const char * username)
 {
+  wzd_user_t * user = NULL;
   uid_t uid;
 
-  if (username == NULL || strlen(username)<1 || _max_uid==0) return NULL;
+  if (username == NULL || username[0] == '\0' || _max_uid==0) return NULL;
 
-  /* We don't need to lock the access since the _user_array can only grow */
-  for (uid=0; uid<=_max_uid; uid++) {
-    if (_user_array[uid] != NULL
-        && _user_array[uid]->username != NULL
-        && strcmp(username,_user_array[uid]->username)==0)
-      return _user_array[uid];
+  WZD_MUTEX_LOCK(SET_MUTEX_USER);
+  uid = _user_index_find(username);
+  if (uid != (uid_t)-1)
+    user = _user_array[uid];
+  WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
+
+  return user;
+}
+
+/** \brief Update name index after user \a uid has been modified in place
+ */
+void user_reindex(uid_t uid)
+{
+  if (uid == (uid_t)-1 || uid > _max_uid) return;
+
+  WZD_MUTEX_LOCK(SET_MUTEX_USER);
+  if (_user_array[uid] != NULL &&
+      (_user_name_nodes[uid] == NULL || strcmp(_user_name_nodes[uid]->name,_user_array[uid]->username)!=0)) {
+    _user_index_remove(uid);
+    _user_index_add(uid);
   }
-  return NULL;
+  WZD_MUTEX_UNLOCK(SET_MUTEX_USER);
 }
 
 /** \brief Get list or users register for a specific backend
@@ -601,3 +742,47 @@ int user_flags_change(wzd_user_t * user, wzd_string_t * newflags) {
   /* success */
   return 0;
 }
+
+/* statistics are shared between all connections of a user, and updated
+ * using atomic operations only
+ */
+void user_stats_add_bytes(wzd_user_t * user, int is_upload, u64_t bytes)
+{
+  u64_t credits, new_credits;
+
+  if (!user || bytes == 0) return;
+
+  if (is_upload)
+    WZD_ATOMIC_ADD64(&user->stats.bytes_ul_total, bytes);
+  else
+    WZD_ATOMIC_ADD64(&user->stats.bytes_dl_total, bytes);
+
+  if (!user->ratio) return;
+
+  do {
+    credits = user->credits;
+    if (is_upload) {
+      /* make sure credits aren't incremented above ULLONG_MAX */
+      if (ULLONG_MAX - (user->ratio * bytes) <= credits)
+        new_credits = ULLONG_MAX;
+      else
+        new_credits = credits + (user->ratio * bytes);
+    } else {
+      /* make sure credits aren't decremented below 0 (credits is an unsigned number) */
+      if (credits >= bytes)
+        new_credits = credits - bytes;
+      else
+        new_credits = 0;
+    }
+  } while (!WZD_ATOMIC_CAS64(&user->credits, credits, new_credits));
+}
+
+void user_stats_add_file(wzd_user_t * user, int is_upload)
+{
+  if (!user) return;
+
+  if (is_upload)
+    WZD_ATOMIC_INC(&user->stats.files_ul_total);
+  else
+    WZD_ATOMIC_INC(&user->stats.files_dl_total);
+}
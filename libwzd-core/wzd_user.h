@@ -106,6 +106,13 @@ wzd_user_t * user_get_by_id(uid_t uid);
  */
 wzd_user_t * user_get_by_name(const char * username);
 
+/** \brief Update name index after user \a uid has been modified in place
+ *
+ * This must be called if the name of a registered user is changed without
+ * using user_update(). backend_mod_user() does it.
+ */
+void user_reindex(uid_t uid);
+
 /** \brief Get list or users register for a specific backend
  * The returned list is terminated by -1, and must be freed with wzd_free()
  */
@@ -173,4 +180,16 @@ void user_flags_clear(wzd_user_t * user);
  */
 int user_flags_change(wzd_user_t * user, wzd_string_t * newflags);
 
+/** \brief Account \a bytes transferred by \a user in statistics and credits
+ *
+ * Counters are updated atomically, since the same user can be transferring
+ * from several connections. Changes are not sent to the backend, see
+ * backend_mod_user_deferred().
+ */
+void user_stats_add_bytes(wzd_user_t * user, int is_upload, u64_t bytes);
+
+/** \brief Increment the number of files uploaded or downloaded by \a user
+ */
+void user_stats_add_file(wzd_user_t * user, int is_upload);
+
 #endif /* __WZD_USER_H__ */
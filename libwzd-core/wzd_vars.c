@@ -57,6 +57,7 @@
 #include "wzd_vars.h"
 #include "wzd_log.h"
 #include "wzd_mutex.h"
+#include "wzd_pasv.h"
 #include "wzd_user.h"
 
 
@@ -113,6 +114,15 @@ int vars_get(const char *varname, char *data, size_t datalength, wzd_config_t *
     snprintf(data,datalength,"%u",config->pasv_high_range);
     return 0;
   }
+  if (strcasecmp(varname,"pasv_stats")==0) {
+    wzd_pasv_stats_t stats;
+
+    pasv_get_stats(&stats);
+    snprintf(data,datalength,"in use: %lu, acquired: %lu, exhausted: %lu, bind failures: %lu, pool: %lu (hits: %lu)",
+        stats.ports_in_use, stats.acquired, stats.exhausted, stats.bind_failures,
+        stats.pool_size, stats.pool_hits);
+    return 0;
+  }
   if (strcmp(varname,"port")==0) {
     const char * str;
 
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include <sys/types.h>
@@ -50,6 +51,7 @@
 #include "wzd_structs.h"
 
 #include "wzd_vfs.h"
+#include "wzd_atomic.h"
 #include "wzd_dir.h"
 #include "wzd_file.h"
 #include "wzd_fs.h"
@@ -83,6 +85,7 @@ int vfs_remove( wzd_vfs_t **vfs_list, const char *vpath )
         wzd_free (current_vfs);
         previous_vfs->next_vfs = next_vfs;
       }
+      checkpath_cache_invalidate();
       return 0;
     }
 
@@ -119,6 +122,7 @@ int vfs_free(wzd_vfs_t **vfs_list)
   }
 
   *vfs_list = NULL;
+  checkpath_cache_invalidate();
   return 0;
 }
 
@@ -158,6 +162,8 @@ int vfs_add_restricted(wzd_vfs_t ** vfs_list, const char *vpath, const char *pat
   new_vfs->next_vfs = NULL;
   new_vfs->prev_vfs = NULL;
 
+  checkpath_cache_invalidate();
+
   current_vfs = *vfs_list;
 
   if (!current_vfs) {
@@ -284,8 +290,8 @@ out_err(LEVEL_HIGH,"converted to %s\n",buf);
 
 /** parse vfs entry and replace cookies by their value
  * \return a newly allocated string with the interpreted path
- * \todo TODO it would REALLY be nice to use the function defined in
- *  wzd_cookie_lex.l ... problem: it automatically prints the result !
+ * \todo TODO it would REALLY be nice to use the templates defined in
+ *  wzd_cookie.c, which can now render into a buffer
  */
 char * vfs_replace_cookies(const char * path, wzd_context_t * context)
 {
@@ -535,6 +541,77 @@ int path_abs2rel(const char *abs, char *rel, int rel_len, wzd_context_t *context
   return 0;
 }
 
+/** \brief Path resolution cache entry */
+struct wzd_checkpath_entry_t {
+  unsigned long hash;
+  char * ftppath;		/**< absolute, simplified FTP path */
+  char * syspath;		/**< result, or NULL if nothing was written */
+  int ret;
+  unsigned long generation;
+  time_t expires;
+};
+
+/** \brief Path resolution cache, one per client */
+struct wzd_checkpath_cache_t {
+  u32_t userid;
+  char * rootpath;
+  unsigned int next;		/**< next slot to replace */
+  struct wzd_checkpath_entry_t entries[HARD_CHECKPATH_CACHE_SIZE];
+};
+
+/* incremented each time a file, directory, permission or vfs is changed */
+static volatile unsigned long _checkpath_generation = 0;
+
+static int _checkpath_resolve(const char *wanted_path, char *path, wzd_context_t *context);
+
+/** \brief Invalidate path resolution caches of all clients
+ *
+ * Must be called after each change which can modify the result of
+ * checkpath_new(): files or directories created, removed or renamed,
+ * permissions or vfs changed.
+ */
+void checkpath_cache_invalidate(void)
+{
+  WZD_ATOMIC_INC(&_checkpath_generation);
+}
+
+/** \brief Free path resolution cache of \a context */
+void checkpath_cache_free(wzd_context_t * context)
+{
+  struct wzd_checkpath_cache_t * cache;
+  unsigned int i;
+
+  if (!context || !context->path_cache) return;
+  cache = context->path_cache;
+
+  for (i=0; i<HARD_CHECKPATH_CACHE_SIZE; i++) {
+    wzd_free(cache->entries[i].ftppath);
+    wzd_free(cache->entries[i].syspath);
+  }
+  wzd_free(cache->rootpath);
+  wzd_free(cache);
+  context->path_cache = NULL;
+}
+
+/** \brief Get cache of \a context, flushing it if it was created for another user */
+static struct wzd_checkpath_cache_t * _checkpath_cache_get(wzd_context_t * context, wzd_user_t * user)
+{
+  struct wzd_checkpath_cache_t * cache = context->path_cache;
+
+  if (cache && (cache->userid != context->userid || strcmp(cache->rootpath,user->rootpath)!=0))
+    checkpath_cache_free(context);
+
+  if (!context->path_cache) {
+    cache = wzd_malloc(sizeof(struct wzd_checkpath_cache_t));
+    memset(cache,0,sizeof(struct wzd_checkpath_cache_t));
+    cache->userid = context->userid;
+    cache->rootpath = wzd_strdup(user->rootpath);
+    context->path_cache = cache;
+  }
+
+  return context->path_cache;
+}
+
 /** converts wanted_path (in ftp-style) to path (system path), checking
  * for errors and permissions
  *
@@ -544,8 +621,83 @@ int path_abs2rel(const char *abs, char *rel, int rel_len, wzd_context_t *context
  *
  * If the return is 0, then we are SURE the result exists.
  * If the real path points to a directory, then the result is / terminated
+ *
+ * Results are kept in a small per-client cache, invalidated by
+ * checkpath_cache_invalidate() or after HARD_CHECKPATH_CACHE_TTL seconds
+ * (for changes made outside of the server).
  */
 int checkpath_new(const char *wanted_path, char *path, wzd_context_t *context)
+{
+  char ftppath[WZD_MAX_PATH+1];
+  struct wzd_checkpath_cache_t * cache;
+  struct wzd_checkpath_entry_t * entry;
+  wzd_user_t * user;
+  unsigned long hash, generation;
+  unsigned int i;
+  time_t now;
+  int ret;
+
+  WZD_ASSERT(context != NULL);
+  if (context == NULL) return E_USER_IDONTEXIST;
+
+  /* relative paths are converted, and resolved using this function again */
+  if (!wanted_path || wanted_path[0] != '/')
+    return _checkpath_resolve(wanted_path, path, context);
+
+  user = GetUserByID(context->userid);
+  if (!user) return E_USER_IDONTEXIST;
+  if (strlen(user->rootpath) + strlen(wanted_path) >= WZD_MAX_PATH) return E_PARAM_BIG;
+
+#ifdef WIN32
+  if (strchr(user->flags,FLAG_FULLPATH) )
+    return _checkpath_resolve(wanted_path, path, context);
+#endif
+
+  wzd_strncpy(ftppath, wanted_path, WZD_MAX_PATH);
+  path_simplify(ftppath);
+  hash = compute_hashval(ftppath, strlen(ftppath));
+
+  cache = _checkpath_cache_get(context, user);
+  generation = _checkpath_generation;
+  now = time(NULL);
+
+  for (i=0; i<HARD_CHECKPATH_CACHE_SIZE; i++) {
+    entry = &cache->entries[i];
+    if (entry->ftppath && entry->hash == hash && strcmp(entry->ftppath,ftppath)==0) {
+      if (entry->generation == generation && entry->expires > now) {
+        if (entry->syspath) wzd_strncpy(path, entry->syspath, WZD_MAX_PATH);
+        return entry->ret;
+      }
+      break;
+    }
+  }
+
+  ret = _checkpath_resolve(ftppath, path, context);
+
+  /* only keep results which are not related to a temporary problem */
+  if (ret != 0 && ret != E_FILE_NOEXIST && ret != E_WRONGPATH && ret != E_NOPERM)
+    return ret;
+
+  if (i == HARD_CHECKPATH_CACHE_SIZE) { /* not found, take next slot */
+    entry = &cache->entries[cache->next];
+    cache->next = (cache->next + 1) % HARD_CHECKPATH_CACHE_SIZE;
+  }
+  wzd_free(entry->ftppath);
+  wzd_free(entry->syspath);
+  entry->hash = hash;
+  entry->ftppath = wzd_strdup(ftppath);
+  entry->syspath = (ret == 0 || ret == E_FILE_NOEXIST) ? wzd_strdup(path) : NULL;
+  entry->ret = ret;
+  entry->generation = generation;
+  entry->expires = now + HARD_CHECKPATH_CACHE_TTL;
+
+  return ret;
+}
+
+/** \brief Resolve \a wanted_path, without using the cache
+ * \see checkpath_new
+ */
+static int _checkpath_resolve(const char *wanted_path, char *path, wzd_context_t *context)
 {
   int ret;
   char * ftppath, *syspath, *ptr, *lpart, *rpart;
@@ -553,7 +705,8 @@ int checkpath_new(const char *wanted_path, char *path, wzd_context_t *context)
   wzd_user_t * user;
   unsigned int sys_offset;
   fs_filestat_t s;
-  struct wzd_file_t * perm_list, * entry;
+  struct wzd_permfile_t * permfile;
+  struct wzd_file_t * entry;
   fs_dir_t * dir;
 
   WZD_ASSERT(context != NULL);
@@ -666,33 +819,29 @@ int checkpath_new(const char *wanted_path, char *path, wzd_context_t *context)
 
       /* read permission file for parent */
       strcpy(syspath+sys_offset, HARD_PERMFILE);
-      perm_list = NULL;
-      ret = readPermFile(syspath, &perm_list);
+      permfile = permfile_acquire(syspath);
       syspath[sys_offset] = '\0';
 
       ret = 1;
       /* check for symlink */
-      for (entry=perm_list; entry; entry = entry->next_file)
+      entry = permfile_find_file(permfile,lpart);
+      if (entry && entry->kind == FILE_LNK)
       {
-        if (entry->kind == FILE_LNK && strcmp(lpart,entry->filename) == 0)
-        {
-          /* bingo, symlink */
-          /* we overwrite syspath ! */
-          if ( ((char*)entry->data)[0] == '/'
+        /* bingo, symlink */
+        /* we overwrite syspath ! */
+        if ( ((char*)entry->data)[0] == '/'
 #ifdef WIN32
-            || ((char*)entry->data)[1] == ':'
+          || ((char*)entry->data)[1] == ':'
 #endif
-            )
-          { /* symlink target is absolute */
-            strncpy(syspath, (char*)entry->data, WZD_MAX_PATH);
-            sys_offset = strlen(syspath);
-            ret = 0;
-            break;
-          }
+          )
+        { /* symlink target is absolute */
+          strncpy(syspath, (char*)entry->data, WZD_MAX_PATH);
+          sys_offset = strlen(syspath);
+          ret = 0;
         }
       }
 
-      free_file_recursive(perm_list);
+      permfile_release(permfile);
 
       if (ret) { /* not a symlink, check for VFS */
         /* XXX add vfs entries */
@@ -28,6 +28,15 @@
 char *stripdir(const char * dir, char *buf, int maxlen);
 int checkpath(const char *wanted_path, char *path, wzd_context_t *context);
 int checkpath_new(const char *wanted_path, char *path, wzd_context_t *context);
+
+/** \brief Invalidate path resolution caches of all clients
+ *
+ * Call it after files, directories, permissions or vfs have been changed.
+ */
+void checkpath_cache_invalidate(void);
+
+/** \brief Free path resolution cache of \a context */
+void checkpath_cache_free(wzd_context_t * context);
 int test_path(const char *trial_path, wzd_context_t *context);
 
 int path_abs2rel(const char *abs, char *rel, int rel_len, wzd_context_t *context);
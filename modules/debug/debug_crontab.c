@@ -41,8 +41,6 @@
 
 #include "debug_crontab.h"
 
-static int _cron_find_and_execute(const char * jobname, wzd_cronjob_t * crontab);
-
 int do_site_listcrontab(UNUSED wzd_string_t *name,
         UNUSED wzd_string_t *param,
         wzd_context_t * context)
@@ -53,7 +51,7 @@ int do_site_listcrontab(UNUSED wzd_string_t *name,
   time_t now;
 
   send_message_raw("200-\r\n",context);
-  send_message_raw(" Name                              Min  Hour Day  Mon  DayOfWeek Next\r\n",context);
+  send_message_raw(" Name                              Min  Hour Day  Mon  DayOfWeek Next  Runs  Skip  Avg(ms) Max(ms)\r\n",context);
 
   WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
   cronjob = getlib_mainConfig()->crontab;
@@ -62,9 +60,12 @@ int do_site_listcrontab(UNUSED wzd_string_t *name,
 
   while (cronjob != NULL) {
 
-    snprintf(buffer,sizeof(buffer)," %-33s %-4s %-4s %-4s %-4s %-9s %-5ld\r\n",cronjob->hook->external_command,
+    snprintf(buffer,sizeof(buffer)," %-33s %-4s %-4s %-4s %-4s %-9s %-5ld %-5lu %-5lu %-7lu %-7lu\r\n",cronjob->hook->external_command,
         cronjob->minutes, cronjob->hours, cronjob->day_of_month, cronjob->month,
-        cronjob->day_of_week, (long)(cronjob->next_run - now));
+        cronjob->day_of_week, (long)(cronjob->next_run - now),
+        cronjob->runs, cronjob->skipped,
+        (cronjob->runs) ? cronjob->total_duration / cronjob->runs : 0,
+        cronjob->max_duration);
     ret = send_message_raw(buffer,context);
 
     cronjob = cronjob->next_cronjob;
@@ -97,7 +98,7 @@ int do_site_cronjob(UNUSED wzd_string_t *name,
     if (jobname) {
       send_message_raw("200-\r\n",context);
 
-      status = _cron_find_and_execute(str_tochar(jobname),getlib_mainConfig()->crontab);
+      status = cronjob_run_now(&getlib_mainConfig()->crontab,str_tochar(jobname));
 
       snprintf(buffer,sizeof(buffer)-1," cron job: %s\r\n",str_tochar(jobname));
       ret = send_message_raw(buffer,context);
@@ -107,7 +108,7 @@ int do_site_cronjob(UNUSED wzd_string_t *name,
       else if (status == -1)
         ret = send_message_raw("200 command failed (no cron job with this name)\r\n",context);
       else
-        ret = send_message_raw("200 command ok (with errors)\r\n",context);
+        ret = send_message_raw("200 command failed (cron job is already running)\r\n",context);
       ret = 0;
     } else {
       ret = send_message_with_args(501,context,"site cronjob exec jobname");
@@ -123,39 +124,3 @@ int do_site_cronjob(UNUSED wzd_string_t *name,
 
   return ret;
 }
-
-
-
-static int _cron_find_and_execute(const char * jobname, wzd_cronjob_t * crontab)
-{
-  int status = -1;
-  wzd_cronjob_t *job;
-  time_t now;
-
-  job = malloc(sizeof(wzd_cronjob_t));
-
-  WZD_MUTEX_LOCK(SET_MUTEX_CRONTAB);
-  while (crontab != NULL) {
-    if (crontab->hook && crontab->hook->external_command &&
-        strcmp(crontab->hook->external_command,jobname)==0) {
-      memcpy(job, crontab, sizeof(wzd_cronjob_t));
-      time(&now);
-      job->next_run = now;
-      job->next_cronjob = NULL;
-      status = 0;
-      break;
-    }
-    crontab = crontab->next_cronjob;
-  }
-
-  WZD_MUTEX_UNLOCK(SET_MUTEX_CRONTAB);
-
-  if (status == 0) {
-    cronjob_run(&job);
-  }
-
-  free(job);
-
-  return status;
-}
-
@@ -24,12 +24,40 @@
  * the source code for OpenSSL in the source distribution.
  */
 
+/*
+ * One connection to the database is kept while the module is loaded, in
+ * WAL mode, with prepared statements for the queries run on each upload.
+ *
+ * A Bloom filter of all known filenames is built when the module is
+ * loaded: if a filename is not in the filter, it is not in the database,
+ * and the upload is allowed without any query. Deleted entries stay in
+ * the filter, and only cause a query.
+ *
+ * New entries are inserted in batches, in one transaction: they are kept
+ * in memory until batch_size entries are waiting, DUPELOG_BATCH_DELAY
+ * seconds have passed, or another query needs the table. A thread sleeps
+ * until the oldest entry has waited DUPELOG_BATCH_DELAY seconds (and does
+ * not wake up while no entry is waiting), so entries are inserted even if
+ * no other upload follows. If the transaction fails, entries are kept and
+ * inserted with the next batch.
+ */
+
 #include "dupelog.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sqlite3.h>
 
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_log.h>
 #include <libwzd-core/wzd_misc.h>
@@ -39,38 +67,496 @@
 #include <libwzd-core/wzd_configfile.h>
 #include <libwzd-core/wzd_file.h>
 #include <libwzd-core/wzd_messages.h>
-
-/* These two are defined further down. */
+#include <libwzd-core/wzd_mutex.h>
+#include <libwzd-core/wzd_threads.h>
+
+/* default number of entries inserted in one transaction */
+#define DUPELOG_BATCH_SIZE	32
+/* maximum time (in seconds) an entry waits before being inserted */
+#define DUPELOG_BATCH_DELAY	2
+/* maximum number of entries kept in memory while they can not be inserted */
+#define DUPELOG_PENDING_MAX	4096
+
+/* minimum number of entries of the Bloom filter, and number of bits
+ * per entry (with 6 hash functions, ~3% of false positives when full)
+ */
+#define DUPELOG_BLOOM_MIN	65536
+#define DUPELOG_BLOOM_BITS	16
+#define DUPELOG_BLOOM_HASHES	6
+
+struct dupelog_pending_t {
+  char * filename;
+  char * path;
+  time_t added_at;
+};
+
+/* everything below is protected by _dupelog_mutex */
+static wzd_mutex_t * _dupelog_mutex = NULL;
+static sqlite3 * _dupelog_db = NULL;
+static sqlite3_stmt * _stmt_select = NULL;
+static sqlite3_stmt * _stmt_insert = NULL;
+static sqlite3_stmt * _stmt_delete = NULL;
+
+static unsigned char * _bloom = NULL;
+static unsigned long _bloom_mask = 0;		/* number of bits - 1 */
+static unsigned long _bloom_capacity = 0;
+static unsigned long _bloom_count = 0;
+
+static struct dupelog_pending_t * _pending = NULL;
+static unsigned int _pending_count = 0;
+static unsigned int _pending_alloc = 0;
+static unsigned int _batch_size = DUPELOG_BATCH_SIZE;
+
+/* inserts entries which have waited DUPELOG_BATCH_DELAY seconds */
+static wzd_thread_t _flush_thread;
+static volatile int _flush_thread_running = 0;
+
+#ifdef HAVE_PTHREAD
+/* wakes up the flush thread, _flush_deadline is 0 while no entry is waiting */
+static pthread_mutex_t _flush_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _flush_wait_cond = PTHREAD_COND_INITIALIZER;
+static time_t _flush_deadline = 0;
+#endif
+
+/* These are defined further down. */
 static int check_table_created(sqlite3 *db);
-static sqlite3 *opendb();
+static sqlite3 *opendb(void);
+static int _dupelog_flush(void);
+static void * _dupelog_flush_thread(void * arg);
+static void _dupelog_flush_arm(void);
+static int _bloom_build(unsigned long entries);
 
-int dupelog_is_upload_allowed(const char *filename)
+int dupelog_init(void)
+{
+  wzd_configfile_t * file = getlib_mainConfig()->cfg_file;
+  int err;
+  long l;
+
+  if (_dupelog_db) return 0;
+
+  if (!_dupelog_mutex)
+    _dupelog_mutex = wzd_mutex_create(0);
+
+  l = config_get_integer(file, "dupecheck", "batch_size", &err);
+  if (err == CF_OK && l > 0)
+    _batch_size = (unsigned int)l;
+  _pending = malloc(_batch_size * sizeof(struct dupelog_pending_t));
+  _pending_count = 0;
+  _pending_alloc = (_pending) ? _batch_size : 0;
+
+  _dupelog_db = opendb();
+  if (!_dupelog_db)
+    return -1;
+
+  if (sqlite3_prepare_v2(_dupelog_db, "SELECT added_at FROM dupelog WHERE filename = ?", -1, &_stmt_select, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(_dupelog_db, "INSERT INTO dupelog (filename, path, added_at) VALUES (?, ?, ?)", -1, &_stmt_insert, NULL) != SQLITE_OK ||
+      sqlite3_prepare_v2(_dupelog_db, "DELETE FROM dupelog WHERE filename = ?", -1, &_stmt_delete, NULL) != SQLITE_OK)
+  {
+    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare queries: %s\n", sqlite3_errmsg(_dupelog_db));
+    dupelog_fini();
+    return -1;
+  }
+
+  if (_bloom_build(0) != 0)
+    out_log(LEVEL_HIGH, "Dupecheck: Could not build filter, all uploads will be checked in database\n");
+
+  _flush_thread_running = 1;
+  if (wzd_thread_create(&_flush_thread, NULL, _dupelog_flush_thread, NULL) != 0)
+  {
+    _flush_thread_running = 0;
+    out_log(LEVEL_HIGH, "Dupecheck: Could not start flush thread, entries will be inserted on next upload\n");
+  }
+
+  return 0;
+}
+
+void dupelog_fini(void)
+{
+  unsigned int i;
+
+  if (_flush_thread_running)
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&_flush_wait_mutex);
+    _flush_thread_running = 0;
+    pthread_cond_signal(&_flush_wait_cond);
+    pthread_mutex_unlock(&_flush_wait_mutex);
+#else
+    _flush_thread_running = 0;
+#endif
+    wzd_thread_join(&_flush_thread, NULL);
+  }
+
+  if (_dupelog_mutex) wzd_mutex_lock(_dupelog_mutex);
+
+  if (_dupelog_db)
+    _dupelog_flush();
+  if (_pending_count > 0)
+    out_err(LEVEL_HIGH, "Dupecheck: %u entries could not be inserted and are lost\n", _pending_count);
+  for (i=0; i<_pending_count; i++) {
+    free(_pending[i].filename);
+    free(_pending[i].path);
+  }
+  free(_pending);
+  _pending = NULL;
+  _pending_count = _pending_alloc = 0;
+
+  sqlite3_finalize(_stmt_select);
+  sqlite3_finalize(_stmt_insert);
+  sqlite3_finalize(_stmt_delete);
+  _stmt_select = _stmt_insert = _stmt_delete = NULL;
+  if (_dupelog_db)
+    sqlite3_close(_dupelog_db);
+  _dupelog_db = NULL;
+
+  free(_bloom);
+  _bloom = NULL;
+  _bloom_mask = _bloom_capacity = _bloom_count = 0;
+
+  if (_dupelog_mutex) {
+    wzd_mutex_unlock(_dupelog_mutex);
+    wzd_mutex_destroy(_dupelog_mutex);
+    _dupelog_mutex = NULL;
+  }
+}
+
+/** \brief Compute the two hashes used to derive the positions of \a filename */
+static void _bloom_hash(const char *filename, unsigned long *h1, unsigned long *h2)
+{
+  /* 64 bits FNV-1a */
+  unsigned long long h = 14695981039346656037ULL;
+  const unsigned char *p;
+
+  for (p = (const unsigned char*)filename; *p; p++) {
+    h ^= *p;
+    h *= 1099511628211ULL;
+  }
+  *h1 = (unsigned long)(h & 0xffffffff);
+  *h2 = (unsigned long)(h >> 32) | 1;
+}
+
+static void _bloom_add(const char *filename)
+{
+  unsigned long h1, h2, bit;
+  int i;
+
+  if (!_bloom) return;
+
+  _bloom_hash(filename, &h1, &h2);
+  for (i=0; i<DUPELOG_BLOOM_HASHES; i++) {
+    bit = (h1 + i * h2) & _bloom_mask;
+    _bloom[bit >> 3] |= (1 << (bit & 7));
+  }
+  _bloom_count++;
+}
+
+/** \return 0 if \a filename is not in database, 1 if it may be */
+static int _bloom_check(const char *filename)
+{
+  unsigned long h1, h2, bit;
+  int i;
+
+  if (!_bloom) return 1;
+
+  _bloom_hash(filename, &h1, &h2);
+  for (i=0; i<DUPELOG_BLOOM_HASHES; i++) {
+    bit = (h1 + i * h2) & _bloom_mask;
+    if (!(_bloom[bit >> 3] & (1 << (bit & 7))))
+      return 0;
+  }
+  return 1;
+}
+
+/** \brief (Re)build filter from database, with room for twice the number
+ * of entries (or \a entries, if larger)
+ *
+ * Must be called with _dupelog_mutex locked, or during init.
+ */
+static int _bloom_build(unsigned long entries)
 {
   sqlite3_stmt *stmt;
-  sqlite3 *db;
+  unsigned long rows = 0, capacity, bits;
+  int retval;
+
+  free(_bloom);
+  _bloom = NULL;
+  _bloom_count = 0;
+
+  if (sqlite3_prepare_v2(_dupelog_db, "SELECT count(*) FROM dupelog", -1, &stmt, NULL) != SQLITE_OK)
+    return -1;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    rows = (unsigned long)sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  capacity = 2 * rows;
+  if (capacity < entries) capacity = entries;
+  if (capacity < DUPELOG_BLOOM_MIN) capacity = DUPELOG_BLOOM_MIN;
+  for (bits = 8; bits < capacity * DUPELOG_BLOOM_BITS; bits <<= 1)
+    ;
+
+  _bloom = calloc(bits / 8, 1);
+  if (!_bloom)
+    return -1;
+  _bloom_mask = bits - 1;
+  _bloom_capacity = capacity;
+
+  if (sqlite3_prepare_v2(_dupelog_db, "SELECT filename FROM dupelog", -1, &stmt, NULL) != SQLITE_OK)
+  {
+    free(_bloom);
+    _bloom = NULL;
+    return -1;
+  }
+  while ((retval = sqlite3_step(stmt)) == SQLITE_ROW)
+    _bloom_add((const char*)sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+
+  if (retval != SQLITE_DONE)
+  {
+    free(_bloom);
+    _bloom = NULL;
+    return -1;
+  }
+
+  out_log(LEVEL_INFO, "Dupecheck: Filter built with %lu entries (%lu bits)\n", _bloom_count, bits);
+  return 0;
+}
+
+/** \brief Insert pending entries in one transaction
+ *
+ * If the transaction fails, entries are kept for the next call.
+ * Must be called with _dupelog_mutex locked.
+ */
+static int _dupelog_flush(void)
+{
+  unsigned int i;
+  int ret;
+
+  if (_pending_count == 0)
+    return 0;
+
+  if (sqlite3_exec(_dupelog_db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+  {
+    out_err(LEVEL_HIGH, "Dupecheck: Could not start transaction, %u entries kept: %s\n", _pending_count, sqlite3_errmsg(_dupelog_db));
+    return -1;
+  }
+  for (i=0; i<_pending_count; i++) {
+    sqlite3_bind_text(_stmt_insert, 1, _pending[i].filename, -1, SQLITE_STATIC);
+    sqlite3_bind_text(_stmt_insert, 2, _pending[i].path, -1, SQLITE_STATIC);
+    sqlite3_bind_int(_stmt_insert, 3, _pending[i].added_at);
+    ret = sqlite3_step(_stmt_insert);
+    sqlite3_reset(_stmt_insert);
+    sqlite3_clear_bindings(_stmt_insert);
+    if (ret == SQLITE_CONSTRAINT) {
+      /* this entry can never be inserted, only skip it */
+      out_err(LEVEL_HIGH, "Dupecheck: Could not insert '%s': %s\n", _pending[i].filename, sqlite3_errmsg(_dupelog_db));
+      continue;
+    }
+    if (ret != SQLITE_DONE)
+      break;
+  }
+  if (i < _pending_count || sqlite3_exec(_dupelog_db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+  {
+    out_err(LEVEL_HIGH, "Dupecheck: Could not insert entries, %u entries kept: %s\n", _pending_count, sqlite3_errmsg(_dupelog_db));
+    sqlite3_exec(_dupelog_db, "ROLLBACK", NULL, NULL, NULL);
+    return -1;
+  }
+
+  for (i=0; i<_pending_count; i++) {
+    free(_pending[i].filename);
+    free(_pending[i].path);
+  }
+  _pending_count = 0;
+
+  return 0;
+}
+
+/** \brief Set the date the flush thread must wake up at, from the oldest
+ * pending entry
+ *
+ * If entries could not be inserted, the next try is DUPELOG_BATCH_DELAY
+ * seconds later.
+ * Must be called with _dupelog_mutex locked.
+ */
+static void _dupelog_flush_arm(void)
+{
+#ifdef HAVE_PTHREAD
+  time_t now, deadline;
+
+  if (_pending_count == 0)
+    return;
+
+  now = time(NULL);
+  deadline = _pending[0].added_at + DUPELOG_BATCH_DELAY;
+  if (deadline <= now)
+    deadline = now + DUPELOG_BATCH_DELAY;
+
+  pthread_mutex_lock(&_flush_wait_mutex);
+  if (_flush_deadline == 0 || deadline < _flush_deadline) {
+    _flush_deadline = deadline;
+    pthread_cond_signal(&_flush_wait_cond);
+  }
+  pthread_mutex_unlock(&_flush_wait_mutex);
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+/** \brief Insert entries which have waited DUPELOG_BATCH_DELAY seconds,
+ * until dupelog_fini() is called
+ *
+ * Sleeps until _flush_deadline, or forever if no entry is waiting.
+ */
+static void * _dupelog_flush_thread(UNUSED void * arg)
+{
+  struct timespec ts;
+
+  pthread_mutex_lock(&_flush_wait_mutex);
+  while (_flush_thread_running)
+  {
+    if (_flush_deadline == 0) {
+      pthread_cond_wait(&_flush_wait_cond, &_flush_wait_mutex);
+      continue;
+    }
+    if (time(NULL) < _flush_deadline) {
+      ts.tv_sec = _flush_deadline;
+      ts.tv_nsec = 0;
+      pthread_cond_timedwait(&_flush_wait_cond, &_flush_wait_mutex, &ts);
+      continue;
+    }
+    _flush_deadline = 0;
+    pthread_mutex_unlock(&_flush_wait_mutex);
+
+    /* _dupelog_mutex is always locked before _flush_wait_mutex */
+    wzd_mutex_lock(_dupelog_mutex);
+    if (_pending_count > 0 && time(NULL) - _pending[0].added_at >= DUPELOG_BATCH_DELAY)
+      _dupelog_flush();
+    _dupelog_flush_arm();
+    wzd_mutex_unlock(_dupelog_mutex);
+
+    pthread_mutex_lock(&_flush_wait_mutex);
+  }
+  pthread_mutex_unlock(&_flush_wait_mutex);
+
+  return NULL;
+}
+#else /* HAVE_PTHREAD */
+/** \brief Insert entries which have waited DUPELOG_BATCH_DELAY seconds,
+ * until dupelog_fini() is called
+ */
+static void * _dupelog_flush_thread(UNUSED void * arg)
+{
+  unsigned int ticks = 0;
+
+  while (_flush_thread_running)
+  {
+    /* sleep by steps, so dupelog_fini() does not wait too long */
+#ifndef WIN32
+    usleep(250000);
+#else
+    Sleep(250);
+#endif
+    if (++ticks < 4)
+      continue;
+    ticks = 0;
+
+    wzd_mutex_lock(_dupelog_mutex);
+    if (_pending_count > 0 && time(NULL) - _pending[0].added_at >= DUPELOG_BATCH_DELAY)
+      _dupelog_flush();
+    wzd_mutex_unlock(_dupelog_mutex);
+  }
+
+  return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/** \brief Make room for one more pending entry
+ *
+ * The array only grows when entries could not be inserted.
+ * \return 0 if ok
+ */
+static int _dupelog_pending_grow(void)
+{
+  struct dupelog_pending_t * pending;
+  unsigned int alloc;
+
+  if (_pending_count < _pending_alloc)
+    return 0;
+  if (_pending_alloc >= DUPELOG_PENDING_MAX)
+    return -1;
+
+  alloc = (_pending_alloc > 0) ? 2 * _pending_alloc : _batch_size;
+  if (alloc > DUPELOG_PENDING_MAX)
+    alloc = DUPELOG_PENDING_MAX;
+  pending = realloc(_pending, alloc * sizeof(struct dupelog_pending_t));
+  if (!pending)
+    return -1;
+  _pending = pending;
+  _pending_alloc = alloc;
+
+  return 0;
+}
+
+/** \brief Forget pending entry \a filename, if any
+ *
+ * Following entries are moved down, so _pending[0] stays the oldest one.
+ */
+static void _dupelog_remove_pending(const char *filename)
+{
+  unsigned int i;
+
+  for (i=0; i<_pending_count; i++)
+    if (strcmp(_pending[i].filename, filename) == 0)
+    {
+      free(_pending[i].filename);
+      free(_pending[i].path);
+      _pending_count--;
+      memmove(&_pending[i], &_pending[i+1], (_pending_count - i) * sizeof(struct dupelog_pending_t));
+      return;
+    }
+}
+
+/** \brief Check if \a filename is waiting to be inserted */
+static int _dupelog_is_pending(const char *filename)
+{
+  unsigned int i;
+
+  for (i=0; i<_pending_count; i++)
+    if (strcmp(_pending[i].filename, filename) == 0)
+      return 1;
+  return 0;
+}
+
+int dupelog_is_upload_allowed(const char *filename)
+{
   int retval;
 
   out_log(LEVEL_INFO, "Dupecheck: Checking '%s'\n", filename);
-  db = opendb();
 
-  if (!db)
+  if (!_dupelog_db)
     return EVENT_OK;
 
-  const char *selectQuery = "SELECT added_at FROM dupelog WHERE filename = ?";
-  if (sqlite3_prepare(db, selectQuery, -1, &stmt, NULL) != SQLITE_OK)
+  wzd_mutex_lock(_dupelog_mutex);
+
+  /* common case: file is not known, the database is not used */
+  if (!_bloom_check(filename))
   {
-    if (stmt)
-      sqlite3_finalize(stmt);
-    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare select query for '%s': %s\n", filename, sqlite3_errmsg(db));
-    sqlite3_close(db);
+    wzd_mutex_unlock(_dupelog_mutex);
+    out_log(LEVEL_INFO, "Dupecheck: Allowing file, not found in dupelog! :)\n");
     return EVENT_OK;
   }
 
-  sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
-  retval = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  if (_dupelog_is_pending(filename))
+  {
+    retval = SQLITE_ROW;
+  }
+  else
+  {
+    sqlite3_bind_text(_stmt_select, 1, filename, -1, SQLITE_TRANSIENT);
+    retval = sqlite3_step(_stmt_select);
+    sqlite3_reset(_stmt_select);
+    sqlite3_clear_bindings(_stmt_select);
+  }
 
-  sqlite3_close(db);
+  wzd_mutex_unlock(_dupelog_mutex);
 
   if (retval == SQLITE_ROW)
   {
@@ -86,63 +572,75 @@ int dupelog_is_upload_allowed(const char *filename)
 
 int dupelog_add_entry(const char *path, const char *filename)
 {
-  sqlite3_stmt *stmt;
-  sqlite3 *db;
+  time_t now = time(NULL);
 
   out_log(LEVEL_INFO, "Dupecheck: Adding '%s'\n", filename);
-  db = opendb();
 
-  if (!db)
+  if (!_dupelog_db || !_pending)
     return EVENT_OK;
 
-  const char *insertQuery = "INSERT INTO dupelog (filename, path, added_at) VALUES (?, ?, ?)";
-  if (sqlite3_prepare(db, insertQuery, -1, &stmt, NULL) != SQLITE_OK)
+  wzd_mutex_lock(_dupelog_mutex);
+
+  /* insert previous entries if they have waited too long */
+  if (_pending_count > 0 && now - _pending[0].added_at >= DUPELOG_BATCH_DELAY)
+    _dupelog_flush();
+
+  if (_dupelog_pending_grow() != 0)
   {
-    if (stmt)
-      sqlite3_finalize(stmt);
-    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare insert query for '%s': %s\n", filename, sqlite3_errmsg(db));
-    sqlite3_close(db);
+    wzd_mutex_unlock(_dupelog_mutex);
+    out_err(LEVEL_HIGH, "Dupecheck: Too many entries waiting, '%s' not added\n", filename);
     return EVENT_OK;
   }
 
-  sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt, 2, path, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int(stmt, 3, time(NULL));
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  _pending[_pending_count].filename = strdup(filename);
+  _pending[_pending_count].path = strdup(path);
+  _pending[_pending_count].added_at = now;
+  _pending_count++;
 
-  sqlite3_close(db);
+  if (_pending_count >= _batch_size)
+    _dupelog_flush();
+
+  if (_bloom && _bloom_count >= _bloom_capacity)
+  {
+    unsigned int i;
+
+    /* filter is full, false positives would increase. Entries which could
+     * not be inserted are not in the database, add them again */
+    _dupelog_flush();
+    _bloom_build(2 * _bloom_capacity);
+    for (i=0; i<_pending_count; i++)
+      _bloom_add(_pending[i].filename);
+  }
+  _bloom_add(filename);
+
+  _dupelog_flush_arm();
+
+  wzd_mutex_unlock(_dupelog_mutex);
 
   return EVENT_OK;
 }
 
 int dupelog_delete_entry(const char *filename)
 {
-  sqlite3_stmt *stmt;
-  sqlite3 *db;
-  int retval;
-
   out_log(LEVEL_INFO, "Dupecheck: Removing dupelog entry for '%s'\n", filename);
-  db = opendb();
 
-  if (!db)
+  if (!_dupelog_db)
     return EVENT_OK;
 
-  const char *deleteQuery = "DELETE FROM dupelog WHERE filename = ?";
-  if (sqlite3_prepare(db, deleteQuery, -1, &stmt, NULL) != SQLITE_OK)
+  wzd_mutex_lock(_dupelog_mutex);
+
+  /* filter can't remove entries, it will only cause a query */
+  if (_bloom_check(filename))
   {
-    if (stmt)
-      sqlite3_finalize(stmt);
-    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare delete query for '%s': %s\n", filename, sqlite3_errmsg(db));
-    sqlite3_close(db);
-    return EVENT_OK;
+    _dupelog_flush();
+    _dupelog_remove_pending(filename);
+    sqlite3_bind_text(_stmt_delete, 1, filename, -1, SQLITE_TRANSIENT);
+    sqlite3_step(_stmt_delete);
+    sqlite3_reset(_stmt_delete);
+    sqlite3_clear_bindings(_stmt_delete);
   }
 
-  sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
-  retval = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  sqlite3_close(db);
+  wzd_mutex_unlock(_dupelog_mutex);
 
   return EVENT_OK;
 }
@@ -150,20 +648,21 @@ int dupelog_delete_entry(const char *filename)
 void dupelog_print_matching_dirs(const char *pattern, int limit, wzd_context_t *context)
 {
   sqlite3_stmt *stmt;
-  sqlite3 *db;
   int retval, rows = 0;
 
-  db = opendb();
-  if (!db)
+  if (!_dupelog_db)
     return;
 
+  wzd_mutex_lock(_dupelog_mutex);
+  _dupelog_flush();
+
   const char *selectQuery = "SELECT path, added_at FROM dupelog WHERE lower(path) GLOB lower(?) GROUP BY path ORDER BY added_at DESC LIMIT ?";
-  if (sqlite3_prepare(db, selectQuery, -1, &stmt, NULL) != SQLITE_OK)
+  if (sqlite3_prepare_v2(_dupelog_db, selectQuery, -1, &stmt, NULL) != SQLITE_OK)
   {
     if (stmt)
       sqlite3_finalize(stmt);
-    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare select query for '%s': %s\n", pattern, sqlite3_errmsg(db));
-    sqlite3_close(db);
+    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare select query for '%s': %s\n", pattern, sqlite3_errmsg(_dupelog_db));
+    wzd_mutex_unlock(_dupelog_mutex);
     return;
   }
 
@@ -180,28 +679,29 @@ void dupelog_print_matching_dirs(const char *pattern, int limit, wzd_context_t *
   }
   sqlite3_finalize(stmt);
 
-  send_message_raw_formatted(context, "210-- %d matches for '%s'", rows, pattern);
+  wzd_mutex_unlock(_dupelog_mutex);
 
-  sqlite3_close(db);
+  send_message_raw_formatted(context, "210-- %d matches for '%s'", rows, pattern);
 }
 
 void dupelog_delete_matching_files(const char *pattern, wzd_context_t *context)
 {
   sqlite3_stmt *stmt;
-  sqlite3 *db;
   int retval, rows = 0;
 
-  db = opendb();
-  if (!db)
+  if (!_dupelog_db)
     return;
 
+  wzd_mutex_lock(_dupelog_mutex);
+  _dupelog_flush();
+
   const char *deleteQuery = "DELETE FROM dupelog WHERE lower(filename) GLOB lower(?)";
-  if (sqlite3_prepare(db, deleteQuery, -1, &stmt, NULL) != SQLITE_OK)
+  if (sqlite3_prepare_v2(_dupelog_db, deleteQuery, -1, &stmt, NULL) != SQLITE_OK)
   {
     if (stmt)
       sqlite3_finalize(stmt);
-    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare delete query for '%s': %s\n", pattern, sqlite3_errmsg(db));
-    sqlite3_close(db);
+    out_err(LEVEL_HIGH, "Dupecheck: Could not prepare delete query for '%s': %s\n", pattern, sqlite3_errmsg(_dupelog_db));
+    wzd_mutex_unlock(_dupelog_mutex);
     return;
   }
 
@@ -209,15 +709,15 @@ void dupelog_delete_matching_files(const char *pattern, wzd_context_t *context)
   retval = sqlite3_step(stmt);
 
   if (retval == SQLITE_DONE || retval == SQLITE_ROW)
-    rows = sqlite3_changes(db);
+    rows = sqlite3_changes(_dupelog_db);
   else
     rows = 0;
 
   sqlite3_finalize(stmt);
 
-  send_message_raw_formatted(context, "210- Deleted %d dupes that matched '%s'", rows, pattern);
+  wzd_mutex_unlock(_dupelog_mutex);
 
-  sqlite3_close(db);
+  send_message_raw_formatted(context, "210- Deleted %d dupes that matched '%s'", rows, pattern);
 }
 
 static int check_table_created(sqlite3 *db)
@@ -234,7 +734,7 @@ static int check_table_created(sqlite3 *db)
   return retval == SQLITE_OK;
 }
 
-static sqlite3 *opendb()
+static sqlite3 *opendb(void)
 {
   sqlite3 *db;
   const char *dbpath = config_get_value(getlib_mainConfig()->cfg_file, "dupecheck", "database");
@@ -248,6 +748,11 @@ static sqlite3 *opendb()
     return NULL;
   }
 
+  /* readers do not block the writer, and commits do not wait for fsync */
+  sqlite3_exec(db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+  sqlite3_exec(db, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
+  sqlite3_busy_timeout(db, 1000);
+
   if (!check_table_created(db))
   {
     out_err(LEVEL_HIGH, "Dupecheck: Could not create table for dupelog: %s\n", sqlite3_errmsg(db));
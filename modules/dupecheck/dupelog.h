@@ -3,6 +3,9 @@
 
 #include <libwzd-core/wzd_structs.h>
 
+int dupelog_init(void);
+void dupelog_fini(void);
+
 int dupelog_is_upload_allowed(const char *filename);
 int dupelog_add_entry(const char *path, const char *filename);
 int dupelog_delete_entry(const char *filename);
@@ -35,12 +35,16 @@
 
 #include "libwzd_dupecheck_events.h"
 #include "libwzd_dupecheck_commands.h"
+#include "dupelog.h"
 
 MODULE_NAME(dupecheck);
 MODULE_VERSION(100);
 
 int WZD_MODULE_INIT (void)
 { 
+  if (dupelog_init() != 0)
+    out_log(LEVEL_HIGH, "Dupecheck: Could not open database, uploads will not be checked\n");
+
   event_connect_function(getlib_mainConfig()->event_mgr, EVENT_PREUPLOAD, dupecheck_event_preupload, NULL);
   event_connect_function(getlib_mainConfig()->event_mgr, EVENT_POSTUPLOAD_DENIED, dupecheck_event_postupload_denied, NULL);
   event_connect_function(getlib_mainConfig()->event_mgr, EVENT_DELE, dupecheck_event_dele, NULL);
@@ -58,6 +62,7 @@ int WZD_MODULE_INIT (void)
 
 int WZD_MODULE_CLOSE(void)
 {
+  dupelog_fini();
   out_log(LEVEL_INFO, "Dupecheck: Module unloaded!\n");
   return 0;
 }
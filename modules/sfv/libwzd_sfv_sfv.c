@@ -168,6 +168,29 @@ int sfv_sfv_update_release_and_get_stats(wzd_release_stats * stats , const char
 }
 
 
+/** get crc computed by the server while \a filename was uploaded.
+ * The crc is only used if it covers the whole file, and if the file
+ * was not modified since.
+ * \return 0 if the crc is available
+ */
+static int sfv_get_upload_crc(const char *filename, const struct stat *s, unsigned long *crc)
+{
+  wzd_context_t * context;
+
+  context = GetMyContext();
+  if (!context || !context->last_file.crc_valid)
+    return -1;
+  if (context->last_file.token != TOK_STOR)
+    return -1;
+  if (strcmp(context->last_file.name,filename) != 0)
+    return -1;
+  if ((u64_t)s->st_size != context->last_file.size)
+    return -1;
+
+  *crc = context->last_file.crc;
+  return 0;
+}
+
 /** create / remove ".missing" / ".bad" depending on the result of the test */
 int sfv_check_create(const char *filename, wzd_sfv_entry * entry)
 {
@@ -207,9 +230,11 @@ int sfv_check_create(const char *filename, wzd_sfv_entry * entry)
   
   entry->size = s.st_size;
   real_crc = 0;
-  ret = calc_crc32(filename,&real_crc,0,-1);
-  if (ret) 
-    return -1; /* something weird has happened, crc calc failed, do nothing */
+  if (sfv_get_upload_crc(filename,&s,&real_crc) != 0) {
+    ret = calc_crc32(filename,&real_crc,0,-1);
+    if (ret) 
+      return -1; /* something weird has happened, crc calc failed, do nothing */
+  }
 
   /* remove any existing .bad file first */
     if (!stat(bad,&s)) remove(bad);
@@ -480,7 +505,6 @@ int sfv_process_default(const char *filename, wzd_context_t *context)
 {
   wzd_sfv_file sfv;
   wzd_sfv_entry *entry=NULL;
-  unsigned long real_crc;
   int ret;
   char * sfv_dir;
 
@@ -492,13 +516,6 @@ int sfv_process_default(const char *filename, wzd_context_t *context)
   out_err(LEVEL_NORMAL,"sfv_hook_postupload user %d file %s, crc %08lX OK\n",context->userid,filename,entry->crc);
 #endif
 
-  real_crc = 0;
-  ret = calc_crc32(filename,&real_crc,0,-1);
-  if (ret){
-    sfv_free(&sfv);
-    return -1;
-  }
-
   sfv_check_create(filename,entry);
 
   sfv_dir = path_getdirname(filename);
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libwzd-core/wzd_structs.h>
+#include <libwzd-core/wzd_crc32.h>
+
+/* Micro-benchmark for CRC32 implementations.
+ *
+ * usage: bench_wzd_crc32 [size in MB] [iterations]
+ *
+ * The byte-at-a-time loop is the algorithm used before slicing-by-8 and
+ * hardware implementations were added.
+ */
+
+static unsigned long crc32_bytewise(const unsigned char * buf, size_t length)
+{
+  static unsigned long table[256];
+  static int init = 0;
+  unsigned long crc = 0xFFFFFFFF;
+  unsigned int i, k;
+
+  if (!init) {
+    for (i=0; i<256; i++) {
+      unsigned long c = i;
+      for (k=0; k<8; k++)
+        c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      table[i] = c;
+    }
+    init = 1;
+  }
+
+  while (length--)
+    crc = ((crc >> 8) & 0x00FFFFFFL) ^ table[(crc ^ *buf++) & 0xFF];
+  return (~crc & 0xFFFFFFFF);
+}
+
+static double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static void report(const char * name, size_t size, unsigned int iterations, double elapsed, unsigned long crc)
+{
+  printf("%-10s %8.3f GB/s  (crc %08lx)\n", name,
+      ((double)size * iterations) / elapsed / 1e9, crc);
+}
+
+int main(int argc, char *argv[])
+{
+  const char * impls[] = { "slice8", "pclmul", "armv8", NULL };
+  size_t size = 64;
+  unsigned int iterations = 4, i, j;
+  unsigned char * data;
+  unsigned long crc, crc_ref;
+  double t;
+
+  if (argc > 1) size = strtoul(argv[1],NULL,0);
+  if (argc > 2) iterations = strtoul(argv[2],NULL,0);
+  if (size == 0 || iterations == 0) {
+    fprintf(stderr, "usage: %s [size in MB] [iterations]\n", argv[0]);
+    return 1;
+  }
+  size *= 1024*1024;
+
+  data = malloc(size);
+  if (!data) {
+    fprintf(stderr, "could not allocate %lu bytes\n", (unsigned long)size);
+    return 1;
+  }
+  srand(1);
+  for (i=0; i<size; i++)
+    data[i] = (unsigned char)rand();
+
+  printf("%lu MB x %u iterations\n", (unsigned long)(size/(1024*1024)), iterations);
+
+  t = now();
+  for (i=0; i<iterations; i++)
+    crc_ref = crc32_bytewise(data,size);
+  report("bytewise",size,iterations,now()-t,crc_ref);
+
+  for (j=0; impls[j]; j++) {
+    if (calc_crc32_select(impls[j]) != 0) {
+      printf("%-10s not available\n", impls[j]);
+      continue;
+    }
+    t = now();
+    for (i=0; i<iterations; i++) {
+      crc = 0;
+      calc_crc32_buffer((const char*)data,&crc,size);
+    }
+    report(impls[j],size,iterations,now()-t,crc);
+    if (crc != crc_ref) {
+      fprintf(stderr, "%s: wrong crc\n", impls[j]);
+      free(data);
+      return 2;
+    }
+  }
+
+  calc_crc32_select(NULL);
+  printf("default: %s\n", calc_crc32_implementation());
+
+  free(data);
+  return 0;
+}
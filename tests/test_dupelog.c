@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+# include <unistd.h>
+#endif
+
+#include <sqlite3.h>
+
+#include <libwzd-core/wzd_structs.h>
+#include <libwzd-core/wzd_configfile.h>
+#include <libwzd-core/wzd_events.h>
+
+#include <modules/dupecheck/dupelog.h>
+
+#include "test_common.h"
+
+#define C1 0x12345678
+#define C2 0x9abcdef0
+
+#define DB_PATH "test_dupelog.db"
+
+/* more than DUPELOG_BLOOM_MIN, so the filter is rebuilt at least once */
+#define BLOOM_ENTRIES 70000
+
+static void remove_db(void)
+{
+  unlink(DB_PATH);
+  unlink(DB_PATH "-wal");
+  unlink(DB_PATH "-shm");
+}
+
+static void set_config(const char * batch_size)
+{
+  config_set_value(mainConfig->cfg_file, "dupecheck", "database", DB_PATH);
+  config_set_value(mainConfig->cfg_file, "dupecheck", "batch_size", batch_size);
+}
+
+/* number of rows for filename, read with another connection */
+static int db_count(sqlite3 * db, const char * filename)
+{
+  sqlite3_stmt * stmt;
+  int count = -1;
+
+  if (sqlite3_prepare_v2(db, "SELECT count(*) FROM dupelog WHERE filename = ?", -1, &stmt, NULL) != SQLITE_OK)
+    return -1;
+  sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    count = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  return count;
+}
+
+int main()
+{
+  unsigned long c1 = C1;
+  sqlite3 * db;
+  char name[64];
+  unsigned int i;
+  unsigned long c2 = C2;
+
+  fake_mainConfig();
+  mainConfig->cfg_file = config_new();
+
+  remove_db();
+  set_config("8");
+
+  if (dupelog_init() != 0) {
+    fprintf(stderr, "dupelog_init failed\n");
+    return 1;
+  }
+  if (sqlite3_open(DB_PATH, &db) != SQLITE_OK) {
+    fprintf(stderr, "could not open %s\n", DB_PATH);
+    return 1;
+  }
+  sqlite3_busy_timeout(db, 1000);
+
+  /* unknown file */
+  if (dupelog_is_upload_allowed("first.rar") != EVENT_OK) {
+    fprintf(stderr, "unknown file denied\n");
+    return 2;
+  }
+
+  /* dupe found while the entry is still pending */
+  dupelog_add_entry("/site/first", "first.rar");
+  if (db_count(db, "first.rar") != 0) {
+    fprintf(stderr, "entry inserted before the end of the batch\n");
+    return 3;
+  }
+  if (dupelog_is_upload_allowed("first.rar") != EVENT_DENY) {
+    fprintf(stderr, "pending entry not found\n");
+    return 3;
+  }
+
+  /* the flush thread inserts it after DUPELOG_BATCH_DELAY seconds */
+  sleep(4);
+  if (db_count(db, "first.rar") != 1) {
+    fprintf(stderr, "pending entry not inserted by flush thread\n");
+    return 4;
+  }
+
+  /* lock the database: the transaction fails, and entries are kept */
+  if (sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK) {
+    fprintf(stderr, "could not lock database\n");
+    return 5;
+  }
+  dupelog_add_entry("/site/a", "a.rar");
+  dupelog_add_entry("/site/b", "b.rar");
+  dupelog_add_entry("/site/c", "c.rar");
+
+  /* DELE of a pending entry: the flush fails, the entry is only removed
+   * from pending entries */
+  dupelog_delete_entry("a.rar");
+  if (dupelog_is_upload_allowed("a.rar") != EVENT_OK) {
+    fprintf(stderr, "deleted pending entry still found\n");
+    return 5;
+  }
+  if (dupelog_is_upload_allowed("b.rar") != EVENT_DENY ||
+      dupelog_is_upload_allowed("c.rar") != EVENT_DENY) {
+    fprintf(stderr, "entries lost after failed transaction\n");
+    return 5;
+  }
+  sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+  /* DELE of an inserted entry */
+  dupelog_delete_entry("first.rar");
+  if (dupelog_is_upload_allowed("first.rar") != EVENT_OK) {
+    fprintf(stderr, "deleted entry still found\n");
+    return 6;
+  }
+
+  /* kept entries are inserted with the next batch */
+  dupelog_fini();
+  if (db_count(db, "a.rar") != 0 || db_count(db, "first.rar") != 0) {
+    fprintf(stderr, "deleted entries inserted\n");
+    return 7;
+  }
+  if (db_count(db, "b.rar") != 1 || db_count(db, "c.rar") != 1) {
+    fprintf(stderr, "kept entries not inserted\n");
+    return 7;
+  }
+
+  /* Bloom filter: built from database at init, rebuilt when full, and
+   * never gives false negatives */
+  set_config("1024");
+  if (dupelog_init() != 0) {
+    fprintf(stderr, "dupelog_init failed\n");
+    return 1;
+  }
+  if (dupelog_is_upload_allowed("b.rar") != EVENT_DENY) {
+    fprintf(stderr, "entry not found after init\n");
+    return 8;
+  }
+  for (i=0; i<BLOOM_ENTRIES; i++) {
+    snprintf(name, sizeof(name), "release-%u.rar", i);
+    dupelog_add_entry("/site/bloom", name);
+  }
+  for (i=0; i<BLOOM_ENTRIES; i++) {
+    snprintf(name, sizeof(name), "release-%u.rar", i);
+    if (dupelog_is_upload_allowed(name) != EVENT_DENY) {
+      fprintf(stderr, "false negative for %s\n", name);
+      return 8;
+    }
+  }
+  if (dupelog_is_upload_allowed("b.rar") != EVENT_DENY ||
+      dupelog_is_upload_allowed("release-new.rar") != EVENT_OK) {
+    fprintf(stderr, "wrong result after filter rebuild\n");
+    return 8;
+  }
+  dupelog_fini();
+
+  sqlite3_close(db);
+  remove_db();
+
+  config_free(mainConfig->cfg_file);
+  mainConfig->cfg_file = NULL;
+  fake_exit();
+
+  if (c1 != C1) {
+    fprintf(stderr, "c1 nuked !\n");
+    return -1;
+  }
+  if (c2 != C2) {
+    fprintf(stderr, "c2 nuked !\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -7,6 +7,7 @@
 
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_configfile.h>
+#include <libwzd-core/wzd_configloader.h>
 
 #include <libwzd-core/wzd_debug.h>
 
@@ -105,6 +106,45 @@ int main()
   config_set_value(file, "GROUP2", "keyr", "should not be here");
   config_remove_group(file, "GROUP2");
 
+  /* snapshot */
+  {
+    const wzd_config_snapshot_t * s1, * s2;
+
+    s1 = config_snapshot_acquire();
+    if (s1->auto_crc != 0 || s1->client_tick != DEFAULT_CLIENT_TICK || strcmp(s1->tls_cipher_list,"ALL")) {
+      fprintf(stderr, "default snapshot has wrong values\n");
+      return -1;
+    }
+    config_snapshot_release(s1);
+
+    config_set_boolean(file, "GLOBAL", "auto crc", 1);
+    config_set_integer(file, "GLOBAL", "client tick", 3);
+    config_set_value(file, "GLOBAL", "tls_cipher_list", "HIGH");
+    config_snapshot_publish(config_snapshot_build(file));
+
+    s1 = config_snapshot_acquire();
+    if (s1->auto_crc != 1 || s1->client_tick != 3 || strcmp(s1->tls_cipher_list,"HIGH")) {
+      fprintf(stderr, "config_snapshot_build failed\n");
+      return -1;
+    }
+
+    /* s1 must stay valid after a new snapshot is published */
+    config_set_boolean(file, "GLOBAL", "auto crc", 0);
+    config_snapshot_publish(config_snapshot_build(file));
+
+    s2 = config_snapshot_acquire();
+    if (s2 == s1 || s2->auto_crc != 0 || s1->auto_crc != 1 || strcmp(s1->tls_cipher_list,"HIGH")) {
+      fprintf(stderr, "config_snapshot_publish failed\n");
+      return -1;
+    }
+    config_snapshot_release(s1);
+    config_snapshot_release(s2);
+
+    config_remove_key(file, "GLOBAL", "auto crc");
+    config_remove_key(file, "GLOBAL", "client tick");
+    config_remove_key(file, "GLOBAL", "tls_cipher_list");
+  }
+
   str = config_to_data(file, NULL);
 
   if (str) printf("%s\n",str_tochar(str));
@@ -3,6 +3,9 @@
 
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_misc.h>
+#include <libwzd-core/wzd_user.h>
+#include <libwzd-core/wzd_group.h>
+#include <libwzd-core/wzd_cookie.h>
 
 #include "test_common.h"
 
@@ -16,6 +19,13 @@ struct comp_t {
   char * ref;
 };
 
+/* output of the former flex lexer, out_buffer_len is given for each entry */
+struct comp_len_t {
+  char * in;
+  unsigned int len;
+  char * ref;
+};
+
 
 int test_cookies(const char * input, const char * reference, char * buffer, char * outbuf)
 {
@@ -29,6 +39,22 @@ int test_cookies(const char * input, const char * reference, char * buffer, char
   return 0;
 }
 
+int test_cookies_len(const struct comp_len_t * comp, char * buffer, char * outbuf)
+{
+  strncpy(buffer,comp->in,BUFLEN);
+  memset(outbuf,'x',BUFLEN);
+  if (cookie_parse_buffer(buffer,f_user,f_group,f_context,outbuf,comp->len) != 0) {
+    fprintf(stderr,"test_cookies: parse error on [%s]\n",buffer);
+    return 1;
+  }
+  if (strcmp(outbuf,comp->ref)) {
+    fprintf(stderr,"test_cookies: got unexpected output [%s] for [%s]\n",outbuf,buffer);
+    return 1;
+  }
+
+  return 0;
+}
+
 /* run this program inside a memory checker (like valgrind) */
 
 int main()
@@ -39,9 +65,49 @@ int main()
   unsigned long c2 = C2;
   struct comp_t comparisons[] = {
     { "HELO %username\n", "HELO test_user\r\n" },
+    { "[%12.username]\n", "[test_user   ]\r\n" },
+    { "100%% %s %\n", "100% %s %\r\n" },
+    { "A\n%if(=nogroup)\nB\n%endif\nC\n", "A\r\nC\r\n" },
+    { "%for(unknown)\nB\n%endfor\nC", "C\r\n" },
 /*    { "HELO %!black%username%!0\n", "HELO [30mtest_user[0m\r\n" },*/
     { NULL, NULL }
   };
+  struct comp_len_t lexer_comparisons[] = {
+    /* user */
+    { "%username|%userid|%usertag|%userflags|%userhome\n", BUFLEN, "test_user|666|my tag|5FA|- some where -\r\n" },
+    { "%userratio %usercredits %usercredits2\n", BUFLEN, "1:3 5000000 4.77 M\r\n" },
+    { "%usertotal_ul %usertotal_ul2 %usertotal_dl %usertotal_dl2\n", BUFLEN, "1536 1.50 k 3221225472 3.00 G\r\n" },
+    { "%userfiles_ul %userfiles_dl\n", BUFLEN, "12 7\r\n" },
+    { "%usermaxidle %usermaxul %usermaxdl\n", BUFLEN, "300 1000 2048000\r\n" },
+    { "%usernum_logins %userlogins_per_ip %userslots %userleechslots\n", BUFLEN, "3 2 4 1\r\n" },
+    { "%usergroup %usergroups %usercreator\n", BUFLEN, "test_group test_group 666\r\n" },
+    /* group */
+    { "%groupname|%groupid|%grouptag|%groupflags|%groupratio\n", BUFLEN, "test_group|333|grp tag|G|1:2\r\n" },
+    { "%groupmaxidle %groupmaxul %groupmaxdl %groupnum_logins %grouphome\n", BUFLEN, "600 10 20 5 /home/grp\r\n" },
+    /* padding / width */
+    { "[%12.username]\n", BUFLEN, "[test_user   ]\r\n" },
+    { "[%3.username]\n", BUFLEN, "[tes]\r\n" },
+    { "[%8.userid][%6.groupname]\n", BUFLEN, "[666     ][test_g]\r\n" },
+    { "[%10.usertotal_ul2]\n", BUFLEN, "[1.50 k    ]\r\n" },
+    /* %for / %if: directives must end the line, %endfor alone is dropped */
+    { "%for(allusers)<%username>%endfor\n", BUFLEN, "%for(allusers)<test_user>\r\n" },
+    { "%for(allvfs)<%vfsvirtual>%endfor\nend\n", BUFLEN, "%for(allvfs)<virtual_dir>end\r\n" },
+    { "%if(+5)color %endif%if(+Z)never %endif.\n", BUFLEN, "%if(+5)color %endif%if(+Z)never %endif.\r\n" },
+    { "A\n%if(+A)\nB\n%endif\nC\n", BUFLEN, "A\r\nB\r\nC\r\n" },
+    { "A\n%if(+Z)\nB\n%endif\nC\n", BUFLEN, "A\r\nC\r\n" },
+    { "%endfor stray\n", BUFLEN, "%endfor stray\r\n" },
+    /* unknown cookies are copied with their % */
+    { "%unknowncookie %s %d 50%%\n", BUFLEN, "%unknowncookie %s %d 50%\r\n" },
+    { "[%6.msg]\n", BUFLEN, "[%6.msg]\r\n" },
+    { "100%%", BUFLEN, "100%\r\n" },
+    { "line1\nline2\n\nline4", BUFLEN, "line1\r\nline2\r\n\r\nline4\r\n" },
+    /* truncation at out_buffer_len */
+    { "%username is here\n", 8, "test_us" },
+    { "abcdef", 4, "abc" },
+    { "abc", 1, "" },
+    { "[%20.username]\n", 16, "[test_user     " },
+    { NULL, 0, NULL }
+  };
   unsigned int i;
 
   fake_mainConfig();
@@ -71,6 +137,70 @@ int main()
     i++;
   }
 
+  /* per-family comparisons */
+  f_user->creator = 666;
+  strcpy(f_user->tagline,"my tag");
+  strcpy(f_user->flags,"5FA");
+  f_user->max_idle_time = 300;
+  f_user->max_ul_speed = 1000;
+  f_user->max_dl_speed = 2048000;
+  f_user->num_logins = 3;
+  f_user->logins_per_ip = 2;
+  f_user->ratio = 3;
+  f_user->credits = 5000000;
+  f_user->user_slots = 4;
+  f_user->leech_slots = 1;
+  f_user->stats.bytes_ul_total = 1536;
+  f_user->stats.bytes_dl_total = 3221225472ULL;
+  f_user->stats.files_ul_total = 12;
+  f_user->stats.files_dl_total = 7;
+  strcpy(f_group->tagline,"grp tag");
+  strcpy(f_group->flags,"G");
+  f_group->max_idle_time = 600;
+  f_group->max_ul_speed = 10;
+  f_group->max_dl_speed = 20;
+  f_group->num_logins = 5;
+  f_group->ratio = 2;
+  strcpy(f_group->defaultpath,"/home/grp");
+
+  i = 0;
+  while (lexer_comparisons[i].in) {
+    if (test_cookies_len(&lexer_comparisons[i],buffer,outbuf)) {
+      fprintf(stderr, "cookies: %s failed !\n",lexer_comparisons[i].in);
+      return -2;
+    }
+    i++;
+  }
+
+  /* unterminated block: error, and the output must still be a valid string */
+  strncpy(buffer,"%for(allvfs)\n%vfsvirtual\n",BUFLEN);
+  memset(outbuf,'x',BUFLEN);
+  if (cookie_parse_buffer(buffer,f_user,NULL,NULL,outbuf,BUFLEN) != 1) {
+    fprintf(stderr, "cookies: unterminated block accepted !\n");
+    return -3;
+  }
+  if (outbuf[0] != '\0') {
+    fprintf(stderr, "cookies: output not cleared on error !\n");
+    return -3;
+  }
+
+  /* nesting too deep */
+  buffer[0] = '\0';
+  for (i=0; i<11; i++)
+    strcat(buffer,"%if(+A)\n");
+  for (i=0; i<11; i++)
+    strcat(buffer,"%endif\n");
+  memset(outbuf,'x',BUFLEN);
+  if (cookie_parse_buffer(buffer,f_user,NULL,NULL,outbuf,BUFLEN) != 1 || outbuf[0] != '\0') {
+    fprintf(stderr, "cookies: too deep nesting not rejected !\n");
+    return -3;
+  }
+
+  /* template from cache */
+  strncpy(buffer,"HELO %username\n",BUFLEN);
+  cookie_parse_buffer(buffer,f_user,NULL,NULL,outbuf,BUFLEN);
+  cookie_cache_purge();
+
   /* spacefree with no user */
   strncpy(buffer,"Space: %spacefree\n",BUFLEN);
   cookie_parse_buffer(buffer,NULL,NULL,NULL,outbuf,BUFLEN);
@@ -8,10 +8,68 @@
 #define C1 0x12345678
 #define C2 0x9abcdef0
 
+/* reference implementation: bit-at-a-time */
+static unsigned long crc32_ref(const unsigned char * buf, size_t length)
+{
+  unsigned long crc = 0xFFFFFFFF;
+  int k;
+
+  while (length--) {
+    crc ^= *buf++;
+    for (k=0; k<8; k++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return (~crc & 0xFFFFFFFF);
+}
+
+/* check implementation against reference, for all lengths and alignments */
+static int check_implementation(const char * name, const unsigned char * data, size_t size)
+{
+  size_t offset, length;
+  unsigned long crc, crc1, crc2;
+
+  if (calc_crc32_select(name) != 0) {
+    /* not available on this cpu */
+    return 0;
+  }
+
+  for (offset=0; offset<16; offset++) {
+    for (length=0; length<1100 && offset+length<=size; length+=(length<300)?1:37) {
+      crc = 0;
+      calc_crc32_buffer((const char*)data+offset,&crc,length);
+      if (crc != crc32_ref(data+offset,length)) {
+        fprintf(stderr, "calc_crc32_buffer (%s) failed for offset %lu length %lu\n",
+            name, (unsigned long)offset, (unsigned long)length);
+        return 1;
+      }
+      /* incremental computation */
+      crc1 = 0;
+      calc_crc32_buffer((const char*)data+offset,&crc1,length/3);
+      calc_crc32_buffer((const char*)data+offset+length/3,&crc1,length-length/3);
+      if (crc1 != crc) {
+        fprintf(stderr, "calc_crc32_buffer (%s) incremental failed\n", name);
+        return 1;
+      }
+      /* combine */
+      crc1 = 0; crc2 = 0;
+      calc_crc32_buffer((const char*)data+offset,&crc1,length/2);
+      calc_crc32_buffer((const char*)data+offset+length/2,&crc2,length-length/2);
+      if (calc_crc32_combine(crc1,crc2,length-length/2) != crc) {
+        fprintf(stderr, "calc_crc32_combine (%s) failed\n", name);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
   unsigned long c1 = C1;
   unsigned long crc = 0x0;
+  unsigned char data[2048];
+  unsigned int i;
   char input1[1024];
   const char * file1 = "file_crc.txt";
   const unsigned long crc_ref = 0xEB2FAFAF; /* cksfv file_crc.txt */
@@ -40,6 +98,23 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  /* buffer implementations */
+  srand(1);
+  for (i=0; i<sizeof(data); i++)
+    data[i] = (unsigned char)rand();
+
+  if (check_implementation("slice8",data,sizeof(data))) return 2;
+  if (check_implementation("pclmul",data,sizeof(data))) return 2;
+  if (check_implementation("armv8",data,sizeof(data))) return 2;
+
+  /* check file with the fastest implementation too */
+  calc_crc32_select(NULL);
+  crc = 0;
+  if ( calc_crc32(input1,&crc,0,(unsigned long)-1) || crc != crc_ref ) {
+    fprintf(stderr, "calc_crc32 (%s) returned crap\n", calc_crc32_implementation());
+    return 3;
+  }
+
 
   if (c1 != C1) {
     fprintf(stderr, "c1 nuked !\n");
@@ -3,7 +3,12 @@
 
 #include <time.h>
 
+#ifndef WIN32
+# include <unistd.h>
+#endif
+
 #include <libwzd-core/wzd_structs.h>
+#include <libwzd-core/wzd_libmain.h>
 #include <libwzd-core/wzd_crontab.h>
 
 #define C1 0x12345678
@@ -18,12 +23,20 @@ typedef struct {
   const char * day_of_week;
 } wzd_test_struct_t;
 
+static volatile int test_counter = 0;
+
 static int test_callback(void)
 {
   fprintf(stdout,"crontab: test callback\n");
   return 0;
 }
 
+static int test_counter_callback(void)
+{
+  test_counter++;
+  return 0;
+}
+
 time_t _find_next_exec(time_t now, wzd_test_struct_t test)
 {
   time_t next;
@@ -110,6 +123,7 @@ int main()
   wzd_cronjob_t * crontab = NULL;
   int ret;
   long diff;
+  char minute[4];
   wzd_test_struct_t tests[] = {
     { "every minute", "*", "*", "*", "*", "*" },
     { "every hour",   "0", "*", "*", "*", "*" },
@@ -162,8 +176,59 @@ int main()
   now = time(NULL);
   ret = cronjob_add_once(&crontab, test_callback, "fn:test_callback", now);
   cronjob_run(&crontab);
+  if (crontab != NULL) {
+    fprintf(stderr,"crontab: job run once was not removed\n");
+    return 2;
+  }
+
+  cronjob_free(&crontab);
+
+  /* statistics and overlap policy */
+  server_mutex_set_init();
+  cronjob_add(&crontab, test_counter_callback, "fn:test_counter", "*", "*", "*", "*", "*");
+  if (cronjob_run_now(&crontab, "fn:test_counter") != 0 || test_counter != 1 || crontab->runs != 1) {
+    fprintf(stderr,"crontab: cronjob_run_now failed\n");
+    return 3;
+  }
+  crontab->running = 1; /* pretend it is still running */
+  if (cronjob_run_now(&crontab, "fn:test_counter") != 1 || crontab->skipped != 1) {
+    fprintf(stderr,"crontab: job was not skipped\n");
+    return 4;
+  }
+  cronjob_set_flags(&crontab, "fn:test_counter", CRONJOB_FLAG_ALLOW_OVERLAP);
+  if (cronjob_run_now(&crontab, "fn:test_counter") != 0 || test_counter != 2) {
+    fprintf(stderr,"crontab: overlap was not allowed\n");
+    return 5;
+  }
+  crontab->running = 0;
+  if (cronjob_run_now(&crontab, "fn:nonexistent") != -1) {
+    fprintf(stderr,"crontab: cronjob_run_now found a nonexistent job\n");
+    return 6;
+  }
+
+  /* scheduler thread: job added after start must wake it up. The job of
+   * the list runs in 30 minutes, so only the added job can be run */
+  fprintf(stdout,"Testing crontab thread\n");
+  cronjob_free(&crontab);
+  now = time(NULL);
+  snprintf(minute, sizeof(minute), "%d", (localtime(&now)->tm_min + 30) % 60);
+  cronjob_add(&crontab, test_counter_callback, "fn:test_counter", minute, "*", "*", "*", "*");
+  crontab_start(&crontab);
+  cronjob_add_once(&crontab, test_counter_callback, "fn:test_once", time(NULL)+1);
+  for (i=0; i<40 && test_counter < 3; i++)
+    usleep(100000);
+  crontab_stop();
+  if (test_counter != 3) {
+    fprintf(stderr,"crontab: job was not run by crontab thread\n");
+    return 7;
+  }
+  if (crontab == NULL || crontab->next_cronjob != NULL) {
+    fprintf(stderr,"crontab: job run once was not removed by crontab thread\n");
+    return 8;
+  }
 
   cronjob_free(&crontab);
+  server_mutex_set_fini();
 
   if (c1 != C1) {
     fprintf(stderr, "c1 nuked !\n");
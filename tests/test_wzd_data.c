@@ -4,7 +4,11 @@
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_string.h>
 
+#include <libwzd-core/wzd_configfile.h>
+#include <libwzd-core/wzd_configloader.h>
 #include <libwzd-core/wzd_data.h>
+#include <libwzd-core/wzd_pasv.h>
+#include <libwzd-core/wzd_user.h>
 
 #include "test_common.h"
 
@@ -23,6 +27,10 @@ int main()
   int ret;
   unsigned long c2 = C2;
   unsigned char localhost[4] = { 127, 0, 0, 1 };
+  int ports[8];
+  unsigned int i;
+  wzd_pasv_stats_t stats;
+  wzd_configfile_t * file;
 
   fake_context();
   fake_proto();
@@ -56,6 +64,75 @@ int main()
   fprintf(stderr, "bound port: %d (awaited: %s)\n", ret, "any port with range");
   pasv_close(f_context);
 
+  /* allocator: all ports of the range, then exhaustion */
+  for (i=0; i<8; i++) {
+    ports[i] = pasv_port_acquire(40060, 40067);
+    if (ports[i] < 40060 || ports[i] > 40067) {
+      fprintf(stderr, "pasv_port_acquire returned %d\n", ports[i]);
+      return 1;
+    }
+  }
+  if (pasv_port_acquire(40060, 40067) != -1) {
+    fprintf(stderr, "pasv_port_acquire should fail when range is full\n");
+    return 2;
+  }
+  pasv_get_stats(&stats);
+  if (stats.exhausted != 1) {
+    fprintf(stderr, "exhaustion was not counted\n");
+    return 3;
+  }
+  pasv_port_release(ports[3]);
+  if (pasv_port_acquire(40060, 40067) != ports[3]) {
+    fprintf(stderr, "released port was not given again\n");
+    return 4;
+  }
+  for (i=0; i<8; i++)
+    pasv_port_release(ports[i]);
+
+  /* pool: listening socket is reused by the next PASV */
+  memset(mainConfig->pasv_ip,0,4);
+  mainConfig->pasv_low_range = 40100;
+  mainConfig->pasv_high_range = 40199;
+  file = config_new();
+  config_set_value(file, "GLOBAL", "pasv_pool_size", "4");
+  config_snapshot_publish(config_snapshot_build(file));
+  config_free(file);
+
+  /* users allowed to use FXP never get a pooled socket */
+  ret = get_pasv_port(WZD_INET4, f_context);
+  if (ret > 0) {
+    pasv_close(f_context);
+    ret = get_pasv_port(WZD_INET4, f_context);
+    pasv_get_stats(&stats);
+    if (stats.pool_hits != 0 || f_context->pasv_pooled) {
+      fprintf(stderr, "pooled socket given to a user allowed to use FXP\n");
+      return 7;
+    }
+    pasv_close(f_context);
+  }
+
+  strcpy(f_user->flags,"5F"); /* F = FXP disabled */
+  pasv_pool_purge();
+  ret = get_pasv_port(WZD_INET4, f_context);
+  if (ret > 0) {
+    int ret2;
+
+    pasv_close(f_context);
+    ret2 = get_pasv_port(WZD_INET4, f_context);
+    pasv_get_stats(&stats);
+    if (ret2 != ret || stats.pool_hits != 1 || !f_context->pasv_pooled) {
+      fprintf(stderr, "listening socket was not reused (%d, %d)\n", ret, ret2);
+      return 5;
+    }
+    pasv_close(f_context);
+  }
+  pasv_pool_purge();
+  pasv_get_stats(&stats);
+  if (stats.pool_size != 0 || stats.ports_in_use != 0) {
+    fprintf(stderr, "ports still in use after purge\n");
+    return 6;
+  }
+
   fake_exit();
 
   if (c1 != C1) {
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_dir.h>
 #include <libwzd-core/wzd_file.h>
+#include <libwzd-core/wzd_list.h>
 
 #include <libwzd-core/wzd_debug.h>
 
@@ -32,6 +35,25 @@ struct test_basename_t {
 int create_fake_dirinfo(const char * dir);
 int remove_fake_dirinfo(const char * dir);
 
+static char list_output[4096];
+
+static int list_to_buffer(socket_t sock, wzd_context_t * context, char * line)
+{
+  strncat(list_output, line, sizeof(list_output)-strlen(list_output)-1);
+  return 1;
+}
+
+static int create_file(const char * filename)
+{
+  FILE * file;
+
+  file = fopen(filename,"w");
+  if (!file) return -1;
+  fclose(file);
+
+  return 0;
+}
+
 int main()
 {
   unsigned long c1 = C1;
@@ -112,8 +134,86 @@ int main()
 
   dir_close(dir);
 
+  /* permission file cache: same entry while file is unchanged */
+  {
+    struct wzd_permfile_t * pf1, * pf2;
+
+    pf1 = permfile_acquire(".//.dirinfo");
+    pf2 = permfile_acquire(".//.dirinfo");
+    if (pf1 == NULL || pf1 != pf2) {
+      fprintf(stderr, "permfile_acquire: cache miss on unchanged file\n");
+      return -3;
+    }
+    file = permfile_get_files(pf1);
+    if (file == NULL || file->kind != FILE_LNK || strcmp(file->filename,"link1") != 0) {
+      fprintf(stderr, "permfile_get_files: wrong contents\n");
+      return -3;
+    }
+    if (permfile_find_file(pf1,"link1") != file || permfile_find_file(pf1,"link2") != NULL) {
+      fprintf(stderr, "permfile_find_file: wrong result\n");
+      return -3;
+    }
+    permfile_release(pf2);
+
+    /* invalidation must not free the entry still held */
+    permfile_invalidate(".//.dirinfo");
+    pf2 = permfile_acquire(".//.dirinfo");
+    if (pf2 == NULL || pf2 == pf1) {
+      fprintf(stderr, "permfile_invalidate: stale entry returned\n");
+      return -3;
+    }
+    permfile_release(pf2);
+    permfile_release(pf1);
+
+    permfile_cache_purge();
+  }
+
   remove_fake_dirinfo("./");
 
+  /* listing cache */
+  mkdir("list_cache",0755);
+  create_file("list_cache/file1");
+  create_file("list_cache/.hidden");
+
+  list_output[0] = '\0';
+  list(0,f_context,LIST_TYPE_SHORT,"list_cache",NULL,list_to_buffer);
+  if (strcmp(list_output,"file1\r\n") != 0) {
+    fprintf(stderr, "list: wrong output [%s]\n",list_output);
+    return -4;
+  }
+
+  /* same directory, other format: not shared */
+  list_output[0] = '\0';
+  list(0,f_context,LIST_TYPE_SHORT|LIST_SHOW_HIDDEN,"list_cache/",NULL,list_to_buffer);
+  if (strstr(list_output,".hidden\r\n") == NULL || strstr(list_output,"file1\r\n") == NULL) {
+    fprintf(stderr, "list: hidden file not shown [%s]\n",list_output);
+    return -4;
+  }
+
+  /* new file is shown after invalidation */
+  create_file("list_cache/file2");
+  list_cache_invalidate("list_cache/");
+  list_output[0] = '\0';
+  list(0,f_context,LIST_TYPE_SHORT,"list_cache",NULL,list_to_buffer);
+  if (strstr(list_output,"file2\r\n") == NULL) {
+    fprintf(stderr, "list_cache_invalidate: stale listing [%s]\n",list_output);
+    return -4;
+  }
+
+  /* masks are applied to cached listing */
+  list_output[0] = '\0';
+  list(0,f_context,LIST_TYPE_SHORT,"list_cache",(char*)"*2",list_to_buffer);
+  if (strcmp(list_output,"file2\r\n") != 0) {
+    fprintf(stderr, "list: mask not applied [%s]\n",list_output);
+    return -4;
+  }
+
+  list_cache_purge();
+  remove("list_cache/file1");
+  remove("list_cache/file2");
+  remove("list_cache/.hidden");
+  rmdir("list_cache");
+
 
   /* path_getdirname */
   i=0;
@@ -1,10 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
 
 #include <libwzd-core/wzd_structs.h>
 #include <libwzd-core/wzd_string.h>
 
 #include <libwzd-core/wzd_events.h>
+#include <libwzd-core/wzd_spawn.h>
 
 #include "test_common.h"
 
@@ -23,6 +27,30 @@ event_reply_t callback1(const char * args)
   return EVENT_OK;
 }
 
+/* read output of command until end of file */
+static void read_output(int fd, char * buffer, size_t length)
+{
+  size_t total = 0;
+  ssize_t ret;
+
+  while (total < length-1 && (ret = read(fd, buffer+total, length-1-total)) > 0)
+    total += ret;
+  buffer[total] = '\0';
+}
+
+static volatile int limited_job_started = 0;
+
+static void * limited_job_fund(void * arg)
+{
+  wzd_spawn_job_t job;
+
+  if (spawn_command(EVENT_ID_TEST4, "/bin/true", 0, NULL, &job) == 0) {
+    limited_job_started = 1;
+    spawn_wait(&job);
+  }
+  return NULL;
+}
+
 int main()
 {
   unsigned long c1 = C1;
@@ -30,6 +58,12 @@ int main()
   wzd_string_t * command_name;
   wzd_string_t * fixed_args, * event_args;
   event_reply_t event_reply;
+  wzd_popen_t * p;
+  wzd_spawn_job_t job;
+  pthread_t thread;
+  char buffer[256];
+  char * envp[] = { "WZD_TEST=42", NULL };
+  int status;
   unsigned long c2 = C2;
 
   fake_context();
@@ -57,6 +91,75 @@ int main()
   /* test 7: testing a protocol, special name with args */
   event_reply = event_exec("perl:'/tmp 2/test.pl' user group", f_context);
 
+  /******* spawn helper **********/
+  if (spawn_helper_start() != 0 || !spawn_helper_running()) {
+    fprintf(stderr, "spawn_helper_start failed\n");
+    return 1;
+  }
+
+  /* output and exit status */
+  p = wzd_popen("/bin/echo hello world");
+  if (!p) { fprintf(stderr, "wzd_popen failed\n"); return 2; }
+  read_output(p->fdr, buffer, sizeof(buffer));
+  if (strcmp(buffer, "hello world\n") != 0 || wzd_pclose(p) != 0) {
+    fprintf(stderr, "wrong output from helper: [%s]\n", buffer);
+    return 3;
+  }
+  p = wzd_popen("/bin/false");
+  if (!p || wzd_pclose(p) != 1) {
+    fprintf(stderr, "wrong exit status from helper\n");
+    return 4;
+  }
+  if (wzd_popen("/nonexistent/command") != NULL) {
+    fprintf(stderr, "helper started inexistant command\n");
+    return 5;
+  }
+
+  /* shell and environment */
+  if (spawn_command(0, "echo $WZD_TEST", 1, envp, &job) != 0) {
+    fprintf(stderr, "spawn_command failed\n");
+    return 6;
+  }
+  read_output(job.fd_out, buffer, sizeof(buffer));
+  status = spawn_wait(&job);
+  if (strcmp(buffer, "42\n") != 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "wrong output from shell command: [%s]\n", buffer);
+    return 7;
+  }
+
+  /* concurrency limit: second command waits for the first one */
+  spawn_set_limit(EVENT_ID_TEST4, 1);
+  if (spawn_command(EVENT_ID_TEST4, "/bin/true", 0, NULL, &job) != 0) {
+    fprintf(stderr, "spawn_command failed\n");
+    return 8;
+  }
+  pthread_create(&thread, NULL, limited_job_fund, NULL);
+  usleep(200000);
+  if (limited_job_started) {
+    fprintf(stderr, "concurrency limit not respected\n");
+    return 9;
+  }
+  spawn_wait(&job);
+  pthread_join(thread, NULL);
+  if (!limited_job_started) {
+    fprintf(stderr, "limited command not started\n");
+    return 10;
+  }
+  spawn_set_limit(EVENT_ID_TEST4, 0);
+
+  /* without helper, commands are forked by the server */
+  spawn_helper_stop();
+  p = wzd_popen("/bin/echo hello");
+  if (spawn_helper_running() || !p) {
+    fprintf(stderr, "wzd_popen without helper failed\n");
+    return 11;
+  }
+  read_output(p->fdr, buffer, sizeof(buffer));
+  if (strcmp(buffer, "hello\n") != 0 || wzd_pclose(p) != 0) {
+    fprintf(stderr, "wrong output without helper: [%s]\n", buffer);
+    return 12;
+  }
+
   mgr = malloc(sizeof(wzd_event_manager_t));
   event_mgr_init(mgr);
 
@@ -20,6 +20,7 @@ int main()
   unsigned long c1 = C1;
   fs_dir_t * dir;
   fs_fileinfo_t * fileinfo;
+  fs_filestat_t st, st2;
   int err;
   const char * test_dirname = "_T_fs_mkdir";
   unsigned long c2 = C2;
@@ -55,8 +56,18 @@ int main()
   /** \todo XXX '.' does not appear in the list ?! */
   while ( fs_dir_read(dir, &fileinfo) >= 0 ) {
     printf(" +--> %s\n", fs_fileinfo_getname(fileinfo));
-  }
 
+    /** fs_fileinfo_lstat must give the same result as fs_file_lstat **/
+    if (fs_fileinfo_lstat(dir, fileinfo, &st) < 0) {
+      fprintf(stderr,"fs_fileinfo_lstat failed for %s\n", fs_fileinfo_getname(fileinfo));
+      return 2;
+    }
+    if (fs_file_lstat(fs_fileinfo_getname(fileinfo), &st2) < 0 ||
+        st.mode != st2.mode || st.size != st2.size || st.mtime != st2.mtime) {
+      fprintf(stderr,"fs_fileinfo_lstat differs from fs_file_lstat for %s\n", fs_fileinfo_getname(fileinfo));
+      return 3;
+    }
+  }
 
 
   fs_dir_close(dir);
@@ -44,6 +44,17 @@ int main()
 
   wzd_free(gid_list);
 
+  /* test on name index */
+  strcpy(group1->groupname, "group1");
+  group_reindex(group1->gid);
+  strcpy(group2->groupname, "group2");
+  group_reindex(group2->gid);
+  if (group_get_by_name("group1") != group1 || group_get_by_name("group2") != group2) return 2;
+  strcpy(group1->groupname, "group3");
+  if (group_get_by_name("group1") != NULL) return 2;
+  group_reindex(group1->gid);
+  if (group_get_by_name("group3") != group1) return 2;
+
   group = group_unregister(group1->gid);
   group_free(group);
 
@@ -2,6 +2,8 @@
 #include <libwzd-core/wzd_ip.h>
 #include <libwzd-core/wzd_debug.h>
 
+#include <unistd.h> /* sleep */
+
 #define C1 0x12345678
 #define C2 0x9abcdef0
 
@@ -31,6 +33,14 @@ int main()
     { "192.168.*10",   1 },
     { "192.168.*1",    0 },
     { "*",             1 },
+    { "192.168.0.0/24", 1 },
+    { "192.168.0.8/31", 0 },
+    { "192.168.0.8/29", 1 },
+    { "192.168.0.10/32", 1 },
+    { "192.0.0.0/8",   1 },
+    { "0.0.0.0/0",     1 },
+    { "10.0.0.0/8",    0 },
+    { "::ffff:192.168.0.0/120", 1 },
     { NULL, 2 } };
 #ifdef IPV6_SUPPORT
   const char * ip2 = "3dde:70ef:3223:0:0:0:0:ffff";
@@ -41,6 +51,8 @@ int main()
     { "3dde:70e?:3223:0:0:0:0:ffff",  1 },
     { "192.168.*",                    0 },
     { "*",                            1 },
+    { "3dde:70ef::/32",               1 },
+    { "3dde:70ef:3224::/48",          0 },
     { NULL, 2 } };
 #endif
   unsigned int i;
@@ -68,6 +80,149 @@ int main()
 #endif
 
   /* ip_add_check */
+  /* ip_list_check */
+  /* ip_acl_compile */
+  {
+    struct wzd_ip_list_t * list = NULL;
+    wzd_ip_acl_t * acl;
+    struct test_ip_t test_list[] = {
+      { "192.168.0.10",   0 }, /* denied by first rule */
+      { "192.168.0.11",   1 },
+      { "192.168.1.1",    1 },
+      { "192.168.2.1",    0 },
+      { "10.1.2.3",       1 },
+      { "10.1.3.3",       0 }, /* first match is 10.*, even if 10.1.3.0/24 is allowed */
+      { "172.16.0.1",    -1 },
+      { "127.0.0.1",      1 },
+      { "::ffff:192.168.1.1", 1 },
+      { NULL, 2 } };
+
+    if (ip_add_check(&list, "192.168.0.10", 0) ||
+        ip_add_check(&list, "192.168.0.0/23", 1) ||
+        ip_add_check(&list, "192.168.*", 0) ||
+        ip_add_check(&list, "10.1.2.?", 1) ||
+        ip_add_check(&list, "10.*", 0) ||
+        ip_add_check(&list, "10.1.3.0/24", 1) ||
+        ip_add_check(&list, "ident@127.0.0.1", 0) ||
+        ip_add_check(&list, "127.0.0.1", 1)) {
+      fprintf(stderr, "ip_add_check failed !\n");
+      return -3;
+    }
+    if (ip_add_check(&list, "10.0.0.0/33", 1) != -1 ||
+        ip_add_check(&list, "10.0.0.0/", 1) != -1) {
+      fprintf(stderr, "ip_add_check accepted an invalid network !\n");
+      return -3;
+    }
+
+    acl = ip_acl_compile(list);
+    i=0;
+    while (test_list[i].pattern != NULL) {
+      if (ip_list_check(list,test_list[i].pattern) != test_list[i].result) {
+        fprintf(stderr, "ip_list_check(%s) failed !\n",test_list[i].pattern);
+        return -3;
+      }
+      if (ip_acl_check(acl,test_list[i].pattern) != test_list[i].result) {
+        fprintf(stderr, "ip_acl_check(%s) failed !\n",test_list[i].pattern);
+        return -3;
+      }
+      i++;
+    }
+
+    /* ident rules are only used by ip_list_check_ident */
+    if (ip_list_check_ident(list,"127.0.0.1","ident") != 0 ||
+        ip_list_check_ident(list,"127.0.0.1","other") != 1 ||
+        ip_list_check_ident(list,"127.0.0.1",NULL) != 1) {
+      fprintf(stderr, "ip_list_check_ident failed !\n");
+      return -3;
+    }
+
+    ip_acl_free(acl);
+    if (ip_acl_compile(NULL) != NULL) {
+      fprintf(stderr, "ip_acl_compile(NULL) failed !\n");
+      return -3;
+    }
+
+    if (ip_remove(&list,"192.168.0.10") != 0 || ip_list_check(list,"192.168.0.10") != 1) {
+      fprintf(stderr, "ip_remove failed !\n");
+      return -3;
+    }
+
+    ip_list_free(list);
+  }
+
+  /* host name rules, resolved in background */
+  {
+    struct wzd_ip_list_t * list = NULL;
+    unsigned char localhost[4] = { 127, 0, 0, 1 };
+    char hostname[256];
+    int ret = -1;
+
+    ip_add_check(&list, "localhost", 1);
+
+    /* names are not known yet, checks must not block */
+    for (i=0; i<50; i++) {
+      ret = ip_list_check(list, "127.0.0.1");
+      if (ret == 1) break;
+      usleep(100000);
+    }
+    if (ret != 1) {
+      fprintf(stderr, "Warning: could not resolve localhost\n");
+    } else {
+      if (ip_get_hostname_cached(localhost, WZD_INET4, hostname, sizeof(hostname)) != 0)
+        fprintf(stderr, "Warning: reverse lookup of 127.0.0.1 failed\n");
+      else if (ip_compare("127.0.0.1", "local*") != 1) {
+        fprintf(stderr, "ip_compare(127.0.0.1,local*) failed (name %s) !\n", hostname);
+        return -4;
+      }
+    }
+
+    ip_list_free(list);
+  }
+
+  /* host names not known yet: deny rules match, allow rules do not */
+  {
+    struct wzd_ip_list_t * list = NULL;
+    wzd_ip_acl_t * acl;
+
+    ip_add_check(&list, "denied.invalid", 0);
+    ip_add_check(&list, "*", 1);
+    acl = ip_acl_compile(list);
+
+    /* these addresses have not been looked up before */
+    if (ip_list_check(list, "192.0.2.1") != 0 || ip_acl_check_wait(acl, "192.0.2.2", 0) != 0) {
+      fprintf(stderr, "unknown host name was not denied !\n");
+      return -5;
+    }
+
+    /* the non-blocking check must let the caller decide */
+    if (ip_acl_check(acl, "192.0.2.3") != -2) {
+      fprintf(stderr, "unknown host name was not deferred !\n");
+      return -5;
+    }
+
+    ip_acl_free(acl);
+    ip_list_free(list);
+  }
+
+  /* numeric rules before host names are decided without DNS */
+  {
+    struct wzd_ip_list_t * list = NULL;
+    wzd_ip_acl_t * acl;
+
+    ip_add_check(&list, "10.0.0.0/8", 0);
+    ip_add_check(&list, "allowed.invalid", 1);
+    ip_add_check(&list, "*", 1);
+    acl = ip_acl_compile(list);
+
+    if (ip_acl_check(acl, "10.1.2.3") != 0) {
+      fprintf(stderr, "numeric rule was not applied first !\n");
+      return -5;
+    }
+
+    ip_acl_free(acl);
+    ip_list_free(list);
+  }
+
   /* ip_inlist */
   /* ip_free */
 
@@ -0,0 +1,65 @@
+#include <string.h> /* memset */
+
+#include <libwzd-core/wzd_structs.h>
+#include <libwzd-core/wzd_misc.h>
+
+#include "test_common.h"
+
+#define C1 0x12345678
+#define C2 0x9abcdef0
+
+int main()
+{
+  unsigned long c1 = C1;
+  wzd_bw_limiter global, connection;
+  unsigned long delay;
+  unsigned long c2 = C2;
+
+  /* no limit */
+  limiter_init(&global, 0, NULL);
+  limiter_init(&connection, 0, &global);
+  if (limiter_consume(&connection, 1000000) != 0) {
+    fprintf(stderr, "unlimited limiter returned a delay\n");
+    return 1;
+  }
+
+  /* 1 MB/s, bucket is full on first use (250 ms of data) */
+  limiter_init(&connection, 1000000, &global);
+  if (limiter_consume(&connection, 250000) != 0) {
+    fprintf(stderr, "burst was not allowed\n");
+    return 2;
+  }
+  delay = limiter_consume(&connection, 100000);
+  if (delay < 50000 || delay > 100000) {
+    fprintf(stderr, "wrong delay %lu for 100 kB at 1 MB/s\n", delay);
+    return 3;
+  }
+  if (limiter_get_delay(&connection) == 0) {
+    fprintf(stderr, "limiter_get_delay returned 0 while in debt\n");
+    return 4;
+  }
+
+  /* global limit is lower than connection limit */
+  limiter_init(&global, 100000, NULL);
+  limiter_init(&connection, 1000000, &global);
+  if (limiter_consume(&connection, 25000) != 0) {
+    fprintf(stderr, "burst was not allowed by parent\n");
+    return 5;
+  }
+  delay = limiter_consume(&connection, 10000);
+  if (delay < 50000 || delay > 100000) {
+    fprintf(stderr, "wrong delay %lu for 10 kB at 100 kB/s (parent)\n", delay);
+    return 6;
+  }
+
+  if (c1 != C1) {
+    fprintf(stderr, "c1 nuked !\n");
+    return -1;
+  }
+  if (c2 != C2) {
+    fprintf(stderr, "c2 nuked !\n");
+    return -1;
+  }
+
+  return 0;
+}
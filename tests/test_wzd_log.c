@@ -13,12 +13,34 @@
 #define C1 0x12345678
 #define C2 0x9abcdef0
 
+/* count lines of file containing \a str */
+static int count_lines(const char * filename, const char * str, size_t * max_length)
+{
+  FILE * f;
+  char line[4096];
+  int count = 0;
+
+  f = fopen(filename,"r");
+  if (!f) return -1;
+  while (fgets(line,sizeof(line),f)) {
+    if (max_length && strlen(line) > *max_length) *max_length = strlen(line);
+    if (strstr(line,str)) count++;
+  }
+  fclose(f);
+
+  return count;
+}
+
 int main()
 {
   unsigned long c1 = C1;
   int ret;
   char template[] = "/tmp/wzd-XXXXXX";
   fd_t fd;
+  int i;
+  char big[4000];
+  size_t max_length;
+  struct memory_log_t * memlog;
   unsigned long c2 = C2;
 
   wzd_debug_init();
@@ -61,12 +83,52 @@ int main()
   log_set(LEVEL_NORMAL,fd);
   log_message("DEBUG","test 2 format %d %s",123,"hello");
 
+  /* messages are written by another thread */
+  log_flush();
+  if (count_lines(template,"test format 123 hello",NULL) != 1) {
+    fprintf(stderr,"message not found in log after log_flush()\n");
+    return 6;
+  }
+
+  /* more messages than a ring can contain: nothing is lost with the default policy */
+  for (i=0; i<1000; i++)
+    out_log(RESERVED_LOG_CHANNELS+1,"line %d of test\n",i);
+  log_flush();
+  if (count_lines(template," of test",NULL) != 1000 || log_get_dropped() != 0) {
+    fprintf(stderr,"messages lost with LOG_OVERFLOW_BLOCK\n");
+    return 7;
+  }
+
+  memlog = get_log_buffer();
+  if (!memlog || !memlog->data[memlog->size-1] || strcmp(memlog->data[memlog->size-1],"line 999 of test\n")!=0) {
+    fprintf(stderr,"last message not found in memory log\n");
+    return 8;
+  }
+
+  /* long messages are truncated */
+  memset(big,'x',sizeof(big)-1);
+  big[sizeof(big)-1] = '\0';
+  out_log(RESERVED_LOG_CHANNELS+1,"%s\n",big);
+  log_flush();
+  max_length = 0;
+  if (count_lines(template,"xxxxxxxx",&max_length) != 1 || max_length > HARD_LOG_LINE_SIZE + 32) {
+    fprintf(stderr,"long message not truncated\n");
+    return 9;
+  }
+
+  if (str2logoverflow("count") != LOG_OVERFLOW_COUNT || str2logoverflow("none") != -1) {
+    fprintf(stderr,"str2logoverflow failed\n");
+    return 10;
+  }
+
 
 
 
 
   log_close(fd);
-  /*unlink(template);*/
+  unlink(template);
+
+  log_fini();
 
   wzd_debug_fini();
 
@@ -46,6 +46,41 @@ int main()
 
   wzd_free(uid_list);
 
+  /* test on name index */
+  strcpy(user1->username, "user1");
+  user_reindex(user1->uid);
+  strcpy(user2->username, "user2");
+  user_reindex(user2->uid);
+  if (user_get_by_name("user1") != user1 || user_get_by_name("user2") != user2) exit(2);
+  if (user_get_by_name("user3") != NULL) exit(2);
+  /* renamed in place: old name must not be found, even before reindex */
+  strcpy(user1->username, "user3");
+  if (user_get_by_name("user1") != NULL) exit(2);
+  user_reindex(user1->uid);
+  if (user_get_by_name("user3") != user1) exit(2);
+  /* a lot of users, to grow the index */
+  {
+    unsigned int i;
+    char name[HARD_USERNAME_LENGTH];
+
+    for (i=0; i<2000; i++) {
+      user = user_allocate();
+      user->uid = 2000 + i;
+      snprintf(user->username, sizeof(user->username), "bulk%u", i);
+      if (user_register(user,1) != user->uid) exit(3);
+    }
+    for (i=0; i<2000; i++) {
+      snprintf(name, sizeof(name), "bulk%u", i);
+      user = user_get_by_name(name);
+      if (!user || user->uid != 2000 + i) exit(3);
+    }
+    for (i=0; i<2000; i++) {
+      user = user_unregister(2000 + i);
+      user_free(user);
+    }
+    if (user_get_by_name("bulk0") != NULL) exit(3);
+  }
+
   /* test on flags */
   user_flags_clear(user1);
   user_flags_add(user1, "abc");
@@ -55,6 +90,24 @@ int main()
   user_flags_delete(user1, "ade");
   if (strcmp(user1->flags,"bcf")!=0) exit(1);
 
+  /* test on statistics */
+  user1->ratio = 3;
+  user1->credits = 0;
+  user_stats_add_bytes(user1, 1 /* is_upload */, 1000);
+  if (user1->stats.bytes_ul_total != 1000 || user1->credits != 3000) exit(1);
+  user_stats_add_bytes(user1, 0 /* is_upload */, 2500);
+  if (user1->stats.bytes_dl_total != 2500 || user1->credits != 500) exit(1);
+  /* credits can't go below 0 */
+  user_stats_add_bytes(user1, 0 /* is_upload */, 1000);
+  if (user1->credits != 0) exit(1);
+  /* nor above ULLONG_MAX */
+  user1->credits = ULLONG_MAX - 10;
+  user_stats_add_bytes(user1, 1 /* is_upload */, 10);
+  if (user1->credits != ULLONG_MAX) exit(1);
+  user_stats_add_file(user1, 1 /* is_upload */);
+  user_stats_add_file(user1, 0 /* is_upload */);
+  if (user1->stats.files_ul_total != 1 || user1->stats.files_dl_total != 1) exit(1);
+
   /* end of tests */
   user = user_unregister(user1->uid);
   user_free(user);
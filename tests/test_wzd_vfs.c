@@ -1,9 +1,16 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include <libwzd-core/wzd_structs.h>
+#include <libwzd-core/wzd_user.h>
 #include <libwzd-core/wzd_vfs.h>
 
+#include "test_common.h"
+
 #define C1 0x12345678
 #define C2 0x9abcdef0
 
@@ -30,6 +37,49 @@ void test_stripdir(char * test_input, const char * correct_out)
   }
 }
 
+/* checkpath_new results are cached until checkpath_cache_invalidate() */
+void test_checkpath_cache(void)
+{
+  char path[WZD_MAX_PATH+1];
+  FILE * file;
+  int ret;
+
+  fake_context();
+  if (!getcwd(f_user->rootpath, sizeof(f_user->rootpath))) exit(2);
+  f_user->userperms = 0xffffffff;
+
+  mkdir("checkpath", 0755);
+  unlink("checkpath/file");
+
+  ret = checkpath_new("/checkpath/file", path, f_context);
+  if (ret != E_FILE_NOEXIST || strstr(path, "/checkpath/file") == NULL) {
+    fprintf(stderr, "checkpath_new failed on non-existing file (%d)\n", ret);
+    exit(3);
+  }
+
+  /* file created behind our back: result comes from the cache */
+  file = fopen("checkpath/file", "w");
+  if (!file) exit(2);
+  fclose(file);
+  ret = checkpath_new("checkpath/../checkpath/file", path, f_context);
+  if (ret != E_FILE_NOEXIST) {
+    fprintf(stderr, "checkpath_new did not use cache (%d)\n", ret);
+    exit(4);
+  }
+
+  checkpath_cache_invalidate();
+  ret = checkpath_new("/checkpath/file", path, f_context);
+  if (ret != 0 || strstr(path, "/checkpath/file") == NULL) {
+    fprintf(stderr, "checkpath_new failed after invalidation (%d)\n", ret);
+    exit(5);
+  }
+
+  checkpath_cache_free(f_context);
+  unlink("checkpath/file");
+  rmdir("checkpath");
+  fake_exit();
+}
+
 int main()
 {
   unsigned long c1 = C1;
@@ -53,6 +103,8 @@ int main()
     test_stripdir(tab_stripdir[i],tab_stripdir[i+1]);
   }
 
+  test_checkpath_cache();
+
   if (c1 != C1) {
     fprintf(stderr, "c1 nuked !\n");
     return -1;
@@ -25,6 +25,13 @@ pasv_high_range  = 65535
 #pasv_ip = 62.xxx.xxx.xxx
 #pasv_ip = 134.xxx.xx.xx
 
+# pasv_pool_size (default: 0)
+# number of PASV listening sockets kept open after a data connection, and
+# reused by the next PASV/EPSV commands (maximum: 64). Useful with clients
+# sending many PASV commands (FXP, segmented downloads). Can be changed
+# with SITE RELOAD.
+#pasv_pool_size = 16
+
 # uncomment this line to disable ident checks (default: check for ident)
 #disable_ident = 1
 
@@ -56,6 +63,22 @@ logdir = @CMAKE_INSTALL_PREFIX@/@localstatedir@/log/@PACKAGE@
 # max number of child threads (default: 64)
 max_threads = 64
 
+# use an event loop (epoll) and a pool of worker threads to serve control
+# connections, instead of one thread per client (default: 0)
+# transfers are always run in their own thread when this is enabled
+#event_loop = 1
+
+# number of worker threads used by the event loop (default: 16)
+#event_workers = 16
+
+# number of worker threads running the login sequence with the event loop
+# (default: 8). Clients must log in within 60 seconds.
+#login_workers = 8
+
+# number of worker threads running TLS handshakes for implicit TLS with the
+# event loop (default: 8)
+#handshake_workers = 8
+
 # max number of users allowed to connect to server (default: 64)
 max_users = 64
 
@@ -71,6 +94,13 @@ backend = @CMAKE_INSTALL_PREFIX@/@datadir@/@PACKAGE@/backends/libwzd_plaintext.s
 #backend = @CMAKE_INSTALL_PREFIX@/@datadir@/@PACKAGE@/backends/libwzd_pam.so
 #backend = @CMAKE_INSTALL_PREFIX@/@datadir@/@PACKAGE@/backends/libwzd_sqlite.so
 
+# user statistics (bytes, files and credits) are sent to the backend by a
+# background thread, every minute or when many transfers are waiting.
+# If the server crashes, statistics not yet sent are lost, unless
+# stats_journal is set: they are then written to this file after each
+# transfer, and restored at next start (default: not set)
+#stats_journal = @CMAKE_INSTALL_PREFIX@/@localstatedir@/lib/@PACKAGE@/stats.journal
+
 # speed limits in bytes /sec (approx !)
 # 0 = no limit
 # ex: max_dl_speed = 300000
@@ -91,12 +121,26 @@ deny_access_files_uploaded = 1
 # hide files beggining by a '.'
 #hide_dotted_files = 1
 
+# list_subdir_perms (default: 1)
+# when listing a directory, read the permission file of each subdirectory
+# to display its owner and group. Set to 0 to save one open per subdirectory
+# (subdirectories not listed in the parent permission file will then be
+# displayed with default owner and permissions)
+#list_subdir_perms = 0
+
 # Log level (default: normal)
 # Verbosity of log (only messages >= level will be displayed)
 # can be one of (in order):
 # lowest, flood, info, normal, high, critical
 #loglevel = lowest
 
+# log_overflow (default: block)
+# messages are written to the log file by a separate thread. If messages
+# are sent faster than they can be written, threads can either wait (block),
+# drop messages (drop), or drop messages and log the number of dropped
+# messages (count). Can be changed with SITE RELOAD.
+#log_overflow = count
+
 # help file location
 help_file = @CMAKE_INSTALL_PREFIX@/@sysconfdir@/file_help.txt
 
@@ -118,6 +162,19 @@ tls_certificate = @CMAKE_INSTALL_PREFIX@/@sysconfdir@/wzd.pem
 # see openssl ciphers, man openssl(1)
 #tls_cipher_list = ALL
 
+# session cache (default: 1024 sessions, kept 300 seconds)
+# cached sessions are resumed by data connections, avoiding a full
+# handshake for each transfer. Set size to 0 to disable the cache
+#tls_session_cache_size = 1024
+#tls_session_timeout = 300
+
+# kernel TLS (default: no)
+# Linux and OpenSSL >= 3.0 only: after the handshake, encryption of data
+# connections is done by the kernel, so transfers can use sendfile/splice.
+# If the kernel (tls module) or the negotiated cipher is not supported,
+# TLS stays in userspace
+#tls_ktls = no
+
 # /TLS
 
 ##### SITE FILES
@@ -251,6 +308,10 @@ create_symlinks = false
 [dupecheck]
 ## Where should dupecheck keep it's sqlite database?
 # database = @CMAKE_INSTALL_PREFIX@/@localstatedir@/lib/dupelog
+## Number of new entries written to the database in one transaction
+## (default: 32). Entries are also written after 2 seconds, and when the
+## module is unloaded. Set to 1 to write each entry immediately.
+# batch_size = 32
 
 [plaintext]
 param = @CMAKE_INSTALL_PREFIX@/@sysconfdir@/users
@@ -307,6 +368,16 @@ ALL = /* ^([]\[A-Za-z0-9_.'() \t+-])*$
 [events]
 #event1 = MKDIR /bin/df
 
+# External commands (events, cron jobs) are started by a helper process,
+# forked when the server starts. This section limits the number of commands
+# running at the same time for an event type: when the limit is reached,
+# the next command waits, and is not run if no command of the same type has
+# terminated after 10 seconds. The caller is blocked during the wait, as it
+# is while the command runs. The name CRONTAB is used for cron jobs.
+[spawn_limits]
+#POSTUPLOAD = 4
+#CRONTAB = 1
+
 # Here you can define external site commands.
 # You must use absolute paths
 [custom_commands]
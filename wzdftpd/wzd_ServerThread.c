@@ -85,17 +85,23 @@
 #include <libwzd-core/wzd_misc.h>
 #include <libwzd-core/wzd_log.h>
 #include <libwzd-core/wzd_tls.h>
+#include <libwzd-core/wzd_file.h>
 #include <libwzd-core/wzd_fs.h>
 #include <libwzd-core/wzd_ip.h>
 #include <libwzd-core/wzd_libmain.h>
+#include <libwzd-core/wzd_list.h>
 #include <libwzd-core/wzd_ClientThread.h>
 #include <libwzd-core/wzd_vfs.h>
+#include <libwzd-core/wzd_pasv.h>
 #include <libwzd-core/wzd_perm.h>
+#include <libwzd-core/wzd_reactor.h>
 #include <libwzd-core/wzd_socket.h>
+#include <libwzd-core/wzd_spawn.h>
 #include <libwzd-core/wzd_mod.h>
 #include <libwzd-core/wzd_cache.h>
 #include <libwzd-core/wzd_configfile.h>
 #include <libwzd-core/wzd_configloader.h>
+#include <libwzd-core/wzd_cookie.h>
 #include <libwzd-core/wzd_crontab.h>
 #include <libwzd-core/wzd_group.h>
 #include <libwzd-core/wzd_messages.h>
@@ -227,36 +233,11 @@ void reset_stats(wzd_server_stat_t * stats)
 {
   stats->num_connections = 0;
   stats->num_childs = 0;
-}
-
-/** \return 1 if ip is ok, 0 if ip is denied, -1 if ip is not in list or on error */
-static int global_check_ip_allowed(unsigned char *userip, net_family_t family)
-{
-  char ipv6[INET6_ADDRSTRLEN] = {0};
-  char ipv4[INET_ADDRSTRLEN] = {0};
-  int ret = -1;
-
-  /** \warning If no ip was specified (ok or denied), then the default is to allow */
-  if (mainConfig->login_pre_ip_checks == NULL) return 1;
-
-#if defined(IPV6_SUPPORT)
-  if (family == WZD_INET6) {
-    inet_ntop(AF_INET6,userip,ipv6,INET6_ADDRSTRLEN);
-    ret = ip_list_check(mainConfig->login_pre_ip_checks,ipv6);
-    if (ret == 0 && IN6_IS_ADDR_V4MAPPED(PORCUS_CAST(userip))) {
-      inet_ntop(AF_INET,userip,ipv4,INET_ADDRSTRLEN);
-      ret = ip_list_check(mainConfig->login_pre_ip_checks,ipv4);
-    }
-  } else
-#else
-    (void)ipv6; /* Quelches warnings about unused variable. */
-#endif
-  {
-    inet_ntop(AF_INET,userip,ipv4,INET_ADDRSTRLEN);
-    ret = ip_list_check(mainConfig->login_pre_ip_checks,ipv4);
-  }
-
-  return ret;
+  stats->tls_handshakes = 0;
+  stats->tls_handshake_failures = 0;
+  stats->tls_handshake_time = 0;
+  stats->tls_sessions_resumed = 0;
+  stats->tls_sessions_full = 0;
 }
 
 void server_rebind(const char *new_ip, unsigned int new_port)
@@ -508,6 +489,8 @@ static int server_add_ident_candidate(socket_t socket_accept_fd)
   wzd_context_t * context;
   wzd_ident_context_t * ident_context;
   net_family_t family;
+  int ip_pending;
+  int ret;
 
   newsock = socket_accept(socket_accept_fd, remote_host, &remote_port, &family);
   if (newsock == (socket_t)-1)
@@ -533,8 +516,14 @@ static int server_add_ident_candidate(socket_t socket_accept_fd)
     inet_ntop(AF_INET,userip,inet_buf,INET_ADDRSTRLEN);
   }
 
-  /* Here we check IP BEFORE starting session */
-  if (global_check_ip_allowed(userip, family)<=0) { /* IP was rejected */
+  /* Here we check IP BEFORE starting session. Rules using host names are
+   * checked by the login worker if the name is not known yet, the accept
+   * loop must not wait for DNS */
+  ip_pending = 0;
+  ret = ip_check_global(userip, family, mainConfig, 0);
+  if (ret == -2)
+    ip_pending = 1;
+  else if (ret <= 0) { /* IP was rejected */
     /* close socket without warning ! */
     socket_close(newsock);
     FD_UNREGISTER(newsock,"Client socket");
@@ -556,6 +545,9 @@ static int server_add_ident_candidate(socket_t socket_accept_fd)
 
   out_log(LEVEL_NORMAL,"Connection opened from %s (socket %d)\n", inet_buf,newsock);
 
+  /* start reverse lookup now, so the name is known when user logs in */
+  ip_get_hostname_cached(userip, family, NULL, 0);
+
   /* 1. create new context */
   context = context_find_free(context_list);
   if (!context) {
@@ -571,6 +563,8 @@ static int server_add_ident_candidate(socket_t socket_accept_fd)
   context->control_socket = newsock;
   context->family = family;
   context->localport = localport;
+  if (ip_pending)
+    context->connection_flags |= CONNECTION_IP_PENDING;
   time (&context->login_time);
 
   memcpy(context->hostip,userip,sizeof(context->hostip));
@@ -891,32 +885,33 @@ static int server_login_accept(wzd_context_t * context)
     inet_ntop(AF_INET,userip,inet_buf,INET_ADDRSTRLEN);
   }
 
-  /* switch to tls mode ? */
+  /* for implicit TLS, the handshake is done by the thread handling the client */
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
-  if (mainConfig->tls_type == TLS_IMPLICIT) {
-    if (tls_auth("SSL",context)) {
+  context->tls_data_mode = TLS_CLEAR;
+#endif
+
+  if (CFG_GET_OPTION(mainConfig,CFG_OPT_CHECKIP_LOGIN)) {
+    ret = check_ip_before_login(context);
+    if (ret) {
       socket_close(context->control_socket);
       FD_UNREGISTER(context->control_socket,"Client socket");
-      out_log(LEVEL_HIGH,"TLS switch failed (implicit) from client %s\n", inet_buf);
+      out_log(LEVEL_NORMAL,"INFO rejected connection from %s\n",inet_buf);
       /* mark context as free */
       context_remove(context_list, context);
       return -1;
     }
-    context->connection_flags |= CONNECTION_TLS;
   }
-  context->tls_data_mode = TLS_CLEAR;
-#endif
 
-  if (CFG_GET_OPTION(mainConfig,CFG_OPT_CHECKIP_LOGIN)) {
-    ret = check_ip_before_login(context);
-    if (ret) {
+  /* event loop: no thread for this client */
+  if (reactor_is_running()) {
+    if (reactor_add_client(context)) {
       socket_close(context->control_socket);
       FD_UNREGISTER(context->control_socket,"Client socket");
-      out_log(LEVEL_NORMAL,"INFO rejected connection from %s\n",inet_buf);
       /* mark context as free */
       context_remove(context_list, context);
       return -1;
     }
+    return 0;
   }
 
   /* start new thread */
@@ -1204,6 +1199,12 @@ int server_switch_to_config(wzd_config_t *config)
       setuid(getlib_server_uid());
     }
   }
+
+  /* external commands will be run by a helper process, forked now while
+   * the server is small, and after privileges have been dropped
+   */
+  if (spawn_helper_start())
+    out_log(LEVEL_HIGH,"Could not start spawn helper, external commands will be run by the server\n");
 #endif /* WIN32 */
 
 
@@ -1528,6 +1529,30 @@ int serverMainThreadProc(void *arg)
     max_wait_time = DEFAULT_SERVER_TICK;
   }
 
+  /* use event loop instead of one thread per client ? */
+  ret = config_get_boolean(mainConfig->cfg_file, "GLOBAL", "event_loop", &err);
+  if (err == CF_OK && (ret)) {
+    unsigned long num_workers, num_login_workers, num_handshake_workers, client_tick;
+
+    num_workers = config_get_integer(mainConfig->cfg_file, "GLOBAL", "event_workers", &err);
+    if (err != CF_OK || num_workers == 0 || num_workers > HARD_THREADLIMIT)
+      num_workers = DEFAULT_EVENT_WORKERS;
+    num_login_workers = config_get_integer(mainConfig->cfg_file, "GLOBAL", "login_workers", &err);
+    if (err != CF_OK || num_login_workers == 0 || num_login_workers > HARD_THREADLIMIT)
+      num_login_workers = DEFAULT_LOGIN_WORKERS;
+    num_handshake_workers = config_get_integer(mainConfig->cfg_file, "GLOBAL", "handshake_workers", &err);
+    if (err != CF_OK || num_handshake_workers == 0 || num_handshake_workers > HARD_THREADLIMIT)
+      num_handshake_workers = DEFAULT_HANDSHAKE_WORKERS;
+    {
+      const wzd_config_snapshot_t * snapshot = config_snapshot_acquire();
+      client_tick = snapshot->client_tick;
+      config_snapshot_release(snapshot);
+    }
+
+    if (reactor_start(num_workers, num_login_workers, num_handshake_workers, client_tick))
+      out_log(LEVEL_HIGH,"Could not start event loop, using one thread per client\n");
+  }
+
   /* sets start time, for uptime */
   time(&mainConfig->server_start);
 
@@ -1542,6 +1567,8 @@ int serverMainThreadProc(void *arg)
 
   mainConfig->serverstop=0;
   while (!mainConfig->serverstop) {
+    server_reload_check();
+
     FD_ZERO(&r_fds);
     FD_ZERO(&w_fds);
     FD_ZERO(&e_fds);
@@ -1616,12 +1643,18 @@ void serverMainThreadCleanup(int retcode)
     FD_UNREGISTER(mainConfig->control_socket,"Server control fd");
   }
 #ifdef WZD_MULTITHREAD
-  /* kill all childs threads */
-  out_log(LEVEL_INFO,"Sending EXIT signal to child threads\n");
-  if (context_list)
+  if (reactor_is_running()) {
+    /* clients have no thread, event loop will close connections */
+    out_log(LEVEL_INFO,"Stopping event loop\n");
+    reactor_stop();
+  }
+  else if (context_list)
   {
     ListElmt * elmnt;
     wzd_context_t * loop_context;
+
+    /* kill all childs threads */
+    out_log(LEVEL_INFO,"Sending EXIT signal to child threads\n");
     for (elmnt=list_head(context_list); elmnt!=NULL; elmnt=list_next(elmnt))
     {
       if ((loop_context = list_data(elmnt))) {
@@ -1674,6 +1707,12 @@ void serverMainThreadCleanup(int retcode)
   tls_exit();
 #endif
   wzd_cache_purge();
+  cookie_cache_purge();
+  list_cache_purge();
+  permfile_cache_purge();
+  pasv_pool_purge();
+  spawn_helper_stop();
+  limiter_group_free();
   vars_shm_free();
   utf8_end(mainConfig);
   hook_free(&mainConfig->hook);